@@ -0,0 +1,638 @@
+/*!
+Benchmark.cpp
+@author Alex Schlieck
+@version 0.1
+@date 2026-10-14
+
+---------------------------------
+Performance benchmarks for the boom Logger Library
+Needs nothing but BoomLog.hpp, build it with optimizations on:
+g++ -std=c++17 -O2 -DNDEBUG Benchmark.cpp -pthread -o benchmark
+
+Usage: benchmark [--filter text] [--min-time ms] [--threads n] [--json file] [--csv file] [--compare file] [--label text]
+
+*/
+
+#include <iostream>
+#include <cstdio>
+#include "BoomLog.hpp"
+
+
+
+using namespace boom;
+
+using Clock = std::chrono::steady_clock;
+
+/// @brief Written by the benchmarks so the compiler can't throw their work away
+volatile size_t sink = 0;
+
+/// @brief Stream that does nothing, so only the cost of the logger is measured
+class NullStream : public Stream
+{
+public:
+	virtual void handle(Event& event)
+	{
+		sink = sink + event.msg.size();
+	}
+};
+
+/// @brief Settings taken from the command line
+struct Options
+{
+	/// @brief Only run benchmarks whose name contains this
+	std::string filter;
+
+	/// @brief How long each benchmark is measured for
+	std::chrono::milliseconds minTime = std::chrono::milliseconds(500);
+
+	/// @brief Most producer threads used by the scaling benchmarks
+	unsigned maxThreads = std::max(2u, std::thread::hardware_concurrency());
+
+	/// @brief Files to write the results to, empty to skip
+	std::string json;
+	std::string csv;
+
+	/// @brief CSV file of an earlier run to compare against
+	std::string compare;
+
+	/// @brief Written into the output files, such as the commit being measured
+	std::string label;
+};
+
+/// @brief Measurements of one benchmark, times are nanoseconds per operation
+struct Result
+{
+	std::string name;
+	unsigned threads = 1;
+	uint64_t operations = 0;
+	double seconds = 0;
+	double mean = 0;
+	double p50 = 0;
+	double p90 = 0;
+	double p99 = 0;
+	double p999 = 0;
+	double max = 0;
+	double opsPerSecond = 0;
+};
+
+/// @brief Runs the benchmarks that match the filter and keeps their results
+/// Each thread runs the operation in batches big enough to time accurately, and the time per operation
+/// of every batch is a sample. The percentiles are taken over the samples of all threads
+class Runner
+{
+public:
+	/// @brief Shortest time a batch should take, so reading the clock doesn't count for much
+	static constexpr std::chrono::nanoseconds MIN_BATCH_TIME = std::chrono::microseconds(5);
+
+	Runner(const Options& options) : options(options)
+	{}
+
+	/// @brief Check if a benchmark was asked for
+	/// @param name the benchmark's name
+	/// @return true if it matches the filter
+	bool wanted(const std::string& name) const
+	{
+		return name.find(options.filter) != std::string::npos;
+	}
+
+	/// @brief Measure an operation
+	/// @param name shown in the results, the filter is matched against it
+	/// @param threads number of threads running the operation at once
+	/// @param body void(size_t count) that does the operation count times
+	/// @param finish called once every thread is done, such as a flush, its time counts towards the throughput
+	template<typename Body>
+	void run(const std::string& name, unsigned threads, Body body, const std::function<void()>& finish = {})
+	{
+		if (!wanted(name))
+		{
+			return;
+		}
+
+		std::vector<std::vector<double>> samples(threads);
+		std::vector<uint64_t> operations(threads, 0);
+		std::atomic<unsigned> waiting = threads;
+		std::atomic<bool> go = false;
+		Clock::time_point start;
+
+		auto produce = [&](unsigned thread)
+		{
+			// find a batch size that takes long enough to time
+			size_t batch = 1;
+			while (true)
+			{
+				auto before = Clock::now();
+				body(batch);
+				if (Clock::now() - before >= MIN_BATCH_TIME || batch >= ((size_t)1 << 30))
+				{
+					break;
+				}
+				batch *= 2;
+			}
+
+			// start every thread together
+			if (waiting.fetch_sub(1) == 1)
+			{
+				start = Clock::now();
+				go.store(true, std::memory_order_release);
+			}
+			while (!go.load(std::memory_order_acquire))
+			{
+				std::this_thread::yield();
+			}
+
+			auto end = start + options.minTime;
+			std::vector<double>& mine = samples[thread];
+			Clock::time_point now = Clock::now();
+			while (now < end)
+			{
+				body(batch);
+				auto after = Clock::now();
+				mine.push_back(std::chrono::duration<double, std::nano>(after - now).count() / batch);
+				operations[thread] += batch;
+				now = after;
+			}
+		};
+
+		std::vector<std::thread> workers;
+		for (unsigned thread = 1; thread < threads; ++thread)
+		{
+			workers.emplace_back(produce, thread);
+		}
+		produce(0);
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+		if (finish)
+		{
+			finish();
+		}
+		auto stop = Clock::now();
+
+		Result result;
+		result.name = name;
+		result.threads = threads;
+		result.seconds = std::chrono::duration<double>(stop - start).count();
+		std::vector<double> all;
+		double total = 0;
+		for (unsigned thread = 0; thread < threads; ++thread)
+		{
+			result.operations += operations[thread];
+			for (double sample : samples[thread])
+			{
+				all.push_back(sample);
+				total += sample;
+			}
+		}
+		std::sort(all.begin(), all.end());
+		if (!all.empty())
+		{
+			result.mean = total / all.size();
+			result.p50 = percentile(all, 0.5);
+			result.p90 = percentile(all, 0.9);
+			result.p99 = percentile(all, 0.99);
+			result.p999 = percentile(all, 0.999);
+			result.max = all.back();
+		}
+		result.opsPerSecond = result.seconds > 0 ? result.operations / result.seconds : 0;
+		print(result);
+		results.push_back(result);
+	}
+
+	/// @brief Write the header of the table of results
+	static void printHeader()
+	{
+		std::printf("%-44s %7s %10s %10s %10s %10s %10s %12s %14s\n",
+			"benchmark", "threads", "mean ns", "p50 ns", "p90 ns", "p99 ns", "p99.9 ns", "max ns", "ops/s");
+	}
+
+	/// @brief Everything measured so far
+	std::vector<Result> results;
+
+private:
+	/// @brief Value below which a fraction of the sorted samples fall
+	static double percentile(const std::vector<double>& sorted, double fraction)
+	{
+		size_t index = (size_t)(fraction * sorted.size());
+		return sorted[std::min(index, sorted.size() - 1)];
+	}
+
+	static void print(const Result& result)
+	{
+		std::printf("%-44s %7u %10.1f %10.1f %10.1f %10.1f %10.1f %12.1f %14.0f\n",
+			result.name.c_str(), result.threads, result.mean, result.p50, result.p90, result.p99, result.p999,
+			result.max, result.opsPerSecond);
+		std::fflush(stdout);
+	}
+
+	const Options& options;
+};
+
+/// @brief Cost of a logging call for each level, with no streams, one stream and many streams
+void logLevels(Runner& runner)
+{
+	const std::pair<LEVELS, const char*> levels[] = {
+		{ LEVELS::DBG, "debug" }, { LEVELS::INFO, "info" }, { LEVELS::WARNING, "warning" },
+		{ LEVELS::ERR, "error" }, { LEVELS::CRITICAL, "critical" } };
+
+	Log::forceDebug(true);
+	for (size_t count : { 0, 1, 8 })
+	{
+		std::vector<NullStream> streams(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			Log::addStream("Null" + std::to_string(i), &streams[i]);
+		}
+		for (auto& level : levels)
+		{
+			LEVELS logged = level.first;
+			runner.run(std::string("log/") + level.second + "/streams:" + std::to_string(count), 1, [logged](size_t n)
+			{
+				for (size_t i = 0; i < n; ++i)
+				{
+					Log::log(logged, "benchmark message", "logLevels", "B1");
+				}
+			});
+		}
+		for (size_t i = 0; i < count; ++i)
+		{
+			Log::removeStream("Null" + std::to_string(i));
+		}
+	}
+	Log::forceDebug(false);
+}
+
+/// @brief Cost of calls that no stream listens to, and of the deferred and compiled out forms
+void logFiltered(Runner& runner)
+{
+	NullStream errors;
+	errors.setLevels(LEVELS::ERR | LEVELS::CRITICAL);
+	Log::addStream("Errors", &errors);
+
+	runner.run("log/filtered", 1, [](size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			Log::info("benchmark message", "logFiltered", "B2");
+		}
+	});
+	runner.run("log/filtered/deferred", 1, [](size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			Log::infof("benchmark message {} of {}", i, n);
+		}
+	});
+	runner.run("log/deferred/streams:1", 1, [](size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			Log::errorf("benchmark message {} of {}", i, n);
+		}
+	});
+	runner.run("log/strings/streams:1", 1, [](size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			Log::error("benchmark message", "logFiltered::strings", "B2");
+		}
+	});
+	runner.run("log/callsite/streams:1", 1, [](size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			BOOM_ERROR_AT("benchmark message", "B2");
+		}
+	});
+
+	// the call returns once the event is queued for the stream's own thread
+	WorkerConfig worker;
+	worker.mode = WORKER_MODE::DEDICATED;
+	worker.overflow = OVERFLOW_POLICY::BLOCK;
+	errors.setWorker(worker);
+	runner.run("log/worker/streams:1", 1, [](size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			Log::error("benchmark message", "logFiltered::worker", "B2");
+		}
+	}, [] { Log::flush(); });
+	errors.setWorker(WorkerConfig());
+
+	FilterRule noisy;
+	noisy.source = "logFiltered::noisy";
+	errors.setFilter({ noisy });
+	runner.run("log/filter/passed", 1, [](size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			Log::error("benchmark message", "logFiltered::strings", "B2");
+		}
+	});
+	runner.run("log/filter/held", 1, [](size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			Log::error("benchmark message", "logFiltered::noisy::module", "B2");
+		}
+	});
+	errors.setFilter({});
+
+	Log::removeStream("Errors");
+}
+
+/// @brief Speed of turning events into text
+void formatting(Runner& runner)
+{
+	Event event(LEVELS::WARNING, "a benchmark message of a typical length", "formatting", "B3");
+	runner.run("event/toString", 1, [&event](size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			sink = sink + event.toString().size();
+		}
+	});
+
+	std::string out;
+	runner.run("event/formatTo", 1, [&event, &out](size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			out.clear();
+			event.formatTo(out);
+			sink = sink + out.size();
+		}
+	});
+
+	Event structured(LEVELS::WARNING, "a benchmark message of a typical length", "formatting", "B3");
+	structured.fields.add("user", "benchmark").add("attempt", 3).add("ms", 12.5);
+	runner.run("event/formatTo/fields", 1, [&structured, &out](size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			out.clear();
+			structured.formatTo(out);
+			sink = sink + out.size();
+		}
+	});
+	{
+		JsonLinesStream json("boom_benchmark.jsonl");
+		runner.run("JsonLinesStream/format", 1, [&json, &structured, &out](size_t n)
+		{
+			for (size_t i = 0; i < n; ++i)
+			{
+				out.clear();
+				json.format(structured, out);
+				sink = sink + out.size();
+			}
+		});
+	}
+	std::remove("boom_benchmark.jsonl");
+}
+
+/// @brief Cost of reading each source of event timestamps
+void clocks(Runner& runner)
+{
+	const std::pair<const char*, CLOCK_SOURCE> sources[] = {
+		{ "clock/system", CLOCK_SOURCE::SYSTEM_CLOCK },
+		{ "clock/coarse", CLOCK_SOURCE::COARSE_CLOCK },
+		{ "clock/cached", CLOCK_SOURCE::CACHED_CLOCK },
+		{ "clock/steady", CLOCK_SOURCE::STEADY_CLOCK }
+	};
+	for (auto& source : sources)
+	{
+		Log::setClock(source.second);
+		runner.run(source.first, 1, [](size_t n)
+		{
+			for (size_t i = 0; i < n; ++i)
+			{
+				sink = sink + (size_t)EventClock::now().time_since_epoch().count();
+			}
+		});
+	}
+	Log::setClock(CLOCK_SOURCE::SYSTEM_CLOCK);
+}
+
+/// @brief Events per second that the streams themselves take
+void streams(Runner& runner)
+{
+	Event event(LEVELS::INFO, "a benchmark message of a typical length", "streams", "B4");
+	{
+		TextFileStream file("boom_benchmark.txt");
+		file.setLevels(LEVELS::INFO); // keep errors from flushing every line
+		runner.run("TextFileStream/handle", 1, [&file, &event](size_t n)
+		{
+			for (size_t i = 0; i < n; ++i)
+			{
+				file.handle(event);
+			}
+		}, [&file] { file.flush(); });
+	}
+	std::remove("boom_benchmark.txt");
+
+	ArchiveStream archive;
+	runner.run("ArchiveStream/handle", 1, [&archive, &event](size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			archive.handle(event);
+		}
+	});
+}
+
+/// @brief How logging from more threads at once scales, in each mode
+void scaling(Runner& runner, unsigned maxThreads)
+{
+	NullStream stream;
+	Log::addStream("Null", &stream);
+
+	std::vector<unsigned> counts;
+	for (unsigned threads = 1; threads < maxThreads; threads *= 2)
+	{
+		counts.push_back(threads);
+	}
+	counts.push_back(maxThreads);
+
+	auto body = [](size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			Log::info("benchmark message", "scaling", "B5");
+		}
+	};
+
+	for (unsigned threads : counts)
+	{
+		runner.run("scaling/sync/threads:" + std::to_string(threads), threads, body);
+	}
+
+	AsyncConfig config;
+	config.capacity = 65536;
+	Log::enableAsync(config);
+	for (unsigned threads : counts)
+	{
+		runner.run("scaling/async/threads:" + std::to_string(threads), threads, body, [] { Log::flush(); });
+	}
+	Log::disableAsync();
+
+	config.perThreadBuffers = true;
+	Log::enableAsync(config);
+	for (unsigned threads : counts)
+	{
+		runner.run("scaling/async-per-thread/threads:" + std::to_string(threads), threads, body, [] { Log::flush(); });
+	}
+	Log::disableAsync();
+
+	Log::removeStream("Null");
+}
+
+/// @brief Put quotes around text for JSON, escaping what needs it
+std::string quote(const std::string& text)
+{
+	std::string quoted = "\"";
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+		{
+			quoted.push_back('\\');
+		}
+		quoted.push_back(c);
+	}
+	return quoted + "\"";
+}
+
+/// @brief Write the results in the layout Google Benchmark uses, with the percentiles added
+void writeJson(const std::string& name, const Options& options, const std::vector<Result>& results)
+{
+	std::ofstream out(name);
+	std::time_t now = std::time(nullptr);
+	char date[32] = "";
+	std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::gmtime(&now));
+	out << "{\n  \"context\": {\n";
+	out << "    \"date\": " << quote(date) << ",\n";
+	out << "    \"label\": " << quote(options.label) << ",\n";
+	out << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n";
+#ifdef NDEBUG
+	out << "    \"library_build_type\": \"release\"\n";
+#else
+	out << "    \"library_build_type\": \"debug\"\n";
+#endif
+	out << "  },\n  \"benchmarks\": [\n";
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const Result& result = results[i];
+		out << "    {\"name\": " << quote(result.name) << ", \"threads\": " << result.threads
+			<< ", \"iterations\": " << result.operations << ", \"real_time\": " << result.mean
+			<< ", \"time_unit\": \"ns\", \"items_per_second\": " << result.opsPerSecond
+			<< ", \"p50\": " << result.p50 << ", \"p90\": " << result.p90 << ", \"p99\": " << result.p99
+			<< ", \"p999\": " << result.p999 << ", \"max\": " << result.max << "}"
+			<< (i + 1 < results.size() ? ",\n" : "\n");
+	}
+	out << "  ]\n}\n";
+}
+
+/// @brief Write the results with one line per benchmark
+void writeCsv(const std::string& name, const Options& options, const std::vector<Result>& results)
+{
+	std::ofstream out(name);
+	out << "name,threads,operations,seconds,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,ops_per_second,label\n";
+	for (const Result& result : results)
+	{
+		out << result.name << ',' << result.threads << ',' << result.operations << ',' << result.seconds << ','
+			<< result.mean << ',' << result.p50 << ',' << result.p90 << ',' << result.p99 << ','
+			<< result.p999 << ',' << result.max << ',' << result.opsPerSecond << ',' << options.label << '\n';
+	}
+}
+
+/// @brief Show how the median and the 99th percentile changed since a run saved with --csv
+void compare(const std::string& name, const std::vector<Result>& results)
+{
+	std::ifstream in(name);
+	if (!in.is_open())
+	{
+		std::fprintf(stderr, "can't read %s\n", name.c_str());
+		return;
+	}
+
+	std::map<std::string, std::pair<double, double>> before;
+	std::string line;
+	std::getline(in, line); // header
+	while (std::getline(in, line))
+	{
+		std::vector<std::string> fields;
+		std::stringstream columns(line);
+		std::string field;
+		while (std::getline(columns, field, ','))
+		{
+			fields.push_back(field);
+		}
+		if (fields.size() >= 8)
+		{
+			before[fields[0]] = { std::atof(fields[5].c_str()), std::atof(fields[7].c_str()) };
+		}
+	}
+
+	std::printf("\n%-44s %12s %12s %9s %12s %12s %9s\n", "benchmark", "p50 before", "p50 now", "change", "p99 before", "p99 now", "change");
+	for (const Result& result : results)
+	{
+		auto found = before.find(result.name);
+		if (found == before.end())
+		{
+			continue;
+		}
+		auto change = [](double was, double now) { return was > 0 ? (now - was) * 100 / was : 0; };
+		std::printf("%-44s %12.1f %12.1f %+8.1f%% %12.1f %12.1f %+8.1f%%\n", result.name.c_str(),
+			found->second.first, result.p50, change(found->second.first, result.p50),
+			found->second.second, result.p99, change(found->second.second, result.p99));
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	Options options;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		std::string value = i + 1 < argc ? argv[i + 1] : "";
+		if (arg == "--filter") options.filter = value;
+		else if (arg == "--min-time") options.minTime = std::chrono::milliseconds(std::atoi(value.c_str()));
+		else if (arg == "--threads") options.maxThreads = std::max(1, std::atoi(value.c_str()));
+		else if (arg == "--json") options.json = value;
+		else if (arg == "--csv") options.csv = value;
+		else if (arg == "--compare") options.compare = value;
+		else if (arg == "--label") options.label = value;
+		else
+		{
+			std::printf("Usage: %s [--filter text] [--min-time ms] [--threads n] [--json file] [--csv file] [--compare file] [--label text]\n", argv[0]);
+			return arg == "--help" ? 0 : 1;
+		}
+		++i;
+	}
+
+	// measure the logger without the console and the log file it starts with
+	Log::removeStream("defaultTextFile");
+	Log::removeStream("defaultConsole");
+
+	Runner runner(options);
+	Runner::printHeader();
+	logLevels(runner);
+	logFiltered(runner);
+	formatting(runner);
+	clocks(runner);
+	streams(runner);
+	scaling(runner, options.maxThreads);
+
+	if (!options.json.empty())
+	{
+		writeJson(options.json, options, runner.results);
+	}
+	if (!options.csv.empty())
+	{
+		writeCsv(options.csv, options, runner.results);
+	}
+	if (!options.compare.empty())
+	{
+		compare(options.compare, runner.results);
+	}
+	return 0;
+}
@@ -1,401 +1,9832 @@
-/*!
-BoomLog.hpp
-@author Alex Schlieck
-@version 0.1
-@date 2023-05-31
---------------------------------------------------
-
-!!! REQUIRES C++17 or newer to compile
-
-
-A small, simple logging library
-
-For simple usage call one of the following functions to create an event:
-boom::Log::debug(msg);
-boom::Log::info(msg);
-boom::Log::warning(msg);
-boom::Log::error(msg);
-boom::Log::critical(msg);
-
-This will send your message to the console and write it to a text file.
-For more advanced usage see the readme file
-*/
-
-
-#ifndef BOOM_LOGGER_HPP
-#define BOOM_LOGGER_HPP
-
-#include <string>
-#include <iostream>
-#include <iomanip> // put_time
-#include <map>
-#include <vector>
-#include <fstream>
-#include <chrono>
-#include <sstream>
-
-#if _DEBUG
-#define SHOW_DEBUG
-#endif
-
-/// @brief Class to provide simple logging functionality
-namespace boom
-{
-	/// @brief the different types of messages that can be logged
-	enum LEVELS { 
-		DBG = 1,		// Values being tracked while debugging. Automatically ignored in release build
-		INFO = 2,		// Track that something expected has happened
-		WARNING = 4,	// Track that something unexpected has happened
-		ERR = 8,		// A non-fatal error has occurred
-		CRITICAL = 16	// A fatal error has occurred, program may crash	
-	};
-
-	const int ALL_LEVELS = 31;// Used to set a stream to listen to all of the levels
-
-	/// @brief Stores one message with associated data
-	class Event
-	{
-	public:
-		Event() : level(LEVELS::INFO)
-		{}
-
-		/// @brief Constructor
-		/// @param level 
-		/// @param msg 
-		/// @param timestamp
-		Event(	LEVELS level,
-				const std::string& msg, 
-				const std::string& source = "",
-				const std::string& code = "",
-				std::chrono::time_point<std::chrono::system_clock> timestamp = std::chrono::system_clock::now()
-			)
-			:level(level), msg(msg), source(source), code(code), timestamp(timestamp) {}
-
-
-		/// @brief Generate a string containing all of the event's data
-		/// @return String with event's data
-		std::string toString()
-		{
-			std::string levelSymbol;
-			switch (level)
-			{
-			case(LEVELS::DBG): levelSymbol = " # ";
-				break;
-			case(LEVELS::INFO): levelSymbol = "   ";
-				break;
-			case(LEVELS::WARNING): levelSymbol = " ! ";
-				break;
-			case(LEVELS::ERR): levelSymbol = "!! ";
-				break;
-			case(LEVELS::CRITICAL): levelSymbol = "!!!";
-				break;
-			}
-
-
-			std::stringstream result;
-			//TODO: Allow user to use custom date format
-			const std::string dateFormat("%Y/%m/%d/%H:%M:%S - ");
-
-			struct tm output;
-
-			auto converted = std::chrono::system_clock::to_time_t(timestamp);
-			localtime_s(&output, &converted);
-
-
-			result << levelSymbol << std::put_time(&output, dateFormat.c_str());
-			if (code != "")
-			{
-				result << "[" << code << "] ";
-			}
-
-			result << msg;
-
-			if (source != "")
-			{
-				result << " (from " << source << ")";
-			}
-			return result.str();
-		}
-
-		/// @brief When the event happened
-		std::chrono::time_point<std::chrono::system_clock> timestamp;
-		LEVELS level;
-		std::string msg;
-		std::string source;
-		std::string code;
-	};
-
-	/// @brief Possible destinations that events can be sent to
-	class Stream
-	{
-	public:
-		/// @brief Default constructor
-		Stream() : levels(ALL_LEVELS) {}
-
-		/// @brief Change the event levels to listen to
-		/// @param levels 
-		void setLevels(int levels)
-		{
-			this->levels = levels;
-		}
-
-		/// @brief Alert this stream of a new event
-		/// Check if the event is of a level that is being monitored and handle if it is
-		/// @param event the new event to handle
-		void call(Event& event)
-		{
-			//TODO: skip debug events if not debugging
-
-			if ((levels & event.level) == event.level)
-			{
-				handle(event);
-			}
-		}
-
-		/// @brief 
-		/// @param event The new event to handle
-		virtual void handle(Event& event) = 0;
-
-	private:
-		/// @brief the types of events that this handler is listening for
-		int levels;
-	};
-
-
-	/// @brief Stream that writes the events to a text file
-	class TextFileStream : public Stream
-	{
-	public:
-		/// @brief Constructor
-		/// @param path Name of file to write events to, default is Log.txt
-		TextFileStream(const std::string& fileName = "Log.txt") :file(fileName)
-		{}
-
-		/// @brief Write the event to a text file
-		/// @param event to be written to file
-		virtual void handle(Event& event)
-		{
-			std::fstream f{file, f.app | f.out};
-			if (f.is_open())
-			{
-				std::string msg = event.toString();
-				f.write(msg.c_str(), msg.size());
-			}
-			f.close();
-		}
-
-		/// @brief set a new filename for the stream to write to 
-		/// @param filename new name of the log file
-		void setFilename(const std::string& filename)
-		{
-			file = filename;
-		}
-
-	private:
-		/// @brief Name of file to write to
-		std::string file;
-	};
-
-	/// @brief Stream that outputs the events to the console
-	class ConsoleStream : public Stream
-	{
-	public:
-		/// @brief Send the event to be displayed on a console
-		/// @param event to be sent to console
-		virtual void handle(Event& event)
-		{
-			std::cout << event.toString();
-		}
-	};
-
-	/// @brief Stream that stores a copy of each event
-	class ArchiveStream : public Stream
-	{
-	public:
-		/// @brief Store the event to be handled later
-		/// @param event to be sent to stored
-		virtual void handle(Event& event)
-		{
-			events.push_back(event);
-		}
-
-		/// @brief Access the stored events
-		/// @return a vector containing all stored events
-		std::vector<Event>& getEvents()
-		{
-			return events;
-		}
-
-	private:
-		/// @brief a container to store the events
-		std::vector<Event> events;
-	};
-
-
-
-	class Log
-	{
-	public:
-
-		//TODO: Add destructor, including cleaning up default streams
-
-		/// @brief Get a pointer to a registered stream with the given name
-		/// @param name the stream to look for
-		/// @return pointer to stream with given name
-		/// @return nullptr if there no matching stream is found
-		static Stream* getStream(const std::string& name)
-		{
-			Stream* result = nullptr;
-			auto inst = getInstance();
-			auto found = inst->streams.find(name);
-			if (found != inst->streams.end())
-			{
-				result = found->second;
-			}
-			return result;
-		}
-
-		/// @brief 
-		/// @param name 
-		/// @param stream 
-		static void addStream(const std::string& name, Stream* stream)
-		{
-			auto inst = getInstance();
-			inst->streams[name] = stream;
-		}
-
-		/// @brief Remove a stream's pointer from the list and return the pointer so that it can be deleted
-		/// @param name ID of the stream to remove
-		/// @return pointer to the removed stream
-		/// @return nullptr if no matching stream was found
-		static Stream* removeStream(const std::string& name)
-		{
-			auto inst = getInstance();
-			Stream* result = getStream(name);
-			if (result != nullptr)
-			{
-				inst->streams.erase(name);
-			}
-			return result;
-		}
-
-		/// @brief Allow the logger to handle debug messages even if in release build
-		/// @param show whether to display debug messages in release build
-		static void forceDebug(bool show)
-		{
-			showDebug = show;
-		}
-
-		/// @brief generate a new log event
-		/// @param level define how the event will be handled
-		/// @param msg what is to be output
-		/// @param source [optional] the fuction that caused the event to be created
-		/// @param code [optional] a user-defined code that represents the errror
-		static void log(LEVELS level, const std::string& msg, const std::string& source ="", const std::string& code = "")
-		{
-			bool debugVisible = showDebug;
-			#ifdef SHOW_DEBUG
-				debugVisible = true;
-			#endif // LOG_DEBUG
-
-			// check if we should show debug messages
-			if (level != LEVELS::DBG || debugVisible)
-			{
-				auto inst = getInstance();
-				Event e{ level, msg, source, code };
-
-				for (auto s : inst->streams)
-				{
-					s.second->call(e);
-				}
-			}
-		}
-
-		/// @brief Create an event that is only visible during debugging
-		/// Useful for checking variable values etc.
-		/// @param msg description of the event
-		/// @param source [optional] the fuction that caused the event to be created
-		/// @param code [optional] a user-defined code that represents the errror
-
-		static void debug(const std::string& msg, const std::string& source = "", const std::string& code = "")
-		{
-			log(LEVELS::DBG, msg, source, code);
-		}
-
-		/// @brief Create an event to track that something normal has happened
-		/// Something is loaded, a user connects, an action is taken, etc.
-		/// @param msg description of the event
-		/// @param source [optional] the fuction that caused the event to be created
-		/// @param code [optional] a user-defined code that represents the errror
-		static void info(const std::string& msg, const std::string& source = "", const std::string& code = "")
-		{
-			log(LEVELS::INFO, msg, source, code);
-		}
-
-		/// @brief Create an event to alert that something unexpected has happened
-		/// A file or a service is not available, user entered invalid input, etc.
-		/// @param msg description of the event
-		/// @param source [optional] the fuction that caused the event to be created
-		/// @param code [optional] a user-defined code that represents the errror
-		static void warning(const std::string& msg, const std::string& source = "", const std::string& code = "")
-		{
-			log(LEVELS::WARNING, msg, source, code);
-		}
-
-		/// @brief Create an event indicating an error that can be handled or caught
-		/// @param msg description of the event
-		/// @param source [optional] the fuction that caused the event to be created
-		/// @param code [optional] a user-defined code that represents the errror
-		static void error(const std::string& msg, const std::string& source = "", const std::string& code = "")
-		{
-			log(LEVELS::ERR, msg, source, code);
-		}
-
-		/// @brief Create a new event indicating a critical error that could cause the program to crash
-		/// @param msg description of the event
-		/// @param source [optional] the fuction that caused the event to be created
-		/// @param code [optional] a user-defined code that represents the errror
-		static void critical(const std::string& msg, const std::string& source = "", const std::string& code = "")
-		{
-			log(LEVELS::CRITICAL, msg, source, code);
-		}
-
-	private:
-
-		/// @brief Constructor, private to make it a singleton
-		Log() = default;
-
-		/// @brief Copy constructor, not used
-		/// @param obj object to copy, not used
-		Log(const Log& obj) = delete;
-
-		/// @brief get access to a single instance of the logger
-		/// Create a new instance if none exists
-		/// @return pointer to the instantiated singleton
-		static Log* getInstance()
-		{
-			if (instance == nullptr)
-			{
-				instance = new Log();
-				instance->addStream("defaultTextFile", new TextFileStream("log.txt"));
-				instance->addStream("defaultConsole", new ConsoleStream());
-			}
-			return instance;
-		}
-
-		/// @brief The singleton instance
-		inline static Log* instance = nullptr;
-
-		/// @brief List of all the streams that are listening to events
-		std::map<std::string, Stream*>streams;
-
-		/// @brief Whether to display debug messages in release build
-		inline static bool showDebug = false;
-	};
-
-
-	
-
-}
-
-#endif // !BOOM_LOGGER_HPP
+/*!
+BoomLog.hpp
+@author Alex Schlieck
+@version 0.1
+@date 2023-05-31
+--------------------------------------------------
+
+!!! REQUIRES C++17 or newer to compile
+
+
+A small, simple logging library
+
+For simple usage call one of the following functions to create an event:
+boom::Log::debug(msg);
+boom::Log::info(msg);
+boom::Log::warning(msg);
+boom::Log::error(msg);
+boom::Log::critical(msg);
+
+This will send your message to the console and write it to a text file.
+For more advanced usage see the readme file
+*/
+
+
+#ifndef BOOM_LOGGER_HPP
+#define BOOM_LOGGER_HPP
+
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <iostream>
+#include <iomanip> // put_time
+#include <ctime>
+#include <map>
+#include <vector>
+#include <fstream>
+#include <chrono>
+#include <sstream>
+#include <array>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <deque>
+#include <algorithm>
+#include <functional>
+#include <cstdio>
+#include <charconv>
+#include <cmath>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <filesystem>
+#include <csignal>
+#include <exception>
+#if __cplusplus >= 202002L && __has_include(<span>)
+#include <span>
+#endif
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "ws2_32.lib")
+#endif
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <limits.h>
+#include <cerrno>
+#endif
+
+#ifdef BOOM_USE_ZLIB
+#include <zlib.h>
+#endif
+
+#if _DEBUG
+#define SHOW_DEBUG
+#endif
+
+// Lowest event level that is compiled in. Calls made through the BOOM_ macros below this level are removed,
+// including the evaluation of their arguments. Define before including this file, eg. 4 keeps warnings and above
+#ifndef BOOM_MIN_LEVEL
+#define BOOM_MIN_LEVEL 1
+#endif
+
+/// @brief Class to provide simple logging functionality
+namespace boom
+{
+	/// @brief the different types of messages that can be logged
+	enum LEVELS { 
+		DBG = 1,		// Values being tracked while debugging. Automatically ignored in release build
+		INFO = 2,		// Track that something expected has happened
+		WARNING = 4,	// Track that something unexpected has happened
+		ERR = 8,		// A non-fatal error has occurred
+		CRITICAL = 16	// A fatal error has occurred, program may crash	
+	};
+
+	const int ALL_LEVELS = 31;// Used to set a stream to listen to all of the levels
+
+	const size_t LEVEL_COUNT = 5;// Number of different levels
+
+	/// @brief Turn a level into a position from 0 to LEVEL_COUNT - 1, useful for per-level arrays
+	/// @param level the level to convert
+	/// @return the position of the level's bit
+	constexpr size_t levelIndex(LEVELS level)
+	{
+		size_t index = 0;
+		while (index + 1 < LEVEL_COUNT && (1 << index) != level)
+		{
+			++index;
+		}
+		return index;
+	}
+
+	/// @brief Check at compile time if events of a level are kept
+	/// @param level the level to check
+	/// @param minLevel the lowest level being kept, BOOM_MIN_LEVEL by default
+	/// @return true if events of the level are handled
+	constexpr bool isCompiledIn(int level, int minLevel = BOOM_MIN_LEVEL)
+	{
+		return level >= minLevel;
+	}
+
+	/// @brief What to do with a new event when the asynchronous queue is full
+	enum OVERFLOW_POLICY {
+		BLOCK,			// Wait until the background writer makes room
+		DROP_NEWEST,	// Discard the new event
+		DROP_OLDEST		// Discard the oldest queued event to make room for the new one
+	};
+
+	/// @brief Settings used when the logger runs in asynchronous mode
+	struct AsyncConfig
+	{
+		/// @brief Maximum number of events waiting to be sent to the streams
+		size_t capacity = 8192;
+
+		/// @brief How to handle events logged while the queue is full
+		OVERFLOW_POLICY overflow = OVERFLOW_POLICY::BLOCK;
+
+		/// @brief Time every enqueue so that QueueStats can report latencies, costs two clock reads per event
+		bool measureLatency = false;
+
+		/// @brief Give each logging thread its own queue so producers don't share cache lines
+		/// The writer collects from every thread and merges the events of each batch by timestamp
+		bool perThreadBuffers = false;
+
+		/// @brief Number of events each thread's queue holds, events go to the shared queue while it is full
+		size_t threadBufferCapacity = 512;
+	};
+
+	/// @brief Which thread hands a stream its events, see Stream::setWorker
+	enum WORKER_MODE {
+		DIRECT,		// The thread that sends the event, the background writer in asynchronous mode
+		DEDICATED,	// A thread of the stream's own
+		POOLED		// One of a few threads shared by the pooled streams, see Log::setWorkerPoolSize
+	};
+
+	/// @brief Settings for a stream that handles its events on a worker thread, so a slow stream can't hold up the others
+	struct WorkerConfig
+	{
+		/// @brief Which thread handles the stream's events
+		WORKER_MODE mode = WORKER_MODE::DIRECT;
+
+		/// @brief Most events waiting for the stream
+		size_t capacity = 1024;
+
+		/// @brief What to do with new events while the stream's queue is full, BLOCK holds up every stream until it catches up
+		OVERFLOW_POLICY overflow = OVERFLOW_POLICY::DROP_OLDEST;
+	};
+
+	/// @brief Where event timestamps come from, see Log::setClock
+	enum CLOCK_SOURCE {
+		SYSTEM_CLOCK,	// std::chrono::system_clock, exact but slow to read on some virtual machines
+		COARSE_CLOCK,	// The system's coarse wall clock, quick to read but only as precise as the scheduler tick
+		CACHED_CLOCK,	// The time kept by a background thread, a memory read, as precise as the update interval
+		STEADY_CLOCK	// std::chrono::steady_clock moved to the wall time of when it was chosen, doesn't follow changes to the system time
+	};
+
+	/// @brief Settings for starting the logger with Log::init
+	struct LogConfig
+	{
+		/// @brief Register the "defaultTextFile" stream writing to log.txt and the "defaultConsole" stream
+		bool defaultStreams = true;
+
+		/// @brief Start the background writer straight away, see Log::enableAsync
+		bool async = false;
+
+		/// @brief Settings for the background writer when async is set
+		AsyncConfig asyncConfig;
+
+		/// @brief Where event timestamps come from, see Log::setClock
+		CLOCK_SOURCE clock = CLOCK_SOURCE::SYSTEM_CLOCK;
+
+		/// @brief Send the queued events and stop the logger's threads before fork(), and start them again in both processes after it
+		/// The threads of the streams are stopped and started through Stream::beforeFork and Stream::afterFork.
+		/// Without it the child has no background threads, so it must not log or exit normally, and events queued in the parent are written by both processes
+		bool handleFork = true;
+	};
+
+	/// @brief One rule of a stream's filter, see Stream::setFilter
+	/// A rule matches an event of one of its levels whose source starts with its prefix and whose code is one of its codes.
+	/// The first rule that matches decides, events that match no rule are let through
+	struct FilterRule
+	{
+		/// @brief Whether matching events are let through or held back
+		bool allow = false;
+
+		/// @brief The levels the rule applies to
+		int levels = ALL_LEVELS;
+
+		/// @brief Start of the sources the rule applies to, empty for every source
+		std::string source;
+
+		/// @brief The codes the rule applies to, empty for every code
+		std::vector<std::string> codes;
+	};
+
+	/// @brief Limits how often the same event can be logged, see Log::setRateLimit
+	/// Events are told apart by level, source and code, or by level and message when they have neither
+	struct RateLimit
+	{
+		/// @brief Events allowed per second for each kind of event, 0 turns the limit off
+		double eventsPerSecond = 0;
+
+		/// @brief Events allowed in a burst before the rate applies
+		double burst = 20;
+
+		/// @brief How often to log a summary of the events that were held back
+		std::chrono::milliseconds summaryInterval = std::chrono::milliseconds(1000);
+
+		/// @brief The levels that are limited
+		int levels = ALL_LEVELS;
+	};
+
+	/// @brief How many events an ArchiveStream keeps, the oldest events are removed first
+	struct ArchiveLimits
+	{
+		/// @brief Maximum number of stored events
+		size_t maxEvents = 65536;
+
+		/// @brief Maximum bytes of message, source, code and field data
+		size_t maxBytes = 8 * 1024 * 1024;
+
+		/// @brief Events older than this are removed, zero keeps them regardless of age
+		std::chrono::seconds maxAge = std::chrono::seconds(0);
+	};
+
+	/// @brief When a file stream starts a new file, and what happens to the old ones
+	struct RotationConfig
+	{
+		/// @brief Start a new file once the current one reaches this many bytes, 0 for no size limit
+		size_t maxSize = 0;
+
+		/// @brief Start a new file at every multiple of this interval since the epoch, 0 to not rotate on time
+		std::chrono::seconds interval = std::chrono::seconds(0);
+
+		/// @brief How many old files to keep, named fileName.1 (the newest) up to fileName.keep
+		size_t keep = 5;
+
+		/// @brief Whether old files are compressed
+		bool compress = true;
+
+		/// @brief Compresses the first file into the second, returning false if it failed
+		/// When empty gzip is used if BOOM_USE_ZLIB is defined, otherwise files are left uncompressed
+		std::function<bool(const std::string& from, const std::string& to)> compressor;
+
+		/// @brief Added to the name of compressed files
+		std::string extension = ".gz";
+	};
+
+	/// @brief How a NetworkStream sends its events
+	enum NETWORK_PROTOCOL {
+		TCP,		// Batches over a connection, each batch is sent after its length as a little-endian u32, the top bit marks compressed batches
+		UDP_SYSLOG	// One RFC 5424 syslog message per datagram
+	};
+
+	/// @brief Where a NetworkStream sends its events, and what it does with them while it can't
+	struct NetworkConfig
+	{
+		/// @brief Name or address of the collector
+		std::string host = "127.0.0.1";
+
+		/// @brief Port the collector listens on
+		uint16_t port = 5140;
+
+		/// @brief How events are sent
+		NETWORK_PROTOCOL protocol = NETWORK_PROTOCOL::TCP;
+
+		/// @brief With TCP, send BinaryFileStream records instead of lines of text, every batch starts its own session
+		bool binary = false;
+
+		/// @brief With TCP, compress each batch before it is sent, batches that don't get smaller are sent as they are
+		bool compress = false;
+
+		/// @brief Compresses the events of a batch into out, returning false to send the batch uncompressed
+		/// When empty zlib is used if BOOM_USE_ZLIB is defined, otherwise batches are sent uncompressed
+		std::function<bool(std::string_view in, std::string& out)> compressor;
+
+		/// @brief Bytes to collect before a batch is sent
+		size_t batchSize = 64 * 1024;
+
+		/// @brief Longest time an event waits for its batch to fill up
+		std::chrono::milliseconds linger = std::chrono::milliseconds(100);
+
+		/// @brief Wait after the first failed connection, doubled after each failure that follows
+		std::chrono::milliseconds reconnectMin = std::chrono::milliseconds(100);
+
+		/// @brief Longest wait between attempts to connect
+		std::chrono::milliseconds reconnectMax = std::chrono::milliseconds(30000);
+
+		/// @brief Longest time to wait for a connection, or for a batch to be taken by the network
+		std::chrono::milliseconds timeout = std::chrono::milliseconds(2000);
+
+		/// @brief Bytes of batches kept in memory while they can't be sent, new events are dropped beyond this
+		size_t memoryLimit = 4 * 1024 * 1024;
+
+		/// @brief File that batches are moved to while the collector can't be reached, empty to only keep them in memory
+		/// Batches left in the file by an earlier run are sent too
+		std::string spillFile;
+
+		/// @brief Largest size of the spill file, batches are dropped once it is full
+		size_t spillLimit = 64 * 1024 * 1024;
+
+		/// @brief Syslog facility, 1 is user-level messages
+		int facility = 1;
+
+		/// @brief APP-NAME field of syslog messages
+		std::string appName = "boom";
+
+		/// @brief Longest syslog message, longer messages are cut short
+		size_t maxDatagram = 2048;
+	};
+
+	/// @brief Snapshot of how the asynchronous queue is being used, to help choose its capacity
+	struct QueueStats
+	{
+		/// @brief Number of slots in the queue
+		size_t capacity = 0;
+
+		/// @brief Events waiting in the queue when the snapshot was taken
+		size_t depth = 0;
+
+		/// @brief Most events seen waiting in the queue at once
+		size_t highWater = 0;
+
+		/// @brief Events added to the queue
+		uint64_t enqueued = 0;
+
+		/// @brief Events discarded because the queue was full
+		uint64_t dropped = 0;
+
+		/// @brief Times a producer found the queue full
+		uint64_t full = 0;
+
+		/// @brief Times a producer had to retry because another producer claimed the same slot first
+		uint64_t contention = 0;
+
+		/// @brief Total time spent adding events to the queue, only with AsyncConfig::measureLatency
+		uint64_t enqueueNsTotal = 0;
+
+		/// @brief Slowest time taken to add an event to the queue, only with AsyncConfig::measureLatency
+		uint64_t enqueueNsMax = 0;
+
+		/// @brief Enqueue times by bucket, bucket i counts enqueues taking less than 2^(i+4)ns, the last bucket counts the rest
+		std::array<uint64_t, 16> enqueueNsHistogram{};
+	};
+
+	/// @brief What the logger has counted for one registered stream, since it was registered
+	struct StreamStats
+	{
+		/// @brief Events handed to the stream
+		uint64_t delivered = 0;
+
+		/// @brief Events the stream didn't receive because it doesn't listen to their level
+		uint64_t filtered = 0;
+
+		/// @brief Bytes the stream has written out, for streams that keep count such as the file streams
+		uint64_t bytesWritten = 0;
+
+		/// @brief Calls to handle() or handleBatch() that were timed, only with StatsConfig::measureHandle
+		uint64_t handleCalls = 0;
+
+		/// @brief Total time spent in the timed calls
+		uint64_t handleNsTotal = 0;
+
+		/// @brief Slowest timed call
+		uint64_t handleNsMax = 0;
+
+		/// @brief Timed calls by bucket, bucket i counts calls taking less than 2^(i+6)ns, the last bucket counts the rest
+		std::array<uint64_t, 20> handleNsHistogram{};
+
+		/// @brief Events waiting for the stream's worker, see Stream::setWorker
+		size_t queued = 0;
+
+		/// @brief Events the stream's worker queue discarded because it was full
+		uint64_t dropped = 0;
+	};
+
+	/// @brief Snapshot of what the logger has been doing, returned by Log::getStats()
+	struct LogStats
+	{
+		/// @brief Events created at each level, by levelIndex
+		std::array<uint64_t, LEVEL_COUNT> created{};
+
+		/// @brief Counters of each registered stream, by the name it was registered with
+		std::map<std::string, StreamStats> streams;
+
+		/// @brief Depth and drops of the asynchronous queue
+		QueueStats queue;
+
+		/// @brief Events held back by the rate limit
+		uint64_t rateLimited = 0;
+
+		/// @brief Events the rate limit had no room to track by kind, they are limited together
+		uint64_t rateLimitOverflow = 0;
+	};
+
+	/// @brief What the logger measures about itself, see Log::setStatsConfig
+	struct StatsConfig
+	{
+		/// @brief Time every call to a stream's handle() or handleBatch(), costs two clock reads per call
+		bool measureHandle = false;
+
+		/// @brief How often to send a stats event, 0 to never send one
+		/// The time is checked whenever an event is logged, and by the background writer in asynchronous mode
+		std::chrono::milliseconds interval = std::chrono::milliseconds(0);
+
+		/// @brief Name of the stream the stats events are sent to, no other stream receives them
+		std::string stream;
+	};
+
+	/// @brief How events are kept safe when the program is about to crash, see Log::enableCrashHandling
+	struct CrashConfig
+	{
+		/// @brief Levels written straight to the crash file, and sent to the streams without queueing them
+		int levels = LEVELS::CRITICAL;
+
+		/// @brief File opened up front and written to with no buffering, empty for none
+		std::string file = "crash.log";
+
+		/// @brief Also write the events to stderr
+		bool writeStderr = false;
+
+		/// @brief Catch SIGSEGV, SIGABRT, SIGBUS, SIGFPE and SIGILL to write out the queued events before the program dies
+		bool handleSignals = true;
+
+		/// @brief Catch std::terminate to note the exception, write the queued events to the crash file and flush the streams
+		/// that aren't busy before the program dies
+		bool handleTerminate = true;
+	};
+
+	/// @brief Text that is stored inside the object while it is short, so most events never allocate
+	/// Longer text overflows to a heap block which is kept and reused when new text is assigned
+	/// @tparam N bytes stored inline, including the terminating null
+	template <size_t N>
+	class InlineString
+	{
+	public:
+		/// @brief Create an empty string
+		InlineString() : text(local), length(0), reserved(N - 1)
+		{
+			local[0] = '\0';
+		}
+
+		/// @brief Create a string holding a copy of the text
+		/// @param value the text to copy
+		InlineString(std::string_view value) : InlineString()
+		{
+			assign(value.data(), value.size());
+		}
+
+		/// @brief Create a string holding a copy of the text
+		/// @param value the text to copy
+		InlineString(const char* value) : InlineString(std::string_view(value))
+		{}
+
+		/// @brief Create a string holding a copy of the text
+		/// @param value the text to copy
+		InlineString(const std::string& value) : InlineString(std::string_view(value))
+		{}
+
+		/// @brief Copy constructor
+		/// @param other the string to copy
+		InlineString(const InlineString& other) : InlineString()
+		{
+			assign(other.text, other.length);
+		}
+
+		/// @brief Move constructor, takes over the other string's heap block if it has one
+		/// @param other the string to move from
+		InlineString(InlineString&& other) noexcept : InlineString()
+		{
+			*this = std::move(other);
+		}
+
+		/// @brief Destructor
+		~InlineString()
+		{
+			if (text != local)
+			{
+				delete[] text;
+			}
+		}
+
+		/// @brief Copy assignment, reuses the existing storage when it is big enough
+		/// @param other the string to copy
+		InlineString& operator=(const InlineString& other)
+		{
+			if (this != &other)
+			{
+				assign(other.text, other.length);
+			}
+			return *this;
+		}
+
+		/// @brief Move assignment
+		/// Heap blocks are swapped rather than freed, so neither string loses its storage
+		/// @param other the string to move from
+		InlineString& operator=(InlineString&& other) noexcept
+		{
+			if (this == &other)
+			{
+				return *this;
+			}
+
+			if (other.text != other.local)
+			{
+				char* ownText = text != local ? text : nullptr;
+				size_t ownReserved = reserved;
+
+				text = other.text;
+				reserved = other.reserved;
+				length = other.length;
+
+				if (ownText != nullptr)
+				{
+					other.text = ownText;
+					other.reserved = ownReserved;
+				}
+				else
+				{
+					other.text = other.local;
+					other.reserved = N - 1;
+				}
+				other.length = 0;
+				other.text[0] = '\0';
+			}
+			else
+			{
+				assign(other.text, other.length);
+			}
+			return *this;
+		}
+
+		/// @brief Replace the text
+		/// @param value the new text
+		InlineString& operator=(std::string_view value)
+		{
+			assign(value.data(), value.size());
+			return *this;
+		}
+
+		/// @brief Replace the text
+		/// @param value the new text
+		InlineString& operator=(const char* value)
+		{
+			return *this = std::string_view(value);
+		}
+
+		/// @brief Replace the text
+		/// @param value the new text
+		InlineString& operator=(const std::string& value)
+		{
+			return *this = std::string_view(value);
+		}
+
+		/// @brief Replace the text, only allocating if it doesn't fit in the current storage
+		/// @param data the new text
+		/// @param size length of the new text
+		void assign(const char* data, size_t size)
+		{
+			if (size > reserved)
+			{
+				char* grown = new char[size + 1];
+				std::memcpy(grown, data, size);
+				if (text != local)
+				{
+					delete[] text;
+				}
+				text = grown;
+				reserved = size;
+			}
+			else if (size > 0)
+			{
+				std::memmove(text, data, size);
+			}
+			length = size;
+			text[length] = '\0';
+		}
+
+		/// @brief Add text to the end, growing the storage if it doesn't fit
+		/// @param data the text to add, which must not be part of this string
+		/// @param size length of the text
+		void append(const char* data, size_t size)
+		{
+			if (length + size > reserved)
+			{
+				size_t capacity = std::max(length + size, reserved * 2);
+				char* grown = new char[capacity + 1];
+				std::memcpy(grown, text, length);
+				if (text != local)
+				{
+					delete[] text;
+				}
+				text = grown;
+				reserved = capacity;
+			}
+			if (size > 0)
+			{
+				std::memcpy(text + length, data, size);
+			}
+			length += size;
+			text[length] = '\0';
+		}
+
+		/// @brief Access the text
+		/// @return the text, not null terminated
+		const char* data() const
+		{
+			return text;
+		}
+
+		/// @brief Access the text
+		/// @return null terminated text
+		const char* c_str() const
+		{
+			return text;
+		}
+
+		/// @brief Length of the text
+		/// @return number of characters
+		size_t size() const
+		{
+			return length;
+		}
+
+		/// @brief Check if there is any text
+		/// @return true if the string is empty
+		bool empty() const
+		{
+			return length == 0;
+		}
+
+		/// @brief Check if the text fits inside the object
+		/// @return true if no heap block is being used
+		bool isInline() const
+		{
+			return text == local;
+		}
+
+		/// @brief View the text without copying it
+		/// @return a view of the text, valid until the string is changed
+		std::string_view view() const
+		{
+			return std::string_view(text, length);
+		}
+
+		/// @brief View the text without copying it
+		operator std::string_view() const
+		{
+			return view();
+		}
+
+		/// @brief Copy the text into a std::string
+		operator std::string() const
+		{
+			return std::string(text, length);
+		}
+
+		friend bool operator==(const InlineString& a, std::string_view b)
+		{
+			return a.view() == b;
+		}
+
+		friend bool operator==(std::string_view a, const InlineString& b)
+		{
+			return a == b.view();
+		}
+
+		friend bool operator!=(const InlineString& a, std::string_view b)
+		{
+			return a.view() != b;
+		}
+
+		friend bool operator!=(std::string_view a, const InlineString& b)
+		{
+			return a != b.view();
+		}
+
+		friend std::ostream& operator<<(std::ostream& out, const InlineString& value)
+		{
+			return out.write(value.text, value.length);
+		}
+
+	private:
+		/// @brief Points at either the inline buffer or the heap block
+		char* text;
+
+		/// @brief Length of the text
+		size_t length;
+
+		/// @brief Longest text that fits in the current storage
+		size_t reserved;
+
+		/// @brief Storage for short text
+		char local[N];
+	};
+
+	/// @brief Reads the time given to new events from the source chosen with Log::setClock
+	/// Every source gives system_clock time points, so streams and formats don't need to know which one is used
+	class EventClock
+	{
+	public:
+		using time_point = std::chrono::time_point<std::chrono::system_clock>;
+
+		/// @brief Read the current source
+		/// @return the time now
+		static time_point now()
+		{
+			switch (source.load(std::memory_order_relaxed))
+			{
+			case CLOCK_SOURCE::COARSE_CLOCK:
+				return coarse();
+			case CLOCK_SOURCE::CACHED_CLOCK:
+				return fromNanoseconds(cached.load(std::memory_order_relaxed));
+			case CLOCK_SOURCE::STEADY_CLOCK:
+				return fromNanoseconds(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()
+					+ steadyOffset.load(std::memory_order_relaxed));
+			default:
+				return std::chrono::system_clock::now();
+			}
+		}
+
+		/// @brief The source being read
+		/// @return the source
+		static CLOCK_SOURCE get()
+		{
+			return (CLOCK_SOURCE)source.load(std::memory_order_relaxed);
+		}
+
+		/// @brief Read the system's coarse wall clock
+		/// Falls back to system_clock where there isn't one
+		/// @return the time of the last scheduler tick
+		static time_point coarse()
+		{
+#if defined(CLOCK_REALTIME_COARSE)
+			timespec now;
+			clock_gettime(CLOCK_REALTIME_COARSE, &now);
+			return fromNanoseconds((int64_t)now.tv_sec * 1000000000 + now.tv_nsec);
+#elif defined(_WIN32)
+			FILETIME now;
+			GetSystemTimeAsFileTime(&now);
+			int64_t ticks = (int64_t)(((uint64_t)now.dwHighDateTime << 32) | now.dwLowDateTime) - 116444736000000000LL; // 100ns ticks from 1601 to 1970
+			return fromNanoseconds(ticks * 100);
+#else
+			return std::chrono::system_clock::now();
+#endif
+		}
+
+	private:
+		friend class Log;
+
+		/// @brief Change the source, the cached time and steady clock offset are set first so the new source is read correctly straight away
+		/// @param value the new source
+		static void set(CLOCK_SOURCE value)
+		{
+			update();
+			auto wall = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+			auto steady = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+			steadyOffset.store(wall - steady, std::memory_order_relaxed);
+			source.store(value, std::memory_order_release);
+		}
+
+		/// @brief Store the system time for CACHED_CLOCK
+		static void update()
+		{
+			cached.store(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count(), std::memory_order_relaxed);
+		}
+
+		/// @brief Make a time point from nanoseconds since the epoch
+		static time_point fromNanoseconds(int64_t ns)
+		{
+			return time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(ns)));
+		}
+
+		/// @brief The source being read
+		inline static std::atomic<int> source = CLOCK_SOURCE::SYSTEM_CLOCK;
+
+		/// @brief System time in nanoseconds since the epoch, kept by the logger's clock thread
+		inline static std::atomic<int64_t> cached = 0;
+
+		/// @brief Nanoseconds added to the steady clock to get the wall time
+		inline static std::atomic<int64_t> steadyOffset = 0;
+	};
+
+	/// @brief Turns event timestamps into text
+	/// The date format is split into pieces once when it is set, and each thread keeps the text for the
+	/// current second so the date is only worked out again when the second changes
+	class TimestampFormat
+	{
+	public:
+		/// @brief The format used unless another one is set
+		inline static const char* const DEFAULT = "%Y/%m/%d/%H:%M:%S - ";
+
+		/// @brief Choose how timestamps are written
+		/// %Y %y %m %d %H %M %S and %% are written directly, other strftime fields are passed on to strftime
+		/// @param format strftime style format
+		/// @param subsecondDigits number of digits of the fraction of a second to add after each %S, from 0 to 9
+		static void set(const std::string& format, int subsecondDigits = 0)
+		{
+			auto compiled = compile(format, subsecondDigits);
+			std::lock_guard<std::mutex> guard(lock);
+			current = compiled;
+			++version;
+		}
+
+		/// @brief Get the current format
+		/// @return the strftime style format
+		static std::string getFormat()
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			return current ? current->format : DEFAULT;
+		}
+
+		/// @brief Add the text of a timestamp to the end of a string
+		/// @param timestamp the time to write
+		/// @param out string to add to
+		static void append(std::chrono::time_point<std::chrono::system_clock> timestamp, std::string& out)
+		{
+			thread_local Cache cache;
+			unsigned latest = version.load(std::memory_order_acquire);
+			if (cache.version != latest)
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				if (!current)
+				{
+					current = compile(DEFAULT, 0);
+				}
+				cache.format = current;
+				cache.version = latest;
+				cache.valid = false;
+			}
+
+			auto second = std::chrono::floor<std::chrono::seconds>(timestamp);
+			time_t seconds = std::chrono::system_clock::to_time_t(second);
+			if (!cache.valid || cache.second != seconds)
+			{
+				render(*cache.format, seconds, cache);
+			}
+
+			if (cache.fractionAt.empty())
+			{
+				out.append(cache.text);
+				return;
+			}
+
+			// write the digits of the fraction between the cached pieces
+			char digits[9];
+			int count = cache.format->digits;
+			auto fraction = std::chrono::duration_cast<std::chrono::nanoseconds>(timestamp - second).count();
+			for (int i = 9; i > count; --i)
+			{
+				fraction /= 10;
+			}
+			for (int i = count - 1; i >= 0; --i)
+			{
+				digits[i] = (char)('0' + fraction % 10);
+				fraction /= 10;
+			}
+
+			size_t start = 0;
+			for (size_t at : cache.fractionAt)
+			{
+				out.append(cache.text, start, at - start);
+				out.push_back('.');
+				out.append(digits, count);
+				start = at;
+			}
+			out.append(cache.text, start, std::string::npos);
+		}
+
+		/// @brief Convert a time to the local time zone, works the same on every platform
+		/// @param time the time to convert
+		/// @param result [out] the converted time
+		/// @return false if the time could not be converted
+		static bool toLocalTime(time_t time, tm& result)
+		{
+#ifdef _WIN32
+			return localtime_s(&result, &time) == 0;
+#else
+			return localtime_r(&time, &result) != nullptr;
+#endif
+		}
+
+	private:
+		/// @brief One piece of a format, either plain text or a field to fill in
+		struct Token
+		{
+			/// @brief The field's strftime letter, or 0 for plain text
+			char field;
+
+			/// @brief Plain text to copy
+			std::string text;
+		};
+
+		/// @brief A format that has been split into tokens
+		struct Compiled
+		{
+			std::string format;
+			int digits = 0;
+			std::vector<Token> tokens;
+		};
+
+		/// @brief The text of the last second a thread formatted
+		struct Cache
+		{
+			unsigned version = 0;
+			bool valid = false;
+			time_t second = 0;
+			std::shared_ptr<const Compiled> format;
+
+			/// @brief The date without the fraction of a second
+			std::string text;
+
+			/// @brief Where to insert the fraction of a second
+			std::vector<size_t> fractionAt;
+		};
+
+		/// @brief Split a format into tokens
+		/// @param format strftime style format
+		/// @param digits number of sub-second digits
+		/// @return the tokens
+		static std::shared_ptr<const Compiled> compile(const std::string& format, int digits)
+		{
+			auto result = std::make_shared<Compiled>();
+			result->format = format;
+			result->digits = digits < 0 ? 0 : (digits > 9 ? 9 : digits);
+
+			std::string text;
+			for (size_t i = 0; i < format.size(); ++i)
+			{
+				if (format[i] == '%' && i + 1 < format.size())
+				{
+					char field = format[++i];
+					if (field == '%')
+					{
+						text.push_back('%');
+						continue;
+					}
+					if (!text.empty())
+					{
+						result->tokens.push_back({ 0, text });
+						text.clear();
+					}
+					result->tokens.push_back({ field, "" });
+				}
+				else
+				{
+					text.push_back(format[i]);
+				}
+			}
+			if (!text.empty())
+			{
+				result->tokens.push_back({ 0, text });
+			}
+			return result;
+		}
+
+		/// @brief Add a number with a fixed number of digits
+		/// @param value the number
+		/// @param width number of digits
+		/// @param out string to add to
+		static void appendNumber(int value, int width, std::string& out)
+		{
+			char digits[12];
+			int count = 0;
+			do
+			{
+				digits[count++] = (char)('0' + value % 10);
+				value /= 10;
+			} while (value > 0 && count < 12);
+			while (count < width)
+			{
+				digits[count++] = '0';
+			}
+			while (count > 0)
+			{
+				out.push_back(digits[--count]);
+			}
+		}
+
+		/// @brief Fill the cache with the text for a second
+		/// @param format the format to use
+		/// @param seconds the second to write
+		/// @param cache the thread's cache
+		static void render(const Compiled& format, time_t seconds, Cache& cache)
+		{
+			tm local = {};
+			toLocalTime(seconds, local);
+
+			cache.text.clear();
+			cache.fractionAt.clear();
+			for (auto& token : format.tokens)
+			{
+				switch (token.field)
+				{
+				case(0): cache.text.append(token.text);
+					break;
+				case('Y'): appendNumber(local.tm_year + 1900, 4, cache.text);
+					break;
+				case('y'): appendNumber(local.tm_year % 100, 2, cache.text);
+					break;
+				case('m'): appendNumber(local.tm_mon + 1, 2, cache.text);
+					break;
+				case('d'): appendNumber(local.tm_mday, 2, cache.text);
+					break;
+				case('H'): appendNumber(local.tm_hour, 2, cache.text);
+					break;
+				case('M'): appendNumber(local.tm_min, 2, cache.text);
+					break;
+				case('S'): appendNumber(local.tm_sec, 2, cache.text);
+					if (format.digits > 0)
+					{
+						cache.fractionAt.push_back(cache.text.size());
+					}
+					break;
+				default:
+				{
+					char spec[3] = { '%', token.field, '\0' };
+					char buffer[128];
+					size_t written = std::strftime(buffer, sizeof(buffer), spec, &local);
+					cache.text.append(buffer, written);
+				}
+				}
+			}
+			cache.second = seconds;
+			cache.valid = true;
+		}
+
+		/// @brief Guards the current format
+		inline static std::mutex lock;
+
+		/// @brief The format being used, created on first use
+		inline static std::shared_ptr<const Compiled> current;
+
+		/// @brief Incremented when the format changes so threads know to update their caches
+		inline static std::atomic<unsigned> version = 1;
+	};
+
+	/// @brief Turning the arguments of the deferred logging functions (Log::infof etc.) into text
+	namespace deferred
+	{
+		/// @brief How an argument is kept until it is formatted, strings are copied so they outlive the caller's buffers
+		template<typename T>
+		using Stored = std::conditional_t<!std::is_arithmetic_v<std::decay_t<T>> && std::is_convertible_v<const std::decay_t<T>&, std::string_view>,
+			std::string, std::decay_t<T>>;
+
+		inline void append(std::string& out, const std::string& value)
+		{
+			out.append(value);
+		}
+
+		inline void append(std::string& out, bool value)
+		{
+			out.append(value ? "true" : "false");
+		}
+
+		inline void append(std::string& out, char value)
+		{
+			out.push_back(value);
+		}
+
+		template<typename T>
+		std::enable_if_t<std::is_integral_v<T>> append(std::string& out, T value)
+		{
+			char text[24];
+			auto end = std::to_chars(text, text + sizeof(text), value).ptr;
+			out.append(text, end - text);
+		}
+
+		template<typename T>
+		std::enable_if_t<std::is_floating_point_v<T>> append(std::string& out, T value)
+		{
+#if defined(__cpp_lib_to_chars) || defined(_MSC_VER)
+			char text[64];
+			auto end = std::to_chars(text, text + sizeof(text), value).ptr;
+			out.append(text, end - text);
+#else
+			char text[64];
+			int size = std::snprintf(text, sizeof(text), "%g", (double)value);
+			out.append(text, size > 0 ? size : 0);
+#endif
+		}
+
+		/// @brief Anything else is written with its operator<<
+		template<typename T>
+		std::enable_if_t<!std::is_arithmetic_v<T>> append(std::string& out, const T& value)
+		{
+			std::ostringstream text;
+			text << value;
+			out.append(text.str());
+		}
+
+		/// @brief Copy the text of a pattern up to the next {} placeholder, {{ and }} are written as { and }
+		/// @param pattern the format
+		/// @param position where to start, moved past the placeholder
+		/// @param out buffer to add to
+		/// @return false if there are no placeholders left
+		inline bool copyUntilPlaceholder(std::string_view pattern, size_t& position, std::string& out)
+		{
+			while (position < pattern.size())
+			{
+				char c = pattern[position];
+				char next = position + 1 < pattern.size() ? pattern[position + 1] : '\0';
+				if (c == '{' && next == '}')
+				{
+					position += 2;
+					return true;
+				}
+				if ((c == '{' && next == '{') || (c == '}' && next == '}'))
+				{
+					++position;
+				}
+				out.push_back(c);
+				++position;
+			}
+			return false;
+		}
+	}
+
+	/// @brief Arguments of an event whose message is formatted later
+	class DeferredFormat
+	{
+	public:
+		/// @brief Destructor
+		virtual ~DeferredFormat() = default;
+
+		/// @brief Write the message
+		/// @param pattern the format, with a {} for each argument
+		/// @param out buffer to add to
+		virtual void format(std::string_view pattern, std::string& out) const = 0;
+	};
+
+	/// @brief Arguments captured by value for a DeferredFormat
+	template<typename... Args>
+	class FormatArguments : public DeferredFormat
+	{
+	public:
+		/// @brief Constructor
+		/// @param args the values to keep
+		template<typename... Values>
+		FormatArguments(Values&&... args) : values(std::forward<Values>(args)...) {}
+
+		/// @brief Write the message, replacing each {} with the next argument
+		/// Arguments without a placeholder are left out, placeholders without an argument are written as they are
+		/// @param pattern the format
+		/// @param out buffer to add to
+		virtual void format(std::string_view pattern, std::string& out) const
+		{
+			size_t position = 0;
+			bool placeholders = true;
+			std::apply([&](const auto&... value)
+				{
+					((placeholders = placeholders && deferred::copyUntilPlaceholder(pattern, position, out),
+						placeholders ? deferred::append(out, value) : void()), ...);
+				}, values);
+			if (position < pattern.size())
+			{
+				out.append(pattern.data() + position, pattern.size() - position);
+			}
+		}
+
+	private:
+		std::tuple<Args...> values;
+	};
+
+	/// @brief Where an event is logged from, made once for each call site by the BOOM_*_AT macros
+	/// Each call site is given a small ID when it is first reached, and its events carry the ID instead of
+	/// copies of their source and code. The strings must last for the whole program, such as string literals
+	class CallSite
+	{
+	public:
+		/// @brief Most call sites that can be given an ID, events from later ones carry their strings as usual
+		static const size_t MAX_SITES = 65536;
+
+		/// @brief Constructor, registers the call site
+		/// @param level level of the events logged here
+		/// @param file source file of the call
+		/// @param line line of the call
+		/// @param function function the call is in
+		/// @param code user-defined code of the events logged here
+		/// @param source where the events come from, the function if it is empty
+		CallSite(LEVELS level, const char* file, int line, const char* function, std::string_view code, std::string_view source = "")
+			: level(level), file(file), line(line), function(function), code(code), source(source.empty() ? std::string_view(function) : source)
+		{
+			std::lock_guard<std::mutex> guard(registryLock);
+			if (registered + 1 < MAX_SITES)
+			{
+				id = (uint32_t)++registered;
+				sites[id].store(this, std::memory_order_release);
+			}
+		}
+
+		CallSite(const CallSite&) = delete;
+		CallSite& operator=(const CallSite&) = delete;
+
+		/// @brief Find a registered call site
+		/// @param id the call site's ID
+		/// @return the call site, nullptr if no call site has that ID
+		static const CallSite* find(uint32_t id)
+		{
+			return id < MAX_SITES ? sites[id].load(std::memory_order_acquire) : nullptr;
+		}
+
+		/// @brief Number of call sites that have been given an ID
+		static size_t count()
+		{
+			std::lock_guard<std::mutex> guard(registryLock);
+			return registered;
+		}
+
+		/// @brief The call site's ID
+		/// @return the ID, 0 if there was no room left to register it
+		uint32_t getId() const
+		{
+			return id;
+		}
+
+		LEVELS getLevel() const
+		{
+			return level;
+		}
+
+		const char* getFile() const
+		{
+			return file;
+		}
+
+		int getLine() const
+		{
+			return line;
+		}
+
+		const char* getFunction() const
+		{
+			return function;
+		}
+
+		std::string_view getCode() const
+		{
+			return code;
+		}
+
+		std::string_view getSource() const
+		{
+			return source;
+		}
+
+	private:
+		LEVELS level;
+		const char* file;
+		int line;
+		const char* function;
+		std::string_view code;
+		std::string_view source;
+		uint32_t id = 0;
+
+		/// @brief The registered call sites by ID, a fixed table so it is never freed while events still refer to it
+		inline static std::array<std::atomic<const CallSite*>, MAX_SITES> sites{};
+
+		/// @brief Number of registered call sites, guarded by registryLock
+		inline static size_t registered = 0;
+
+		/// @brief Makes call sites register one at a time
+		inline static std::mutex registryLock;
+	};
+
+	/// @brief Type of the value of a Field
+	enum FIELD_TYPE { FIELD_INT, FIELD_UINT, FIELD_DOUBLE, FIELD_BOOL, FIELD_STRING };
+
+	/// @brief One key and value attached to an event, a view that is valid until the fields are changed
+	struct Field
+	{
+		std::string_view key;
+		FIELD_TYPE type = FIELD_INT;
+		int64_t integer = 0;			// FIELD_INT
+		uint64_t unsignedInteger = 0;	// FIELD_UINT
+		double number = 0;				// FIELD_DOUBLE
+		bool flag = false;				// FIELD_BOOL
+		std::string_view text;			// FIELD_STRING
+	};
+
+	/// @brief Typed key-value pairs attached to an event, for streams that write structured records
+	/// The values are kept in a small fixed array and the text of keys and strings in one buffer, so there is no map per event
+	/// and short fields don't allocate. Fields after the first MAX_FIELDS are ignored
+	class Fields
+	{
+	public:
+		/// @brief Most fields an event can carry
+		static const size_t MAX_FIELDS = 8;
+
+		/// @brief Create an empty set of fields
+		Fields() = default;
+
+		/// @brief Copy constructor, only copies the fields in use
+		/// @param other the fields to copy
+		Fields(const Fields& other)
+		{
+			*this = other;
+		}
+
+		/// @brief Copy assignment, only copies the fields in use and reuses the existing text storage
+		/// @param other the fields to copy
+		Fields& operator=(const Fields& other)
+		{
+			if (this != &other)
+			{
+				count = other.count;
+				std::copy(other.entries.begin(), other.entries.begin() + count, entries.begin());
+				text.assign(other.text.data(), other.text.size());
+			}
+			return *this;
+		}
+
+		/// @brief Add a string field, the text is copied
+		Fields& add(std::string_view key, std::string_view value)
+		{
+			Entry* entry = push(key, FIELD_STRING);
+			if (entry != nullptr)
+			{
+				setText(*entry, value);
+			}
+			return *this;
+		}
+
+		Fields& add(std::string_view key, const char* value)
+		{
+			return add(key, std::string_view(value));
+		}
+
+		Fields& add(std::string_view key, const std::string& value)
+		{
+			return add(key, std::string_view(value));
+		}
+
+		Fields& add(std::string_view key, bool value)
+		{
+			Entry* entry = push(key, FIELD_BOOL);
+			if (entry != nullptr)
+			{
+				entry->integer = value ? 1 : 0;
+			}
+			return *this;
+		}
+
+		/// @brief Add a number field, integers keep their sign and floating point values are stored as double
+		template <typename T>
+		std::enable_if_t<std::is_arithmetic_v<T> && !std::is_same_v<T, bool>, Fields&> add(std::string_view key, T value)
+		{
+			if constexpr (std::is_floating_point_v<T>)
+			{
+				Entry* entry = push(key, FIELD_DOUBLE);
+				if (entry != nullptr)
+				{
+					entry->number = (double)value;
+				}
+			}
+			else if constexpr (std::is_signed_v<T>)
+			{
+				Entry* entry = push(key, FIELD_INT);
+				if (entry != nullptr)
+				{
+					entry->integer = (int64_t)value;
+				}
+			}
+			else
+			{
+				Entry* entry = push(key, FIELD_UINT);
+				if (entry != nullptr)
+				{
+					entry->unsignedInteger = (uint64_t)value;
+				}
+			}
+			return *this;
+		}
+
+		/// @brief Number of fields
+		size_t size() const
+		{
+			return count;
+		}
+
+		/// @brief Check if there are any fields
+		bool empty() const
+		{
+			return count == 0;
+		}
+
+		/// @brief Get a field
+		/// @param index position of the field, in the order they were added
+		/// @return a view of the field
+		Field operator[](size_t index) const
+		{
+			const Entry& entry = entries[index];
+			Field field;
+			field.key = std::string_view(text.data() + entry.keyAt, entry.keySize);
+			field.type = (FIELD_TYPE)entry.type;
+			switch (field.type)
+			{
+			case FIELD_INT: field.integer = entry.integer; break;
+			case FIELD_UINT: field.unsignedInteger = entry.unsignedInteger; break;
+			case FIELD_DOUBLE: field.number = entry.number; break;
+			case FIELD_BOOL: field.flag = entry.integer != 0; break;
+			case FIELD_STRING: field.text = std::string_view(text.data() + entry.textAt, entry.textSize); break;
+			}
+			return field;
+		}
+
+		/// @brief Remove every field, keeping the storage
+		void clear()
+		{
+			count = 0;
+			text.assign("", 0);
+		}
+
+		/// @brief Add the fields to a line of text, as " key=value" for each field with strings in quotes
+		/// @param out anything with append(const char*, size_t), such as a std::string
+		template <typename Out>
+		void appendTo(Out& out) const
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+				Field field = (*this)[i];
+				out.append(" ", 1);
+				out.append(field.key.data(), field.key.size());
+				out.append("=", 1);
+				char number[64];
+				char* end = number;
+				switch (field.type)
+				{
+				case FIELD_INT: end = std::to_chars(number, number + sizeof(number), field.integer).ptr; break;
+				case FIELD_UINT: end = std::to_chars(number, number + sizeof(number), field.unsignedInteger).ptr; break;
+				case FIELD_DOUBLE: end = number + formatDouble(field.number, number, sizeof(number)); break;
+				case FIELD_BOOL: out.append(field.flag ? "true" : "false", field.flag ? 4 : 5); break;
+				case FIELD_STRING:
+					out.append("\"", 1);
+					out.append(field.text.data(), field.text.size());
+					out.append("\"", 1);
+					break;
+				}
+				out.append(number, (size_t)(end - number));
+			}
+		}
+
+		/// @brief Number of bytes encode() writes
+		size_t encodedSize() const
+		{
+			size_t size = 1;
+			for (size_t i = 0; i < count; ++i)
+			{
+				const Entry& entry = entries[i];
+				size += 2 + entry.keySize;
+				switch (entry.type)
+				{
+				case FIELD_BOOL: size += 1; break;
+				case FIELD_STRING: size += 2 + entry.textSize; break;
+				default: size += 8; break;
+				}
+			}
+			return size;
+		}
+
+		/// @brief Write the fields as bytes, for streams that store events: u8 count, then for each field u8 key length, key,
+		/// u8 type and the value, which is 8 little-endian bytes for numbers, 1 byte for a bool or u16 length and text for a string
+		/// @param out room for encodedSize() bytes
+		void encode(char* out) const
+		{
+			*out++ = (char)count;
+			for (size_t i = 0; i < count; ++i)
+			{
+				const Entry& entry = entries[i];
+				*out++ = (char)entry.keySize;
+				std::memcpy(out, text.data() + entry.keyAt, entry.keySize);
+				out += entry.keySize;
+				*out++ = (char)entry.type;
+				uint64_t bits = entry.unsignedInteger;
+				switch (entry.type)
+				{
+				case FIELD_BOOL: *out++ = (char)(entry.integer != 0 ? 1 : 0); break;
+				case FIELD_STRING:
+					out = putNumber(out, entry.textSize, 2);
+					std::memcpy(out, text.data() + entry.textAt, entry.textSize);
+					out += entry.textSize;
+					break;
+				case FIELD_DOUBLE: std::memcpy(&bits, &entry.number, 8); out = putNumber(out, bits, 8); break;
+				default: out = putNumber(out, bits, 8); break;
+				}
+			}
+		}
+
+		/// @brief Replace the fields with ones written by encode()
+		/// @param data the bytes
+		/// @param size number of bytes
+		/// @return false if the bytes are damaged, the fields are then left empty
+		bool decode(const char* data, size_t size)
+		{
+			clear();
+			const char* end = data + size;
+			if (size == 0 || (uint8_t)*data > MAX_FIELDS)
+			{
+				return false;
+			}
+			size_t fields = (uint8_t)*data++;
+			for (size_t i = 0; i < fields; ++i)
+			{
+				if (end - data < 2 || end - data < 2 + (uint8_t)*data)
+				{
+					clear();
+					return false;
+				}
+				std::string_view key(data + 1, (uint8_t)*data);
+				data += 1 + key.size();
+				uint8_t type = (uint8_t)*data++;
+				size_t valueSize = type == FIELD_BOOL ? 1 : type == FIELD_STRING ? 2 : 8;
+				if (type > FIELD_STRING || (size_t)(end - data) < valueSize
+					|| (type == FIELD_STRING && (size_t)(end - data) < 2 + getNumber(data, 2)))
+				{
+					clear();
+					return false;
+				}
+				uint64_t bits = type == FIELD_BOOL ? (uint8_t)*data : getNumber(data, valueSize);
+				data += valueSize;
+				double number;
+				switch (type)
+				{
+				case FIELD_INT: add(key, (int64_t)bits); break;
+				case FIELD_UINT: add(key, bits); break;
+				case FIELD_DOUBLE: std::memcpy(&number, &bits, 8); add(key, number); break;
+				case FIELD_BOOL: add(key, bits != 0); break;
+				case FIELD_STRING: add(key, std::string_view(data, (size_t)bits)); data += bits; break;
+				}
+			}
+			if (data != end)
+			{
+				clear();
+				return false;
+			}
+			return true;
+		}
+
+		/// @brief Write a double as the shortest text that reads back as the same value
+		/// @return number of characters written
+		static size_t formatDouble(double value, char* out, size_t size)
+		{
+#if defined(__cpp_lib_to_chars) || defined(_MSC_VER)
+			return (size_t)(std::to_chars(out, out + size, value).ptr - out);
+#else
+			int written = std::snprintf(out, size, "%.17g", value);
+			return written > 0 ? (size_t)written : 0;
+#endif
+		}
+
+	private:
+		/// @brief Where a field's key and value are kept
+		struct Entry
+		{
+			uint16_t keyAt;
+			uint16_t textAt;
+			uint16_t textSize;
+			uint8_t keySize;
+			uint8_t type;
+			union
+			{
+				int64_t integer;
+				uint64_t unsignedInteger;
+				double number;
+			};
+		};
+
+		/// @brief Write a little-endian number
+		/// @return the position after it
+		static char* putNumber(char* out, uint64_t value, size_t bytes)
+		{
+			for (size_t i = 0; i < bytes; ++i)
+			{
+				*out++ = (char)((value >> (8 * i)) & 0xFF);
+			}
+			return out;
+		}
+
+		/// @brief Read a little-endian number
+		static uint64_t getNumber(const char* data, size_t bytes)
+		{
+			uint64_t value = 0;
+			for (size_t i = 0; i < bytes; ++i)
+			{
+				value |= (uint64_t)(uint8_t)data[i] << (8 * i);
+			}
+			return value;
+		}
+
+		/// @brief Start a new field
+		/// @return the entry to fill in, nullptr if there is no room
+		Entry* push(std::string_view key, FIELD_TYPE type)
+		{
+			if (count == MAX_FIELDS || text.size() + key.size() > UINT16_MAX)
+			{
+				return nullptr;
+			}
+			Entry& entry = entries[count++];
+			entry.keySize = (uint8_t)std::min(key.size(), (size_t)UINT8_MAX);
+			entry.keyAt = (uint16_t)text.size();
+			text.append(key.data(), entry.keySize);
+			entry.type = (uint8_t)type;
+			entry.textAt = 0;
+			entry.textSize = 0;
+			entry.unsignedInteger = 0;
+			return &entry;
+		}
+
+		/// @brief Copy a string value into the text buffer, cutting it short if the buffer is full
+		void setText(Entry& entry, std::string_view value)
+		{
+			size_t room = UINT16_MAX - text.size();
+			entry.textAt = (uint16_t)text.size();
+			entry.textSize = (uint16_t)std::min(value.size(), room);
+			text.append(value.data(), entry.textSize);
+		}
+
+		/// @brief Number of fields in use
+		uint8_t count = 0;
+
+		/// @brief The fields
+		std::array<Entry, MAX_FIELDS> entries;
+
+		/// @brief Text of the keys and string values
+		InlineString<64> text;
+	};
+
+	/// @brief Stores one message with associated data
+	/// Short messages, sources and codes are kept inside the event, so creating or copying one doesn't allocate
+	class Event
+	{
+	public:
+		Event() : level(LEVELS::INFO)
+		{}
+
+		/// @brief Constructor
+		/// @param level 
+		/// @param msg 
+		/// @param timestamp
+		Event(	LEVELS level,
+				std::string_view msg, 
+				std::string_view source = "",
+				std::string_view code = "",
+				std::chrono::time_point<std::chrono::system_clock> timestamp = EventClock::now()
+			)
+			:level(level), msg(msg), source(source), code(code), timestamp(timestamp) {}
+
+		/// @brief The event's level
+		/// @return the level
+		LEVELS getLevel() const
+		{
+			return level;
+		}
+
+		/// @brief When the event happened
+		/// @return the timestamp
+		std::chrono::time_point<std::chrono::system_clock> getTimestamp() const
+		{
+			return timestamp;
+		}
+
+		/// @brief View the message without copying it
+		/// @return the message, valid until the event is changed
+		std::string_view getMsg() const
+		{
+			return msg.view();
+		}
+
+		/// @brief View the source without copying it
+		/// @return the function that created the event, empty if it wasn't set
+		std::string_view getSource() const
+		{
+			const CallSite* from = site != 0 && source.empty() ? CallSite::find(site) : nullptr;
+			return from != nullptr ? from->getSource() : source.view();
+		}
+
+		/// @brief View the code without copying it
+		/// @return the user-defined code, empty if it wasn't set
+		std::string_view getCode() const
+		{
+			const CallSite* from = site != 0 && code.empty() ? CallSite::find(site) : nullptr;
+			return from != nullptr ? from->getCode() : code.view();
+		}
+
+		/// @brief The call site the event was logged from
+		/// @return the call site, nullptr if the event wasn't logged through one of the BOOM_*_AT macros
+		const CallSite* getCallSite() const
+		{
+			return CallSite::find(site);
+		}
+
+
+		/// @brief Format the message of an event created by one of the deferred logging functions
+		/// The logger does this before the event reaches any stream, afterwards msg holds the finished text
+		void resolve()
+		{
+			if (args)
+			{
+				static thread_local std::string text;
+				text.clear();
+				args->format(msg.view(), text);
+				msg = text;
+				args.reset();
+			}
+		}
+
+		/// @brief Generate a string containing all of the event's data
+		/// @return String with event's data
+		std::string toString() const
+		{
+			std::string result;
+			formatTo(result);
+			return result;
+		}
+
+		/// @brief Add the event's text to the end of a buffer
+		/// Writes the same text as toString() without creating any temporary strings,
+		/// so reusing one buffer for many events doesn't allocate once it has grown
+		/// @param out buffer to add to
+		void formatTo(std::string& out) const
+		{
+			out.append(levelSymbol(level), 3);
+			TimestampFormat::append(timestamp, out);
+			std::string_view code = getCode();
+			if (!code.empty())
+			{
+				out.push_back('[');
+				out.append(code.data(), code.size());
+				out.append("] ", 2);
+			}
+
+			if (args)
+			{
+				args->format(msg.view(), out);
+			}
+			else
+			{
+				out.append(msg.data(), msg.size());
+			}
+			fields.appendTo(out);
+
+			std::string_view source = getSource();
+			if (!source.empty())
+			{
+				out.append(" (from ", 7);
+				out.append(source.data(), source.size());
+				out.push_back(')');
+			}
+		}
+
+		/// @brief The symbol written at the start of an event's text
+		/// @param level the event's level
+		/// @return three characters showing the level
+		static const char* levelSymbol(LEVELS level)
+		{
+			switch (level)
+			{
+			case(LEVELS::DBG): return " # ";
+			case(LEVELS::INFO): return "   ";
+			case(LEVELS::WARNING): return " ! ";
+			case(LEVELS::ERR): return "!! ";
+			case(LEVELS::CRITICAL): return "!!!";
+			}
+			return "   ";
+		}
+
+		/// @brief Name of a level, in lower case
+		/// @param level the level
+		/// @return the name, such as "warning"
+		static const char* levelName(LEVELS level)
+		{
+			switch (level)
+			{
+			case(LEVELS::DBG): return "debug";
+			case(LEVELS::INFO): return "info";
+			case(LEVELS::WARNING): return "warning";
+			case(LEVELS::ERR): return "error";
+			case(LEVELS::CRITICAL): return "critical";
+			}
+			return "info";
+		}
+
+		/// @brief When the event happened
+		std::chrono::time_point<std::chrono::system_clock> timestamp;
+		LEVELS level;
+		InlineString<96> msg;
+		InlineString<48> source;
+		InlineString<16> code;
+
+		/// @brief ID of the call site the event was logged from, 0 if none. The source and code are taken from the call site when they are empty
+		uint32_t site = 0;
+
+		/// @brief Typed key-value pairs, written after the message
+		Fields fields;
+
+		/// @brief Arguments still to be formatted into the message, in which case msg holds the format
+		std::shared_ptr<const DeferredFormat> args;
+	};
+
+#if __cplusplus >= 202002L && __has_include(<span>)
+	/// @brief A run of events delivered to a stream at once
+	using EventSpan = std::span<Event>;
+#else
+	/// @brief A run of events delivered to a stream at once, stands in for std::span<Event> before C++20
+	class EventSpan
+	{
+	public:
+		EventSpan() = default;
+		EventSpan(Event* data, size_t size) : first(data), count(size) {}
+
+		Event* data() const { return first; }
+		size_t size() const { return count; }
+		bool empty() const { return count == 0; }
+		Event* begin() const { return first; }
+		Event* end() const { return first + count; }
+		Event& operator[](size_t index) const { return first[index]; }
+
+	private:
+		Event* first = nullptr;
+		size_t count = 0;
+	};
+#endif
+
+	/// @brief A stream's filter rules compiled for matching, never changed once built
+	/// Each rule is one bit. The rules whose prefix matches are found by walking a radix tree along the source, the rules whose
+	/// code matches by one lookup in a hash table and the rules of each level are kept as a mask, so matching an event is a
+	/// few ANDs and no strings are copied. The answer for each call site is remembered, so events logged through the
+	/// BOOM_*_AT macros are only matched once per site
+	class EventFilter
+	{
+	public:
+		/// @brief Most rules a filter can have, the rest are ignored
+		static const size_t MAX_RULES = 64;
+
+		/// @brief Compile the rules
+		/// @param rules the rules in the order they are tried
+		explicit EventFilter(const std::vector<FilterRule>& rules)
+			: siteAnswers(std::make_unique<std::atomic<uint8_t>[]>(CallSite::MAX_SITES))
+		{
+			std::vector<Node> nodes(1);
+			std::vector<std::pair<std::string, uint64_t>> codes;
+			size_t count = std::min(rules.size(), (size_t)MAX_RULES);
+			for (size_t i = 0; i < count; ++i)
+			{
+				const FilterRule& rule = rules[i];
+				uint64_t bit = (uint64_t)1 << i;
+				if (rule.allow)
+				{
+					allowed |= bit;
+				}
+				for (size_t level = 0; level < LEVEL_COUNT; ++level)
+				{
+					if ((rule.levels & (1 << level)) != 0)
+					{
+						byLevel[level] |= bit;
+					}
+				}
+				nodes[addPrefix(nodes, rule.source)].rules |= bit;
+				if (rule.codes.empty())
+				{
+					anyCode |= bit;
+				}
+				for (const std::string& code : rule.codes)
+				{
+					auto found = std::find_if(codes.begin(), codes.end(), [&code](const auto& c) { return c.first == code; });
+					if (found == codes.end())
+					{
+						codes.emplace_back(code, bit);
+					}
+					else
+					{
+						found->second |= bit;
+					}
+				}
+			}
+			buildCodeTable(codes);
+			tree.emplace_back();
+			compress(nodes, 0, 0);
+		}
+
+		/// @brief Copy constructor, not used
+		EventFilter(const EventFilter&) = delete;
+
+		/// @brief Check if an event gets through the filter
+		/// @param level the event's level
+		/// @param source the function or module that logged it
+		/// @param code its code
+		/// @param site ID of the call site the source and code come from, 0 if they don't come from one
+		/// @return false if the first rule that matches holds the event back
+		bool allows(LEVELS level, std::string_view source, std::string_view code, uint32_t site = 0) const
+		{
+			if (site == 0 || site >= CallSite::MAX_SITES)
+			{
+				return match(level, source, code);
+			}
+			uint8_t known = siteAnswers[site].load(std::memory_order_relaxed);
+			if (known == 0)
+			{
+				known = match(level, source, code) ? ALLOWED : HELD;
+				siteAnswers[site].store(known, std::memory_order_relaxed);
+			}
+			return known == ALLOWED;
+		}
+
+		/// @brief Check if an event gets through the filter
+		/// @param event the event
+		/// @return false if the first rule that matches holds the event back
+		bool allows(const Event& event) const
+		{
+			uint32_t site = event.source.empty() && event.code.empty() ? event.site : 0;
+			return allows(event.level, event.getSource(), event.getCode(), site);
+		}
+
+		/// @brief Read filter rules for several streams, one rule per line
+		/// Each line is a stream name, allow or deny, then any of levels=debug,info,... (or all), source=prefix and code=C1,C2.
+		/// Blank lines and lines starting with # are skipped
+		/// @param in the rules
+		/// @param out [out] the rules of each stream named, in the order they were read
+		/// @return false if a line couldn't be read, out is left empty then
+		static bool parse(std::istream& in, std::map<std::string, std::vector<FilterRule>>& out)
+		{
+			out.clear();
+			std::string line;
+			while (std::getline(in, line))
+			{
+				std::istringstream words(line);
+				std::string stream;
+				std::string action;
+				if (!(words >> stream) || stream[0] == '#')
+				{
+					continue;
+				}
+				FilterRule rule;
+				words >> action;
+				if (action != "allow" && action != "deny")
+				{
+					out.clear();
+					return false;
+				}
+				rule.allow = action == "allow";
+				std::string word;
+				while (words >> word)
+				{
+					size_t equals = word.find('=');
+					std::string key = word.substr(0, equals);
+					std::string value = equals == std::string::npos ? "" : word.substr(equals + 1);
+					if (key == "source")
+					{
+						rule.source = value;
+					}
+					else if (key == "code")
+					{
+						rule.codes = split(value);
+					}
+					else if (key == "levels" && parseLevels(value, rule.levels))
+					{
+					}
+					else
+					{
+						out.clear();
+						return false;
+					}
+				}
+				out[stream].push_back(rule);
+			}
+			return true;
+		}
+
+	private:
+		/// @brief Answers remembered for a call site
+		static const uint8_t ALLOWED = 1;
+		static const uint8_t HELD = 2;
+
+		/// @brief Find the first rule that matches
+		bool match(LEVELS level, std::string_view source, std::string_view code) const
+		{
+			uint64_t candidates = byLevel[levelIndex(level)] & (anyCode | findCode(code));
+			if (candidates == 0)
+			{
+				return true;
+			}
+			uint64_t bySource = 0;
+			size_t at = 0;
+			const Branch* branch = &tree[0];
+			while (true)
+			{
+				if (source.size() - at < branch->labelSize || std::memcmp(source.data() + at, labels.data() + branch->labelAt, branch->labelSize) != 0)
+				{
+					break;
+				}
+				at += branch->labelSize;
+				bySource |= branch->rules;
+				if (at == source.size() || (branch->below & ~branch->rules & candidates) == 0)
+				{
+					break; // no longer prefix could change the answer
+				}
+				const Branch* next = nullptr;
+				for (uint32_t i = 0; i < branch->childCount && next == nullptr; ++i)
+				{
+					const Branch& candidate = tree[branch->firstChild + i];
+					if (labels[candidate.labelAt] == source[at])
+					{
+						next = &candidate;
+					}
+				}
+				if (next == nullptr)
+				{
+					break;
+				}
+				branch = next;
+			}
+			candidates &= bySource;
+			if (candidates == 0)
+			{
+				return true;
+			}
+			uint64_t first = candidates & (~candidates + 1);
+			return (allowed & first) != 0;
+		}
+
+		/// @brief A point in the trie of source prefixes, one character per step, only used while building
+		struct Node
+		{
+			/// @brief The rules whose prefix ends here
+			uint64_t rules = 0;
+
+			/// @brief The next character of longer prefixes and the node it leads to
+			std::vector<std::pair<char, uint32_t>> children;
+		};
+
+		/// @brief A point in the radix tree, where runs of the trie with no branches and no rules are one label
+		/// The children of a branch are next to each other and start with different characters
+		struct Branch
+		{
+			/// @brief The rules whose prefix ends here
+			uint64_t rules = 0;
+
+			/// @brief The rules whose prefix ends here or further down
+			uint64_t below = 0;
+
+			/// @brief Where the label is in labels, and its length
+			uint32_t labelAt = 0;
+			uint32_t labelSize = 0;
+
+			/// @brief The children
+			uint32_t firstChild = 0;
+			uint32_t childCount = 0;
+		};
+
+		/// @brief Add a prefix to the trie
+		/// @return the node where it ends
+		static uint32_t addPrefix(std::vector<Node>& nodes, const std::string& prefix)
+		{
+			uint32_t node = 0;
+			for (char c : prefix)
+			{
+				uint32_t next = UINT32_MAX;
+				for (auto& child : nodes[node].children)
+				{
+					if (child.first == c)
+					{
+						next = child.second;
+					}
+				}
+				if (next == UINT32_MAX)
+				{
+					next = (uint32_t)nodes.size();
+					nodes[node].children.emplace_back(c, next);
+					nodes.emplace_back();
+				}
+				node = next;
+			}
+			return node;
+		}
+
+		/// @brief Fill in a branch from a trie node, following the node's run of single children into the label
+		/// @param nodes the trie
+		/// @param node the trie node the branch starts at, just after the character that led to it
+		/// @param at the branch to fill in
+		/// @return the rules of the branch and everything below it
+		uint64_t compress(const std::vector<Node>& nodes, uint32_t node, size_t at)
+		{
+			while (nodes[node].rules == 0 && nodes[node].children.size() == 1)
+			{
+				labels.push_back(nodes[node].children[0].first);
+				++tree[at].labelSize;
+				node = nodes[node].children[0].second;
+			}
+			tree[at].rules = nodes[node].rules;
+			const auto& children = nodes[node].children;
+			size_t first = tree.size();
+			tree[at].firstChild = (uint32_t)first;
+			tree[at].childCount = (uint32_t)children.size();
+			tree.resize(first + children.size());
+			uint64_t below = nodes[node].rules;
+			for (size_t i = 0; i < children.size(); ++i)
+			{
+				tree[first + i].labelAt = (uint32_t)labels.size();
+				tree[first + i].labelSize = 1;
+				labels.push_back(children[i].first);
+				below |= compress(nodes, children[i].second, first + i);
+			}
+			tree[at].below = below;
+			return below;
+		}
+
+		/// @brief One slot of the code table, an empty code marks a free slot
+		struct CodeSlot
+		{
+			std::string code;
+			uint64_t rules = 0;
+		};
+
+		/// @brief FNV-1a hash of a code
+		static uint64_t hash(std::string_view code)
+		{
+			uint64_t h = 14695981039346656037ull;
+			for (char c : code)
+			{
+				h = (h ^ (uint8_t)c) * 1099511628211ull;
+			}
+			return h;
+		}
+
+		/// @brief Build an open addressing table, at most half full so lookups stop quickly
+		void buildCodeTable(const std::vector<std::pair<std::string, uint64_t>>& codes)
+		{
+			size_t size = 1;
+			while (size < codes.size() * 2)
+			{
+				size <<= 1;
+			}
+			codeTable.resize(size);
+			for (auto& code : codes)
+			{
+				if (code.first.empty())
+				{
+					anyCode |= code.second; // an empty code in the list means events without a code
+					continue;
+				}
+				size_t at = hash(code.first) & (size - 1);
+				while (!codeTable[at].code.empty())
+				{
+					at = (at + 1) & (size - 1);
+				}
+				codeTable[at].code = code.first;
+				codeTable[at].rules = code.second;
+			}
+		}
+
+		/// @brief The rules that list a code
+		uint64_t findCode(std::string_view code) const
+		{
+			if (code.empty())
+			{
+				return 0;
+			}
+			// the table always has a free slot, which ends the search
+			size_t mask = codeTable.size() - 1;
+			for (size_t at = hash(code) & mask; !codeTable[at].code.empty(); at = (at + 1) & mask)
+			{
+				if (codeTable[at].code == code)
+				{
+					return codeTable[at].rules;
+				}
+			}
+			return 0;
+		}
+
+		/// @brief Split a comma separated list
+		static std::vector<std::string> split(const std::string& list)
+		{
+			std::vector<std::string> items;
+			size_t start = 0;
+			while (start <= list.size())
+			{
+				size_t comma = std::min(list.find(',', start), list.size());
+				if (comma > start)
+				{
+					items.push_back(list.substr(start, comma - start));
+				}
+				start = comma + 1;
+			}
+			return items;
+		}
+
+		/// @brief Read a list of level names such as debug,info or all
+		static bool parseLevels(const std::string& list, int& levels)
+		{
+			levels = 0;
+			for (const std::string& name : split(list))
+			{
+				int found = name == "all" ? ALL_LEVELS : 0;
+				for (size_t i = 0; i < LEVEL_COUNT && found == 0; ++i)
+				{
+					if (name == Event::levelName((LEVELS)(1 << i)))
+					{
+						found = 1 << i;
+					}
+				}
+				if (found == 0)
+				{
+					return false;
+				}
+				levels |= found;
+			}
+			return levels != 0;
+		}
+
+		/// @brief The radix tree of source prefixes, the first branch is the empty prefix
+		std::vector<Branch> tree;
+
+		/// @brief Text of the labels of the tree
+		std::string labels;
+
+		/// @brief The rules of each level, by levelIndex
+		std::array<uint64_t, LEVEL_COUNT> byLevel{};
+
+		/// @brief The rules that don't list any codes
+		uint64_t anyCode = 0;
+
+		/// @brief The rules that let events through
+		uint64_t allowed = 0;
+
+		/// @brief The rules of each code listed
+		std::vector<CodeSlot> codeTable;
+
+		/// @brief Answers for each call site, 0 until the site is first matched
+		std::unique_ptr<std::atomic<uint8_t>[]> siteAnswers;
+	};
+
+	class Log;
+
+	/// @brief Possible destinations that events can be sent to
+	class Stream
+	{
+		friend class Log;
+		friend class StreamWorker;
+		friend class SamplingStream;
+
+	public:
+		/// @brief Default constructor
+		Stream() : levels(ALL_LEVELS) {}
+
+		/// @brief Destructor
+		virtual ~Stream() = default;
+
+		/// @brief Change the event levels to listen to
+		/// @param levels 
+		void setLevels(int levels)
+		{
+			this->levels = levels;
+			++configVersion; // tell the logger to rebuild its dispatch table
+		}
+
+		/// @brief Get the event levels being listened to
+		/// @return the levels combined as flags
+		int getLevels() const
+		{
+			return levels;
+		}
+
+		/// @brief Choose which thread hands the stream its events, and how many can wait for it
+		/// Like setLevels it takes effect the next time an event is logged. Events are shared between the worker streams rather than
+		/// copied for each one, so a stream on a worker must not change the events it is given
+		/// @param config the worker settings, the default WorkerConfig hands events over directly
+		void setWorker(const WorkerConfig& config)
+		{
+			{
+				std::lock_guard<std::mutex> lock(configLock);
+				worker = config;
+			}
+			++configVersion;
+		}
+
+		/// @brief Get the worker settings
+		/// @return the settings last given to setWorker
+		WorkerConfig getWorker() const
+		{
+			std::lock_guard<std::mutex> lock(configLock);
+			return worker;
+		}
+
+		/// @brief Hold back or let through events by their source and code, on top of the levels
+		/// The rules are compiled once here, and like setLevels they take effect the next time an event is logged.
+		/// Events that no stream would let through are dropped before they are created. See FilterRule for how rules match
+		/// @param rules the rules in the order they are tried, an empty list removes the filter
+		void setFilter(const std::vector<FilterRule>& rules)
+		{
+			std::shared_ptr<const EventFilter> compiled;
+			if (!rules.empty())
+			{
+				compiled = std::make_shared<const EventFilter>(rules);
+			}
+			{
+				std::lock_guard<std::mutex> lock(configLock);
+				filter = std::move(compiled);
+			}
+			++configVersion;
+		}
+
+		/// @brief Get the compiled filter
+		/// @return the filter, nullptr if the stream has no filter rules
+		std::shared_ptr<const EventFilter> getFilter() const
+		{
+			std::lock_guard<std::mutex> lock(configLock);
+			return filter;
+		}
+
+		/// @brief Changes every time any stream's configuration changes
+		/// @return the current version
+		static unsigned getConfigVersion()
+		{
+			return configVersion.load(std::memory_order_acquire);
+		}
+
+		/// @brief Alert this stream of a new event
+		/// Check if the event is of a level that is being monitored and gets through the filter, and handle it if it does
+		/// @param event the new event to handle
+		void call(Event& event)
+		{
+			//TODO: skip debug events if not debugging
+
+			std::shared_ptr<const EventFilter> rules = getFilter();
+			if ((levels & event.level) == event.level && (!rules || rules->allows(event)))
+			{
+				handle(event);
+			}
+		}
+
+		/// @brief 
+		/// @param event The new event to handle
+		virtual void handle(Event& event) = 0;
+
+		/// @brief Handle several events at once, the logger delivers batches in asynchronous mode
+		/// Every event is of a level the stream listens to. The default calls handle() for each one,
+		/// override it when a stream can do the work for the whole batch in one go
+		/// @param events the events in the order they were logged
+		virtual void handleBatch(EventSpan events)
+		{
+			for (Event& event : events)
+			{
+				handle(event);
+			}
+		}
+
+		/// @brief Write out anything the stream is holding back
+		/// Called by Log::flush(), streams that don't buffer can ignore it
+		virtual void flush() {}
+
+		/// @brief Number of bytes the stream has written out, reported in StreamStats
+		/// @return the count, 0 for streams that don't keep one
+		virtual uint64_t getBytesWritten() const
+		{
+			return 0;
+		}
+
+		/// @brief Called before fork() when LogConfig::handleFork is set, after the stream has been flushed and while no events are handled
+		/// Streams that run a thread of their own stop it here, as the child would have no copy of it
+		virtual void beforeFork() {}
+
+		/// @brief Called after fork() in both processes, starts the threads stopped by beforeFork again
+		/// @param child true in the new process
+		virtual void afterFork(bool) {}
+
+	protected:
+		/// @brief Hold off the logger's calls to handle() and flush(), for settings that another thread changes while events arrive
+		/// The lock is recursive, so handle() can change settings as well
+		/// @return the lock, released when it goes out of scope
+		std::unique_lock<std::recursive_mutex> holdHandling()
+		{
+			return std::unique_lock<std::recursive_mutex>(handleLock);
+		}
+
+	private:
+		/// @brief Hand an event to handle(), one thread at a time
+		/// @param event the event to handle
+		/// @param timed whether to add the time the call took to the counters
+		void deliver(Event& event, bool timed)
+		{
+			std::lock_guard<std::recursive_mutex> guard(handleLock);
+			if (!timed)
+			{
+				handle(event);
+				counters.add(counters.delivered, 1);
+				return;
+			}
+			auto start = std::chrono::steady_clock::now();
+			handle(event);
+			counters.timed(start, 1);
+		}
+
+		/// @brief Hand a batch to handleBatch(), one thread at a time
+		/// @param events the events to handle
+		/// @param timed whether to add the time the call took to the counters
+		void deliverBatch(EventSpan events, bool timed)
+		{
+			std::lock_guard<std::recursive_mutex> guard(handleLock);
+			if (!timed)
+			{
+				handleBatch(events);
+				counters.add(counters.delivered, events.size());
+				return;
+			}
+			auto start = std::chrono::steady_clock::now();
+			handleBatch(events);
+			counters.timed(start, events.size());
+		}
+
+		/// @brief Hand events shared with other streams to handle(), one thread at a time
+		/// @param events the events to handle
+		/// @param count number of events
+		/// @param timed whether to add the time the calls took to the counters
+		void deliverShared(const std::shared_ptr<const Event>* events, size_t count, bool timed)
+		{
+			std::lock_guard<std::recursive_mutex> guard(handleLock);
+			std::chrono::steady_clock::time_point start;
+			if (timed)
+			{
+				start = std::chrono::steady_clock::now();
+			}
+			for (size_t i = 0; i < count; ++i)
+			{
+				handle(const_cast<Event&>(*events[i])); // see setWorker, the event is never changed
+			}
+			if (timed)
+			{
+				counters.timed(start, count);
+			}
+			else
+			{
+				counters.add(counters.delivered, count);
+			}
+		}
+
+		/// @brief Hand the logger's own stats event to handle() without counting it
+		void deliverStats(Event& event)
+		{
+			std::lock_guard<std::recursive_mutex> guard(handleLock);
+			handle(event);
+		}
+
+		/// @brief Copy the counters into the stats of the stream
+		/// @param out [out] receives the counters
+		void readCounters(StreamStats& out) const
+		{
+			out.delivered = counters.delivered.load(std::memory_order_relaxed);
+			out.handleCalls = counters.calls.load(std::memory_order_relaxed);
+			out.handleNsTotal = counters.nsTotal.load(std::memory_order_relaxed);
+			out.handleNsMax = counters.nsMax.load(std::memory_order_relaxed);
+			for (size_t i = 0; i < out.handleNsHistogram.size(); ++i)
+			{
+				out.handleNsHistogram[i] = counters.histogram[i].load(std::memory_order_relaxed);
+			}
+			out.bytesWritten = getBytesWritten();
+		}
+
+		/// @brief Start counting again, when the stream is registered
+		void resetCounters()
+		{
+			std::lock_guard<std::recursive_mutex> guard(handleLock);
+			counters.reset();
+		}
+
+		/// @brief Call flush() while no events are being handled
+		void deliverFlush()
+		{
+			std::lock_guard<std::recursive_mutex> guard(handleLock);
+			flush();
+		}
+
+		/// @brief Call flush() unless another thread is handling events
+		/// @return false if the stream was busy and wasn't flushed
+		bool tryDeliverFlush()
+		{
+			std::unique_lock<std::recursive_mutex> guard(handleLock, std::try_to_lock);
+			if (!guard)
+			{
+				return false;
+			}
+			flush();
+			return true;
+		}
+
+		/// @brief Call beforeFork() while no events are being handled
+		/// The lock isn't held across the fork, as the child can't unlock a recursive mutex that the parent locked
+		void pauseForFork()
+		{
+			std::lock_guard<std::recursive_mutex> guard(handleLock);
+			beforeFork();
+		}
+
+		/// @brief Call afterFork() while no events are being handled
+		/// @param child true in the new process
+		void resumeAfterFork(bool child)
+		{
+			std::lock_guard<std::recursive_mutex> guard(handleLock);
+			afterFork(child);
+		}
+
+		/// @brief Makes the logger call handle() from one thread at a time, recursive so that streams can log events of their own
+		std::recursive_mutex handleLock;
+
+		/// @brief What the logger counts while delivering to the stream, only changed while handleLock is held
+		struct Counters
+		{
+			/// @brief Add to a counter, there is only ever one writer
+			static void add(std::atomic<uint64_t>& counter, uint64_t amount)
+			{
+				counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+			}
+
+			/// @brief Count a call that started at the given time
+			void timed(std::chrono::steady_clock::time_point start, size_t events)
+			{
+				uint64_t ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+				add(delivered, events);
+				add(calls, 1);
+				add(nsTotal, ns);
+				if (ns > nsMax.load(std::memory_order_relaxed))
+				{
+					nsMax.store(ns, std::memory_order_relaxed);
+				}
+				size_t bucket = 0;
+				for (uint64_t limit = 64; ns >= limit && bucket + 1 < histogram.size(); limit <<= 1)
+				{
+					++bucket;
+				}
+				add(histogram[bucket], 1);
+			}
+
+			/// @brief Set everything back to zero
+			void reset()
+			{
+				delivered = 0;
+				calls = 0;
+				nsTotal = 0;
+				nsMax = 0;
+				for (auto& bucket : histogram)
+				{
+					bucket = 0;
+				}
+			}
+
+			std::atomic<uint64_t> delivered = 0;
+			std::atomic<uint64_t> calls = 0;
+			std::atomic<uint64_t> nsTotal = 0;
+			std::atomic<uint64_t> nsMax = 0;
+			std::array<std::atomic<uint64_t>, 20> histogram{};
+		} counters;
+
+		/// @brief the types of events that this handler is listening for
+		std::atomic<int> levels;
+
+		/// @brief Which thread handles the events, guarded by configLock
+		WorkerConfig worker;
+
+		/// @brief The compiled filter rules, nullptr if there are none, guarded by configLock
+		std::shared_ptr<const EventFilter> filter;
+
+		/// @brief Guards the worker settings and the filter
+		mutable std::mutex configLock;
+
+		/// @brief Incremented when any stream's levels change
+		inline static std::atomic<unsigned> configVersion = 0;
+	};
+
+
+	/// @brief A file that stays open and collects writes in memory until it is flushed
+	class BufferedFile
+	{
+	public:
+		/// @brief Constructor, the file is opened on the first flush
+		/// @param fileName name of the file to append to
+		/// @param bufferSize number of bytes to collect before writing them to the file
+		BufferedFile(const std::string& fileName, size_t bufferSize) : name(fileName), capacity(bufferSize)
+		{
+			buffer.reserve(capacity);
+			stored = sizeOnDisk();
+		}
+
+		/// @brief Destructor, writes out anything still in the buffer
+		~BufferedFile()
+		{
+			close();
+		}
+
+		/// @brief Add data to the buffer, writing the buffer out first if there is not enough room
+		/// @param data bytes to write
+		/// @param size number of bytes
+		void write(const char* data, size_t size)
+		{
+			if (buffer.size() + size > capacity)
+			{
+				flush();
+			}
+			buffer.append(data, size);
+			if (buffer.size() >= capacity)
+			{
+				flush();
+			}
+		}
+
+		/// @brief Write everything in the buffer to the file
+		/// If the file can't be opened the buffered data is discarded
+		void flush()
+		{
+			if (buffer.empty())
+			{
+				return;
+			}
+			if (!file.is_open())
+			{
+				// let our buffer be the only one, so each flush is a single write
+				file.rdbuf()->pubsetbuf(nullptr, 0);
+				file.open(name, std::ios::out | std::ios::app | std::ios::binary);
+			}
+			if (file.is_open())
+			{
+				file.write(buffer.data(), buffer.size());
+				file.flush();
+				stored += buffer.size();
+				total.store(total.load(std::memory_order_relaxed) + buffer.size(), std::memory_order_relaxed);
+			}
+			buffer.clear();
+		}
+
+		/// @brief Direct access to the buffer, so data can be formatted straight into it
+		/// Call written() afterwards so the buffer is written out once it is full
+		/// @return the buffer
+		std::string& getBuffer()
+		{
+			return buffer;
+		}
+
+		/// @brief Write the buffer out if data added through getBuffer() has filled it
+		void written()
+		{
+			if (buffer.size() >= capacity)
+			{
+				flush();
+			}
+		}
+
+		/// @brief Flush the buffer and close the file
+		void close()
+		{
+			flush();
+			if (file.is_open())
+			{
+				file.close();
+			}
+			file.clear();
+		}
+
+		/// @brief Flush and close the current file, future writes go to the new one
+		/// @param fileName name of the new file
+		void setName(const std::string& fileName)
+		{
+			close();
+			name = fileName;
+			stored = sizeOnDisk();
+		}
+
+		/// @brief Flush and close the file and give it a new name, future writes start a new file with the old name
+		/// @param newName what to call the current file
+		/// @return false if the file could not be renamed
+		bool moveTo(const std::string& newName)
+		{
+			close();
+			std::remove(newName.c_str());
+			if (std::rename(name.c_str(), newName.c_str()) != 0)
+			{
+				return false;
+			}
+			stored = 0;
+			return true;
+		}
+
+		/// @brief Size of the file including the data still in the buffer
+		/// @return size in bytes
+		size_t size() const
+		{
+			return stored + buffer.size();
+		}
+
+		/// @brief Name of the file being written to
+		/// @return the file name
+		const std::string& getName() const
+		{
+			return name;
+		}
+
+		/// @brief Change how many bytes are collected before the buffer is written out
+		/// @param bufferSize the new size in bytes
+		void setBufferSize(size_t bufferSize)
+		{
+			capacity = bufferSize;
+			if (buffer.size() >= capacity)
+			{
+				flush();
+			}
+			buffer.reserve(capacity);
+		}
+
+		/// @brief Number of bytes waiting to be written
+		/// @return size of the buffered data
+		size_t pending() const
+		{
+			return buffer.size();
+		}
+
+		/// @brief Number of bytes written to disk since the object was made, across every file it opened
+		/// @return the count, safe to read from any thread
+		uint64_t written() const
+		{
+			return total.load(std::memory_order_relaxed);
+		}
+
+	private:
+		/// @brief Size of the file on disk, before it is opened
+		/// @return size in bytes, 0 if the file doesn't exist
+		size_t sizeOnDisk() const
+		{
+			std::ifstream existing(name, std::ios::binary | std::ios::ate);
+			return existing.is_open() ? (size_t)existing.tellg() : 0;
+		}
+
+		/// @brief Name of the file to write to
+		std::string name;
+
+		/// @brief The open file
+		std::ofstream file;
+
+		/// @brief Bytes in the file on disk
+		size_t stored = 0;
+
+		/// @brief Bytes written by flush()
+		std::atomic<uint64_t> total = 0;
+
+		/// @brief Data waiting to be written
+		std::string buffer;
+
+		/// @brief Number of bytes to collect before writing
+		size_t capacity;
+	};
+
+	/// @brief Background thread that numbers, compresses and deletes the old files of a rotating stream
+	class FileRotator
+	{
+	public:
+		/// @brief Constructor, starts the thread
+		/// @param fileName name of the file being rotated
+		/// @param config how many files to keep and how to compress them
+		FileRotator(const std::string& fileName, const RotationConfig& config)
+			: baseName(fileName), config(config)
+		{
+			worker = std::thread(&FileRotator::run, this);
+		}
+
+		/// @brief Copy constructor, not used
+		FileRotator(const FileRotator&) = delete;
+
+		/// @brief Destructor, finishes the files already handed over then stops the thread
+		~FileRotator()
+		{
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				stopping = true;
+			}
+			wake.notify_all();
+			worker.join();
+		}
+
+		/// @brief Finish the files already handed over and stop the thread, before fork()
+		void pause()
+		{
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				stopping = true;
+			}
+			wake.notify_all();
+			worker.join();
+			stopping = false;
+		}
+
+		/// @brief Start the thread stopped by pause()
+		void resume()
+		{
+			worker = std::thread(&FileRotator::run, this);
+		}
+
+		/// @brief Hand over a file that has just been rotated out
+		/// @param staged temporary name of the file
+		void add(const std::string& staged)
+		{
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				files.push_back(staged);
+			}
+			wake.notify_all();
+		}
+
+		/// @brief Wait until every file handed over has been dealt with
+		void wait()
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			done.wait(guard, [this] { return files.empty() && !busy; });
+		}
+
+		/// @brief Name of an old file
+		/// @param index 1 for the newest
+		/// @return the file name, without the compressed extension
+		std::string oldName(size_t index) const
+		{
+			return baseName + "." + std::to_string(index);
+		}
+
+	private:
+		/// @brief Main function of the thread
+		void run()
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			while (true)
+			{
+				wake.wait(guard, [this] { return !files.empty() || stopping; });
+				if (files.empty())
+				{
+					break;
+				}
+				std::string staged = std::move(files.front());
+				files.pop_front();
+				busy = true;
+				guard.unlock();
+				retire(staged);
+				guard.lock();
+				busy = false;
+				done.notify_all();
+			}
+		}
+
+		/// @brief Move the old files along one place and make the new one fileName.1
+		/// @param staged temporary name of the newest file
+		void retire(const std::string& staged)
+		{
+			if (config.keep == 0)
+			{
+				std::remove(staged.c_str());
+				return;
+			}
+			std::remove(oldName(config.keep).c_str());
+			std::remove((oldName(config.keep) + config.extension).c_str());
+			for (size_t index = config.keep - 1; index > 0; --index)
+			{
+				std::rename(oldName(index).c_str(), oldName(index + 1).c_str());
+				std::rename((oldName(index) + config.extension).c_str(), (oldName(index + 1) + config.extension).c_str());
+			}
+
+			std::string newest = oldName(1);
+			if (std::rename(staged.c_str(), newest.c_str()) != 0 || !config.compress)
+			{
+				return;
+			}
+			std::string compressed = newest + config.extension;
+			if (compress(newest, compressed))
+			{
+				std::remove(newest.c_str());
+			}
+			else
+			{
+				std::remove(compressed.c_str());
+			}
+		}
+
+		/// @brief Compress a file with the configured compressor, or gzip
+		/// @return false if the file was not compressed
+		bool compress(const std::string& from, const std::string& to)
+		{
+			if (config.compressor)
+			{
+				return config.compressor(from, to);
+			}
+#ifdef BOOM_USE_ZLIB
+			std::ifstream in(from, std::ios::binary);
+			gzFile out = gzopen(to.c_str(), "wb");
+			if (!in.is_open() || out == nullptr)
+			{
+				if (out != nullptr)
+				{
+					gzclose(out);
+				}
+				return false;
+			}
+			std::vector<char> chunk(64 * 1024);
+			bool ok = true;
+			while (ok)
+			{
+				in.read(chunk.data(), chunk.size());
+				int got = (int)in.gcount();
+				if (got <= 0)
+				{
+					break;
+				}
+				ok = gzwrite(out, chunk.data(), (unsigned)got) == got;
+			}
+			return gzclose(out) == Z_OK && ok;
+#else
+			return false;
+#endif
+		}
+
+		/// @brief Name of the file being rotated
+		std::string baseName;
+
+		/// @brief How many files to keep and how to compress them
+		RotationConfig config;
+
+		/// @brief Files waiting to be dealt with
+		std::deque<std::string> files;
+
+		/// @brief Whether a file is being dealt with right now
+		bool busy = false;
+
+		/// @brief Whether the thread should stop once the waiting files are done
+		bool stopping = false;
+
+		std::mutex lock;
+		std::condition_variable wake;
+		std::condition_variable done;
+		std::thread worker;
+	};
+
+	/// @brief Base for streams that write events to a file
+	/// The file is kept open and events are buffered, they are written out when the buffer is full,
+	/// when the flush interval has passed, when an event of a flush level arrives or when flush() is called
+	class FileStream : public Stream
+	{
+	public:
+		/// @brief Constructor
+		/// @param fileName Name of file to write events to
+		/// @param bufferSize number of bytes to collect before writing to the file
+		FileStream(const std::string& fileName, size_t bufferSize)
+			:file(fileName, bufferSize), lastFlush(std::chrono::steady_clock::now())
+		{}
+
+		/// @brief Write any buffered events to the file
+		virtual void flush()
+		{
+			file.flush();
+			lastFlush = std::chrono::steady_clock::now();
+		}
+
+		/// @brief Number of bytes written to the file, and to the files before it when the name changed or the file rotated
+		/// @return the count since the stream was created
+		virtual uint64_t getBytesWritten() const
+		{
+			return file.written();
+		}
+
+		/// @brief set a new filename for the stream to write to 
+		/// Buffered events are written to the old file first
+		/// @param filename new name of the log file
+		void setFilename(const std::string& filename)
+		{
+			auto holding = holdHandling();
+			file.setName(filename);
+			fileChanged();
+			if (rotator)
+			{
+				rotator = std::make_unique<FileRotator>(filename, rotation);
+			}
+		}
+
+		/// @brief Start new files by size or time, the old file is renamed and handed to a background thread
+		/// which numbers, compresses and deletes the old files
+		/// @param config when to rotate and what to do with old files
+		void setRotation(const RotationConfig& config)
+		{
+			auto holding = holdHandling();
+			rotator.reset();
+			rotation = config;
+			nextRotation = {};
+			if (rotation.maxSize > 0 || rotation.interval.count() > 0)
+			{
+				rotator = std::make_unique<FileRotator>(file.getName(), rotation);
+			}
+		}
+
+		/// @brief Start a new file now, whatever the rotation settings
+		void rotate()
+		{
+			auto holding = holdHandling();
+			if (!rotator)
+			{
+				rotator = std::make_unique<FileRotator>(file.getName(), rotation);
+			}
+			std::string staged = file.getName() + "." + std::to_string(++rotations) + ".rotating";
+			if (file.moveTo(staged))
+			{
+				rotator->add(staged);
+			}
+			fileChanged();
+		}
+
+		/// @brief Wait until the old files handed over by rotate() have been compressed and numbered
+		void waitForRotation()
+		{
+			if (rotator)
+			{
+				rotator->wait();
+			}
+		}
+
+		/// @brief Change how many bytes are collected before they are written to the file
+		/// @param bufferSize the new size in bytes, 0 writes every event straight away
+		void setBufferSize(size_t bufferSize)
+		{
+			auto holding = holdHandling();
+			file.setBufferSize(bufferSize);
+		}
+
+		/// @brief Write the buffer out when this much time has passed since the last write
+		/// The interval is checked when a new event arrives
+		/// @param interval the time between writes, 0 to only write when the buffer is full
+		void setFlushInterval(std::chrono::milliseconds interval)
+		{
+			auto holding = holdHandling();
+			flushInterval = interval;
+		}
+
+		/// @brief Choose which event levels are written to the file straight away
+		/// @param levels the levels to write immediately, default is ERR and CRITICAL
+		void setFlushLevels(int levels)
+		{
+			auto holding = holdHandling();
+			flushLevels = levels;
+		}
+
+		/// @brief Stop the rotation thread before fork()
+		virtual void beforeFork()
+		{
+			if (rotator)
+			{
+				rotator->pause();
+			}
+		}
+
+		/// @brief Start the rotation thread again after fork()
+		virtual void afterFork(bool)
+		{
+			if (rotator)
+			{
+				rotator->resume();
+			}
+		}
+
+	protected:
+		/// @brief Called after an event has been added to the buffer, flushes if the event or the time requires it
+		/// @param event the event that was just written
+		void written(const Event& event)
+		{
+			written((int)event.level);
+		}
+
+		/// @brief Called after a batch of events has been added to the buffer
+		/// @param levels the levels of all the events combined as flags
+		void written(int levels)
+		{
+			file.written();
+			if ((flushLevels & levels) != 0
+				|| (flushInterval.count() > 0 && std::chrono::steady_clock::now() - lastFlush >= flushInterval))
+			{
+				flush();
+			}
+		}
+
+		/// @brief Called before an event is written, rotates the file if it is full or its time is up
+		/// @param event the event about to be written
+		void rotateIfDue(const Event& event)
+		{
+			if (!rotator)
+			{
+				return;
+			}
+			if (rotation.interval.count() > 0)
+			{
+				bool due = nextRotation != std::chrono::time_point<std::chrono::system_clock>() && event.timestamp >= nextRotation;
+				if (due || nextRotation == std::chrono::time_point<std::chrono::system_clock>())
+				{
+					auto since = std::chrono::duration_cast<std::chrono::seconds>(event.timestamp.time_since_epoch());
+					auto next = (since / rotation.interval + 1) * rotation.interval;
+					nextRotation = std::chrono::time_point<std::chrono::system_clock>(
+						std::chrono::duration_cast<std::chrono::system_clock::duration>(next));
+				}
+				if (due)
+				{
+					rotate();
+					return;
+				}
+			}
+			if (rotation.maxSize > 0 && file.size() >= rotation.maxSize)
+			{
+				rotate();
+			}
+		}
+
+		/// @brief Called when the stream starts writing to a different file
+		virtual void fileChanged() {}
+
+		/// @brief The file to write to
+		BufferedFile file;
+
+	private:
+		/// @brief Event levels that cause the buffer to be written immediately
+		int flushLevels = LEVELS::ERR | LEVELS::CRITICAL;
+
+		/// @brief Maximum time between writes
+		std::chrono::milliseconds flushInterval{ 1000 };
+
+		/// @brief When the buffer was last written out
+		std::chrono::steady_clock::time_point lastFlush;
+
+		/// @brief When to start new files
+		RotationConfig rotation;
+
+		/// @brief Time of the next rotation on time, unset until the first event
+		std::chrono::time_point<std::chrono::system_clock> nextRotation;
+
+		/// @brief Number of rotations, keeps the temporary names unique
+		size_t rotations = 0;
+
+		/// @brief Deals with the old files, only created when rotation is used
+		std::unique_ptr<FileRotator> rotator;
+	};
+
+	/// @brief Stream that writes the events to a text file
+	class TextFileStream : public FileStream
+	{
+	public:
+		/// @brief Constructor
+		/// @param path Name of file to write events to, default is Log.txt
+		/// @param bufferSize number of bytes to collect before writing to the file, default is 64KB
+		TextFileStream(const std::string& fileName = "Log.txt", size_t bufferSize = 64 * 1024) 
+			:FileStream(fileName, bufferSize)
+		{}
+
+		/// @brief Write the event to a text file
+		/// @param event to be written to file
+		virtual void handle(Event& event)
+		{
+			rotateIfDue(event);
+			event.formatTo(file.getBuffer());
+			written(event);
+		}
+
+		/// @brief Write a batch of events to the text file with a single write
+		/// @param events to be written to file
+		virtual void handleBatch(EventSpan events)
+		{
+			int levels = 0;
+			for (const Event& event : events)
+			{
+				rotateIfDue(event);
+				event.formatTo(file.getBuffer());
+				levels |= event.level;
+			}
+			written(levels);
+		}
+	};
+
+	/// @brief Helpers for writing JSON without a library
+	namespace json
+	{
+		/// @brief Add a string in quotes, escaping quotes, backslashes and control characters
+		/// Other bytes are copied as they are, so UTF-8 text stays UTF-8
+		inline void appendString(std::string& out, std::string_view text)
+		{
+			static const char hex[] = "0123456789abcdef";
+			out.push_back('"');
+			size_t start = 0;
+			for (size_t i = 0; i < text.size(); ++i)
+			{
+				unsigned char c = (unsigned char)text[i];
+				if (c >= 0x20 && c != '"' && c != '\\')
+				{
+					continue;
+				}
+				out.append(text.data() + start, i - start);
+				start = i + 1;
+				switch (c)
+				{
+				case '"': out.append("\\\"", 2); break;
+				case '\\': out.append("\\\\", 2); break;
+				case '\n': out.append("\\n", 2); break;
+				case '\r': out.append("\\r", 2); break;
+				case '\t': out.append("\\t", 2); break;
+				case '\b': out.append("\\b", 2); break;
+				case '\f': out.append("\\f", 2); break;
+				default:
+					char escaped[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF] };
+					out.append(escaped, sizeof(escaped));
+					break;
+				}
+			}
+			out.append(text.data() + start, text.size() - start);
+			out.push_back('"');
+		}
+
+		/// @brief Add a number, NaN and infinity become null as JSON has no value for them
+		inline void appendNumber(std::string& out, double value)
+		{
+			if (!std::isfinite(value))
+			{
+				out.append("null", 4);
+				return;
+			}
+			char text[64];
+			out.append(text, Fields::formatDouble(value, text, sizeof(text)));
+		}
+
+		/// @brief Add an integer
+		template <typename T>
+		void appendInteger(std::string& out, T value)
+		{
+			char text[24];
+			out.append(text, (size_t)(std::to_chars(text, text + sizeof(text), value).ptr - text));
+		}
+	}
+
+	/// @brief Stream that writes each event to a file as one JSON object per line
+	/// Lines look like {"ts":"2024-01-31T12:00:00.000000Z","level":"info","msg":"...","source":"...","code":"...","fields":{...}}.
+	/// The source, code and fields are left out when they are empty, and file and line are added for events from a call site
+	class JsonLinesStream : public FileStream
+	{
+	public:
+		/// @brief Constructor
+		/// @param fileName name of file to write events to, default is Log.jsonl
+		/// @param bufferSize number of bytes to collect before writing to the file, default is 64KB
+		JsonLinesStream(const std::string& fileName = "Log.jsonl", size_t bufferSize = 64 * 1024)
+			:FileStream(fileName, bufferSize)
+		{}
+
+		/// @brief Write the event as a line of JSON
+		/// @param event to be written to file
+		virtual void handle(Event& event)
+		{
+			rotateIfDue(event);
+			format(event, file.getBuffer());
+			written(event);
+		}
+
+		/// @brief Write a batch of events with a single write
+		/// @param events to be written to file
+		virtual void handleBatch(EventSpan events)
+		{
+			int levels = 0;
+			for (const Event& event : events)
+			{
+				rotateIfDue(event);
+				format(event, file.getBuffer());
+				levels |= event.level;
+			}
+			written(levels);
+		}
+
+		/// @brief Add an event as a line of JSON, ending with a new line
+		/// @param event the event to write
+		/// @param out buffer to add to
+		void format(const Event& event, std::string& out)
+		{
+			out.append("{\"ts\":\"", 7);
+			appendTimestamp(event.timestamp, out);
+			out.append("\",\"level\":\"", 11);
+			out.append(Event::levelName(event.level));
+			out.append("\",\"msg\":", 8);
+			if (event.args)
+			{
+				std::string message;
+				event.args->format(event.msg.view(), message);
+				json::appendString(out, message);
+			}
+			else
+			{
+				json::appendString(out, event.msg.view());
+			}
+			std::string_view source = event.getSource();
+			if (!source.empty())
+			{
+				out.append(",\"source\":", 10);
+				json::appendString(out, source);
+			}
+			std::string_view code = event.getCode();
+			if (!code.empty())
+			{
+				out.append(",\"code\":", 8);
+				json::appendString(out, code);
+			}
+			const CallSite* site = event.getCallSite();
+			if (site != nullptr)
+			{
+				out.append(",\"file\":", 8);
+				json::appendString(out, site->getFile());
+				out.append(",\"line\":", 8);
+				json::appendInteger(out, site->getLine());
+			}
+			if (!event.fields.empty())
+			{
+				out.append(",\"fields\":{", 11);
+				for (size_t i = 0; i < event.fields.size(); ++i)
+				{
+					Field field = event.fields[i];
+					if (i > 0)
+					{
+						out.push_back(',');
+					}
+					json::appendString(out, field.key);
+					out.push_back(':');
+					switch (field.type)
+					{
+					case FIELD_INT: json::appendInteger(out, field.integer); break;
+					case FIELD_UINT: json::appendInteger(out, field.unsignedInteger); break;
+					case FIELD_DOUBLE: json::appendNumber(out, field.number); break;
+					case FIELD_BOOL: out.append(field.flag ? "true" : "false"); break;
+					case FIELD_STRING: json::appendString(out, field.text); break;
+					}
+				}
+				out.push_back('}');
+			}
+			out.append("}\n", 2);
+		}
+
+	private:
+		/// @brief Add the time in UTC with microseconds, the date and time of day are only worked out once per second
+		void appendTimestamp(std::chrono::time_point<std::chrono::system_clock> timestamp, std::string& out)
+		{
+			auto second = std::chrono::floor<std::chrono::seconds>(timestamp);
+			time_t seconds = std::chrono::system_clock::to_time_t(second);
+			if (seconds != cachedSecond)
+			{
+				tm utc{};
+#ifdef _WIN32
+				gmtime_s(&utc, &seconds);
+#else
+				gmtime_r(&seconds, &utc);
+#endif
+				int size = std::snprintf(cachedText, sizeof(cachedText), "%04d-%02d-%02dT%02d:%02d:%02d.",
+					utc.tm_year + 1900, utc.tm_mon + 1, utc.tm_mday, utc.tm_hour, utc.tm_min, utc.tm_sec);
+				cachedSize = size > 0 ? (size_t)size : 0;
+				cachedSecond = seconds;
+			}
+			out.append(cachedText, cachedSize);
+			long micros = (long)std::chrono::duration_cast<std::chrono::microseconds>(timestamp - second).count();
+			char digits[8] = { '0', '0', '0', '0', '0', '0', 'Z' };
+			for (int i = 5; i >= 0; --i, micros /= 10)
+			{
+				digits[i] = (char)('0' + micros % 10);
+			}
+			out.append(digits, 7);
+		}
+
+		/// @brief The second the cached date and time are for
+		time_t cachedSecond = (time_t)-1;
+
+		/// @brief Date and time of day of cachedSecond, up to and including the decimal point
+		char cachedText[32] = {};
+
+		/// @brief Length of cachedText
+		size_t cachedSize = 0;
+	};
+
+	/// @brief A file of fixed size that is mapped into memory
+	/// Data copied into the mapping reaches the file without any write calls
+	class MappedFile
+	{
+	public:
+		/// @brief Constructor, call open() to map a file
+		MappedFile() = default;
+
+		/// @brief Copy constructor, not used
+		MappedFile(const MappedFile&) = delete;
+
+		/// @brief Destructor, unmaps the file keeping all of its data
+		~MappedFile()
+		{
+			close(size);
+		}
+
+		/// @brief Create or open a file, make it the given size and map it
+		/// @param fileName the file to map
+		/// @param fileSize size of the mapping in bytes
+		/// @param existing [out] size of the file before it was opened
+		/// @return false if the file could not be mapped
+		bool open(const std::string& fileName, size_t fileSize, size_t& existing)
+		{
+			close(size);
+			existing = 0;
+#ifdef _WIN32
+			file = CreateFileA(fileName.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file == INVALID_HANDLE_VALUE)
+			{
+				return false;
+			}
+			LARGE_INTEGER current;
+			if (GetFileSizeEx(file, &current))
+			{
+				existing = (size_t)current.QuadPart;
+			}
+			if (existing < fileSize && !resize(fileSize))
+			{
+				close(existing);
+				return false;
+			}
+			LARGE_INTEGER mapped;
+			mapped.QuadPart = (LONGLONG)fileSize;
+			mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, mapped.HighPart, mapped.LowPart, nullptr);
+			if (mapping != nullptr)
+			{
+				data = (char*)MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, fileSize);
+			}
+#else
+			fd = ::open(fileName.c_str(), O_RDWR | O_CREAT, 0644);
+			if (fd < 0)
+			{
+				return false;
+			}
+			struct stat info;
+			if (fstat(fd, &info) == 0)
+			{
+				existing = (size_t)info.st_size;
+			}
+			if (existing < fileSize && !resize(fileSize))
+			{
+				close(existing);
+				return false;
+			}
+			void* mapped = mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			data = mapped == MAP_FAILED ? nullptr : (char*)mapped;
+#endif
+			if (data == nullptr)
+			{
+				close(existing);
+				return false;
+			}
+			size = fileSize;
+			return true;
+		}
+
+		/// @brief Write part of the mapping to the file
+		/// @param offset start of the range
+		/// @param length number of bytes
+		/// @param wait whether to wait until the data is on disk
+		void sync(size_t offset, size_t length, bool wait)
+		{
+			if (data == nullptr || length == 0)
+			{
+				return;
+			}
+#ifdef _WIN32
+			FlushViewOfFile(data + offset, length);
+			if (wait)
+			{
+				FlushFileBuffers(file);
+			}
+#else
+			// msync needs the start of the range on a page boundary
+			static const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+			size_t start = offset - offset % page;
+			msync(data + start, length + (offset - start), wait ? MS_SYNC : MS_ASYNC);
+#endif
+		}
+
+		/// @brief Unmap and close the file, cutting it down to the bytes that were used
+		/// @param used number of bytes with data in them
+		void close(size_t used)
+		{
+#ifdef _WIN32
+			if (data != nullptr)
+			{
+				FlushViewOfFile(data, used);
+				UnmapViewOfFile(data);
+			}
+			if (mapping != nullptr)
+			{
+				CloseHandle(mapping);
+			}
+			if (file != INVALID_HANDLE_VALUE)
+			{
+				resize(used);
+				CloseHandle(file);
+			}
+			file = INVALID_HANDLE_VALUE;
+			mapping = nullptr;
+#else
+			if (data != nullptr)
+			{
+				munmap(data, size);
+			}
+			if (fd >= 0)
+			{
+				resize(used);
+				::close(fd);
+			}
+			fd = -1;
+#endif
+			data = nullptr;
+			size = 0;
+		}
+
+		/// @brief Access the mapped memory
+		/// @return the start of the mapping, nullptr if nothing is mapped
+		char* getData() const
+		{
+			return data;
+		}
+
+		/// @brief Size of the mapping
+		/// @return size in bytes
+		size_t getSize() const
+		{
+			return size;
+		}
+
+	private:
+		/// @brief Change the size of the open file
+		/// @param newSize the size in bytes
+		/// @return false if the size could not be changed
+		bool resize(size_t newSize)
+		{
+#ifdef _WIN32
+			LARGE_INTEGER position;
+			position.QuadPart = (LONGLONG)newSize;
+			return SetFilePointerEx(file, position, nullptr, FILE_BEGIN) && SetEndOfFile(file);
+#else
+			return ftruncate(fd, (off_t)newSize) == 0;
+#endif
+		}
+
+#ifdef _WIN32
+		HANDLE file = INVALID_HANDLE_VALUE;
+		HANDLE mapping = nullptr;
+#else
+		int fd = -1;
+#endif
+
+		/// @brief The mapped memory
+		char* data = nullptr;
+
+		/// @brief Size of the mapping
+		size_t size = 0;
+	};
+
+	/// @brief Stream that copies events straight into a memory mapped file
+	/// Each segment file is created at full size and mapped, so writing an event is a copy with no system call.
+	/// When a segment is full the stream moves on to the next one, named fileName.1, fileName.2 and so on.
+	/// Dirty pages are written out by a background thread at a regular interval, and straight away for sync levels.
+	class MappedFileStream : public Stream
+	{
+	public:
+		/// @brief Constructor
+		/// @param fileName name of the first segment, default is log.txt
+		/// @param segmentSize size of each segment file, default is 16MB
+		/// @param syncInterval time between background syncs, 0 to leave it to the operating system
+		MappedFileStream(const std::string& fileName = "log.txt", size_t segmentSize = 16 * 1024 * 1024,
+			std::chrono::milliseconds syncInterval = std::chrono::milliseconds(1000))
+			: baseName(fileName), segmentSize(segmentSize > 0 ? segmentSize : 1), interval(syncInterval)
+		{
+			openSegment(0);
+			if (interval.count() > 0)
+			{
+				syncer = std::thread(&MappedFileStream::syncLoop, this);
+			}
+		}
+
+		/// @brief Copy constructor, not used
+		MappedFileStream(const MappedFileStream&) = delete;
+
+		/// @brief Destructor, syncs and closes the current segment
+		~MappedFileStream()
+		{
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				stopping = true;
+			}
+			wake.notify_all();
+			if (syncer.joinable())
+			{
+				syncer.join();
+			}
+			std::lock_guard<std::mutex> guard(lock);
+			file.close(cursor);
+		}
+
+		/// @brief Copy the event's text into the mapping
+		/// @param event to be written
+		virtual void handle(Event& event)
+		{
+			line.clear();
+			event.formatTo(line);
+			size_t length = line.size() < segmentSize ? line.size() : segmentSize;
+
+			// handle() is only called by one thread at a time, the sync thread only reads the written mark
+			if (cursor + length > segmentSize)
+			{
+				// this segment is full, move on to the next one with room for the event
+				std::lock_guard<std::mutex> guard(lock);
+				do
+				{
+					openSegment(segment + 1);
+				} while (file.getData() != nullptr && cursor + length > segmentSize);
+			}
+
+			if (file.getData() == nullptr)
+			{
+				return; // the file couldn't be mapped, the event is lost
+			}
+			size_t at = cursor;
+			std::memcpy(file.getData() + at, line.data(), length);
+			cursor = at + length;
+			written.store(cursor, std::memory_order_release);
+
+			if ((syncLevels & event.level) == event.level)
+			{
+				// the sync thread may have started an asynchronous sync of this event, it still has to wait for it here
+				std::lock_guard<std::mutex> guard(lock);
+				size_t from = synced < at ? synced : at;
+				file.sync(from, cursor - from, true);
+				synced = cursor;
+			}
+		}
+
+		/// @brief Wait until everything written so far is on disk
+		virtual void flush()
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			file.sync(0, cursor, true);
+			synced = cursor;
+		}
+
+		/// @brief Stop the sync thread before fork()
+		virtual void beforeFork()
+		{
+			if (!syncer.joinable())
+			{
+				return;
+			}
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				stopping = true;
+			}
+			wake.notify_all();
+			syncer.join();
+			stopping = false;
+		}
+
+		/// @brief Start the sync thread again after fork()
+		virtual void afterFork(bool)
+		{
+			if (interval.count() > 0)
+			{
+				syncer = std::thread(&MappedFileStream::syncLoop, this);
+			}
+		}
+
+		/// @brief Choose which event levels are synced to disk as soon as they are written
+		/// @param levels the levels to sync immediately, default is CRITICAL
+		void setSyncLevels(int levels)
+		{
+			syncLevels = levels;
+		}
+
+		/// @brief Name of the segment currently being written
+		/// @return the file name
+		std::string getFilename()
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			return segmentName(segment);
+		}
+
+	private:
+		/// @brief Name of a segment file
+		/// @param index the segment number
+		/// @return the file name
+		std::string segmentName(size_t index) const
+		{
+			return index == 0 ? baseName : baseName + "." + std::to_string(index);
+		}
+
+		/// @brief Close the current segment and map the next one with room left, must be called with lock held
+		/// @param index the first segment to try
+		void openSegment(size_t index)
+		{
+			if (file.getData() != nullptr)
+			{
+				file.close(cursor);
+			}
+
+			// continue after the data of earlier runs, skipping segments that are already full
+			size_t existing = 0;
+			bool mapped = false;
+			for (segment = index; segment < index + 1000; ++segment)
+			{
+				mapped = file.open(segmentName(segment), segmentSize, existing);
+				if (!mapped || existing < segmentSize)
+				{
+					break;
+				}
+				file.close(existing);
+			}
+			cursor = mapped ? existing : 0;
+			synced = cursor;
+			written.store(cursor, std::memory_order_release);
+		}
+
+		/// @brief Main function of the background sync thread
+		void syncLoop()
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			while (!stopping)
+			{
+				wake.wait_for(guard, interval);
+				size_t used = written.load(std::memory_order_acquire);
+				if (used > synced)
+				{
+					file.sync(synced, used - synced, false);
+					synced = used;
+				}
+			}
+		}
+
+		/// @brief Name of the first segment
+		std::string baseName;
+
+		/// @brief Size of each segment
+		size_t segmentSize;
+
+		/// @brief Time between background syncs
+		std::chrono::milliseconds interval;
+
+		/// @brief The mapping of the current segment
+		MappedFile file;
+
+		/// @brief Number of the current segment
+		size_t segment = 0;
+
+		/// @brief Where the next event goes in the current segment
+		size_t cursor = 0;
+
+		/// @brief End of the events that have been copied in, what the sync thread may write out
+		std::atomic<size_t> written = 0;
+
+		/// @brief Everything before this offset has been synced
+		size_t synced = 0;
+
+		/// @brief Event levels that are synced straight away
+		int syncLevels = LEVELS::CRITICAL;
+
+		/// @brief Reused for the text of each event
+		std::string line;
+
+		/// @brief Guards the mapping while it is synced or replaced
+		std::mutex lock;
+
+		/// @brief Wakes the sync thread when the stream is destroyed
+		std::condition_variable wake;
+
+		/// @brief Whether the sync thread should stop
+		bool stopping = false;
+
+		/// @brief The background sync thread
+		std::thread syncer;
+	};
+
+	/// @brief Stream that outputs the events to the console
+	class ConsoleStream : public Stream
+	{
+	public:
+		/// @brief Send the event to be displayed on a console
+		/// @param event to be sent to console
+		virtual void handle(Event& event)
+		{
+			line.clear();
+			event.formatTo(line);
+			std::cout.write(line.data(), line.size());
+		}
+
+		/// @brief Send a batch of events to the console with a single write
+		/// @param events to be sent to console
+		virtual void handleBatch(EventSpan events)
+		{
+			line.clear();
+			for (const Event& event : events)
+			{
+				event.formatTo(line);
+			}
+			std::cout.write(line.data(), line.size());
+		}
+
+	private:
+		/// @brief Reused for the text of each event
+		std::string line;
+	};
+
+	/// @brief Stream that writes events to the console in batches, without going through iostreams
+	/// Lines are collected in a buffer that is written with one system call when it is full, when an event of a flush level
+	/// arrives, when the flush interval has passed or when flush() is called.
+	/// If the console can't keep up (for example a pipe nobody is reading) new events are dropped and counted instead of
+	/// blocking the logging thread, and a note of how many were lost is written once the console catches up.
+	class BufferedConsoleStream : public Stream
+	{
+	public:
+#ifdef _WIN32
+		using Output = HANDLE;
+#else
+		using Output = int;
+#endif
+
+		/// @brief Standard output, or standard error
+		/// @param error whether to use standard error
+		/// @return the console to write to
+		static Output standardOutput(bool error = false)
+		{
+#ifdef _WIN32
+			return GetStdHandle(error ? STD_ERROR_HANDLE : STD_OUTPUT_HANDLE);
+#else
+			return error ? STDERR_FILENO : STDOUT_FILENO;
+#endif
+		}
+
+		/// @brief Constructor
+		/// @param output where to write, default is standard output
+		/// @param bufferSize number of bytes to collect before writing, default is 64KB
+		BufferedConsoleStream(Output output = standardOutput(), size_t bufferSize = 64 * 1024)
+			: output(output), capacity(bufferSize > 0 ? bufferSize : 1), lastFlush(std::chrono::steady_clock::now())
+		{
+			buffer.reserve(capacity);
+#ifndef _WIN32
+			struct stat info;
+			slowOutput = fstat(output, &info) == 0 && (S_ISFIFO(info.st_mode) || S_ISSOCK(info.st_mode));
+#endif
+			setColor(LEVELS::DBG, "\x1b[90m");
+			setColor(LEVELS::INFO, "");
+			setColor(LEVELS::WARNING, "\x1b[33m");
+			setColor(LEVELS::ERR, "\x1b[31m");
+			setColor(LEVELS::CRITICAL, "\x1b[1;31m");
+		}
+
+		/// @brief Destructor, writes what the console will take
+		~BufferedConsoleStream()
+		{
+			writeOut();
+		}
+
+		/// @brief Add the event to the buffer
+		/// @param event to be sent to console
+		virtual void handle(Event& event)
+		{
+			if (buffer.size() >= capacity)
+			{
+				writeOut();
+				if (buffer.size() >= capacity && dropWhenBehind)
+				{
+					dropped.fetch_add(1, std::memory_order_relaxed);
+					++unreported;
+					return;
+				}
+			}
+			if (unreported > 0)
+			{
+				Event note(LEVELS::WARNING, std::to_string(unreported) + " console events dropped");
+				unreported = 0;
+				append(note);
+			}
+			append(event);
+
+			if (buffer.size() >= capacity || (flushLevels & event.level) == event.level
+				|| (flushInterval.count() > 0 && std::chrono::steady_clock::now() - lastFlush >= flushInterval))
+			{
+				writeOut();
+			}
+		}
+
+		/// @brief Write the buffer to the console
+		virtual void flush()
+		{
+			writeOut();
+		}
+
+		/// @brief Turn the level colors on or off, they are off by default
+		/// @param enabled whether to add ANSI color codes around each event
+		void setColors(bool enabled)
+		{
+			colors = enabled;
+#ifdef _WIN32
+			DWORD mode = 0;
+			if (enabled && GetConsoleMode(output, &mode))
+			{
+				SetConsoleMode(output, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+			}
+#endif
+		}
+
+		/// @brief Change the ANSI code written before events of a level
+		/// @param level the level to change
+		/// @param code the escape sequence, empty for the console's default color
+		void setColor(LEVELS level, const std::string& code)
+		{
+			colorCodes[levelIndex(level)] = code;
+		}
+
+		/// @brief Choose what happens when the console can't keep up
+		/// @param drop true to drop new events (the default), false to wait for the console
+		void setDropWhenBehind(bool drop)
+		{
+			dropWhenBehind = drop;
+		}
+
+		/// @brief Write the buffer out when this much time has passed since the last write
+		/// @param interval the time between writes, 0 to only write when the buffer is full
+		void setFlushInterval(std::chrono::milliseconds interval)
+		{
+			flushInterval = interval;
+		}
+
+		/// @brief Choose which event levels are written to the console straight away
+		/// @param levels the levels to write immediately, default is WARNING, ERR and CRITICAL
+		void setFlushLevels(int levels)
+		{
+			flushLevels = levels;
+		}
+
+		/// @brief Number of events dropped because the console was behind
+		/// @return the count since the stream was created
+		uint64_t getDroppedCount() const
+		{
+			return dropped.load(std::memory_order_relaxed);
+		}
+
+	private:
+		/// @brief Format an event into the buffer, with its color
+		void append(const Event& event)
+		{
+			const std::string& color = colorCodes[levelIndex(event.level)];
+			if (colors && !color.empty())
+			{
+				buffer.append(color);
+				event.formatTo(buffer);
+				buffer.append("\x1b[0m", 4);
+			}
+			else
+			{
+				event.formatTo(buffer);
+			}
+		}
+
+		/// @brief Write as much of the buffer as the console will take
+		/// When dropping, a pipe or socket is only written while it has room so the write never blocks
+		void writeOut()
+		{
+			lastFlush = std::chrono::steady_clock::now();
+			size_t sent = 0;
+			while (sent < buffer.size())
+			{
+				size_t size = buffer.size() - sent;
+#ifdef _WIN32
+				DWORD done = 0;
+				if (!WriteFile(output, buffer.data() + sent, (DWORD)size, &done, nullptr))
+				{
+					sent = buffer.size(); // the console is gone, there is nowhere to put the data
+					break;
+				}
+#else
+				if (dropWhenBehind && slowOutput)
+				{
+					pollfd ready = { output, POLLOUT, 0 };
+					if (poll(&ready, 1, 0) <= 0)
+					{
+						break;
+					}
+					// a pipe with room takes at least PIPE_BUF bytes without blocking
+					if (size > PIPE_BUF)
+					{
+						size = PIPE_BUF;
+					}
+				}
+				ssize_t done = ::write(output, buffer.data() + sent, size);
+				if (done < 0)
+				{
+					if (errno == EINTR)
+					{
+						continue;
+					}
+					if (errno == EAGAIN || errno == EWOULDBLOCK)
+					{
+						break;
+					}
+					sent = buffer.size();
+					break;
+				}
+#endif
+				sent += (size_t)done;
+			}
+			buffer.erase(0, sent);
+		}
+
+		/// @brief Where the events are written
+		Output output;
+
+		/// @brief Number of bytes to collect before writing
+		size_t capacity;
+
+		/// @brief Formatted events waiting to be written
+		std::string buffer;
+
+		/// @brief Whether the output is a pipe or socket, which can fill up
+		bool slowOutput = false;
+
+		/// @brief Whether to drop events rather than wait for the console
+		bool dropWhenBehind = true;
+
+		/// @brief Whether to add colors
+		bool colors = false;
+
+		/// @brief Color codes of each level, by levelIndex
+		std::array<std::string, LEVEL_COUNT> colorCodes;
+
+		/// @brief Event levels that cause the buffer to be written immediately
+		int flushLevels = LEVELS::WARNING | LEVELS::ERR | LEVELS::CRITICAL;
+
+		/// @brief Maximum time between writes
+		std::chrono::milliseconds flushInterval{ 100 };
+
+		/// @brief When the buffer was last written out
+		std::chrono::steady_clock::time_point lastFlush;
+
+		/// @brief Events dropped in total
+		std::atomic<uint64_t> dropped = 0;
+
+		/// @brief Events dropped since the last note was written
+		uint64_t unreported = 0;
+	};
+
+	/// @brief Stream that passes only some of its events on to another stream
+	/// Each level can keep every Nth event or a random fraction of events, levels that aren't set keep everything.
+	/// Register the SamplingStream with the logger instead of the stream it wraps; the wrapped stream is not owned.
+	/// Events are passed on through the wrapped stream's levels, filter and handle lock, so it can be registered as well
+	class SamplingStream : public Stream
+	{
+	public:
+		/// @brief Constructor, listens to the same levels as the wrapped stream
+		/// @param target the stream that receives the sampled events
+		SamplingStream(Stream* target) : target(target)
+		{
+			setLevels(target->getLevels());
+			for (auto& rule : rules)
+			{
+				rule.every = 1;
+				rule.threshold = ALWAYS;
+			}
+		}
+
+		/// @brief Pass on one event in every n of a level
+		/// @param level the level to sample
+		/// @param n 1 passes on every event, 0 passes on none
+		void setSampleEvery(LEVELS level, uint32_t n)
+		{
+			Rule& rule = rules[levelIndex(level)];
+			rule.threshold = ALWAYS;
+			rule.every = n;
+		}
+
+		/// @brief Pass on a random fraction of the events of a level
+		/// @param level the level to sample
+		/// @param fraction between 0 (none) and 1 (all)
+		void setSampleRate(LEVELS level, double fraction)
+		{
+			Rule& rule = rules[levelIndex(level)];
+			rule.every = 1;
+			rule.threshold = fraction >= 1 ? ALWAYS : fraction <= 0 ? 0 : (uint64_t)(fraction * (double)ALWAYS);
+		}
+
+		/// @brief Pass the event on if it is picked
+		/// @param event the event to sample
+		virtual void handle(Event& event)
+		{
+			if (accepts(event, target->getFilter().get()) && keep(event.level))
+			{
+				target->deliver(event, false);
+			}
+		}
+
+		/// @brief Pass on the picked events of a batch, in runs so the wrapped stream still gets batches
+		/// @param events the events to sample
+		virtual void handleBatch(EventSpan events)
+		{
+			std::shared_ptr<const EventFilter> filter = target->getFilter();
+			size_t start = 0;
+			for (size_t i = 0; i < events.size(); ++i)
+			{
+				if (!accepts(events[i], filter.get()) || !keep(events[i].level))
+				{
+					forward(events, start, i);
+					start = i + 1;
+				}
+			}
+			forward(events, start, events.size());
+		}
+
+		/// @brief Flush the wrapped stream
+		virtual void flush()
+		{
+			target->deliverFlush();
+		}
+
+		/// @brief Number of events of a level that were passed on
+		/// @param level the level to check
+		/// @return the count since the stream was created
+		uint64_t getSampledCount(LEVELS level) const
+		{
+			return rules[levelIndex(level)].sampled.load(std::memory_order_relaxed);
+		}
+
+		/// @brief Number of events of a level that were not passed on
+		/// @param level the level to check
+		/// @return the count since the stream was created
+		uint64_t getDroppedCount(LEVELS level) const
+		{
+			return rules[levelIndex(level)].dropped.load(std::memory_order_relaxed);
+		}
+
+		/// @brief The wrapped stream
+		/// @return the stream given to the constructor
+		Stream* getTarget() const
+		{
+			return target;
+		}
+
+	private:
+		/// @brief Threshold of a fraction of 1, compared with 53 random bits
+		static const uint64_t ALWAYS = 1ull << 53;
+
+		/// @brief How one level is sampled and what happened to its events
+		/// The counts only change on the thread delivering events to the stream, so they are read and written without RMW operations
+		struct Rule
+		{
+			std::atomic<uint32_t> every;
+			std::atomic<uint64_t> threshold;
+			std::atomic<uint64_t> sampled = 0;
+			std::atomic<uint64_t> dropped = 0;
+			uint32_t counter = 0;
+		};
+
+		/// @brief Decide whether to pass on an event and count the decision
+		/// @param level the event's level
+		/// @return true if the event should be passed on
+		bool keep(LEVELS level)
+		{
+			Rule& rule = rules[levelIndex(level)];
+			uint32_t every = rule.every.load(std::memory_order_relaxed);
+			uint64_t threshold = rule.threshold.load(std::memory_order_relaxed);
+			bool kept;
+			if (every != 1)
+			{
+				kept = every != 0 && ++rule.counter >= every;
+				if (kept)
+				{
+					rule.counter = 0;
+				}
+			}
+			else
+			{
+				kept = threshold == ALWAYS || (random() >> 11) < threshold;
+			}
+			std::atomic<uint64_t>& count = kept ? rule.sampled : rule.dropped;
+			count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			return kept;
+		}
+
+		/// @brief Check if the wrapped stream listens to an event, its levels may have changed since it was wrapped
+		/// @param event the event to check
+		/// @param filter the wrapped stream's filter, nullptr if it has none
+		/// @return true if the event should be passed on
+		bool accepts(const Event& event, const EventFilter* filter) const
+		{
+			return (target->getLevels() & event.level) == event.level && (filter == nullptr || filter->allows(event));
+		}
+
+		/// @brief Pass a run of events on to the wrapped stream
+		void forward(EventSpan events, size_t start, size_t end)
+		{
+			if (end > start)
+			{
+				target->deliverBatch(EventSpan(events.data() + start, end - start), false);
+			}
+		}
+
+		/// @brief Fast random number generator with one state per thread (xorshift64*)
+		/// @return 64 random bits
+		static uint64_t random()
+		{
+			static thread_local uint64_t state = 0;
+			if (state == 0)
+			{
+				state = (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count() ^ (uint64_t)(uintptr_t)&state;
+				state |= 1;
+			}
+			state ^= state >> 12;
+			state ^= state << 25;
+			state ^= state >> 27;
+			return state * 2685821657736338717ull;
+		}
+
+		/// @brief The stream that receives the sampled events
+		Stream* target;
+
+		/// @brief Sampling of each level, by levelIndex
+		std::array<Rule, LEVEL_COUNT> rules;
+	};
+
+	/// @brief Stream that stores a copy of each event
+	class ArchiveStream : public Stream
+	{
+	public:
+		/// @brief A stored event, the text points into the archive
+		/// The views stay valid until the event is pushed out by newer ones; use toEvent() to keep a copy
+		struct ArchivedEvent
+		{
+			/// @brief Position of the event in the archive, counting every event ever stored
+			uint64_t sequence;
+			std::chrono::time_point<std::chrono::system_clock> timestamp;
+			LEVELS level;
+			std::string_view msg;
+			std::string_view source;
+			std::string_view code;
+			/// @brief The event's fields as written by Fields::encode, empty if it had none
+			std::string_view fieldData;
+
+			/// @brief Copy the stored fields
+			/// @return the fields
+			Fields getFields() const
+			{
+				Fields fields;
+				if (!fieldData.empty())
+				{
+					fields.decode(fieldData.data(), fieldData.size());
+				}
+				return fields;
+			}
+
+			/// @brief Copy the stored event into an Event
+			/// @return the copy
+			Event toEvent() const
+			{
+				Event event(level, msg, source, code, timestamp);
+				if (!fieldData.empty())
+				{
+					event.fields.decode(fieldData.data(), fieldData.size());
+				}
+				return event;
+			}
+		};
+
+		/// @brief Constructor
+		/// @param limits how many events to keep, the storage for both is allocated here
+		ArchiveStream(const ArchiveLimits& limits = ArchiveLimits())
+			: limits(limits)
+		{
+			if (this->limits.maxEvents == 0)
+			{
+				this->limits.maxEvents = 1;
+			}
+			if (this->limits.maxBytes == 0)
+			{
+				this->limits.maxBytes = 1;
+			}
+			records.resize(this->limits.maxEvents);
+			arena.resize(this->limits.maxBytes);
+		}
+
+		/// @brief Store the event to be handled later, pushing out the oldest events to make room
+		/// @param event to be sent to stored
+		virtual void handle(Event& event)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			store(event);
+		}
+
+		/// @brief Store a batch of events, taking the archive's lock once
+		/// @param events to be stored
+		virtual void handleBatch(EventSpan events)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			for (const Event& event : events)
+			{
+				store(event);
+			}
+		}
+
+		/// @brief Find the stored events of some levels
+		/// @param levels the levels to look for
+		/// @return the events, oldest first
+		std::vector<ArchivedEvent> findLevels(int levels)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			expireOld();
+			std::vector<uint64_t> found;
+			for (size_t i = 0; i < LEVEL_COUNT; ++i)
+			{
+				if (levels & (1 << i))
+				{
+					found.insert(found.end(), byLevel[i].begin(), byLevel[i].end());
+				}
+			}
+			std::sort(found.begin(), found.end());
+			return views(found.begin(), found.end());
+		}
+
+		/// @brief Find the stored events with a code
+		/// @param code the code to look for
+		/// @return the events, oldest first
+		std::vector<ArchivedEvent> findCode(std::string_view code)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			expireOld();
+			auto found = byCode.find(code);
+			if (found == byCode.end())
+			{
+				return {};
+			}
+			return views(found->second.begin(), found->second.end());
+		}
+
+		/// @brief Find the stored events from a source
+		/// @param source the source to look for
+		/// @return the events, oldest first
+		std::vector<ArchivedEvent> findSource(std::string_view source)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			expireOld();
+			auto found = bySource.find(source);
+			if (found == bySource.end())
+			{
+				return {};
+			}
+			return views(found->second.begin(), found->second.end());
+		}
+
+		/// @brief Find the stored events with timestamps in a range
+		/// Uses a binary search while the events were archived in time order
+		/// @param from the earliest timestamp, inclusive
+		/// @param to the latest timestamp, exclusive
+		/// @return the events, oldest first
+		std::vector<ArchivedEvent> findTime(std::chrono::time_point<std::chrono::system_clock> from,
+			std::chrono::time_point<std::chrono::system_clock> to)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			expireOld();
+			std::vector<ArchivedEvent> found;
+			uint64_t seq = firstSeq;
+			if (ordered)
+			{
+				uint64_t last = nextSeq;
+				while (seq < last)
+				{
+					uint64_t middle = seq + (last - seq) / 2;
+					if (records[middle % records.size()].timestamp < from)
+					{
+						seq = middle + 1;
+					}
+					else
+					{
+						last = middle;
+					}
+				}
+			}
+			for (; seq < nextSeq; ++seq)
+			{
+				const Record& record = records[seq % records.size()];
+				if (record.timestamp >= to && ordered)
+				{
+					break;
+				}
+				if (record.timestamp >= from && record.timestamp < to)
+				{
+					found.push_back(view(seq));
+				}
+			}
+			return found;
+		}
+
+		/// @brief Copy the stored events
+		/// This copies the whole archive, prefer the find functions
+		/// @return a vector containing all stored events, oldest first
+		std::vector<Event> getEvents()
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			expireOld();
+			std::vector<Event> events;
+			events.reserve(count());
+			for (uint64_t seq = firstSeq; seq < nextSeq; ++seq)
+			{
+				events.push_back(view(seq).toEvent());
+			}
+			return events;
+		}
+
+		/// @brief Number of stored events
+		/// @return the number of events
+		size_t size()
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			return count();
+		}
+
+		/// @brief Number of arena bytes taken by the stored events, including space skipped at the end of the arena
+		/// @return size in bytes
+		size_t bytesUsed()
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			return count() > 0 ? (size_t)(arenaHead - oldest().offset) : 0;
+		}
+
+		/// @brief Remove all stored events
+		void clear()
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			while (count() > 0)
+			{
+				evict();
+			}
+		}
+
+	private:
+		/// @brief Where one stored event is, its message, source, code and encoded fields are back to back in the arena
+		struct Record
+		{
+			std::chrono::time_point<std::chrono::system_clock> timestamp;
+			LEVELS level = LEVELS::INFO;
+			uint64_t offset = 0;
+			uint32_t msgSize = 0;
+			uint16_t sourceSize = 0;
+			uint16_t codeSize = 0;
+			uint32_t fieldsSize = 0;
+		};
+
+		/// @brief Lists of sequence numbers, oldest first, for each code or source
+		using Index = std::map<std::string, std::deque<uint64_t>, std::less<>>;
+
+		size_t count() const
+		{
+			return (size_t)(nextSeq - firstSeq);
+		}
+
+		const Record& oldest() const
+		{
+			return records[firstSeq % records.size()];
+		}
+
+		const char* textOf(const Record& record) const
+		{
+			return arena.data() + record.offset % arena.size();
+		}
+
+		std::string_view sourceOf(const Record& record) const
+		{
+			return std::string_view(textOf(record) + record.msgSize, record.sourceSize);
+		}
+
+		std::string_view codeOf(const Record& record) const
+		{
+			return std::string_view(textOf(record) + record.msgSize + record.sourceSize, record.codeSize);
+		}
+
+		std::string_view fieldsOf(const Record& record) const
+		{
+			return std::string_view(textOf(record) + record.msgSize + record.sourceSize + record.codeSize, record.fieldsSize);
+		}
+
+		/// @brief Find or create the list for a key
+		static std::deque<uint64_t>& index(Index& map, std::string_view key)
+		{
+			auto found = map.find(key);
+			if (found == map.end())
+			{
+				found = map.emplace(std::string(key), std::deque<uint64_t>()).first;
+			}
+			return found->second;
+		}
+
+		/// @brief Take the oldest sequence number off the list for a key
+		static void unindex(Index& map, std::string_view key)
+		{
+			auto found = map.find(key);
+			found->second.pop_front();
+			if (found->second.empty())
+			{
+				map.erase(found);
+			}
+		}
+
+		/// @brief Store an event, pushing out the oldest events to make room, must be called with lock held
+		/// @param event to be stored
+		void store(const Event& event)
+		{
+			if (limits.maxAge.count() > 0)
+			{
+				expire(event.timestamp - limits.maxAge);
+			}
+
+			// everything has to fit in the arena, the message is cut short first and fields are kept whole or not at all
+			size_t capacity = arena.size();
+			std::string_view source = event.getSource();
+			std::string_view code = event.getCode();
+			size_t sourceSize = std::min({ source.size(), capacity, (size_t)UINT16_MAX });
+			size_t codeSize = std::min({ code.size(), capacity - sourceSize, (size_t)UINT16_MAX });
+			size_t fieldsSize = event.fields.empty() ? 0 : event.fields.encodedSize();
+			if (fieldsSize > capacity - sourceSize - codeSize)
+			{
+				fieldsSize = 0;
+			}
+			size_t msgSize = std::min({ event.msg.size(), capacity - sourceSize - codeSize - fieldsSize, (size_t)UINT32_MAX });
+			size_t total = msgSize + sourceSize + codeSize + fieldsSize;
+
+			// the text of one event is never split, skip to the start of the arena if it doesn't fit at the end
+			uint64_t start = arenaHead;
+			size_t position = (size_t)(start % capacity);
+			if (position + total > capacity)
+			{
+				start += capacity - position;
+				position = 0;
+			}
+			while (count() > 0 && (count() == records.size() || start + total - oldest().offset > capacity))
+			{
+				evict();
+			}
+
+			char* text = arena.data() + position;
+			std::memcpy(text, event.msg.data(), msgSize);
+			std::memcpy(text + msgSize, source.data(), sourceSize);
+			std::memcpy(text + msgSize + sourceSize, code.data(), codeSize);
+			if (fieldsSize > 0)
+			{
+				event.fields.encode(text + msgSize + sourceSize + codeSize);
+			}
+
+			Record& record = records[nextSeq % records.size()];
+			record.timestamp = event.timestamp;
+			record.level = event.level;
+			record.offset = start;
+			record.msgSize = (uint32_t)msgSize;
+			record.sourceSize = (uint16_t)sourceSize;
+			record.codeSize = (uint16_t)codeSize;
+			record.fieldsSize = (uint32_t)fieldsSize;
+
+			if (count() > 0 && event.timestamp < records[(nextSeq - 1) % records.size()].timestamp)
+			{
+				ordered = false;
+			}
+			byLevel[levelIndex(event.level)].push_back(nextSeq);
+			index(byCode, codeOf(record)).push_back(nextSeq);
+			index(bySource, sourceOf(record)).push_back(nextSeq);
+
+			++nextSeq;
+			arenaHead = start + total;
+		}
+
+		/// @brief Remove the oldest event
+		void evict()
+		{
+			const Record& record = oldest();
+			byLevel[levelIndex(record.level)].pop_front();
+			unindex(byCode, codeOf(record));
+			unindex(bySource, sourceOf(record));
+			++firstSeq;
+			if (count() == 0)
+			{
+				ordered = true;
+			}
+		}
+
+		/// @brief Remove events older than a time, the oldest events are assumed to be first
+		void expire(std::chrono::time_point<std::chrono::system_clock> cutoff)
+		{
+			while (count() > 0 && oldest().timestamp < cutoff)
+			{
+				evict();
+			}
+		}
+
+		/// @brief Remove events older than the maximum age
+		void expireOld()
+		{
+			if (limits.maxAge.count() > 0)
+			{
+				expire(std::chrono::system_clock::now() - limits.maxAge);
+			}
+		}
+
+		ArchivedEvent view(uint64_t seq) const
+		{
+			const Record& record = records[seq % records.size()];
+			return ArchivedEvent{ seq, record.timestamp, record.level,
+				std::string_view(textOf(record), record.msgSize), sourceOf(record), codeOf(record), fieldsOf(record) };
+		}
+
+		template<typename It>
+		std::vector<ArchivedEvent> views(It begin, It end) const
+		{
+			std::vector<ArchivedEvent> found;
+			found.reserve(end - begin);
+			for (; begin != end; ++begin)
+			{
+				found.push_back(view(*begin));
+			}
+			return found;
+		}
+
+		/// @brief How much to keep
+		ArchiveLimits limits;
+
+		/// @brief Ring of stored events, the entry for a sequence number is at sequence % size
+		std::vector<Record> records;
+
+		/// @brief Ring of bytes holding the text of the stored events
+		std::vector<char> arena;
+
+		/// @brief Sequence number of the oldest stored event
+		uint64_t firstSeq = 0;
+
+		/// @brief Sequence number of the next event
+		uint64_t nextSeq = 0;
+
+		/// @brief Total bytes ever taken in the arena, the next text goes at arenaHead % size
+		uint64_t arenaHead = 0;
+
+		/// @brief Whether the stored events are in time order
+		bool ordered = true;
+
+		/// @brief Sequence numbers of the stored events of each level
+		std::array<std::deque<uint64_t>, LEVEL_COUNT> byLevel;
+
+		Index byCode;
+		Index bySource;
+
+		/// @brief Guards the archive from queries while events are stored
+		std::mutex lock;
+	};
+
+
+
+	/// @brief Layout of the files written by BinaryFileStream
+	/// A file is a list of records, each starting with a one byte type. Numbers are little-endian.
+	/// - 'H' header: "BOOMLOG", u8 version, u64 numerator and u64 denominator of the timestamp tick in seconds.
+	///   Starts every session, string IDs from earlier sessions are forgotten
+	/// - 'S' string: u32 ID, u16 length, text. Defines an ID used by later events for their source or code
+	/// - 'E' event: i64 timestamp ticks, u8 level, u8 flags, u32 message length, message,
+	///   then the source and the code, each stored either as a u32 string ID (flags SOURCE_ID / CODE_ID) or as u16 length and text,
+	///   then if flags has FIELDS a u32 length and the event's fields as written by Fields::encode. Version 1 files have no fields
+	namespace binary
+	{
+		const char HEADER = 'H';
+		const char STRING = 'S';
+		const char EVENT = 'E';
+		const char MAGIC[] = "BOOMLOG";
+		const uint8_t VERSION = 2;
+		const uint8_t SOURCE_ID = 1;
+		const uint8_t CODE_ID = 2;
+		const uint8_t FIELDS = 4;
+
+		/// @brief Add a little-endian number to a buffer
+		/// @param out buffer to add to
+		/// @param value the number
+		/// @param bytes how many bytes to write
+		inline void put(std::string& out, uint64_t value, size_t bytes)
+		{
+			for (size_t i = 0; i < bytes; ++i)
+			{
+				out.push_back((char)((value >> (8 * i)) & 0xFF));
+			}
+		}
+
+		/// @brief Read a little-endian number
+		/// @param data at least the given number of bytes
+		/// @param bytes how many bytes to read
+		/// @return the number
+		inline uint64_t get(const char* data, size_t bytes)
+		{
+			uint64_t value = 0;
+			for (size_t i = 0; i < bytes; ++i)
+			{
+				value |= (uint64_t)(uint8_t)data[i] << (8 * i);
+			}
+			return value;
+		}
+
+		/// @brief Writes events as records, repeated sources and codes are given an ID the first time they are written
+		class Encoder
+		{
+		public:
+			/// @brief Most strings that are given an ID, after this sources and codes are written in full
+			static const size_t MAX_INTERNED = 65536;
+
+			/// @brief Constructor
+			/// @param intern whether to give repeated sources and codes an ID instead of writing them out each time
+			Encoder(bool intern = true) : intern(intern)
+			{}
+
+			/// @brief Add an event's record to a buffer, after the session header if this is the first record
+			/// @param event to be written
+			/// @param out buffer to add to
+			void encode(const Event& event, std::string& out)
+			{
+				if (!headerWritten)
+				{
+					writeHeader(out);
+				}
+
+				// events from a call site have the same strings every time, so their IDs are only looked up once
+				uint32_t sourceId, codeId;
+				if (event.site != 0 && event.site < sites.size() && sites[event.site].known)
+				{
+					sourceId = sites[event.site].source;
+					codeId = sites[event.site].code;
+				}
+				else
+				{
+					sourceId = stringId(event.getSource(), out);
+					codeId = stringId(event.getCode(), out);
+					if (event.site != 0 && event.site < CallSite::MAX_SITES && event.source.empty() && event.code.empty())
+					{
+						if (sites.size() <= event.site)
+						{
+							sites.resize(event.site + 1);
+						}
+						sites[event.site] = { true, sourceId, codeId };
+					}
+				}
+				uint8_t flags = (sourceId != 0 ? SOURCE_ID : 0) | (codeId != 0 ? CODE_ID : 0) | (!event.fields.empty() ? FIELDS : 0);
+
+				out.push_back(EVENT);
+				put(out, (uint64_t)event.timestamp.time_since_epoch().count(), 8);
+				out.push_back((char)event.level);
+				out.push_back((char)flags);
+				put(out, event.msg.size(), 4);
+				out.append(event.msg.data(), event.msg.size());
+				writeString(out, event.getSource(), sourceId);
+				writeString(out, event.getCode(), codeId);
+				if (!event.fields.empty())
+				{
+					size_t size = event.fields.encodedSize();
+					put(out, size, 4);
+					size_t at = out.size();
+					out.resize(at + size);
+					event.fields.encode(&out[at]);
+				}
+			}
+
+			/// @brief Start a new session, the next record is preceded by a header and string IDs are given out again
+			void reset()
+			{
+				headerWritten = false;
+				ids.clear();
+				sites.clear();
+			}
+
+		private:
+			/// @brief Start a session
+			/// @param out buffer to write to
+			void writeHeader(std::string& out)
+			{
+				out.push_back(HEADER);
+				out.append(MAGIC, 7);
+				out.push_back((char)VERSION);
+				put(out, std::chrono::system_clock::period::num, 8);
+				put(out, std::chrono::system_clock::period::den, 8);
+				headerWritten = true;
+			}
+
+			/// @brief Find the ID of a source or code, defining a new one if needed
+			/// @param text the string
+			/// @param out buffer to write a definition to
+			/// @return the ID, or 0 if the string should be written in full
+			uint32_t stringId(std::string_view text, std::string& out)
+			{
+				if (!intern || text.empty() || text.size() > 0xFFFF)
+				{
+					return 0;
+				}
+				auto found = ids.find(text);
+				if (found != ids.end())
+				{
+					return found->second;
+				}
+				if (ids.size() >= MAX_INTERNED)
+				{
+					return 0;
+				}
+
+				uint32_t id = (uint32_t)ids.size() + 1;
+				ids.emplace(std::string(text), id);
+				out.push_back(STRING);
+				put(out, id, 4);
+				put(out, text.size(), 2);
+				out.append(text.data(), text.size());
+				return id;
+			}
+
+			/// @brief Write a source or code as either its ID or its text
+			/// @param out buffer to write to
+			/// @param text the string
+			/// @param id the string's ID, 0 to write the text
+			static void writeString(std::string& out, std::string_view text, uint32_t id)
+			{
+				if (id != 0)
+				{
+					put(out, id, 4);
+				}
+				else
+				{
+					size_t size = text.size() > 0xFFFF ? 0xFFFF : text.size();
+					put(out, size, 2);
+					out.append(text.data(), size);
+				}
+			}
+
+			/// @brief Whether repeated strings are given IDs
+			bool intern;
+
+			/// @brief Whether this session's header has been written
+			bool headerWritten = false;
+
+			/// @brief IDs of the strings written so far
+			std::map<std::string, uint32_t, std::less<>> ids;
+
+			/// @brief IDs of the source and code of each call site seen so far, by call site ID
+			struct SiteIds
+			{
+				bool known = false;
+				uint32_t source = 0;
+				uint32_t code = 0;
+			};
+			std::vector<SiteIds> sites;
+		};
+	}
+
+	/// @brief Stream that writes a compact binary record for each event instead of formatting it as text
+	/// The text is only produced later, when BinaryLogReader reads the file back
+	class BinaryFileStream : public FileStream
+	{
+	public:
+		/// @brief Most strings that are given an ID, after this sources and codes are written in full
+		static const size_t MAX_INTERNED = binary::Encoder::MAX_INTERNED;
+
+		/// @brief Constructor
+		/// @param fileName Name of file to write events to, default is log.bin
+		/// @param bufferSize number of bytes to collect before writing to the file, default is 64KB
+		/// @param intern whether to give repeated sources and codes an ID instead of writing them out each time
+		BinaryFileStream(const std::string& fileName = "log.bin", size_t bufferSize = 64 * 1024, bool intern = true)
+			:FileStream(fileName, bufferSize), encoder(intern)
+		{}
+
+		/// @brief Write the event's record to the file
+		/// @param event to be written to file
+		virtual void handle(Event& event)
+		{
+			encode(event);
+			written(event);
+		}
+
+		/// @brief Write the records of a batch of events
+		/// @param events to be written to file
+		virtual void handleBatch(EventSpan events)
+		{
+			int levels = 0;
+			for (const Event& event : events)
+			{
+				encode(event);
+				levels |= event.level;
+			}
+			written(levels);
+		}
+
+	protected:
+		/// @brief A new file needs its own header and string IDs
+		virtual void fileChanged()
+		{
+			encoder.reset();
+		}
+
+	private:
+		/// @brief Add the event's record to the buffer
+		/// @param event to be written
+		void encode(const Event& event)
+		{
+			rotateIfDue(event);
+			encoder.encode(event, file.getBuffer());
+		}
+
+		/// @brief Turns events into records
+		binary::Encoder encoder;
+	};
+
+	/// @brief Reads the files written by BinaryFileStream
+	class BinaryLogReader
+	{
+	public:
+		/// @brief Constructor
+		/// @param fileName the binary log to read
+		BinaryLogReader(const std::string& fileName) : file(fileName, std::ios::in | std::ios::binary)
+		{}
+
+		/// @brief Check if the file could be opened
+		/// @return true if the file is open
+		bool isOpen() const
+		{
+			return file.is_open();
+		}
+
+		/// @brief Check if reading stopped because of bad data rather than the end of the file
+		/// @return true if the file is damaged or not a binary log
+		bool failed() const
+		{
+			return corrupt;
+		}
+
+		/// @brief Read the next event
+		/// @param event [out] receives the event
+		/// @return false at the end of the file or if the data is damaged
+		bool next(Event& event)
+		{
+			while (!corrupt)
+			{
+				int type = file.get();
+				if (type == std::char_traits<char>::eof())
+				{
+					return false;
+				}
+
+				if (type == binary::HEADER)
+				{
+					readHeader();
+				}
+				else if (type == binary::STRING)
+				{
+					readDefinition();
+				}
+				else if (type == binary::EVENT && started)
+				{
+					return readEvent(event);
+				}
+				else
+				{
+					corrupt = true;
+				}
+			}
+			return false;
+		}
+
+		/// @brief Turn a whole binary log into the text a TextFileStream would have written
+		/// @param fileName the binary log to read
+		/// @return the text of every event in the file
+		static std::string toText(const std::string& fileName)
+		{
+			std::string result;
+			BinaryLogReader reader(fileName);
+			Event event;
+			while (reader.next(event))
+			{
+				event.formatTo(result);
+			}
+			return result;
+		}
+
+	private:
+		/// @brief Read bytes from the file
+		/// @param size number of bytes
+		/// @return pointer to the bytes, or nullptr if the file ended too soon
+		const char* read(size_t size)
+		{
+			scratch.resize(size);
+			if (size > 0 && !file.read(&scratch[0], size))
+			{
+				corrupt = true;
+				return nullptr;
+			}
+			return scratch.data();
+		}
+
+		/// @brief Read a little-endian number
+		/// @param bytes size of the number
+		/// @param value [out] the number
+		/// @return false if the file ended too soon
+		bool readNumber(size_t bytes, uint64_t& value)
+		{
+			const char* data = read(bytes);
+			if (data == nullptr)
+			{
+				return false;
+			}
+			value = binary::get(data, bytes);
+			return true;
+		}
+
+		/// @brief Start a new session
+		void readHeader()
+		{
+			uint64_t version, num, den;
+			const char* magic = read(7);
+			if (magic == nullptr || std::memcmp(magic, binary::MAGIC, 7) != 0
+				|| !readNumber(1, version) || version == 0 || version > binary::VERSION
+				|| !readNumber(8, num) || !readNumber(8, den) || num == 0 || den == 0)
+			{
+				corrupt = true;
+				return;
+			}
+			tickNum = num;
+			tickDen = den;
+			strings.clear();
+			started = true;
+		}
+
+		/// @brief Read the definition of a string ID
+		void readDefinition()
+		{
+			uint64_t id, size;
+			if (!started || !readNumber(4, id) || !readNumber(2, size) || id != strings.size() + 1)
+			{
+				corrupt = true;
+				return;
+			}
+			const char* text = read((size_t)size);
+			if (text != nullptr)
+			{
+				strings.emplace_back(text, (size_t)size);
+			}
+		}
+
+		/// @brief Read a source or code, stored either as an ID or as text
+		/// @param isId whether an ID was written
+		/// @param out [out] the string
+		/// @return false if the data is damaged
+		bool readString(bool isId, std::string& out)
+		{
+			uint64_t value;
+			if (isId)
+			{
+				if (!readNumber(4, value) || value == 0 || value > strings.size())
+				{
+					corrupt = true;
+					return false;
+				}
+				out = strings[(size_t)value - 1];
+				return true;
+			}
+
+			if (!readNumber(2, value))
+			{
+				return false;
+			}
+			const char* text = read((size_t)value);
+			if (text == nullptr)
+			{
+				return false;
+			}
+			out.assign(text, (size_t)value);
+			return true;
+		}
+
+		/// @brief Read the body of an event record
+		/// @param event [out] receives the event
+		/// @return false if the data is damaged
+		bool readEvent(Event& event)
+		{
+			uint64_t ticks, level, flags, size;
+			if (!readNumber(8, ticks) || !readNumber(1, level) || !readNumber(1, flags) || !readNumber(4, size))
+			{
+				return false;
+			}
+			const char* msg = read((size_t)size);
+			if (msg == nullptr)
+			{
+				return false;
+			}
+			event.msg.assign(msg, (size_t)size);
+			if (!readString((flags & binary::SOURCE_ID) != 0, text) )
+			{
+				return false;
+			}
+			event.source = text;
+			if (!readString((flags & binary::CODE_ID) != 0, text))
+			{
+				return false;
+			}
+			event.code = text;
+			event.fields.clear();
+			if ((flags & binary::FIELDS) != 0)
+			{
+				if (!readNumber(4, size))
+				{
+					return false;
+				}
+				const char* fields = read((size_t)size);
+				if (fields == nullptr)
+				{
+					return false;
+				}
+				if (!event.fields.decode(fields, (size_t)size))
+				{
+					corrupt = true;
+					return false;
+				}
+			}
+			event.site = 0;
+			event.level = (LEVELS)level;
+			event.timestamp = toTimestamp((int64_t)ticks);
+			return true;
+		}
+
+		/// @brief Convert ticks written by another system clock into a timestamp
+		/// @param ticks the number of ticks since the epoch
+		/// @return the timestamp
+		std::chrono::time_point<std::chrono::system_clock> toTimestamp(int64_t ticks) const
+		{
+			using period = std::chrono::system_clock::period;
+			if (tickNum == (uint64_t)period::num && tickDen == (uint64_t)period::den)
+			{
+				return std::chrono::time_point<std::chrono::system_clock>(std::chrono::system_clock::duration(ticks));
+			}
+			long double converted = (long double)ticks * tickNum * period::den / ((long double)tickDen * period::num);
+			return std::chrono::time_point<std::chrono::system_clock>(std::chrono::system_clock::duration((std::chrono::system_clock::rep)converted));
+		}
+
+		/// @brief The file being read
+		std::ifstream file;
+
+		/// @brief Holds the bytes of the last read
+		std::string scratch;
+
+		/// @brief Holds a source or code while it is being read
+		std::string text;
+
+		/// @brief Strings defined in the current session, ID 1 is the first
+		std::vector<std::string> strings;
+
+		/// @brief Length of a timestamp tick in seconds, as a fraction
+		uint64_t tickNum = 1;
+		uint64_t tickDen = 1;
+
+		/// @brief Whether a header has been read
+		bool started = false;
+
+		/// @brief Whether bad data was found
+		bool corrupt = false;
+	};
+
+	/// @brief Small wrappers that hide the differences between Winsock and POSIX sockets
+	namespace net
+	{
+#ifdef _WIN32
+		using Socket = SOCKET;
+		const Socket NO_SOCKET = INVALID_SOCKET;
+#else
+		using Socket = int;
+		const Socket NO_SOCKET = -1;
+#endif
+
+		/// @brief Start Winsock once per process, does nothing on other platforms
+		/// @return false if sockets can't be used
+		inline bool startup()
+		{
+#ifdef _WIN32
+			static const bool started = []
+			{
+				WSADATA data;
+				return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+			}();
+			return started;
+#else
+			return true;
+#endif
+		}
+
+		/// @brief Close a socket
+		/// @param socket the socket to close
+		inline void close(Socket socket)
+		{
+#ifdef _WIN32
+			closesocket(socket);
+#else
+			::close(socket);
+#endif
+		}
+
+		/// @brief Check if the last socket call only failed because a signal interrupted it
+		inline bool interrupted()
+		{
+#ifdef _WIN32
+			return WSAGetLastError() == WSAEINTR;
+#else
+			return errno == EINTR;
+#endif
+		}
+
+		/// @brief Switch a socket between blocking and non-blocking calls
+		/// @param socket the socket to change
+		/// @param blocking true for calls that wait
+		inline void setBlocking(Socket socket, bool blocking)
+		{
+#ifdef _WIN32
+			u_long mode = blocking ? 0 : 1;
+			ioctlsocket(socket, FIONBIO, &mode);
+#else
+			int flags = fcntl(socket, F_GETFL, 0);
+			fcntl(socket, F_SETFL, blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK);
+#endif
+		}
+
+		/// @brief Wait for a non-blocking connect to finish
+		/// @param socket the connecting socket
+		/// @param timeout longest time to wait
+		/// @return false if the time ran out or the connection was refused
+		inline bool waitConnected(Socket socket, std::chrono::milliseconds timeout)
+		{
+#ifdef _WIN32
+			WSAPOLLFD ready = { socket, POLLWRNORM, 0 };
+			int result = WSAPoll(&ready, 1, (INT)timeout.count());
+#else
+			pollfd ready = { socket, POLLOUT, 0 };
+			int result = poll(&ready, 1, (int)timeout.count());
+#endif
+			int error = 0;
+			socklen_t size = sizeof(error);
+			return result > 0 && getsockopt(socket, SOL_SOCKET, SO_ERROR, (char*)&error, &size) == 0 && error == 0;
+		}
+
+		/// @brief Open a socket to a host
+		/// @param host name or address of the host
+		/// @param port the port to connect to
+		/// @param udp true for a datagram socket, which only remembers where to send to
+		/// @param timeout longest time to wait for the connection, and afterwards for each send
+		/// @return the socket, or NO_SOCKET if the host couldn't be reached
+		inline Socket connect(const std::string& host, uint16_t port, bool udp, std::chrono::milliseconds timeout)
+		{
+			addrinfo hints{};
+			hints.ai_family = AF_UNSPEC;
+			hints.ai_socktype = udp ? SOCK_DGRAM : SOCK_STREAM;
+			addrinfo* found = nullptr;
+			if (!startup() || getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) != 0)
+			{
+				return NO_SOCKET;
+			}
+
+			Socket result = NO_SOCKET;
+			for (addrinfo* address = found; address != nullptr && result == NO_SOCKET; address = address->ai_next)
+			{
+				Socket socket = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+				if (socket == NO_SOCKET)
+				{
+					continue;
+				}
+
+				// connect without blocking so that an unreachable host can be given up on after the timeout
+				setBlocking(socket, false);
+				bool connected = ::connect(socket, address->ai_addr, (socklen_t)address->ai_addrlen) == 0;
+#ifdef _WIN32
+				if (!connected && WSAGetLastError() == WSAEWOULDBLOCK)
+#else
+				if (!connected && errno == EINPROGRESS)
+#endif
+				{
+					connected = waitConnected(socket, timeout);
+				}
+				if (!connected)
+				{
+					close(socket);
+					continue;
+				}
+
+				setBlocking(socket, true);
+#ifdef _WIN32
+				DWORD wait = (DWORD)timeout.count();
+#else
+				timeval wait = { (time_t)(timeout.count() / 1000), (suseconds_t)(timeout.count() % 1000 * 1000) };
+#endif
+				setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, (const char*)&wait, sizeof(wait));
+#ifdef SO_NOSIGPIPE
+				int on = 1;
+				setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+				result = socket;
+			}
+			freeaddrinfo(found);
+			return result;
+		}
+
+		/// @brief Send the whole of a buffer
+		/// @param socket a connected socket
+		/// @param data the bytes to send
+		/// @param size number of bytes
+		/// @return false if the connection failed or the send timed out, the socket should then be closed
+		inline bool sendAll(Socket socket, const char* data, size_t size)
+		{
+#ifdef MSG_NOSIGNAL
+			const int flags = MSG_NOSIGNAL;
+#else
+			const int flags = 0;
+#endif
+			while (size > 0)
+			{
+				int chunk = (int)std::min(size, (size_t)1 << 30);
+				auto done = ::send(socket, data, chunk, flags);
+				if (done < 0)
+				{
+					if (interrupted())
+					{
+						continue;
+					}
+					return false;
+				}
+				data += done;
+				size -= (size_t)done;
+			}
+			return true;
+		}
+
+		/// @brief Send several datagrams on a connected datagram socket, with one system call where the platform has one
+		/// @param socket a connected datagram socket
+		/// @param messages the datagrams to send
+		/// @return how many datagrams were sent before an error
+		inline size_t sendDatagrams(Socket socket, const std::vector<std::string_view>& messages)
+		{
+			size_t sent = 0;
+#if defined(__linux__) && defined(_GNU_SOURCE)
+			std::vector<iovec> parts(messages.size());
+			std::vector<mmsghdr> headers(messages.size());
+			for (size_t i = 0; i < messages.size(); ++i)
+			{
+				parts[i].iov_base = (void*)messages[i].data();
+				parts[i].iov_len = messages[i].size();
+				headers[i].msg_hdr.msg_iov = &parts[i];
+				headers[i].msg_hdr.msg_iovlen = 1;
+			}
+			while (sent < messages.size())
+			{
+				int done = sendmmsg(socket, headers.data() + sent, (unsigned)(messages.size() - sent), MSG_NOSIGNAL);
+				if (done < 0)
+				{
+					if (errno == EINTR)
+					{
+						continue;
+					}
+					break;
+				}
+				sent += (size_t)done;
+			}
+#else
+			while (sent < messages.size() && sendAll(socket, messages[sent].data(), messages[sent].size()))
+			{
+				++sent;
+			}
+#endif
+			return sent;
+		}
+	}
+
+	/// @brief Stream that sends events to a collector over the network, configured with a NetworkConfig
+	/// Events are collected into batches which a background thread sends, so handle() never waits for the network.
+	/// While the collector can't be reached batches are kept in memory or moved to the spill file, and sent once it is back
+	class NetworkStream : public Stream
+	{
+	public:
+		/// @brief Largest datagram that UDP can carry
+		static const size_t MAX_DATAGRAM = 65507;
+
+		/// @brief Bit of a TCP frame's length that is set when the batch after it is compressed
+		static const uint32_t COMPRESSED_FRAME = 0x80000000u;
+
+		/// @brief Constructor, starts the sending thread which connects once the first batch is ready
+		/// @param config where to send events and how
+		NetworkStream(const NetworkConfig& config = NetworkConfig())
+			: config(config), opened(std::chrono::steady_clock::now()), backoff(config.reconnectMin)
+		{
+			char host[256] = "";
+			if (!net::startup() || gethostname(host, sizeof(host)) != 0)
+			{
+				host[0] = 0;
+			}
+			host[sizeof(host) - 1] = 0;
+#ifdef _WIN32
+			std::string process = std::to_string(GetCurrentProcessId());
+#else
+			std::string process = std::to_string(getpid());
+#endif
+			appendField(syslogFields, host, 255);
+			appendField(syslogFields, config.appName, 48);
+			appendField(syslogFields, process, 128);
+
+			if (!config.spillFile.empty())
+			{
+				loadSpill();
+			}
+			worker = std::thread(&NetworkStream::run, this);
+		}
+
+		/// @brief Copy constructor, not used
+		NetworkStream(const NetworkStream&) = delete;
+
+		/// @brief Destructor, makes a last attempt to send what is waiting, what can't be sent goes to the spill file
+		~NetworkStream()
+		{
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				stopping = true;
+			}
+			wake.notify_all();
+			worker.join();
+			if (socket != net::NO_SOCKET)
+			{
+				net::close(socket);
+			}
+		}
+
+		/// @brief Add the event to the batch being collected
+		/// @param event to be sent
+		virtual void handle(Event& event)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			add(event);
+		}
+
+		/// @brief Add a batch of events to the batch being collected
+		/// @param events to be sent
+		virtual void handleBatch(EventSpan events)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			for (const Event& event : events)
+			{
+				add(event);
+			}
+		}
+
+		/// @brief Send the events collected so far, waits for one attempt to send everything that is waiting
+		virtual void flush()
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			uint64_t wanted = ++flushRequested;
+			kicked = true;
+			wake.notify_all();
+			flushed.wait(guard, [&] { return flushedUpTo >= wanted; });
+		}
+
+		/// @brief Stop the sending thread before fork(), the batches it hasn't sent stay waiting
+		virtual void beforeFork()
+		{
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				pausing = true;
+			}
+			wake.notify_all();
+			worker.join();
+		}
+
+		/// @brief Start the sending thread again after fork()
+		/// The child leaves the connection, the waiting batches and the spill file to the parent, connects on its own
+		/// and keeps what it can't send in memory
+		/// @param child true in the new process
+		virtual void afterFork(bool child)
+		{
+			if (child)
+			{
+				if (socket != net::NO_SOCKET)
+				{
+					net::close(socket);
+					socket = net::NO_SOCKET;
+				}
+				connected = false;
+				nextAttempt = {};
+				current = Batch();
+				ready.clear();
+				pendingBytes = 0;
+				unreported = 0;
+				config.spillFile.clear();
+				spillBytes = 0;
+				spillRead = 0;
+				spilled = 0;
+			}
+			pausing = false;
+			worker = std::thread(&NetworkStream::run, this);
+		}
+
+		/// @brief Check if the stream is connected to the collector
+		/// @return true while connected, a UDP socket counts as connected until a send fails
+		bool isConnected() const
+		{
+			return connected.load(std::memory_order_relaxed);
+		}
+
+		/// @brief Number of events the collector has been sent
+		/// @return the count since the stream was created
+		uint64_t getSentCount() const
+		{
+			return sent.load(std::memory_order_relaxed);
+		}
+
+		/// @brief Number of bytes sent, including the framing
+		/// @return the count since the stream was created
+		virtual uint64_t getBytesWritten() const
+		{
+			return bytesSent.load(std::memory_order_relaxed);
+		}
+
+		/// @brief Number of events dropped because the memory limit or the spill file was full
+		/// @return the count since the stream was created
+		uint64_t getDroppedCount() const
+		{
+			return dropped.load(std::memory_order_relaxed);
+		}
+
+		/// @brief Number of events waiting in the spill file
+		/// @return the count, including events left by an earlier run
+		uint64_t getSpilledCount() const
+		{
+			return spilled.load(std::memory_order_relaxed);
+		}
+
+	private:
+		/// @brief Events that are sent together
+		struct Batch
+		{
+			/// @brief With TCP the frame as it is sent, with UDP each datagram after its length as a u16
+			std::string data;
+
+			/// @brief Number of events in the batch
+			uint32_t events = 0;
+		};
+
+		/// @brief Bytes before each batch in the spill file, the number of events and the size as u32s
+		static const size_t SPILL_HEADER = 8;
+
+		/// @brief Add an event to the open batch and seal the batch once it is full, must be called with lock held
+		/// @param event to be sent
+		void add(const Event& event)
+		{
+			if (pendingBytes >= config.memoryLimit)
+			{
+				drop(1);
+				return;
+			}
+			if (unreported > 0)
+			{
+				Event note(LEVELS::WARNING, std::to_string(unreported) + " network events dropped");
+				unreported = 0;
+				encode(note);
+			}
+			encode(event);
+			if (current.data.size() >= config.batchSize)
+			{
+				seal();
+				kicked = true;
+				wake.notify_all();
+			}
+		}
+
+		/// @brief Write an event into the open batch
+		/// @param event to be written
+		void encode(const Event& event)
+		{
+			std::string& out = current.data;
+			if (current.events == 0)
+			{
+				opened = std::chrono::steady_clock::now();
+				if (config.protocol == NETWORK_PROTOCOL::TCP)
+				{
+					binary::put(out, 0, 4); // the length is filled in when the batch is sealed
+					encoder.reset();
+				}
+			}
+
+			if (config.protocol == NETWORK_PROTOCOL::UDP_SYSLOG)
+			{
+				size_t start = out.size();
+				binary::put(out, 0, 2);
+				formatSyslog(event, out);
+				size_t size = std::min({ out.size() - start - 2, config.maxDatagram, MAX_DATAGRAM });
+				out.resize(start + 2 + size);
+				setNumber(out, start, size, 2);
+			}
+			else if (config.binary)
+			{
+				encoder.encode(event, out);
+			}
+			else
+			{
+				event.formatTo(out);
+				out.push_back('\n');
+			}
+			++current.events;
+		}
+
+		/// @brief Write an event as an RFC 5424 syslog message
+		/// @param event to be written
+		/// @param out buffer to add to
+		void formatSyslog(const Event& event, std::string& out) const
+		{
+			int severity = 6;
+			switch (event.level)
+			{
+			case(LEVELS::DBG): severity = 7; break;
+			case(LEVELS::INFO): severity = 6; break;
+			case(LEVELS::WARNING): severity = 4; break;
+			case(LEVELS::ERR): severity = 3; break;
+			case(LEVELS::CRITICAL): severity = 2; break;
+			}
+
+			auto second = std::chrono::floor<std::chrono::seconds>(event.timestamp);
+			time_t seconds = std::chrono::system_clock::to_time_t(second);
+			tm utc{};
+#ifdef _WIN32
+			gmtime_s(&utc, &seconds);
+#else
+			gmtime_r(&seconds, &utc);
+#endif
+			long micros = (long)std::chrono::duration_cast<std::chrono::microseconds>(event.timestamp - second).count();
+			char header[64];
+			int size = std::snprintf(header, sizeof(header), "<%d>1 %04d-%02d-%02dT%02d:%02d:%02d.%06ldZ ",
+				config.facility * 8 + severity, utc.tm_year + 1900, utc.tm_mon + 1, utc.tm_mday,
+				utc.tm_hour, utc.tm_min, utc.tm_sec, micros);
+			out.append(header, size > 0 ? (size_t)size : 0);
+			out.append(syslogFields);
+			appendField(out, event.getCode(), 32);
+			out.append("- ", 2); // no structured data
+			out.append(event.msg.data(), event.msg.size());
+			event.fields.appendTo(out);
+			std::string_view source = event.getSource();
+			if (!source.empty())
+			{
+				out.append(" (from ", 7);
+				out.append(source.data(), source.size());
+				out.push_back(')');
+			}
+		}
+
+		/// @brief Add a syslog header field and the space after it, '-' if it is empty
+		/// @param out buffer to add to
+		/// @param text the field, characters syslog doesn't allow are replaced with '_'
+		/// @param maxSize longest the field can be
+		static void appendField(std::string& out, std::string_view text, size_t maxSize)
+		{
+			if (text.empty())
+			{
+				out.push_back('-');
+			}
+			for (char c : text.substr(0, maxSize))
+			{
+				out.push_back(c > ' ' && c < 127 ? c : '_');
+			}
+			out.push_back(' ');
+		}
+
+		/// @brief Overwrite a little-endian number already in a buffer
+		static void setNumber(std::string& out, size_t at, uint64_t value, size_t bytes)
+		{
+			for (size_t i = 0; i < bytes; ++i)
+			{
+				out[at + i] = (char)((value >> (8 * i)) & 0xFF);
+			}
+		}
+
+		/// @brief Move the open batch to the ready list, must be called with lock held
+		void seal()
+		{
+			if (current.events == 0)
+			{
+				return;
+			}
+			if (config.protocol == NETWORK_PROTOCOL::TCP)
+			{
+				setNumber(current.data, 0, current.data.size() - 4, 4);
+			}
+			pendingBytes += current.data.size();
+			ready.push_back(std::move(current));
+			current = Batch();
+		}
+
+		/// @brief Count dropped events, a warning is added to the next batch, must be called with lock held
+		void drop(uint64_t events)
+		{
+			dropped.fetch_add(events, std::memory_order_relaxed);
+			unreported += events;
+		}
+
+		/// @brief Main function of the sending thread
+		void run()
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			while (!pausing)
+			{
+				auto now = std::chrono::steady_clock::now();
+				bool last = stopping;
+				uint64_t flushing = flushRequested;
+				if (current.events > 0 && (last || flushing > flushedUpTo || now - opened >= config.linger))
+				{
+					seal();
+				}
+
+				// batches go out when a connection can be tried, or to the spill file while there is none
+				bool waiting = !ready.empty() || spillBytes > 0;
+				bool due = now >= nextAttempt || last;
+				if ((waiting && due) || (!ready.empty() && socket == net::NO_SOCKET && !config.spillFile.empty()))
+				{
+					std::deque<Batch> sending;
+					sending.swap(ready);
+					size_t taken = pendingBytes;
+					guard.unlock();
+					uint64_t lost = deliver(sending, last);
+					guard.lock();
+
+					// what couldn't be sent goes back in front of the batches sealed meanwhile
+					size_t kept = 0;
+					for (auto batch = sending.rbegin(); batch != sending.rend(); ++batch)
+					{
+						kept += batch->data.size();
+						ready.push_front(std::move(*batch));
+					}
+					pendingBytes -= taken - kept;
+					if (lost > 0)
+					{
+						drop(lost);
+					}
+				}
+
+				if (flushing > flushedUpTo)
+				{
+					flushedUpTo = flushing;
+					flushed.notify_all();
+				}
+				if (last)
+				{
+					break;
+				}
+
+				// sleep until the open batch has lingered long enough or the next connection can be tried
+				auto until = std::chrono::steady_clock::time_point::max();
+				if (current.events > 0)
+				{
+					until = opened + config.linger;
+				}
+				if (!ready.empty() || spillBytes > 0)
+				{
+					until = std::min(until, nextAttempt);
+				}
+				if (until == std::chrono::steady_clock::time_point::max())
+				{
+					wake.wait(guard, [this] { return stopping || kicked || pausing; });
+				}
+				else
+				{
+					wake.wait_until(guard, until, [this] { return stopping || kicked || pausing; });
+				}
+				kicked = false;
+			}
+		}
+
+		/// @brief Send the spilled batches and then the given ones, the lock is not held
+		/// @param sending [in,out] batches to send, the ones that couldn't be sent or spilled are left in it
+		/// @param last whether to try connecting even if the next attempt isn't due yet
+		/// @return number of events dropped because the spill file was full
+		uint64_t deliver(std::deque<Batch>& sending, bool last)
+		{
+			for (Batch& batch : sending)
+			{
+				pack(batch);
+			}
+			if (socket == net::NO_SOCKET && (last || std::chrono::steady_clock::now() >= nextAttempt))
+			{
+				reconnect();
+			}
+			if (socket != net::NO_SOCKET)
+			{
+				sendSpilled();
+			}
+			while (socket != net::NO_SOCKET && !sending.empty())
+			{
+				if (!send(sending.front()))
+				{
+					disconnect();
+					break;
+				}
+				sending.pop_front();
+			}
+
+			uint64_t lost = 0;
+			if (socket == net::NO_SOCKET && !config.spillFile.empty())
+			{
+				for (const Batch& batch : sending)
+				{
+					if (!spill(batch))
+					{
+						lost += batch.events;
+					}
+				}
+				sending.clear();
+			}
+			return lost;
+		}
+
+		/// @brief Compress a TCP batch if compression is on and it makes the batch smaller, the lock is not held
+		/// @param batch [in,out] the batch, left as it is if it is already compressed
+		void pack(Batch& batch)
+		{
+			if (!config.compress || config.protocol != NETWORK_PROTOCOL::TCP || batch.data.size() <= 4
+				|| (binary::get(batch.data.data(), 4) & COMPRESSED_FRAME) != 0)
+			{
+				return;
+			}
+			std::string_view events(batch.data.data() + 4, batch.data.size() - 4);
+			packed.clear();
+			if (!compress(events, packed) || packed.empty() || packed.size() >= events.size())
+			{
+				return;
+			}
+			batch.data.resize(4);
+			batch.data.append(packed);
+			setNumber(batch.data, 0, packed.size() | COMPRESSED_FRAME, 4);
+		}
+
+		/// @brief Compress the events of a batch with the configured compressor, or zlib
+		/// @return false if the events were not compressed
+		bool compress(std::string_view in, std::string& out) const
+		{
+			if (config.compressor)
+			{
+				return config.compressor(in, out);
+			}
+#ifdef BOOM_USE_ZLIB
+			uLongf size = compressBound((uLong)in.size());
+			out.resize(size);
+			int result = compress2((Bytef*)&out[0], &size, (const Bytef*)in.data(), (uLong)in.size(), Z_DEFAULT_COMPRESSION);
+			out.resize(result == Z_OK ? size : 0);
+			return result == Z_OK;
+#else
+			return false;
+#endif
+		}
+
+		/// @brief Send one batch, with UDP the datagrams that went out are taken off the batch if it fails part way
+		/// @param batch the batch to send
+		/// @return false if the connection failed
+		bool send(Batch& batch)
+		{
+			if (config.protocol == NETWORK_PROTOCOL::TCP)
+			{
+				if (!net::sendAll(socket, batch.data.data(), batch.data.size()))
+				{
+					return false;
+				}
+				sent.fetch_add(batch.events, std::memory_order_relaxed);
+				bytesSent.fetch_add(batch.data.size(), std::memory_order_relaxed);
+				return true;
+			}
+
+			messages.clear();
+			size_t at = 0;
+			while (at + 2 <= batch.data.size())
+			{
+				size_t size = (size_t)binary::get(batch.data.data() + at, 2);
+				if (at + 2 + size > batch.data.size())
+				{
+					break;
+				}
+				messages.emplace_back(batch.data.data() + at + 2, size);
+				at += 2 + size;
+			}
+			size_t done = net::sendDatagrams(socket, messages);
+			sent.fetch_add(done, std::memory_order_relaxed);
+			for (size_t i = 0; i < done; ++i)
+			{
+				bytesSent.fetch_add(messages[i].size(), std::memory_order_relaxed);
+			}
+			if (done == messages.size())
+			{
+				return true;
+			}
+			batch.data.erase(0, (size_t)(messages[done].data() - batch.data.data()) - 2);
+			batch.events -= (uint32_t)done;
+			return false;
+		}
+
+		/// @brief Try to connect, after a failure the next attempt waits twice as long as the last one
+		void reconnect()
+		{
+			socket = net::connect(config.host, config.port, config.protocol == NETWORK_PROTOCOL::UDP_SYSLOG, config.timeout);
+			if (socket == net::NO_SOCKET)
+			{
+				retryLater();
+				return;
+			}
+			backoff = config.reconnectMin;
+			connected.store(true, std::memory_order_relaxed);
+		}
+
+		/// @brief Close a connection that failed
+		void disconnect()
+		{
+			net::close(socket);
+			socket = net::NO_SOCKET;
+			connected.store(false, std::memory_order_relaxed);
+			retryLater();
+		}
+
+		/// @brief Put off the next attempt to connect
+		void retryLater()
+		{
+			nextAttempt = std::chrono::steady_clock::now() + backoff;
+			backoff = std::min(backoff * 2, config.reconnectMax);
+		}
+
+		/// @brief Add a batch to the end of the spill file
+		/// @param batch the batch to keep
+		/// @return false if the file is full or can't be written
+		bool spill(const Batch& batch)
+		{
+			size_t size = SPILL_HEADER + batch.data.size();
+			if (spillBytes + size > config.spillLimit)
+			{
+				return false;
+			}
+			std::string header;
+			binary::put(header, batch.events, 4);
+			binary::put(header, batch.data.size(), 4);
+			std::ofstream out(config.spillFile, std::ios::binary | std::ios::app);
+			out.write(header.data(), header.size());
+			out.write(batch.data.data(), batch.data.size());
+			out.close();
+			if (out.fail())
+			{
+				// don't leave half a batch in front of the next one
+				std::error_code error;
+				std::filesystem::resize_file(config.spillFile, spillBytes, error);
+				return false;
+			}
+			spillBytes += size;
+			spilled.fetch_add(batch.events, std::memory_order_relaxed);
+			return true;
+		}
+
+		/// @brief Read the next batch of the spill file
+		/// @param in the spill file
+		/// @param batch [out] receives the batch
+		/// @return false at the end of the file or if the batch is damaged
+		bool readSpilled(std::ifstream& in, Batch& batch) const
+		{
+			char header[SPILL_HEADER];
+			if (!in.read(header, SPILL_HEADER))
+			{
+				return false;
+			}
+			size_t size = (size_t)binary::get(header + 4, 4);
+			if (size > config.spillLimit)
+			{
+				return false;
+			}
+			batch.events = (uint32_t)binary::get(header, 4);
+			batch.data.resize(size);
+			return (bool)in.read(&batch.data[0], size);
+		}
+
+		/// @brief Send the batches in the spill file, oldest first, the file is removed once they have all gone
+		void sendSpilled()
+		{
+			if (spillBytes == 0)
+			{
+				return;
+			}
+			std::ifstream in(config.spillFile, std::ios::binary);
+			in.seekg((std::streamoff)spillRead);
+			Batch batch;
+			while (spillRead < spillBytes)
+			{
+				if (!readSpilled(in, batch))
+				{
+					spillRead = spillBytes; // the rest of the file is damaged
+					break;
+				}
+				uint32_t events = batch.events;
+				if (!send(batch))
+				{
+					disconnect();
+					return;
+				}
+				spillRead += SPILL_HEADER + batch.data.size();
+				spilled.fetch_sub(events, std::memory_order_relaxed);
+			}
+			in.close();
+			std::remove(config.spillFile.c_str());
+			spillRead = 0;
+			spillBytes = 0;
+			spilled.store(0, std::memory_order_relaxed);
+		}
+
+		/// @brief Pick up the batches an earlier run left in the spill file, a damaged batch at the end is cut off
+		void loadSpill()
+		{
+			std::ifstream in(config.spillFile, std::ios::binary);
+			Batch batch;
+			while (in.is_open() && readSpilled(in, batch))
+			{
+				spillBytes += SPILL_HEADER + batch.data.size();
+				spilled.fetch_add(batch.events, std::memory_order_relaxed);
+			}
+			in.close();
+			std::error_code error;
+			if (std::filesystem::exists(config.spillFile, error) && std::filesystem::file_size(config.spillFile, error) != spillBytes)
+			{
+				std::filesystem::resize_file(config.spillFile, spillBytes, error);
+			}
+		}
+
+		/// @brief Where to send events and how
+		NetworkConfig config;
+
+		/// @brief Host, APP-NAME and PROCID of syslog messages, with the spaces after them
+		std::string syslogFields;
+
+		/// @brief Turns events into records for binary batches
+		binary::Encoder encoder;
+
+		/// @brief The batch being collected
+		Batch current;
+
+		/// @brief When the first event of the open batch arrived
+		std::chrono::steady_clock::time_point opened;
+
+		/// @brief Sealed batches waiting to be sent, oldest first
+		std::deque<Batch> ready;
+
+		/// @brief Bytes of the batches in ready and of those being sent
+		size_t pendingBytes = 0;
+
+		/// @brief Events dropped since the last warning was added to a batch
+		uint64_t unreported = 0;
+
+		/// @brief Whether the sending thread has been woken on purpose
+		bool kicked = false;
+
+		/// @brief Whether the sending thread should make a last attempt and stop
+		bool stopping = false;
+
+		/// @brief Whether the sending thread should stop straight away, for fork()
+		bool pausing = false;
+
+		/// @brief Flushes asked for, and the last one the sending thread has dealt with
+		uint64_t flushRequested = 0;
+		uint64_t flushedUpTo = 0;
+
+		/// @brief Only used by the sending thread
+		net::Socket socket = net::NO_SOCKET;
+		std::chrono::milliseconds backoff;
+		std::chrono::steady_clock::time_point nextAttempt;
+		std::vector<std::string_view> messages;
+		std::string packed;
+
+		/// @brief Size of the spill file and how much of it has been sent, only used by the sending thread
+		size_t spillBytes = 0;
+		size_t spillRead = 0;
+
+		std::atomic<bool> connected = false;
+		std::atomic<uint64_t> sent = 0;
+		std::atomic<uint64_t> bytesSent = 0;
+		std::atomic<uint64_t> dropped = 0;
+		std::atomic<uint64_t> spilled = 0;
+
+		/// @brief Guards the batches, the sending thread only holds it while it takes them
+		std::mutex lock;
+		std::condition_variable wake;
+		std::condition_variable flushed;
+		std::thread worker;
+	};
+
+	/// @brief Writing events out when the program may be about to crash
+	/// Nothing here allocates or takes a lock, so it can be used from a signal handler
+	namespace crash
+	{
+		/// @brief Longest line written for one event, longer events are cut short
+		const size_t LINE_SIZE = 2048;
+
+		/// @brief Open a file for unbuffered appending
+		/// @param name the file
+		/// @return the file descriptor, -1 if it couldn't be opened
+		inline int open(const std::string& name)
+		{
+#ifdef _WIN32
+			return ::_open(name.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+			return ::open(name.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+#endif
+		}
+
+		/// @brief Close a file opened by open()
+		inline void close(int fd)
+		{
+#ifdef _WIN32
+			::_close(fd);
+#else
+			::close(fd);
+#endif
+		}
+
+		/// @brief Write all of the data, retrying after interruptions
+		inline void write(int fd, const char* data, size_t size)
+		{
+			while (size > 0)
+			{
+#ifdef _WIN32
+				int done = ::_write(fd, data, (unsigned)size);
+#else
+				ssize_t done = ::write(fd, data, size);
+				if (done < 0 && errno == EINTR)
+				{
+					continue;
+				}
+#endif
+				if (done <= 0)
+				{
+					return;
+				}
+				data += done;
+				size -= (size_t)done;
+			}
+		}
+
+		/// @brief Adds text to a fixed buffer, dropping whatever doesn't fit
+		struct Line
+		{
+			Line(char* buffer, size_t capacity) : buffer(buffer), end(capacity - 1) // room is kept for the newline
+			{}
+
+			void add(const char* text, size_t size)
+			{
+				size_t room = end - used;
+				size = size < room ? size : room;
+				std::memcpy(buffer + used, text, size);
+				used += size;
+			}
+
+			void add(std::string_view text)
+			{
+				add(text.data(), text.size());
+			}
+
+			/// @brief Same as add, so a Line can be written to like a std::string
+			void append(const char* text, size_t size)
+			{
+				add(text, size);
+			}
+
+			/// @brief Add a number with at least the given number of digits
+			void add(uint64_t value, int digits)
+			{
+				char text[20];
+				int size = 0;
+				do
+				{
+					text[sizeof(text) - 1 - size++] = (char)('0' + value % 10);
+					value /= 10;
+				} while ((value > 0 || size < digits) && size < (int)sizeof(text));
+				add(text + sizeof(text) - size, (size_t)size);
+			}
+
+			/// @brief Add the time as 2000-01-31T12:00:00.000Z, worked out without the C library so it is safe in a signal handler
+			void add(std::chrono::time_point<std::chrono::system_clock> time)
+			{
+				int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+				int64_t days = (ms >= 0 ? ms : ms - 86399999) / 86400000;
+				int64_t ofDay = ms - days * 86400000;
+
+				// civil date from days since 1970-01-01
+				days += 719468;
+				int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+				int64_t ofEra = days - era * 146097;
+				int64_t yearOfEra = (ofEra - ofEra / 1460 + ofEra / 36524 - ofEra / 146096) / 365;
+				int64_t ofYear = ofEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+				int64_t shifted = (5 * ofYear + 2) / 153;
+				int64_t day = ofYear - (153 * shifted + 2) / 5 + 1;
+				int64_t month = shifted < 10 ? shifted + 3 : shifted - 9;
+				int64_t year = yearOfEra + era * 400 + (month <= 2 ? 1 : 0);
+
+				add((uint64_t)year, 4);
+				add("-", 1);
+				add((uint64_t)month, 2);
+				add("-", 1);
+				add((uint64_t)day, 2);
+				add("T", 1);
+				add((uint64_t)(ofDay / 3600000), 2);
+				add(":", 1);
+				add((uint64_t)(ofDay / 60000 % 60), 2);
+				add(":", 1);
+				add((uint64_t)(ofDay / 1000 % 60), 2);
+				add(".", 1);
+				add((uint64_t)(ofDay % 1000), 3);
+				add("Z ", 2);
+			}
+
+			/// @brief End the line
+			/// @return the size of the line
+			size_t finish()
+			{
+				buffer[used++] = '\n';
+				return used;
+			}
+
+			char* buffer;
+			size_t end;
+			size_t used = 0;
+		};
+
+		/// @brief Format the parts of an event the way toString() does, but with a UTC timestamp and a newline
+		/// Nothing is allocated, so it can be used before an Event is built and in signal handlers
+		/// @param fields key-value pairs to add after the message, nullptr if none
+		/// @param out buffer to write to
+		/// @param size size of the buffer
+		/// @return size of the line
+		inline size_t format(LEVELS level, std::chrono::time_point<std::chrono::system_clock> timestamp, std::string_view msg,
+			std::string_view source, std::string_view code, const Fields* fields, char* out, size_t size)
+		{
+			Line line(out, size);
+			line.add(Event::levelSymbol(level), 3);
+			line.add(timestamp);
+			if (!code.empty())
+			{
+				line.add("[", 1);
+				line.add(code);
+				line.add("] ", 2);
+			}
+			line.add(msg);
+			if (fields != nullptr)
+			{
+				fields->appendTo(line);
+			}
+			if (!source.empty())
+			{
+				line.add(" (from ", 7);
+				line.add(source);
+				line.add(")", 1);
+			}
+			return line.finish();
+		}
+
+		/// @brief Format an event the way toString() does, but with a UTC timestamp and a newline
+		/// A deferred message is written as its format, as the arguments can't be formatted without allocating
+		/// @param event the event
+		/// @param out buffer to write to
+		/// @param size size of the buffer
+		/// @return size of the line
+		inline size_t format(const Event& event, char* out, size_t size)
+		{
+			return format(event.level, event.timestamp, event.msg.view(), event.getSource(), event.getCode(), &event.fields, out, size);
+		}
+
+		/// @brief Format a note from the logger itself, at the critical level
+		/// @param text what happened
+		/// @param detail more about it, can be empty
+		/// @param out buffer to write to
+		/// @param size size of the buffer
+		/// @return size of the line
+		inline size_t note(std::string_view text, std::string_view detail, char* out, size_t size)
+		{
+			Line line(out, size);
+			line.add(Event::levelSymbol(LEVELS::CRITICAL), 3);
+			line.add(std::chrono::system_clock::now());
+			line.add(text);
+			line.add(detail);
+			return line.finish();
+		}
+
+#ifndef _WIN32
+		/// @brief A thread's own stack for the crash signal handlers, so they still run when the thread's stack has overflowed
+		/// Signal stacks belong to a thread, so each logging thread sets one up the first time it logs while crash signals are handled
+		class SignalStack
+		{
+		public:
+			/// @brief Bytes in each stack
+			static const size_t SIZE = 64 * 1024;
+
+			/// @brief Give the calling thread a signal stack, unless it already has one
+			static void install()
+			{
+				static thread_local SignalStack stack;
+				if (!stack.checked)
+				{
+					stack.setUp();
+				}
+			}
+
+			/// @brief Destructor, runs when the thread exits
+			~SignalStack()
+			{
+				if (memory != nullptr)
+				{
+					stack_t current = {};
+					if (sigaltstack(nullptr, &current) == 0 && current.ss_sp == memory)
+					{
+						stack_t off = {};
+						off.ss_flags = SS_DISABLE;
+						sigaltstack(&off, nullptr);
+					}
+					delete[] memory;
+				}
+			}
+
+		private:
+			/// @brief Allocate and install the stack, keeping one the thread set up for itself
+			void setUp()
+			{
+				checked = true;
+				stack_t current = {};
+				if (sigaltstack(nullptr, &current) == 0 && !(current.ss_flags & SS_DISABLE))
+				{
+					return;
+				}
+				memory = new (std::nothrow) char[SIZE];
+				if (memory == nullptr)
+				{
+					return;
+				}
+				stack_t stack = {};
+				stack.ss_sp = memory;
+				stack.ss_size = SIZE;
+				if (sigaltstack(&stack, nullptr) != 0)
+				{
+					delete[] memory;
+					memory = nullptr;
+				}
+			}
+
+			bool checked = false;
+			char* memory = nullptr;
+		};
+#endif
+
+		/// @brief Name of a crash signal
+		inline const char* signalName(int signal)
+		{
+			switch (signal)
+			{
+			case SIGSEGV: return "SIGSEGV";
+			case SIGABRT: return "SIGABRT";
+			case SIGFPE: return "SIGFPE";
+			case SIGILL: return "SIGILL";
+#ifndef _WIN32
+			case SIGBUS: return "SIGBUS";
+#endif
+			}
+			return "unknown signal";
+		}
+	}
+
+	/// @brief A fixed size queue that many threads can add to without taking a lock
+	/// Each slot is allocated up front and reused. A producer reserves a slot by claiming its
+	/// sequence number, fills it in place and then publishes it for the consumer.
+	/// Items can also be removed by producers, which is how the oldest event is dropped when the queue is full.
+	/// @tparam T type of the items being queued
+	template <typename T>
+	class RingBuffer
+	{
+	public:
+		/// @brief Constructor
+		/// @param minCapacity the smallest number of slots needed, rounded up to a power of two
+		RingBuffer(size_t minCapacity) : head(0), tail(0)
+		{
+			size_t size = 2;
+			while (size < minCapacity)
+			{
+				size <<= 1;
+			}
+			mask = size - 1;
+			slots.reset(new Slot[size]);
+			for (size_t i = 0; i < size; ++i)
+			{
+				slots[i].sequence.store(i, std::memory_order_relaxed);
+			}
+		}
+
+		/// @brief Claim the next free slot
+		/// @param ticket [out] identifies the slot, pass it to publish() once the slot has been filled
+		/// @param retries [out] number of times another producer claimed the slot first
+		/// @return the slot to fill, or nullptr if the queue is full
+		T* reserve(size_t& ticket, size_t& retries)
+		{
+			size_t pos = head.load(std::memory_order_relaxed);
+			while (true)
+			{
+				Slot& slot = slots[pos & mask];
+				size_t seq = slot.sequence.load(std::memory_order_acquire);
+				intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+				if (diff == 0)
+				{
+					if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					{
+						ticket = pos;
+						return &slot.value;
+					}
+					++retries;
+				}
+				else if (diff < 0)
+				{
+					return nullptr;
+				}
+				else
+				{
+					pos = head.load(std::memory_order_relaxed);
+					++retries;
+				}
+			}
+		}
+
+		/// @brief Make a reserved slot visible to the consumer
+		/// @param ticket the value returned by reserve()
+		void publish(size_t ticket)
+		{
+			slots[ticket & mask].sequence.store(ticket + 1, std::memory_order_release);
+		}
+
+		/// @brief Take the oldest item off the queue
+		/// The item is swapped with out, so the slot keeps out's old storage for reuse
+		/// @param out [out] receives the item
+		/// @return false if there was nothing to take
+		bool pop(T& out)
+		{
+			Slot* slot = claim();
+			if (slot == nullptr)
+			{
+				return false;
+			}
+			std::swap(out, slot->value);
+			release(slot);
+			return true;
+		}
+
+		/// @brief Take the oldest item and use it where it is, without moving it
+		/// Safe alongside the consumer and producers, so it can be used to empty the queue in an emergency
+		/// @param use called with the item
+		/// @return false if there was nothing to take
+		template <typename F>
+		bool consume(F&& use)
+		{
+			Slot* slot = claim();
+			if (slot == nullptr)
+			{
+				return false;
+			}
+			use(slot->value);
+			release(slot);
+			return true;
+		}
+
+		/// @brief Throw away the oldest item
+		/// @return false if there was nothing to throw away
+		bool discard()
+		{
+			Slot* slot = claim();
+			if (slot == nullptr)
+			{
+				return false;
+			}
+			release(slot);
+			return true;
+		}
+
+		/// @brief Check if there is anything in the queue, including slots that are reserved but not published yet
+		/// @return true if nothing is queued
+		bool empty() const
+		{
+			return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+		}
+
+		/// @brief Approximate number of queued items
+		/// @return number of reserved slots that haven't been taken yet
+		size_t size() const
+		{
+			size_t t = tail.load(std::memory_order_acquire);
+			size_t h = head.load(std::memory_order_acquire);
+			return h > t ? h - t : 0;
+		}
+
+		/// @brief Number of slots
+		/// @return the capacity
+		size_t capacity() const
+		{
+			return mask + 1;
+		}
+
+		/// @brief Total number of slots that have ever been reserved
+		/// @return the total
+		size_t reserved() const
+		{
+			return head.load(std::memory_order_relaxed);
+		}
+
+	private:
+		/// @brief One item in the queue along with the sequence number that says who owns it
+		struct alignas(64) Slot
+		{
+			std::atomic<size_t> sequence;
+			T value;
+		};
+
+		/// @brief Claim the oldest published slot
+		/// @return the slot or nullptr if nothing is published
+		Slot* claim()
+		{
+			size_t pos = tail.load(std::memory_order_relaxed);
+			while (true)
+			{
+				Slot& slot = slots[pos & mask];
+				size_t seq = slot.sequence.load(std::memory_order_acquire);
+				intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+				if (diff == 0)
+				{
+					if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					{
+						return &slot;
+					}
+				}
+				else if (diff < 0)
+				{
+					return nullptr;
+				}
+				else
+				{
+					pos = tail.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		/// @brief Hand a claimed slot back to the producers
+		/// @param slot the slot returned by claim()
+		void release(Slot* slot)
+		{
+			size_t pos = slot->sequence.load(std::memory_order_relaxed) - 1;
+			slot->sequence.store(pos + mask + 1, std::memory_order_release);
+		}
+
+		/// @brief The slots, allocated once
+		std::unique_ptr<Slot[]> slots;
+
+		/// @brief Used to turn a position into a slot index
+		size_t mask;
+
+		/// @brief Next position for producers to reserve, kept on its own cache line
+		alignas(64) std::atomic<size_t> head;
+
+		/// @brief Next position for the consumer to take, kept on its own cache line
+		alignas(64) std::atomic<size_t> tail;
+	};
+
+	/// @brief Token buckets for each kind of event, spread over shards that each have their own lock
+	/// so threads logging different events rarely wait for each other
+	class RateLimiter
+	{
+	public:
+		/// @brief Number of shards, a power of two
+		static const size_t SHARDS = 64;
+
+		/// @brief Most kinds of event tracked by one shard, events of further kinds share the shard's overflow bucket
+		static const size_t MAX_BUCKETS = 1024;
+
+		/// @brief A summary of held back events, ready to be logged
+		struct Summary
+		{
+			LEVELS level;
+			std::string msg;
+			std::string source;
+			std::string code;
+		};
+
+		/// @brief Change the limit, forgetting everything counted so far
+		/// @param limit the new limit
+		void configure(const RateLimit& limit)
+		{
+			enabled = false;
+			for (auto& shard : shards)
+			{
+				std::lock_guard<std::mutex> guard(shard.lock);
+				shard.limit = limit;
+				shard.buckets.clear();
+				shard.overflow = Bucket();
+				shard.overflowTotal = 0;
+			}
+			levels = limit.levels;
+			interval = std::chrono::duration_cast<std::chrono::nanoseconds>(limit.summaryInterval).count();
+			enabled = limit.eventsPerSecond > 0;
+		}
+
+		/// @brief Take a token for an event
+		/// @param site ID of the call site the event is logged from, 0 to tell events apart by their strings
+		/// @return false if the event should be held back
+		bool allow(LEVELS level, std::string_view msg, std::string_view source, std::string_view code, uint32_t site = 0)
+		{
+			if (!enabled.load(std::memory_order_relaxed) || (levels.load(std::memory_order_relaxed) & level) == 0)
+			{
+				return true;
+			}
+
+			// a call site is its own kind of event, so its ID is the key and nothing needs hashing
+			uint64_t key = site != 0 ? ((uint64_t)level << 32 | site) * 0x9E3779B97F4A7C15ull
+				: hash(level, source.empty() && code.empty() ? msg : std::string_view(), source, code);
+			int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+			Shard& shard = shards[key & (SHARDS - 1)];
+			bool allowed = true;
+			{
+				std::lock_guard<std::mutex> guard(shard.lock);
+				auto found = shard.buckets.find(key);
+				Bucket* tracked = nullptr;
+				if (found != shard.buckets.end())
+				{
+					tracked = &found->second;
+				}
+				else if (shard.buckets.size() < MAX_BUCKETS)
+				{
+					tracked = &shard.buckets.emplace(key, Bucket()).first->second;
+					tracked->tokens = shard.limit.burst;
+					tracked->last = now;
+				}
+				else
+				{
+					// a flood of different kinds is limited together rather than not at all
+					tracked = &shard.overflow;
+					++shard.overflowTotal;
+				}
+
+				Bucket& bucket = *tracked;
+				double refill = (double)(now - bucket.last) * 1e-9 * shard.limit.eventsPerSecond;
+				bucket.tokens = std::min(shard.limit.burst, bucket.tokens + refill);
+				bucket.last = now;
+				if (bucket.tokens >= 1)
+				{
+					bucket.tokens -= 1;
+				}
+				else
+				{
+					if (bucket.held == 0)
+					{
+						// remember what to say in the summary, once per summary
+						bucket.level = level;
+						bucket.msg.assign(msg.data(), msg.size());
+						bucket.source.assign(source.data(), source.size());
+						bucket.code.assign(code.data(), code.size());
+					}
+					++bucket.held;
+					++shard.heldTotal;
+					allowed = false;
+				}
+			}
+			return allowed;
+		}
+
+		/// @brief Collect summaries of held back events, at most once per summary interval unless forced
+		/// @param force whether to collect now, whatever the time
+		/// @return the summaries to log
+		std::vector<Summary> collect(bool force)
+		{
+			std::vector<Summary> summaries;
+			if (!enabled.load(std::memory_order_relaxed))
+			{
+				return summaries;
+			}
+			int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+			int64_t due = nextCollect.load(std::memory_order_relaxed);
+			if (!force && (now < due || !nextCollect.compare_exchange_strong(due, now + interval.load(std::memory_order_relaxed))))
+			{
+				return summaries; // not time yet, or another thread is collecting
+			}
+
+			for (auto& shard : shards)
+			{
+				std::lock_guard<std::mutex> guard(shard.lock);
+				for (auto it = shard.buckets.begin(); it != shard.buckets.end();)
+				{
+					Bucket& bucket = it->second;
+					if (bucket.held > 0)
+					{
+						summaries.push_back({ bucket.level,
+							bucket.msg + " (repeated " + std::to_string(bucket.held) + " more times)", bucket.source, bucket.code });
+						bucket.held = 0;
+					}
+					// forget events that have gone quiet and have their full burst back
+					double idle = (double)(now - bucket.last) * 1e-9 * shard.limit.eventsPerSecond;
+					if (bucket.tokens + idle >= shard.limit.burst)
+					{
+						it = shard.buckets.erase(it);
+					}
+					else
+					{
+						++it;
+					}
+				}
+				if (shard.overflow.held > 0)
+				{
+					summaries.push_back({ shard.overflow.level, shard.overflow.msg + " (held back with events of other kinds "
+						+ std::to_string(shard.overflow.held) + " times)", shard.overflow.source, shard.overflow.code });
+					shard.overflow.held = 0;
+				}
+			}
+			return summaries;
+		}
+
+		/// @brief Number of events held back
+		/// @return the total since the limit was last configured
+		uint64_t getHeldCount()
+		{
+			uint64_t total = 0;
+			for (auto& shard : shards)
+			{
+				std::lock_guard<std::mutex> guard(shard.lock);
+				total += shard.heldTotal;
+			}
+			return total;
+		}
+
+		/// @brief Number of events whose kind wasn't tracked because its shard was full, they share a bucket instead
+		/// @return the total since the limit was last configured
+		uint64_t getOverflowCount()
+		{
+			uint64_t total = 0;
+			for (auto& shard : shards)
+			{
+				std::lock_guard<std::mutex> guard(shard.lock);
+				total += shard.overflowTotal;
+			}
+			return total;
+		}
+
+	private:
+		/// @brief State of one kind of event
+		struct Bucket
+		{
+			double tokens = 0;
+			int64_t last = 0;
+			uint64_t held = 0;
+			LEVELS level = LEVELS::INFO;
+			std::string msg;
+			std::string source;
+			std::string code;
+		};
+
+		/// @brief Some of the buckets with their lock, on a cache line of their own
+		struct alignas(64) Shard
+		{
+			std::mutex lock;
+			std::unordered_map<uint64_t, Bucket> buckets;
+			Bucket overflow;
+			RateLimit limit;
+			uint64_t heldTotal = 0;
+			uint64_t overflowTotal = 0;
+		};
+
+		/// @brief Combine what identifies a kind of event into one number (FNV-1a)
+		static uint64_t hash(LEVELS level, std::string_view msg, std::string_view source, std::string_view code)
+		{
+			uint64_t h = 14695981039346656037ull ^ (uint64_t)level;
+			for (std::string_view part : { msg, source, code })
+			{
+				for (char c : part)
+				{
+					h = (h ^ (uint8_t)c) * 1099511628211ull;
+				}
+				h = (h ^ 0xFF) * 1099511628211ull; // keeps "ab","c" apart from "a","bc"
+			}
+			return h;
+		}
+
+		std::array<Shard, SHARDS> shards;
+		std::atomic<bool> enabled = false;
+		std::atomic<int> levels = ALL_LEVELS;
+		std::atomic<int64_t> interval = 0;
+		std::atomic<int64_t> nextCollect = 0;
+	};
+
+	/// @brief Queue of events from one thread to the background writer
+	/// Only the owning thread adds events and only the writer takes them, so neither side needs to wait for the other
+	class ThreadBuffer
+	{
+	public:
+		/// @brief Constructor
+		/// @param minCapacity the smallest number of events to hold, rounded up to a power of two
+		ThreadBuffer(size_t minCapacity) : head(0), tail(0)
+		{
+			size_t size = 2;
+			while (size < minCapacity)
+			{
+				size <<= 1;
+			}
+			mask = size - 1;
+			slots.reset(new Event[size]);
+		}
+
+		/// @brief Get the next free slot, called by the owning thread
+		/// @return the slot to fill, or nullptr if the buffer is full
+		Event* reserve()
+		{
+			size_t h = head.load(std::memory_order_relaxed);
+			if (h - tail.load(std::memory_order_acquire) > mask)
+			{
+				return nullptr;
+			}
+			return &slots[h & mask];
+		}
+
+		/// @brief Make the reserved slot visible to the writer
+		void publish()
+		{
+			head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+
+		/// @brief Take the oldest event, called by the writer
+		/// The event is swapped with out, so the slot keeps out's old storage for reuse
+		/// @param out [out] receives the event
+		/// @return false if the buffer is empty
+		bool pop(Event& out)
+		{
+			size_t t = tail.load(std::memory_order_relaxed);
+			if (t == head.load(std::memory_order_acquire))
+			{
+				return false;
+			}
+			std::swap(out, slots[t & mask]);
+			tail.store(t + 1, std::memory_order_release);
+			return true;
+		}
+
+		/// @brief Check if the writer has taken every published event
+		/// @return true if nothing is waiting
+		bool empty() const
+		{
+			return tail.load(std::memory_order_acquire) == head.load(std::memory_order_acquire);
+		}
+
+		/// @brief Number of events that have been published
+		/// @return the total since the buffer was created
+		size_t published() const
+		{
+			return head.load(std::memory_order_acquire);
+		}
+
+		/// @brief Number of events taken that the writer has finished sending to the streams
+		std::atomic<size_t> delivered = 0;
+
+		/// @brief Set when the owning thread exits, the writer releases the buffer once it is empty
+		std::atomic<bool> orphaned = false;
+
+	private:
+		/// @brief The slots, allocated once
+		std::unique_ptr<Event[]> slots;
+
+		/// @brief Used to turn a position into a slot index
+		size_t mask;
+
+		/// @brief Next position for the owning thread to fill, kept on its own cache line
+		alignas(64) std::atomic<size_t> head;
+
+		/// @brief Next position for the writer to take, kept on its own cache line
+		alignas(64) std::atomic<size_t> tail;
+	};
+
+	/// @brief A thread that hands events to one or more streams, each with a queue of its own
+	/// The queues hold shared pointers, so an event sent to several worker streams is only stored once
+	class StreamWorker
+	{
+	public:
+		/// @brief Events waiting for one stream, changed while the worker's lock is held
+		struct Queue
+		{
+			/// @brief Constructor
+			/// @param stream the stream the events are for
+			/// @param config the size of the queue and what to do when it is full
+			Queue(Stream* stream, const WorkerConfig& config)
+				: stream(stream), config(config), slots(std::max<size_t>(config.capacity, 1))
+			{}
+
+			/// @brief Check if the queue was built from the same settings
+			bool matches(const WorkerConfig& other) const
+			{
+				return config.mode == other.mode && config.capacity == other.capacity && config.overflow == other.overflow;
+			}
+
+			Stream* stream;
+			WorkerConfig config;
+			std::vector<std::shared_ptr<const Event>> slots;
+			size_t head = 0;
+			size_t count = 0;
+
+			/// @brief Whether the worker is handing events from the queue to the stream
+			bool busy = false;
+
+			/// @brief Events discarded because the queue was full
+			std::atomic<uint64_t> dropped = 0;
+
+			/// @brief The worker serving the queue
+			StreamWorker* worker = nullptr;
+		};
+
+		/// @brief Constructor, starts the thread
+		/// @param dedicated whether the worker only ever serves one stream
+		/// @param timed set while every call to a stream should be timed
+		StreamWorker(bool dedicated, const std::atomic<bool>& timed) : dedicated(dedicated), timed(timed)
+		{
+			start();
+		}
+
+		/// @brief Copy constructor, not used
+		StreamWorker(const StreamWorker&) = delete;
+
+		/// @brief Destructor, hands over every queued event before the thread ends
+		~StreamWorker()
+		{
+			stop();
+		}
+
+		/// @brief The worker the calling thread runs, nullptr if it isn't a worker
+		static StreamWorker*& current()
+		{
+			static thread_local StreamWorker* worker = nullptr;
+			return worker;
+		}
+
+		/// @brief Check if the worker only serves one stream
+		bool isDedicated() const
+		{
+			return dedicated;
+		}
+
+		/// @brief Number of queues the worker serves
+		size_t load()
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			return queues.size();
+		}
+
+		/// @brief Start serving a queue
+		/// @param queue the queue
+		void attach(const std::shared_ptr<Queue>& queue)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			queue->worker = this;
+			queues.push_back(queue);
+		}
+
+		/// @brief Wait until a queue has been emptied, then stop serving it
+		/// @param queue the queue, which nothing may add to any more
+		void detach(Queue* queue)
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			++idleWaiters;
+			idle.wait(guard, [queue] { return queue->count == 0 && !queue->busy; });
+			--idleWaiters;
+			queues.erase(std::remove_if(queues.begin(), queues.end(),
+				[queue](const std::shared_ptr<Queue>& q) { return q.get() == queue; }), queues.end());
+		}
+
+		/// @brief Add events to one of the worker's queues, following its overflow policy when it is full
+		/// A stream that logs from this worker while its queue is full loses the event rather than waiting for itself
+		/// @param queue the stream's queue
+		/// @param events the events
+		/// @param count number of events
+		void push(Queue& queue, const std::shared_ptr<const Event>* events, size_t count)
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			size_t capacity = queue.slots.size();
+			for (size_t i = 0; i < count; ++i)
+			{
+				if (queue.count == capacity && queue.config.overflow == OVERFLOW_POLICY::BLOCK && current() != this)
+				{
+					wake.notify_one();
+					++blocked;
+					space.wait(guard, [&queue, capacity, this] { return queue.count < capacity || stopping; });
+					--blocked;
+				}
+				if (queue.count == capacity)
+				{
+					queue.dropped.fetch_add(1, std::memory_order_relaxed);
+					if (queue.config.overflow != OVERFLOW_POLICY::DROP_OLDEST)
+					{
+						continue;
+					}
+					queue.slots[queue.head].reset();
+					queue.head = (queue.head + 1) % capacity;
+					--queue.count;
+				}
+				queue.slots[(queue.head + queue.count) % capacity] = events[i];
+				++queue.count;
+			}
+			// a busy worker looks at the queues again before it sleeps, so only a sleeping one needs waking
+			bool asleep = sleeping;
+			guard.unlock();
+			if (asleep)
+			{
+				wake.notify_one();
+			}
+		}
+
+		/// @brief Number of events waiting in a queue
+		size_t depth(const Queue& queue)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			return queue.count;
+		}
+
+		/// @brief Wait until every queue has been emptied and handed over
+		void waitIdle()
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			++idleWaiters;
+			idle.wait(guard, [this]
+				{
+					for (auto& queue : queues)
+					{
+						if (queue->count > 0 || queue->busy)
+						{
+							return false;
+						}
+					}
+					return true;
+				});
+			--idleWaiters;
+		}
+
+		/// @brief Start the thread again after stop, the queues are kept
+		void start()
+		{
+			stopping = false;
+			thread = std::thread(&StreamWorker::run, this);
+		}
+
+		/// @brief Hand over the queued events and end the thread
+		void stop()
+		{
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				stopping = true;
+			}
+			wake.notify_all();
+			space.notify_all();
+			if (thread.joinable())
+			{
+				thread.join();
+			}
+		}
+
+	private:
+		/// @brief Main function of the thread, takes turns between the queues so a busy stream doesn't starve the others
+		void run()
+		{
+			current() = this;
+			std::vector<std::shared_ptr<const Event>> batch;
+			std::unique_lock<std::mutex> guard(lock);
+			size_t next = 0;
+			while (true)
+			{
+				Queue* queue = nullptr;
+				for (size_t i = 0; i < queues.size() && queue == nullptr; ++i)
+				{
+					size_t at = (next + i) % queues.size();
+					if (queues[at]->count > 0)
+					{
+						queue = queues[at].get();
+						next = at + 1;
+					}
+				}
+				if (queue == nullptr)
+				{
+					if (stopping)
+					{
+						break;
+					}
+					sleeping = true;
+					wake.wait(guard);
+					sleeping = false;
+					continue;
+				}
+
+				size_t capacity = queue->slots.size();
+				size_t taken = std::min(queue->count, (size_t)MAX_BATCH);
+				for (size_t i = 0; i < taken; ++i)
+				{
+					batch.push_back(std::move(queue->slots[queue->head]));
+					queue->head = (queue->head + 1) % capacity;
+				}
+				queue->count -= taken;
+				queue->busy = true;
+				bool unblock = blocked > 0;
+				guard.unlock();
+				if (unblock)
+				{
+					space.notify_all();
+				}
+
+				queue->stream->deliverShared(batch.data(), batch.size(), timed.load(std::memory_order_relaxed));
+				batch.clear();
+
+				guard.lock();
+				queue->busy = false;
+				if (idleWaiters > 0)
+				{
+					idle.notify_all();
+				}
+			}
+			current() = nullptr;
+		}
+
+		/// @brief Most events handed to a stream at once
+		static const size_t MAX_BATCH = 256;
+
+		/// @brief Whether the worker only serves one stream
+		bool dedicated;
+
+		/// @brief Set while every call to a stream should be timed
+		const std::atomic<bool>& timed;
+
+		/// @brief Guards the queues
+		std::mutex lock;
+
+		/// @brief Signalled when events are added
+		std::condition_variable wake;
+
+		/// @brief Signalled when events are taken off a queue
+		std::condition_variable space;
+
+		/// @brief Signalled when a batch has been handed over
+		std::condition_variable idle;
+
+		/// @brief The queues being served
+		std::vector<std::shared_ptr<Queue>> queues;
+
+		/// @brief Set when the thread should end once the queues are empty
+		bool stopping = false;
+
+		/// @brief Whether the thread is waiting for events
+		bool sleeping = false;
+
+		/// @brief Producers waiting for room in a queue, and threads waiting for the queues to empty
+		size_t blocked = 0;
+		size_t idleWaiters = 0;
+
+		/// @brief The worker thread
+		std::thread thread;
+	};
+
+	/// @brief Storage for the streams the logger owns
+	/// Streams are built in place in blocks cut from large chunks, so they sit close together in memory
+	/// and adding and removing streams reuses the blocks instead of going back to the heap
+	class StreamPool
+	{
+	public:
+		/// @brief Where one owned stream lives, slots are never freed so a handle can always check its slot
+		struct Slot
+		{
+			/// @brief The stream, nullptr while the slot is free
+			Stream* stream = nullptr;
+
+			/// @brief Block the stream was built in, nullptr if it was allocated on its own
+			void* block = nullptr;
+
+			/// @brief Size class of the block
+			size_t sizeClass = 0;
+
+			/// @brief Changes every time the slot's stream is destroyed, so old handles know it has gone
+			std::atomic<uint32_t> generation = 0;
+		};
+
+		/// @brief Smallest block size, each size class is twice the one before
+		static const size_t MIN_BLOCK = 256;
+
+		/// @brief Number of size classes, larger streams are allocated on their own
+		static const size_t CLASS_COUNT = 7;
+
+		/// @brief Blocks in each chunk
+		static const size_t BLOCKS_PER_CHUNK = 8;
+
+		/// @brief Alignment of every block
+		static const size_t BLOCK_ALIGN = 64;
+
+		StreamPool() = default;
+		StreamPool(const StreamPool&) = delete;
+		StreamPool& operator=(const StreamPool&) = delete;
+
+		/// @brief Destructor, the streams must have been destroyed already
+		~StreamPool()
+		{
+			for (void* chunk : chunks)
+			{
+				::operator delete(chunk, std::align_val_t(BLOCK_ALIGN));
+			}
+		}
+
+		/// @brief Build a stream in the pool
+		/// The constructor runs without any lock held, so it can log
+		/// @param out [out] receives the new stream
+		/// @param args passed to the stream's constructor
+		/// @return the slot holding the stream
+		template <typename T, typename... Args>
+		Slot* create(T*& out, Args&&... args)
+		{
+			static_assert(std::is_base_of_v<Stream, T>, "the pool only holds streams");
+			size_t sizeClass = classFor(sizeof(T), alignof(T));
+			void* block = sizeClass < CLASS_COUNT ? take(sizeClass) : nullptr;
+			out = block != nullptr ? new (block) T(std::forward<Args>(args)...) : new T(std::forward<Args>(args)...);
+			return hold(out, block, sizeClass);
+		}
+
+		/// @brief Take ownership of a stream that was allocated elsewhere
+		/// @param stream the stream
+		/// @return the slot holding the stream
+		Slot* adopt(std::unique_ptr<Stream> stream)
+		{
+			return hold(stream.release(), nullptr, CLASS_COUNT);
+		}
+
+		/// @brief Destroy a slot's stream and free the slot
+		/// Nothing may be using the stream, the destructor runs without any lock held
+		/// @param slot the slot to empty
+		void destroy(Slot* slot)
+		{
+			if (slot->block != nullptr)
+			{
+				slot->stream->~Stream();
+			}
+			else
+			{
+				delete slot->stream;
+			}
+			std::lock_guard<std::mutex> guard(lock);
+			if (slot->block != nullptr)
+			{
+				freeBlocks[slot->sizeClass].push_back(slot->block);
+			}
+			slot->stream = nullptr;
+			slot->block = nullptr;
+			slot->generation.fetch_add(1, std::memory_order_release);
+			freeSlots.push_back(slot);
+		}
+
+	private:
+		/// @brief Pick the size class for an object
+		/// @return the class, CLASS_COUNT if it doesn't fit in a block
+		static size_t classFor(size_t size, size_t alignment)
+		{
+			if (alignment > BLOCK_ALIGN)
+			{
+				return CLASS_COUNT;
+			}
+			size_t sizeClass = 0;
+			while (sizeClass < CLASS_COUNT && (MIN_BLOCK << sizeClass) < size)
+			{
+				++sizeClass;
+			}
+			return sizeClass;
+		}
+
+		/// @brief Take a free block, cutting a new chunk into blocks when there are none
+		void* take(size_t sizeClass)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			std::vector<void*>& free = freeBlocks[sizeClass];
+			if (free.empty())
+			{
+				size_t blockSize = MIN_BLOCK << sizeClass;
+				char* chunk = (char*)::operator new(blockSize * BLOCKS_PER_CHUNK, std::align_val_t(BLOCK_ALIGN));
+				chunks.push_back(chunk);
+				for (size_t i = BLOCKS_PER_CHUNK; i > 0; --i)
+				{
+					free.push_back(chunk + (i - 1) * blockSize); // handed out from the start of the chunk
+				}
+			}
+			void* block = free.back();
+			free.pop_back();
+			return block;
+		}
+
+		/// @brief Put a stream in a free slot
+		Slot* hold(Stream* stream, void* block, size_t sizeClass)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			Slot* slot = nullptr;
+			if (freeSlots.empty())
+			{
+				slot = &slots.emplace_back();
+			}
+			else
+			{
+				slot = freeSlots.back();
+				freeSlots.pop_back();
+			}
+			slot->stream = stream;
+			slot->block = block;
+			slot->sizeClass = sizeClass;
+			return slot;
+		}
+
+		/// @brief Guards the lists
+		std::mutex lock;
+
+		/// @brief Every slot, a deque so they never move
+		std::deque<Slot> slots;
+
+		/// @brief Slots without a stream
+		std::vector<Slot*> freeSlots;
+
+		/// @brief Memory the blocks are cut from
+		std::vector<void*> chunks;
+
+		/// @brief Blocks without a stream, by size class
+		std::array<std::vector<void*>, CLASS_COUNT> freeBlocks;
+	};
+
+	/// @brief Refers to a stream the logger owns, without looking it up by name
+	/// get() returns nullptr once the stream has been removed. A handle doesn't keep the stream alive,
+	/// so don't remove the stream while another thread is using it through a handle
+	/// @tparam T type of the stream
+	template <typename T>
+	class StreamHandle
+	{
+	public:
+		/// @brief Create a handle that doesn't refer to a stream
+		StreamHandle() = default;
+
+		/// @brief Get the stream
+		/// @return the stream, nullptr if it has been removed or the handle is empty
+		T* get() const
+		{
+			return slot != nullptr && slot->generation.load(std::memory_order_acquire) == generation ? stream : nullptr;
+		}
+
+		T* operator->() const
+		{
+			return get();
+		}
+
+		T& operator*() const
+		{
+			return *get();
+		}
+
+		/// @brief Check if the stream is still registered
+		explicit operator bool() const
+		{
+			return get() != nullptr;
+		}
+
+	private:
+		friend class Log;
+
+		/// @brief Constructor, handles are made by the logger
+		StreamHandle(const StreamPool::Slot* slot, T* stream)
+			: slot(slot), stream(stream), generation(slot->generation.load(std::memory_order_acquire))
+		{}
+
+		const StreamPool::Slot* slot = nullptr;
+		T* stream = nullptr;
+		uint32_t generation = 0;
+	};
+
+	class Log
+	{
+	public:
+
+		/// @brief Destructor
+		/// Send any queued events to the streams, stop the background writer and delete the default streams that are still registered
+		~Log()
+		{
+			stopCrashHandling();
+			stopWriter();
+			stopClock();
+			for (auto& worker : workers)
+			{
+				worker->stop(); // hands over its queued events first
+			}
+			flushStreams();
+			{
+				// owned streams may log as they are destroyed, by then they find no streams and the snapshots are still there
+				std::lock_guard<std::mutex> lock(writerLock);
+				publish(std::map<std::string, Stream*>());
+			}
+			for (auto& s : owned)
+			{
+				pool.destroy(s.second);
+			}
+			for (auto slot : retiredSlots)
+			{
+				pool.destroy(slot);
+			}
+			delete snapshot.load();
+			for (auto old : retired)
+			{
+				delete old;
+			}
+		}
+
+		/// @brief Start the logger with chosen settings instead of the defaults it starts with on first use
+		/// Call before anything else is logged, the first log call otherwise starts the logger with LogConfig()
+		/// @param config the settings
+		/// @return false if the logger was already running, nothing is changed then
+		static bool init(const LogConfig& config = LogConfig())
+		{
+			{
+				std::lock_guard<std::mutex> guard(lifecycle);
+				if (instance.load(std::memory_order_acquire) != nullptr)
+				{
+					return false;
+				}
+				create(config);
+			}
+			if (config.async)
+			{
+				enableAsync(config.asyncConfig);
+			}
+			if (config.clock != CLOCK_SOURCE::SYSTEM_CLOCK)
+			{
+				setClock(config.clock);
+			}
+			return true;
+		}
+
+		/// @brief Send every queued event, stop the logger's threads and destroy the streams it owns
+		/// Streams added by pointer are only unregistered. No other thread may log while this runs,
+		/// logging afterwards starts the logger again. Also done when the program ends
+		static void shutdown()
+		{
+			std::lock_guard<std::mutex> guard(lifecycle);
+			Log* inst = instance.load(std::memory_order_acquire);
+			delete inst; // still reachable while it stops, for streams that log as they close
+			instance.store(nullptr, std::memory_order_release);
+		}
+
+		/// @brief Get a pointer to a registered stream with the given name
+		/// @param name the stream to look for
+		/// @return pointer to stream with given name
+		/// @return nullptr if there no matching stream is found
+		static Stream* getStream(const std::string& name)
+		{
+			auto inst = getInstance();
+			ReadGuard reading(*inst);
+			auto found = reading.streams->streams.find(name);
+			return found != reading.streams->streams.end() ? found->second : nullptr;
+		}
+
+		/// @brief Register a stream, replacing any stream with the same name
+		/// Threads that are logging carry on with the old list of streams, so this never waits for them
+		/// @param name ID of the stream
+		/// @param stream the stream, which must stay alive until it is removed
+		static void addStream(const std::string& name, Stream* stream)
+		{
+			getInstance()->insert(name, stream, nullptr);
+		}
+
+		/// @brief Register a stream that the logger takes ownership of, replacing any stream with the same name
+		/// The stream is destroyed when it is removed or replaced, or when the program ends
+		/// @param name ID of the stream
+		/// @param stream the stream
+		/// @return handle to the stream, empty if stream was empty
+		static StreamHandle<Stream> addStream(const std::string& name, std::unique_ptr<Stream> stream)
+		{
+			if (!stream)
+			{
+				return StreamHandle<Stream>();
+			}
+			auto inst = getInstance();
+			Stream* added = stream.get();
+			StreamPool::Slot* slot = inst->pool.adopt(std::move(stream));
+			StreamHandle<Stream> handle(slot, added);
+			inst->insert(name, added, slot);
+			return handle;
+		}
+
+		/// @brief Build a stream inside the logger and register it, replacing any stream with the same name
+		/// The logger keeps its streams together in a pool and destroys them when they are removed or replaced, or when the program ends
+		/// @tparam T the type of stream to build
+		/// @param name ID of the stream
+		/// @param args passed to the stream's constructor
+		/// @return handle to the new stream
+		template <typename T, typename... Args>
+		static StreamHandle<T> emplaceStream(const std::string& name, Args&&... args)
+		{
+			auto inst = getInstance();
+			T* stream = nullptr;
+			StreamPool::Slot* slot = inst->pool.create(stream, std::forward<Args>(args)...);
+			StreamHandle<T> handle(slot, stream);
+			inst->insert(name, stream, slot);
+			return handle;
+		}
+
+		/// @brief Remove a stream's pointer from the list and return the pointer so that it can be deleted
+		/// Waits until other threads have finished sending events to the stream, so it is safe to delete straight away.
+		/// Streams owned by the logger are destroyed here instead. Don't call it from inside a stream's handle function while other threads are logging
+		/// @param name ID of the stream to remove
+		/// @return pointer to the removed stream
+		/// @return nullptr if no matching stream was found, or the stream was owned by the logger and has been destroyed
+		static Stream* removeStream(const std::string& name)
+		{
+			auto inst = getInstance();
+			Stream* result = nullptr;
+			{
+				std::lock_guard<std::mutex> lock(inst->writerLock);
+				auto streams = inst->snapshot.load()->streams;
+				auto found = streams.find(name);
+				if (found == streams.end())
+				{
+					return nullptr;
+				}
+				result = found->second;
+				streams.erase(found);
+				inst->registered.erase(name);
+				if (inst->retireOwned(name))
+				{
+					result = nullptr;
+				}
+				inst->publish(std::move(streams));
+			}
+			inst->reclaim(true);
+			return result;
+		}
+
+		/// @brief Check if any registered stream listens to a level
+		/// Events of levels nobody listens to are discarded before they are created
+		/// @param level the level to check
+		/// @return true if at least one stream would receive an event of this level
+		static bool isListening(LEVELS level)
+		{
+			auto inst = getInstance();
+			if (Stream::getConfigVersion() != inst->snapshotVersion.load(std::memory_order_acquire))
+			{
+				inst->rebuildDispatch();
+			}
+			return (inst->listeningLevels.load(std::memory_order_relaxed) & level) != 0;
+		}
+
+		/// @brief Choose how the timestamps of events are written
+		/// See TimestampFormat::set for the supported fields
+		/// @param format strftime style format, the default is "%Y/%m/%d/%H:%M:%S - "
+		/// @param subsecondDigits number of digits of the fraction of a second to add after the seconds
+		static void setDateFormat(const std::string& format, int subsecondDigits = 0)
+		{
+			TimestampFormat::set(format, subsecondDigits);
+		}
+
+		/// @brief Allow the logger to handle debug messages even if in release build
+		/// @param show whether to display debug messages in release build
+		static void forceDebug(bool show)
+		{
+			showDebug = show;
+		}
+
+		/// @brief Send events to the streams from a background thread instead of the thread that logged them
+		/// Logging calls only queue the event and return straight away. Safe to call while other threads are logging,
+		/// events already queued are sent first and the rest go to the streams directly while the queue is replaced
+		/// @param config size of the queue and what to do when it is full
+		static void enableAsync(const AsyncConfig& config = AsyncConfig())
+		{
+			auto inst = getInstance();
+			std::lock_guard<std::mutex> guard(lifecycle);
+			inst->stopWriter();
+			// a producer that registered before the writer stopped may still be reading the queue and config
+			while (inst->activeProducers.load() != 0)
+			{
+				std::this_thread::yield();
+			}
+
+			inst->config = config;
+			inst->ring.reset(new RingBuffer<Event>(config.capacity));
+			inst->stats.reset();
+			inst->stats.capacity = inst->ring->capacity();
+			inst->startWriter();
+		}
+
+		/// @brief Go back to sending events to the streams from the thread that logged them
+		/// Any events still queued are sent before this returns
+		static void disableAsync()
+		{
+			auto inst = getInstance();
+			std::lock_guard<std::mutex> guard(lifecycle);
+			inst->stopWriter();
+		}
+
+		/// @brief Check if the logger is running in asynchronous mode
+		/// @return true if events are sent from a background thread
+		static bool isAsync()
+		{
+			return getInstance()->running;
+		}
+
+		/// @brief Choose how many threads the streams with WORKER_MODE::POOLED share, see Stream::setWorker
+		/// Each pooled stream is given to the worker serving the fewest streams when it is set up; streams already set up keep their worker
+		/// @param threads most threads in the pool, 2 by default
+		static void setWorkerPoolSize(size_t threads)
+		{
+			auto inst = getInstance();
+			std::lock_guard<std::mutex> lock(inst->writerLock);
+			inst->workerPoolSize = std::max<size_t>(threads, 1);
+		}
+
+		/// @brief Choose where the timestamps of new events come from
+		/// The default SYSTEM_CLOCK reads std::chrono::system_clock for every event. The others trade precision for a cheaper read,
+		/// CACHED_CLOCK starts a thread that stores the time every interval. Events already made keep their timestamps
+		/// @param clock the source
+		/// @param interval how often the time is stored for CACHED_CLOCK
+		static void setClock(CLOCK_SOURCE clock, std::chrono::microseconds interval = std::chrono::milliseconds(1))
+		{
+			auto inst = getInstance();
+			std::lock_guard<std::mutex> guard(inst->clockLock);
+			inst->stopClock();
+			EventClock::set(clock);
+			if (clock == CLOCK_SOURCE::CACHED_CLOCK)
+			{
+				inst->clockInterval = std::max(interval, std::chrono::microseconds(1));
+				inst->startClockThread();
+			}
+		}
+
+		/// @brief Where the timestamps of new events come from
+		/// @return the source
+		static CLOCK_SOURCE getClock()
+		{
+			return EventClock::get();
+		}
+
+		/// @brief Replace the filters of the streams named in a file, see EventFilter::parse for the format
+		/// Can be called again at any time to reload the rules, logging carries on while they change.
+		/// Streams not named in the file keep their filters, names of streams that aren't registered are skipped
+		/// @param fileName the file of rules
+		/// @return false if the file couldn't be read or has a line that isn't a rule, no filter is changed then
+		static bool loadFilters(const std::string& fileName)
+		{
+			std::ifstream file(fileName);
+			std::map<std::string, std::vector<FilterRule>> rules;
+			if (!file || !EventFilter::parse(file, rules))
+			{
+				return false;
+			}
+			for (auto& stream : rules)
+			{
+				Stream* found = getStream(stream.first);
+				if (found != nullptr)
+				{
+					found->setFilter(stream.second);
+				}
+			}
+			return true;
+		}
+
+		/// @brief Stop the same event from being logged over and over
+		/// Each kind of event (level, source and code, or level and message if it has neither) gets a token bucket.
+		/// Events without a token are held back, and a summary saying how many were held back is logged every summary interval
+		/// @param limit the limit, the default RateLimit turns it off
+		static void setRateLimit(const RateLimit& limit)
+		{
+			auto inst = getInstance();
+			inst->sendSummaries(true);
+			inst->limiter.configure(limit);
+		}
+
+		/// @brief Number of events held back by the rate limit
+		/// @return the total since the limit was last set
+		static uint64_t getRateLimitedCount()
+		{
+			return getInstance()->limiter.getHeldCount();
+		}
+
+		/// @brief Wait until every queued event has been sent to the streams, then flush every stream
+		/// Summaries of events held back by the rate limit are logged first, and the streams on workers are waited for as well
+		static void flush()
+		{
+			auto inst = getInstance();
+			inst->sendSummaries(true);
+			inst->waitForQueue();
+			inst->waitForWorkers();
+			inst->flushStreams();
+		}
+
+		/// @brief Hand the events this thread has logged over to the streams and wait until they have been sent
+		/// Use before a thread blocks for a long time when per-thread buffers are enabled, does nothing otherwise
+		static void flushThread()
+		{
+			auto inst = getInstance();
+			ThreadBuffer* local = localBuffer().buffer.get();
+			if (local == nullptr || !inst->running || std::this_thread::get_id() == inst->writerId)
+			{
+				return;
+			}
+			size_t target = local->published();
+			inst->wakeWriter(true);
+			std::unique_lock<std::mutex> lock(inst->queueLock);
+			while (local->delivered.load(std::memory_order_acquire) < target && inst->running)
+			{
+				inst->queueDrained.wait_for(lock, std::chrono::milliseconds(1));
+			}
+		}
+
+		/// @brief Number of events that were discarded because the queue was full
+		/// @return events dropped since asynchronous mode was last enabled
+		static size_t getDroppedCount()
+		{
+			return getInstance()->stats.dropped;
+		}
+
+		/// @brief Get a snapshot of how the asynchronous queue is being used
+		/// @return counters collected since asynchronous mode was last enabled
+		static QueueStats getQueueStats()
+		{
+			auto inst = getInstance();
+			std::lock_guard<std::mutex> lock(inst->queueLock);
+			QueueStats result;
+			result.capacity = inst->stats.capacity;
+			result.highWater = inst->stats.highWater;
+			result.dropped = inst->stats.dropped;
+			result.full = inst->stats.full;
+			result.contention = inst->stats.contention;
+			result.enqueueNsTotal = inst->stats.enqueueNsTotal;
+			result.enqueueNsMax = inst->stats.enqueueNsMax;
+			for (size_t i = 0; i < result.enqueueNsHistogram.size(); ++i)
+			{
+				result.enqueueNsHistogram[i] = inst->stats.enqueueNsHistogram[i];
+			}
+			if (inst->ring)
+			{
+				result.depth = inst->ring->size();
+				result.enqueued = inst->ring->reserved() + inst->stats.harvested;
+			}
+			return result;
+		}
+
+		/// @brief Get a snapshot of what the logger has counted
+		/// The counters are kept by each thread and only added up here, so logging never shares a counter between threads
+		/// @return events created since the program started, and the counters of each stream since it was registered
+		static LogStats getStats()
+		{
+			auto inst = getInstance();
+			LogStats result;
+			uint64_t dispatched = inst->collectCreated(&result.created);
+			result.queue = getQueueStats();
+			result.rateLimited = inst->limiter.getHeldCount();
+			result.rateLimitOverflow = inst->limiter.getOverflowCount();
+
+			std::map<std::string, uint64_t> bases;
+			{
+				std::lock_guard<std::mutex> lock(inst->writerLock);
+				bases = inst->registered;
+			}
+			ReadGuard reading(*inst);
+			for (auto& s : reading.streams->streams)
+			{
+				StreamStats& counted = result.streams[s.first];
+				s.second->readCounters(counted);
+				auto queue = reading.streams->queues.find(s.second);
+				if (queue != reading.streams->queues.end())
+				{
+					counted.queued = queue->second->worker->depth(*queue->second);
+					counted.dropped = queue->second->dropped.load(std::memory_order_relaxed);
+				}
+				auto base = bases.find(s.first);
+				uint64_t sent = base != bases.end() && dispatched > base->second ? dispatched - base->second : 0;
+				uint64_t handled = counted.delivered + counted.queued + counted.dropped;
+				counted.filtered = sent > handled ? sent - handled : 0;
+			}
+			return result;
+		}
+
+		/// @brief Choose what the logger measures about itself, and whether it sends its counters as an event
+		/// @param config the settings, the default StatsConfig measures nothing extra and sends no events
+		static void setStatsConfig(const StatsConfig& config)
+		{
+			auto inst = getInstance();
+			std::lock_guard<std::mutex> lock(inst->statsLock);
+			inst->statsConfig = config;
+			inst->measureHandle.store(config.measureHandle, std::memory_order_relaxed);
+			int64_t interval = std::chrono::duration_cast<std::chrono::nanoseconds>(config.interval).count();
+			inst->statsInterval.store(interval, std::memory_order_relaxed);
+			inst->nextStats.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count() + interval, std::memory_order_relaxed);
+			inst->statsEnabled.store(interval > 0 && !config.stream.empty(), std::memory_order_relaxed);
+		}
+
+		/// @brief Make sure the events that matter most are not lost if the program crashes
+		/// Events of the chosen levels are written straight to a file opened now, without buffering or allocating,
+		/// then everything queued before them is sent, they are sent to the streams from the calling thread and every stream is flushed.
+		/// The signal handlers write a note and the events still in the shared queue to the file before the program dies.
+		/// Events waiting in per-thread buffers or inside a stream's own buffer are not written by the signal handlers
+		/// @param config what to write and which handlers to install
+		/// @return false if the crash file couldn't be opened
+		static bool enableCrashHandling(const CrashConfig& config = CrashConfig())
+		{
+			auto inst = getInstance();
+			inst->stopCrashHandling();
+			int fd = -1;
+			if (!config.file.empty())
+			{
+				fd = crash::open(config.file);
+				if (fd < 0)
+				{
+					return false;
+				}
+			}
+			inst->crashFile.store(fd, std::memory_order_relaxed);
+			inst->crashStderr.store(config.writeStderr, std::memory_order_relaxed);
+			inst->crashing.store(false);
+			if (config.handleSignals)
+			{
+				inst->installSignalHandlers();
+			}
+			if (config.handleTerminate)
+			{
+				inst->previousTerminate = std::set_terminate(&Log::onTerminate);
+				inst->terminateInstalled = true;
+			}
+			inst->crashLevels.store(config.levels & ALL_LEVELS, std::memory_order_release);
+			return true;
+		}
+
+		/// @brief Stop writing events to the crash file and put back the handlers that were there before
+		static void disableCrashHandling()
+		{
+			getInstance()->stopCrashHandling();
+		}
+
+		/// @brief generate a new log event
+		/// @param level define how the event will be handled
+		/// @param msg what is to be output
+		/// @param source [optional] the fuction that caused the event to be created
+		/// @param code [optional] a user-defined code that represents the errror
+		static void log(LEVELS level, std::string_view msg, std::string_view source = "", std::string_view code = "")
+		{
+			bool debugVisible = showDebug;
+			#ifdef SHOW_DEBUG
+				debugVisible = true;
+			#endif // LOG_DEBUG
+
+			// check if the level was compiled out and if we should show debug messages
+			if (isCompiledIn(level) && (level != LEVELS::DBG || debugVisible) && isListening(level))
+			{
+				auto inst = getInstance();
+				if (inst->passesFilters(level, source, code, 0) && inst->limiter.allow(level, msg, source, code))
+				{
+					inst->send(level, msg, source, code, nullptr);
+				}
+				inst->sendSummaries(false);
+				inst->reportStats(false);
+			}
+		}
+
+		/// @brief generate a new log event with typed key-value fields, which structured streams such as JsonLinesStream write out
+		/// @param level define how the event will be handled
+		/// @param msg what is to be output
+		/// @param fields values attached to the event, copied into it
+		/// @param source [optional] the fuction that caused the event to be created
+		/// @param code [optional] a user-defined code that represents the errror
+		static void log(LEVELS level, std::string_view msg, const Fields& fields, std::string_view source = "", std::string_view code = "")
+		{
+			bool debugVisible = showDebug;
+			#ifdef SHOW_DEBUG
+				debugVisible = true;
+			#endif // LOG_DEBUG
+
+			if (isCompiledIn(level) && (level != LEVELS::DBG || debugVisible) && isListening(level))
+			{
+				auto inst = getInstance();
+				if (inst->passesFilters(level, source, code, 0) && inst->limiter.allow(level, msg, source, code))
+				{
+					inst->send(level, msg, source, code, nullptr, 0, &fields);
+				}
+				inst->sendSummaries(false);
+				inst->reportStats(false);
+			}
+		}
+
+		/// @brief generate a new log event from a call site, see the BOOM_*_AT macros
+		/// The event carries the call site's ID rather than copies of its source and code
+		/// @param site where the event is logged from, which gives its level, source and code
+		/// @param msg what is to be output
+		static void log(const CallSite& site, std::string_view msg)
+		{
+			bool debugVisible = showDebug;
+			#ifdef SHOW_DEBUG
+				debugVisible = true;
+			#endif // LOG_DEBUG
+
+			LEVELS level = site.getLevel();
+			if (isCompiledIn(level) && (level != LEVELS::DBG || debugVisible) && isListening(level))
+			{
+				auto inst = getInstance();
+				uint32_t id = site.getId();
+				if (inst->passesFilters(level, site.getSource(), site.getCode(), id) &&
+					inst->limiter.allow(level, msg, site.getSource(), site.getCode(), id))
+				{
+					// a call site without an ID sends its strings like any other event
+					inst->send(level, msg, id != 0 ? "" : site.getSource(), id != 0 ? "" : site.getCode(), nullptr, id);
+				}
+				inst->sendSummaries(false);
+				inst->reportStats(false);
+			}
+		}
+
+		/// @brief generate a new log event whose message is only formatted if a stream receives it
+		/// The arguments are copied into the event and formatted on the background writer in asynchronous mode.
+		/// Nothing is copied or formatted if no stream listens to the level
+		/// @param level define how the event will be handled
+		/// @param format the message, with a {} where each argument goes ({{ and }} for braces)
+		/// @param args values written with std::to_chars, or their operator<< for other types
+		template <typename... Args>
+		static void logf(LEVELS level, std::string_view format, Args&&... args)
+		{
+			bool debugVisible = showDebug;
+			#ifdef SHOW_DEBUG
+				debugVisible = true;
+			#endif // LOG_DEBUG
+
+			if (isCompiledIn(level) && (level != LEVELS::DBG || debugVisible) && isListening(level))
+			{
+				auto inst = getInstance();
+				if (inst->passesFilters(level, "", "", 0) && inst->limiter.allow(level, format, "", ""))
+				{
+					std::shared_ptr<const DeferredFormat> captured =
+						std::make_shared<FormatArguments<deferred::Stored<Args>...>>(std::forward<Args>(args)...);
+					inst->send(level, format, "", "", std::move(captured));
+				}
+				inst->sendSummaries(false);
+				inst->reportStats(false);
+			}
+		}
+
+		/// @brief Debug event with a deferred message, see logf
+		template <typename... Args>
+		static void debugf(std::string_view format, Args&&... args)
+		{
+			if constexpr (isCompiledIn(LEVELS::DBG))
+			{
+				logf(LEVELS::DBG, format, std::forward<Args>(args)...);
+			}
+		}
+
+		/// @brief Info event with a deferred message, see logf
+		template <typename... Args>
+		static void infof(std::string_view format, Args&&... args)
+		{
+			if constexpr (isCompiledIn(LEVELS::INFO))
+			{
+				logf(LEVELS::INFO, format, std::forward<Args>(args)...);
+			}
+		}
+
+		/// @brief Warning event with a deferred message, see logf
+		template <typename... Args>
+		static void warningf(std::string_view format, Args&&... args)
+		{
+			if constexpr (isCompiledIn(LEVELS::WARNING))
+			{
+				logf(LEVELS::WARNING, format, std::forward<Args>(args)...);
+			}
+		}
+
+		/// @brief Error event with a deferred message, see logf
+		template <typename... Args>
+		static void errorf(std::string_view format, Args&&... args)
+		{
+			if constexpr (isCompiledIn(LEVELS::ERR))
+			{
+				logf(LEVELS::ERR, format, std::forward<Args>(args)...);
+			}
+		}
+
+		/// @brief Critical event with a deferred message, see logf
+		template <typename... Args>
+		static void criticalf(std::string_view format, Args&&... args)
+		{
+			if constexpr (isCompiledIn(LEVELS::CRITICAL))
+			{
+				logf(LEVELS::CRITICAL, format, std::forward<Args>(args)...);
+			}
+		}
+
+		/// @brief generate a new log event with a level known at compile time
+		/// The call compiles to nothing if the level is below BOOM_MIN_LEVEL, use the BOOM_ macros to also skip evaluating the arguments
+		/// @tparam level define how the event will be handled
+		/// @param msg what is to be output
+		/// @param source [optional] the fuction that caused the event to be created
+		/// @param code [optional] a user-defined code that represents the errror
+		template <LEVELS level>
+		static void log(std::string_view msg, std::string_view source = "", std::string_view code = "")
+		{
+			if constexpr (isCompiledIn(level))
+			{
+				log(level, msg, source, code);
+			}
+		}
+
+		/// @brief Create an event that is only visible during debugging
+		/// Useful for checking variable values etc.
+		/// @param msg description of the event
+		/// @param source [optional] the fuction that caused the event to be created
+		/// @param code [optional] a user-defined code that represents the errror
+
+		static void debug(std::string_view msg, std::string_view source = "", std::string_view code = "")
+		{
+			if constexpr (isCompiledIn(LEVELS::DBG))
+			{
+				log(LEVELS::DBG, msg, source, code);
+			}
+		}
+
+		/// @brief Same as debug, with typed key-value fields attached to the event
+		static void debug(std::string_view msg, const Fields& fields, std::string_view source = "", std::string_view code = "")
+		{
+			if constexpr (isCompiledIn(LEVELS::DBG))
+			{
+				log(LEVELS::DBG, msg, fields, source, code);
+			}
+		}
+
+		/// @brief Create an event to track that something normal has happened
+		/// Something is loaded, a user connects, an action is taken, etc.
+		/// @param msg description of the event
+		/// @param source [optional] the fuction that caused the event to be created
+		/// @param code [optional] a user-defined code that represents the errror
+		static void info(std::string_view msg, std::string_view source = "", std::string_view code = "")
+		{
+			if constexpr (isCompiledIn(LEVELS::INFO))
+			{
+				log(LEVELS::INFO, msg, source, code);
+			}
+		}
+
+		/// @brief Same as info, with typed key-value fields attached to the event
+		static void info(std::string_view msg, const Fields& fields, std::string_view source = "", std::string_view code = "")
+		{
+			if constexpr (isCompiledIn(LEVELS::INFO))
+			{
+				log(LEVELS::INFO, msg, fields, source, code);
+			}
+		}
+
+		/// @brief Create an event to alert that something unexpected has happened
+		/// A file or a service is not available, user entered invalid input, etc.
+		/// @param msg description of the event
+		/// @param source [optional] the fuction that caused the event to be created
+		/// @param code [optional] a user-defined code that represents the errror
+		static void warning(std::string_view msg, std::string_view source = "", std::string_view code = "")
+		{
+			if constexpr (isCompiledIn(LEVELS::WARNING))
+			{
+				log(LEVELS::WARNING, msg, source, code);
+			}
+		}
+
+		/// @brief Same as warning, with typed key-value fields attached to the event
+		static void warning(std::string_view msg, const Fields& fields, std::string_view source = "", std::string_view code = "")
+		{
+			if constexpr (isCompiledIn(LEVELS::WARNING))
+			{
+				log(LEVELS::WARNING, msg, fields, source, code);
+			}
+		}
+
+		/// @brief Create an event indicating an error that can be handled or caught
+		/// @param msg description of the event
+		/// @param source [optional] the fuction that caused the event to be created
+		/// @param code [optional] a user-defined code that represents the errror
+		static void error(std::string_view msg, std::string_view source = "", std::string_view code = "")
+		{
+			if constexpr (isCompiledIn(LEVELS::ERR))
+			{
+				log(LEVELS::ERR, msg, source, code);
+			}
+		}
+
+		/// @brief Same as error, with typed key-value fields attached to the event
+		static void error(std::string_view msg, const Fields& fields, std::string_view source = "", std::string_view code = "")
+		{
+			if constexpr (isCompiledIn(LEVELS::ERR))
+			{
+				log(LEVELS::ERR, msg, fields, source, code);
+			}
+		}
+
+		/// @brief Create a new event indicating a critical error that could cause the program to crash
+		/// @param msg description of the event
+		/// @param source [optional] the fuction that caused the event to be created
+		/// @param code [optional] a user-defined code that represents the errror
+		static void critical(std::string_view msg, std::string_view source = "", std::string_view code = "")
+		{
+			if constexpr (isCompiledIn(LEVELS::CRITICAL))
+			{
+				log(LEVELS::CRITICAL, msg, source, code);
+			}
+		}
+
+		/// @brief Same as critical, with typed key-value fields attached to the event
+		static void critical(std::string_view msg, const Fields& fields, std::string_view source = "", std::string_view code = "")
+		{
+			if constexpr (isCompiledIn(LEVELS::CRITICAL))
+			{
+				log(LEVELS::CRITICAL, msg, fields, source, code);
+			}
+		}
+
+	private:
+
+		/// @brief Constructor, private to make it a singleton
+		Log() = default;
+
+		/// @brief Copy constructor, not used
+		/// @param obj object to copy, not used
+		Log(const Log& obj) = delete;
+
+		/// @brief get access to a single instance of the logger
+		/// Create a new instance if none exists
+		/// @return pointer to the instantiated singleton
+		static Log* getInstance()
+		{
+			Log* inst = instance.load(std::memory_order_acquire);
+			if (inst != nullptr)
+			{
+				return inst;
+			}
+			std::lock_guard<std::mutex> guard(lifecycle);
+			inst = instance.load(std::memory_order_acquire);
+			return inst != nullptr ? inst : create(LogConfig());
+		}
+
+		/// @brief Make the instance, must be called with lifecycle held
+		/// @param config the settings
+		/// @return the new instance
+		static Log* create(const LogConfig& config)
+		{
+			Log* inst = new Log();
+			std::map<std::string, Stream*> streams;
+			std::lock_guard<std::mutex> lock(inst->writerLock);
+			if (config.defaultStreams)
+			{
+				TextFileStream* text = nullptr;
+				ConsoleStream* console = nullptr;
+				inst->owned["defaultTextFile"] = inst->pool.create(text, "log.txt");
+				inst->owned["defaultConsole"] = inst->pool.create(console);
+				streams["defaultTextFile"] = text;
+				streams["defaultConsole"] = console;
+				inst->registered["defaultTextFile"] = 0;
+				inst->registered["defaultConsole"] = 0;
+			}
+			inst->publish(std::move(streams));
+			inst->handleFork = config.handleFork;
+#ifndef _WIN32
+			if (config.handleFork && !forkHandlersAdded)
+			{
+				forkHandlersAdded = pthread_atfork(&Log::beforeFork, &Log::afterForkParent, &Log::afterForkChild) == 0;
+			}
+#endif
+			instance.store(inst, std::memory_order_release);
+			return inst;
+		}
+
+		/// @brief Runs in the thread calling fork(), sends what is queued, writes out what the streams hold so
+		/// neither process writes it twice, then stops the logger's threads and those of the streams and holds writerLock until the fork is done.
+		/// Threads logging straight to the streams are let finish, and held back from starting again until the fork is done
+		static void beforeFork()
+		{
+			lifecycle.lock();
+			Log* inst = instance.load(std::memory_order_acquire);
+			if (inst == nullptr || !inst->handleFork || StreamWorker::current() != nullptr || std::this_thread::get_id() == inst->writerId)
+			{
+				return; // can't stop the thread that is forking
+			}
+			inst->clockLock.lock();
+			inst->forkPaused = true;
+			inst->forkAsync = inst->running;
+			inst->stopWriter();
+			inst->waitForWorkers();
+			inst->flushStreams();
+			inst->forkClock = inst->clockThread.joinable();
+			inst->endClockThread();
+			inst->writerLock.lock();
+			for (auto& worker : inst->workers)
+			{
+				worker->stop();
+			}
+			// threads logging straight to the streams finish what they are handing over, the next ones wait for the fork
+			inst->forkGate.store(true);
+			for (size_t e = 0; e < 2; ++e)
+			{
+				while (inst->readers[e].count.load() > readDepth()[e])
+				{
+					std::this_thread::yield();
+				}
+			}
+			for (auto s : inst->snapshot.load()->streams) // writerLock keeps the snapshot until resumeAfterFork
+			{
+				s.second->pauseForFork();
+			}
+		}
+
+		/// @brief Runs in the parent after fork(), starts the threads stopped by beforeFork again
+		static void afterForkParent()
+		{
+			resumeAfterFork(false);
+		}
+
+		/// @brief Runs in the child after fork(), which starts with no threads but the one that called fork(),
+		/// starts its own copies of the threads stopped by beforeFork
+		static void afterForkChild()
+		{
+			resumeAfterFork(true);
+		}
+
+		/// @brief Start the threads stopped by beforeFork and let go of its locks
+		/// @param child true in the new process
+		static void resumeAfterFork(bool child)
+		{
+			Log* inst = instance.load(std::memory_order_acquire);
+			if (inst != nullptr && inst->forkPaused)
+			{
+				inst->forkPaused = false;
+				for (auto s : inst->snapshot.load()->streams)
+				{
+					s.second->resumeAfterFork(child);
+				}
+				inst->forkGate.store(false);
+				for (auto& worker : inst->workers)
+				{
+					worker->start();
+				}
+				inst->writerLock.unlock();
+				if (inst->forkClock)
+				{
+					inst->startClockThread();
+				}
+				inst->clockLock.unlock();
+				if (inst->forkAsync && !inst->writer.joinable())
+				{
+					inst->startWriter();
+				}
+			}
+			lifecycle.unlock();
+		}
+
+		/// @brief Register a stream, replacing any stream with the same name
+		/// @param name ID of the stream
+		/// @param stream the stream
+		/// @param slot where the stream lives if the logger owns it, otherwise nullptr
+		void insert(const std::string& name, Stream* stream, StreamPool::Slot* slot)
+		{
+			stream->resetCounters();
+			uint64_t dispatched = collectCreated(nullptr);
+			{
+				std::lock_guard<std::mutex> lock(writerLock);
+				auto streams = snapshot.load()->streams;
+				streams[name] = stream;
+				registered[name] = dispatched;
+				retireOwned(name);
+				if (slot != nullptr)
+				{
+					owned[name] = slot;
+				}
+				publish(std::move(streams));
+			}
+			reclaim(false);
+		}
+
+		/// @brief Forget that the logger owns a stream, it is destroyed once no thread can be using it
+		/// Must be called with writerLock held
+		/// @param name ID of the stream
+		/// @return true if the logger owned a stream with that name
+		bool retireOwned(const std::string& name)
+		{
+			auto found = owned.find(name);
+			if (found == owned.end())
+			{
+				return false;
+			}
+			retiredSlots.push_back(found->second);
+			owned.erase(found);
+			return true;
+		}
+
+		/// @brief Log the summaries of events held back by the rate limit
+		/// @param force whether to log them now, rather than once per summary interval
+		void sendSummaries(bool force)
+		{
+			for (auto& summary : limiter.collect(force))
+			{
+				send(summary.level, summary.msg, summary.source, summary.code, nullptr);
+			}
+		}
+
+		/// @brief Send the counters as an INFO event to the stream chosen in the StatsConfig, once per interval
+		/// In asynchronous mode the background writer sends it, so logging threads never wait on the stream
+		/// @param fromWriter whether the caller is the background writer
+		void reportStats(bool fromWriter)
+		{
+			if (!statsEnabled.load(std::memory_order_relaxed) || fromWriter != running.load(std::memory_order_relaxed))
+			{
+				return;
+			}
+			int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+			int64_t due = nextStats.load(std::memory_order_relaxed);
+			if (now < due || !nextStats.compare_exchange_strong(due, now + statsInterval.load(std::memory_order_relaxed)))
+			{
+				return; // not time yet, or another thread is reporting
+			}
+
+			std::string name;
+			{
+				std::lock_guard<std::mutex> lock(statsLock);
+				name = statsConfig.stream;
+			}
+			LogStats current = getStats();
+			std::string text = "created";
+			for (size_t i = 0; i < LEVEL_COUNT; ++i)
+			{
+				text += ' ';
+				text += Event::levelName((LEVELS)(1 << i));
+				text += ' ' + std::to_string(current.created[i]);
+			}
+			text += ", queue depth " + std::to_string(current.queue.depth) + " dropped " + std::to_string(current.queue.dropped);
+			text += ", rate limited " + std::to_string(current.rateLimited);
+			if (current.rateLimitOverflow > 0)
+			{
+				text += " overflow " + std::to_string(current.rateLimitOverflow);
+			}
+			for (auto& s : current.streams)
+			{
+				text += "; " + s.first + " delivered " + std::to_string(s.second.delivered) + " filtered " + std::to_string(s.second.filtered);
+				if (s.second.bytesWritten > 0)
+				{
+					text += " bytes " + std::to_string(s.second.bytesWritten);
+				}
+				if (s.second.handleCalls > 0)
+				{
+					text += " handle mean " + std::to_string(s.second.handleNsTotal / s.second.handleCalls) + "ns max " +
+						std::to_string(s.second.handleNsMax) + "ns";
+				}
+			}
+
+			Event event(LEVELS::INFO, text, "boom::Log", "stats");
+			ReadGuard reading(*this);
+			auto found = reading.streams->streams.find(name);
+			if (found != reading.streams->streams.end())
+			{
+				found->second->deliverStats(event);
+			}
+		}
+
+		/// @brief Counters kept by each thread that logs, added up by getStats
+		struct ThreadCounters
+		{
+			/// @brief Add to a counter, only the owning thread writes to it
+			static void add(std::atomic<uint64_t>& counter, uint64_t amount)
+			{
+				counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+			}
+
+			/// @brief Events created at each level, by levelIndex
+			std::array<std::atomic<uint64_t>, LEVEL_COUNT> created{};
+
+			/// @brief Events sent to the streams
+			std::atomic<uint64_t> dispatched = 0;
+
+			/// @brief Set when the thread exits, getStats then adds the counters to the totals and forgets them
+			std::atomic<bool> exited = false;
+		};
+
+		/// @brief Holds the calling thread's counters, marking them when the thread exits
+		struct LocalCounters
+		{
+			~LocalCounters()
+			{
+				if (counters)
+				{
+					counters->exited.store(true, std::memory_order_release);
+				}
+			}
+
+			std::shared_ptr<ThreadCounters> counters;
+		};
+
+		/// @brief Get the calling thread's counters, registering them on first use
+		/// @return the counters
+		ThreadCounters& localCounters()
+		{
+			static thread_local LocalCounters local;
+			if (!local.counters)
+			{
+				local.counters = std::make_shared<ThreadCounters>();
+				std::lock_guard<std::mutex> lock(countersLock);
+				threadCounters.push_back(local.counters);
+			}
+			return *local.counters;
+		}
+
+		/// @brief Add up the counters of every thread, folding in the threads that have exited
+		/// @param created [out] receives the events created at each level, can be nullptr
+		/// @return the number of events sent to the streams
+		uint64_t collectCreated(std::array<uint64_t, LEVEL_COUNT>* created)
+		{
+			std::lock_guard<std::mutex> lock(countersLock);
+			std::array<uint64_t, LEVEL_COUNT> sum = exitedCreated;
+			uint64_t dispatched = exitedDispatched;
+			for (auto it = threadCounters.begin(); it != threadCounters.end();)
+			{
+				bool exited = (*it)->exited.load(std::memory_order_acquire);
+				uint64_t sent = (*it)->dispatched.load(std::memory_order_relaxed);
+				dispatched += sent;
+				for (size_t i = 0; i < LEVEL_COUNT; ++i)
+				{
+					uint64_t count = (*it)->created[i].load(std::memory_order_relaxed);
+					sum[i] += count;
+					if (exited)
+					{
+						exitedCreated[i] += count;
+					}
+				}
+				if (exited)
+				{
+					exitedDispatched += sent;
+					it = threadCounters.erase(it);
+				}
+				else
+				{
+					++it;
+				}
+			}
+			if (created != nullptr)
+			{
+				*created = sum;
+			}
+			return dispatched;
+		}
+
+		/// @brief Queue an event for the background writer, or send it to the streams straight away
+		/// @param site ID of the call site the event is logged from, 0 if none
+		/// @param fields key-value pairs to copy into the event, nullptr if none
+		void send(LEVELS level, std::string_view msg, std::string_view source, std::string_view code,
+			std::shared_ptr<const DeferredFormat>&& args, uint32_t site = 0, const Fields* fields = nullptr)
+		{
+			ThreadCounters::add(localCounters().created[levelIndex(level)], 1);
+#ifndef _WIN32
+			if (signalsInstalled.load(std::memory_order_relaxed))
+			{
+				crash::SignalStack::install();
+			}
+#endif
+			if ((crashLevels.load(std::memory_order_relaxed) & level) != 0)
+			{
+				sendUrgent(level, msg, source, code, std::move(args), site, fields);
+				return;
+			}
+			if (!enqueue(level, msg, source, code, args, site, fields))
+			{
+				Event e{ level, msg, source, code };
+				e.site = site;
+				e.args = std::move(args);
+				if (fields != nullptr)
+				{
+					e.fields = *fields;
+				}
+				dispatch(e);
+			}
+		}
+
+		/// @brief Write an event to the crash file, then send it to the streams from this thread and flush them
+		/// The line is written straight from the arguments before anything that could allocate, so it is kept even when
+		/// memory has run out. A deferred message is written as its format. The event waits for everything queued before it,
+		/// so the streams still see the events in order
+		void sendUrgent(LEVELS level, std::string_view msg, std::string_view source, std::string_view code,
+			std::shared_ptr<const DeferredFormat>&& args, uint32_t site, const Fields* fields)
+		{
+			auto now = EventClock::now();
+			const CallSite* from = site != 0 ? CallSite::find(site) : nullptr;
+			char line[crash::LINE_SIZE];
+			writeCrash(line, crash::format(level, now, msg,
+				source.empty() && from != nullptr ? from->getSource() : source,
+				code.empty() && from != nullptr ? from->getCode() : code, fields, line, sizeof(line)));
+
+			Event e{ level, msg, source, code, now };
+			e.site = site;
+			e.args = std::move(args);
+			if (fields != nullptr)
+			{
+				e.fields = *fields;
+			}
+			e.resolve();
+
+			waitForQueue();
+			waitForWorkers();
+			dispatch(e, true);
+			flushStreams();
+		}
+
+		/// @brief Write a line to the crash file and stderr, whichever are enabled
+		void writeCrash(const char* line, size_t size)
+		{
+			int fd = crashFile.load(std::memory_order_relaxed);
+			if (fd >= 0)
+			{
+				crash::write(fd, line, size);
+			}
+			if (crashStderr.load(std::memory_order_relaxed))
+			{
+				crash::write(2, line, size);
+			}
+		}
+
+		/// @brief Write every event left in the shared queue to the crash file, taking them off the queue
+		void drainToCrash()
+		{
+			if (!ring)
+			{
+				return;
+			}
+			char line[crash::LINE_SIZE];
+			while (ring->consume([this, &line](Event& event)
+				{
+					writeCrash(line, crash::format(event, line, sizeof(line)));
+				}))
+			{
+			}
+		}
+
+		/// @brief The signals that the crash handlers catch
+#ifdef _WIN32
+		inline static const std::array<int, 4> CRASH_SIGNALS = { SIGSEGV, SIGABRT, SIGFPE, SIGILL };
+		inline static std::array<void (*)(int), 4> previousSignals{};
+#else
+		inline static const std::array<int, 5> CRASH_SIGNALS = { SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL };
+		inline static std::array<struct sigaction, 5> previousSignals{};
+#endif
+
+		/// @brief Put back the handlers that were there before crash handling was enabled and close the crash file
+		void stopCrashHandling()
+		{
+			crashLevels.store(0, std::memory_order_release);
+			if (signalsInstalled)
+			{
+				for (size_t i = 0; i < CRASH_SIGNALS.size(); ++i)
+				{
+					restoreSignal(i);
+				}
+				signalsInstalled = false;
+			}
+			if (terminateInstalled)
+			{
+				std::set_terminate(previousTerminate);
+				terminateInstalled = false;
+			}
+			int fd = crashFile.exchange(-1);
+			if (fd >= 0)
+			{
+				crash::close(fd);
+			}
+		}
+
+		/// @brief Install the crash signal handlers, remembering the ones they replace
+		void installSignalHandlers()
+		{
+#ifdef _WIN32
+			for (size_t i = 0; i < CRASH_SIGNALS.size(); ++i)
+			{
+				previousSignals[i] = std::signal(CRASH_SIGNALS[i], &Log::onCrashSignal);
+			}
+#else
+			crash::SignalStack::install(); // other threads set theirs up when they log
+
+			struct sigaction action = {};
+			action.sa_handler = &Log::onCrashSignal;
+			action.sa_flags = SA_ONSTACK;
+			sigemptyset(&action.sa_mask);
+			for (size_t i = 0; i < CRASH_SIGNALS.size(); ++i)
+			{
+				sigaction(CRASH_SIGNALS[i], &action, &previousSignals[i]);
+			}
+#endif
+			signalsInstalled = true;
+		}
+
+		/// @brief Put back the handler a crash signal had before
+		/// @param index position of the signal in CRASH_SIGNALS
+		/// @return the signal
+		static int restoreSignal(size_t index)
+		{
+			int signal = CRASH_SIGNALS[index];
+#ifdef _WIN32
+			std::signal(signal, previousSignals[index] != SIG_IGN ? previousSignals[index] : SIG_DFL);
+#else
+			struct sigaction previous = previousSignals[index];
+			if (!(previous.sa_flags & SA_SIGINFO) && previous.sa_handler == SIG_IGN)
+			{
+				previous.sa_handler = SIG_DFL; // ignoring a crash would run the faulting code again
+			}
+			sigaction(signal, &previous, nullptr);
+#endif
+			return signal;
+		}
+
+		/// @brief Signal handler, writes out what it can and then lets the previous handler deal with the signal
+		static void onCrashSignal(int signal)
+		{
+			Log* inst = instance.load();
+			if (inst != nullptr && !inst->crashing.exchange(true))
+			{
+				char line[crash::LINE_SIZE];
+				inst->writeCrash(line, crash::note("fatal signal ", crash::signalName(signal), line, sizeof(line)));
+				inst->drainToCrash();
+			}
+			for (size_t i = 0; i < CRASH_SIGNALS.size(); ++i)
+			{
+				if (CRASH_SIGNALS[i] == signal)
+				{
+					restoreSignal(i);
+				}
+			}
+			std::raise(signal);
+		}
+
+		/// @brief Terminate handler, notes the exception and flushes every stream before the program aborts
+		static void onTerminate()
+		{
+			Log* inst = instance.load();
+			if (inst != nullptr && !inst->crashing.exchange(true))
+			{
+				const char* what = "";
+				std::exception_ptr current = std::current_exception();
+				if (current)
+				{
+					try
+					{
+						std::rethrow_exception(current);
+					}
+					catch (const std::exception& e)
+					{
+						what = e.what();
+					}
+					catch (...)
+					{
+						what = "unknown exception";
+					}
+				}
+				char line[crash::LINE_SIZE];
+				inst->writeCrash(line, crash::note("std::terminate called ", what, line, sizeof(line)));
+				inst->drainToCrash(); // the writer may be the thread that is terminating, so it isn't waited for
+				inst->flushIdleStreams();
+			}
+			std::terminate_handler previous = inst != nullptr ? inst->previousTerminate : nullptr;
+			if (previous != nullptr && previous != &Log::onTerminate)
+			{
+				previous();
+			}
+			std::abort();
+		}
+
+		/// @brief Wait until the background writer has sent everything queued, unless this is the writer
+		void waitForQueue()
+		{
+			if (std::this_thread::get_id() != writerId) // the writer can't wait for itself
+			{
+				std::unique_lock<std::mutex> lock(queueLock);
+				while (!queueIdle())
+				{
+					queueDrained.wait_for(lock, std::chrono::milliseconds(1));
+				}
+			}
+		}
+
+		/// @brief Check if any stream listening to a level would let an event through its filter, before the event is made
+		/// @param site ID of the call site the source and code come from, 0 if none
+		/// @return true if the event should be sent
+		bool passesFilters(LEVELS level, std::string_view source, std::string_view code, uint32_t site)
+		{
+			if ((filteredLevels.load(std::memory_order_relaxed) & level) == 0)
+			{
+				return true;
+			}
+			ReadGuard reading(*this);
+			for (auto& target : reading.streams->byLevel[levelIndex(level)])
+			{
+				if (target.filter == nullptr || target.filter->allows(level, source, code, site))
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
+		/// @brief Wait until the workers have handed every event in their queues to their streams
+		void waitForWorkers()
+		{
+			if (StreamWorker::current() != nullptr) // a worker could end up waiting for itself
+			{
+				return;
+			}
+			// holding syncLock stops the dedicated workers from being destroyed while they are waited for
+			std::lock_guard<std::mutex> syncing(syncLock);
+			std::vector<StreamWorker*> waiting;
+			{
+				std::lock_guard<std::mutex> lock(writerLock);
+				for (auto& worker : workers)
+				{
+					waiting.push_back(worker.get());
+				}
+			}
+			for (auto worker : waiting)
+			{
+				worker->waitIdle();
+			}
+		}
+
+		/// @brief Fill in a queue slot for the background writer
+		/// @return false if the event needs to be sent directly, because the logger is synchronous or this is the writer thread
+		bool enqueue(LEVELS level, std::string_view msg, std::string_view source, std::string_view code,
+			std::shared_ptr<const DeferredFormat>& args, uint32_t site, const Fields* fields)
+		{
+			if (!running.load(std::memory_order_relaxed) || std::this_thread::get_id() == writerId.load(std::memory_order_relaxed))
+			{
+				return false;
+			}
+
+			// registering as a producer stops the writer from shutting down until the slot is published
+			activeProducers.fetch_add(1);
+			if (!running.load())
+			{
+				activeProducers.fetch_sub(1);
+				return false;
+			}
+
+			std::chrono::steady_clock::time_point start;
+			if (config.measureLatency)
+			{
+				start = std::chrono::steady_clock::now();
+			}
+
+			// the thread's own buffer is tried first, the shared queue takes the events that don't fit
+			ThreadBuffer* local = nullptr;
+			Event* slot = nullptr;
+			if (config.perThreadBuffers)
+			{
+				local = registerBuffer();
+				slot = local->reserve();
+			}
+			bool own = slot != nullptr;
+
+			size_t ticket = 0;
+			size_t retries = 0;
+			unsigned waits = 0;
+			while (!own && (slot = ring->reserve(ticket, retries)) == nullptr)
+			{
+				if (waits == 0)
+				{
+					count(stats.full, 1);
+				}
+				if (config.overflow == OVERFLOW_POLICY::DROP_NEWEST)
+				{
+					count(stats.dropped, 1);
+					activeProducers.fetch_sub(1);
+					return true;
+				}
+				else if (config.overflow == OVERFLOW_POLICY::DROP_OLDEST)
+				{
+					if (ring->discard())
+					{
+						count(stats.dropped, 1);
+					}
+				}
+				else if (++waits < 64)
+				{
+					std::this_thread::yield();
+				}
+				else
+				{
+					std::this_thread::sleep_for(std::chrono::microseconds(50));
+				}
+			}
+
+			slot->timestamp = EventClock::now();
+			slot->level = level;
+			slot->msg = msg;
+			slot->source = source;
+			slot->code = code;
+			slot->site = site;
+			slot->args = std::move(args);
+			if (fields != nullptr)
+			{
+				slot->fields = *fields;
+			}
+			else
+			{
+				slot->fields.clear();
+			}
+			if (own)
+			{
+				local->publish();
+			}
+			else
+			{
+				ring->publish(ticket);
+			}
+
+			if (retries > 0)
+			{
+				count(stats.contention, retries);
+			}
+			if (config.measureLatency)
+			{
+				recordLatency((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+			}
+
+			wakeWriter(false);
+			activeProducers.fetch_sub(1);
+			return true;
+		}
+
+		/// @brief Wake the background writer
+		/// @param always false to only wake it if it has gone to sleep
+		void wakeWriter(bool always)
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (always || writerSleeping.load(std::memory_order_relaxed))
+			{
+				std::lock_guard<std::mutex> lock(queueLock);
+				queueNotEmpty.notify_one();
+			}
+		}
+
+		/// @brief Holds the calling thread's buffer, marking it as orphaned when the thread exits
+		struct LocalBuffer
+		{
+			~LocalBuffer()
+			{
+				if (buffer)
+				{
+					buffer->orphaned.store(true, std::memory_order_release);
+				}
+			}
+
+			std::shared_ptr<ThreadBuffer> buffer;
+			uint64_t generation = 0;
+		};
+
+		/// @brief The calling thread's buffer
+		/// @return the holder of the buffer, which is empty if the thread hasn't logged since per-thread buffers were enabled
+		static LocalBuffer& localBuffer()
+		{
+			static thread_local LocalBuffer local;
+			if (local.buffer && local.generation != getInstance()->bufferGeneration.load(std::memory_order_acquire))
+			{
+				local.buffer.reset(); // left over from an earlier run of the writer
+			}
+			return local;
+		}
+
+		/// @brief Get the calling thread's buffer, creating and registering it with the writer on first use
+		/// @return the buffer
+		ThreadBuffer* registerBuffer()
+		{
+			LocalBuffer& local = localBuffer();
+			if (!local.buffer)
+			{
+				local.buffer = std::make_shared<ThreadBuffer>(config.threadBufferCapacity);
+				local.generation = bufferGeneration.load(std::memory_order_acquire);
+				std::lock_guard<std::mutex> lock(threadBuffersLock);
+				threadBuffers.push_back(local.buffer);
+				++threadBuffersVersion;
+			}
+			return local.buffer.get();
+		}
+
+		/// @brief Check if every thread's buffer is empty
+		/// @return true if no thread has events waiting
+		bool buffersEmpty()
+		{
+			std::lock_guard<std::mutex> lock(threadBuffersLock);
+			for (auto& buffer : threadBuffers)
+			{
+				if (!buffer->empty())
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		/// @brief Take waiting events from every thread's buffer, releasing the buffers of threads that have exited
+		/// @param batch [out] receives the events after the first taken entries
+		/// @param taken number of entries of batch already in use
+		/// @param buffers the writer's copy of the list of buffers
+		/// @param harvested [out] each buffer with the number of events taken from it so far
+		/// @return the number of entries of batch now in use
+		size_t harvest(std::vector<Event>& batch, size_t taken, std::vector<std::shared_ptr<ThreadBuffer>>& buffers,
+			std::vector<std::pair<ThreadBuffer*, size_t>>& harvested)
+		{
+			if (threadBuffersVersion.load(std::memory_order_acquire) != buffersVersionSeen)
+			{
+				std::lock_guard<std::mutex> lock(threadBuffersLock);
+				buffers = threadBuffers;
+				buffersVersionSeen = threadBuffersVersion;
+			}
+
+			harvested.clear();
+			bool released = false;
+			for (auto& buffer : buffers)
+			{
+				// check before taking, so every event published before the thread exited is taken
+				bool exited = buffer->orphaned.load(std::memory_order_acquire);
+				size_t fromBuffer = 0;
+				while (fromBuffer < MAX_HARVEST)
+				{
+					if (taken == batch.size())
+					{
+						batch.emplace_back();
+					}
+					if (!buffer->pop(batch[taken]))
+					{
+						break;
+					}
+					++taken;
+					++fromBuffer;
+				}
+				if (fromBuffer > 0)
+				{
+					harvested.emplace_back(buffer.get(), buffer->delivered.load(std::memory_order_relaxed) + fromBuffer);
+					stats.harvested.fetch_add(fromBuffer, std::memory_order_relaxed);
+				}
+				if (exited && buffer->empty())
+				{
+					released = true;
+				}
+			}
+
+			if (released)
+			{
+				std::lock_guard<std::mutex> lock(threadBuffersLock);
+				auto finished = [](const std::shared_ptr<ThreadBuffer>& buffer)
+				{
+					return buffer->orphaned.load(std::memory_order_acquire) && buffer->empty();
+				};
+				threadBuffers.erase(std::remove_if(threadBuffers.begin(), threadBuffers.end(), finished), threadBuffers.end());
+				++threadBuffersVersion;
+			}
+			return taken;
+		}
+
+		/// @brief Add to one of the queue counters
+		/// @param counter the counter to change
+		/// @param amount how much to add
+		static void count(std::atomic<uint64_t>& counter, uint64_t amount)
+		{
+			counter.fetch_add(amount, std::memory_order_relaxed);
+		}
+
+		/// @brief Add one enqueue time to the queue statistics
+		/// @param ns how long the enqueue took
+		void recordLatency(uint64_t ns)
+		{
+			count(stats.enqueueNsTotal, ns);
+			uint64_t slowest = stats.enqueueNsMax.load(std::memory_order_relaxed);
+			while (ns > slowest && !stats.enqueueNsMax.compare_exchange_weak(slowest, ns, std::memory_order_relaxed))
+			{
+			}
+
+			size_t bucket = 0;
+			for (uint64_t limit = 16; ns >= limit && bucket + 1 < stats.enqueueNsHistogram.size(); limit <<= 1)
+			{
+				++bucket;
+			}
+			count(stats.enqueueNsHistogram[bucket], 1);
+		}
+
+		/// @brief Check if the background writer has nothing left to do
+		/// @return true if the queue is empty and nothing is being sent
+		bool queueIdle()
+		{
+			return !writing && (!ring || ring->empty()) && buffersEmpty();
+		}
+
+		/// @brief Send an event to every registered stream
+		/// The streams on workers get one shared copy of the event, which is moved out once the other streams have it
+		/// @param event the event to send
+		/// @param direct whether to hand the event to the streams on workers from this thread as well
+		void dispatch(Event& event, bool direct = false)
+		{
+			event.resolve();
+			if (Stream::getConfigVersion() != snapshotVersion.load(std::memory_order_relaxed))
+			{
+				rebuildDispatch();
+			}
+			ThreadCounters::add(localCounters().dispatched, 1);
+			bool timed = measureHandle.load(std::memory_order_relaxed);
+			ReadGuard reading(*this);
+			std::shared_ptr<const Event> shared;
+			for (auto& target : reading.streams->byLevel[levelIndex(event.level)])
+			{
+				if (target.filter != nullptr && !target.filter->allows(shared ? *shared : event))
+				{
+					continue;
+				}
+				if (target.queue == nullptr || direct)
+				{
+					target.stream->deliver(event, timed);
+					continue;
+				}
+				if (!shared)
+				{
+					shared = std::make_shared<const Event>(std::move(event)); // the direct streams come first
+				}
+				target.queue->worker->push(*target.queue, &shared, 1);
+			}
+		}
+
+		/// @brief Send a batch of events to the registered streams
+		/// Each stream gets the runs of consecutive events it listens to, so a stream listening to every level gets one call
+		/// @param events the first event
+		/// @param count number of events
+		void dispatchBatch(Event* events, size_t count)
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+				events[i].resolve();
+			}
+			if (Stream::getConfigVersion() != snapshotVersion.load(std::memory_order_relaxed))
+			{
+				rebuildDispatch();
+			}
+			ThreadCounters::add(localCounters().dispatched, count);
+			bool timed = measureHandle.load(std::memory_order_relaxed);
+			ReadGuard reading(*this);
+			if (!reading.streams->queues.empty())
+			{
+				sharedBatch.resize(count);
+			}
+			for (auto& target : reading.streams->listening)
+			{
+				int levels = target.stream->getLevels();
+				auto accepted = [this, &target, levels, events](size_t i)
+					{
+						// events already moved into shared copies are read from there
+						const Event& event = !sharedBatch.empty() && sharedBatch[i] ? *sharedBatch[i] : events[i];
+						return (levels & event.level) == event.level && (target.filter == nullptr || target.filter->allows(event));
+					};
+				size_t start = 0;
+				while (start < count)
+				{
+					size_t end = start;
+					while (end < count && accepted(end))
+					{
+						++end;
+					}
+					if (end == start)
+					{
+						++start; // not for this stream
+						continue;
+					}
+					if (target.queue == nullptr)
+					{
+						target.stream->deliverBatch(EventSpan(events + start, end - start), timed);
+					}
+					else
+					{
+						// the direct streams come first, so the events can be moved into the shared copies
+						for (size_t i = start; i < end; ++i)
+						{
+							if (!sharedBatch[i])
+							{
+								sharedBatch[i] = std::make_shared<const Event>(std::move(events[i]));
+							}
+						}
+						target.queue->worker->push(*target.queue, sharedBatch.data() + start, end - start);
+					}
+					start = end;
+				}
+			}
+			sharedBatch.clear();
+		}
+
+		/// @brief The registered streams and which of them listen to each level
+		/// A snapshot is never changed once published, changes publish a new one
+		struct StreamSnapshot
+		{
+			/// @brief The streams by name
+			std::map<std::string, Stream*> streams;
+
+			/// @brief A stream to send events to, and the queue of its worker if it has one
+			struct Target
+			{
+				Stream* stream;
+				StreamWorker::Queue* queue;
+				const EventFilter* filter;
+			};
+
+			/// @brief The streams that listen to each level, the ones without a worker first
+			std::array<std::vector<Target>, LEVEL_COUNT> byLevel;
+
+			/// @brief The streams that listen to at least one level, for sending batches, the ones without a worker first
+			std::vector<Target> listening;
+
+			/// @brief The queues of the streams on workers
+			std::map<const Stream*, StreamWorker::Queue*> queues;
+
+			/// @brief Keeps the filters of the targets alive for as long as the snapshot
+			std::vector<std::shared_ptr<const EventFilter>> filters;
+
+			/// @brief Stream configuration version the snapshot was built from
+			unsigned version = 0;
+		};
+
+		/// @brief Keeps the current snapshot alive while it is used
+		/// Entering counts the thread as a reader in the current epoch, a writer waits for both epochs to empty before freeing old snapshots
+		struct ReadGuard
+		{
+			ReadGuard(Log& log) : log(log), epoch(log.epoch.load() & 1)
+			{
+				log.readers[epoch].count.fetch_add(1);
+				// a thread that isn't reading yet waits out a fork, a stream reading again from handle() carries on
+				while (log.forkGate.load() && readDepth()[0] == 0 && readDepth()[1] == 0)
+				{
+					log.readers[epoch].count.fetch_sub(1);
+					while (log.forkGate.load())
+					{
+						std::this_thread::yield();
+					}
+					epoch = log.epoch.load() & 1;
+					log.readers[epoch].count.fetch_add(1);
+				}
+				++readDepth()[epoch];
+				streams = log.snapshot.load();
+			}
+
+			~ReadGuard()
+			{
+				--readDepth()[epoch];
+				log.readers[epoch].count.fetch_sub(1);
+			}
+
+			Log& log;
+			size_t epoch;
+			const StreamSnapshot* streams;
+		};
+
+		/// @brief How many times the calling thread is counted as a reader in each epoch
+		static std::array<int, 2>& readDepth()
+		{
+			static thread_local std::array<int, 2> depth = { 0, 0 };
+			return depth;
+		}
+
+		/// @brief Build and publish a new snapshot, must be called with writerLock held
+		/// @param streams the registered streams
+		void publish(std::map<std::string, Stream*>&& streams)
+		{
+			StreamSnapshot* next = new StreamSnapshot();
+			next->version = Stream::getConfigVersion();
+			next->streams = std::move(streams);
+			assignWorkers(*next);
+			int listening = 0;
+			int filtered = 0;
+			for (int queued = 0; queued < 2; ++queued)
+			{
+				for (auto s : next->streams)
+				{
+					auto found = next->queues.find(s.second);
+					StreamWorker::Queue* queue = found != next->queues.end() ? found->second : nullptr;
+					if ((queue != nullptr) != (queued == 1))
+					{
+						continue;
+					}
+					int levels = s.second->getLevels();
+					std::shared_ptr<const EventFilter> filter = s.second->getFilter();
+					if (filter)
+					{
+						next->filters.push_back(filter);
+						filtered |= levels & ALL_LEVELS;
+					}
+					for (size_t i = 0; i < LEVEL_COUNT; ++i)
+					{
+						if ((levels & (1 << i)) != 0)
+						{
+							next->byLevel[i].push_back({ s.second, queue, filter.get() });
+						}
+					}
+					if ((levels & ALL_LEVELS) != 0)
+					{
+						next->listening.push_back({ s.second, queue, filter.get() });
+					}
+					listening |= levels & ALL_LEVELS;
+				}
+			}
+
+			const StreamSnapshot* old = snapshot.exchange(next);
+			if (old != nullptr)
+			{
+				retired.push_back(old);
+			}
+			listeningLevels.store(listening, std::memory_order_relaxed);
+			filteredLevels.store(filtered, std::memory_order_relaxed);
+			snapshotVersion.store(next->version, std::memory_order_release);
+		}
+
+		/// @brief Give each stream that wants a worker its queue, keeping the queues whose settings haven't changed
+		/// Queues that are no longer used are retired and taken off their worker once no thread can be adding to them.
+		/// Must be called with writerLock held
+		/// @param next the snapshot being built
+		void assignWorkers(StreamSnapshot& next)
+		{
+			std::map<const Stream*, std::shared_ptr<StreamWorker::Queue>> queues;
+			for (auto s : next.streams)
+			{
+				WorkerConfig wanted = s.second->getWorker();
+				if (wanted.mode == WORKER_MODE::DIRECT || queues.count(s.second) != 0)
+				{
+					continue;
+				}
+				auto found = workerQueues.find(s.second);
+				if (found != workerQueues.end() && found->second->matches(wanted))
+				{
+					queues[s.second] = found->second;
+					continue;
+				}
+				auto queue = std::make_shared<StreamWorker::Queue>(s.second, wanted);
+				pickWorker(wanted.mode == WORKER_MODE::DEDICATED)->attach(queue);
+				queues[s.second] = queue;
+			}
+			for (auto& old : workerQueues)
+			{
+				auto kept = queues.find(old.first);
+				if (kept == queues.end() || kept->second != old.second)
+				{
+					retiredQueues.push_back(old.second);
+				}
+			}
+			workerQueues.swap(queues);
+			for (auto& queue : workerQueues)
+			{
+				next.queues[queue.first] = queue.second.get();
+			}
+		}
+
+		/// @brief Find a worker for a stream, starting a new thread for a dedicated worker or while the pool isn't full yet
+		/// Must be called with writerLock held
+		/// @param dedicated whether the stream wants a thread of its own
+		/// @return the worker
+		StreamWorker* pickWorker(bool dedicated)
+		{
+			if (!dedicated)
+			{
+				StreamWorker* best = nullptr;
+				size_t bestLoad = 0;
+				size_t pooled = 0;
+				for (auto& worker : workers)
+				{
+					if (worker->isDedicated())
+					{
+						continue;
+					}
+					++pooled;
+					size_t load = worker->load();
+					if (best == nullptr || load < bestLoad)
+					{
+						best = worker.get();
+						bestLoad = load;
+					}
+				}
+				if (best != nullptr && (pooled >= workerPoolSize || bestLoad == 0))
+				{
+					return best;
+				}
+			}
+			workers.push_back(std::make_unique<StreamWorker>(dedicated, measureHandle));
+			return workers.back().get();
+		}
+
+		/// @brief Publish a new snapshot after a stream's levels have changed
+		void rebuildDispatch()
+		{
+			{
+				std::lock_guard<std::mutex> lock(writerLock);
+				if (Stream::getConfigVersion() == snapshotVersion.load(std::memory_order_relaxed))
+				{
+					return; // another thread got here first
+				}
+				auto streams = snapshot.load()->streams;
+				publish(std::move(streams));
+			}
+			reclaim(false);
+		}
+
+		/// @brief Wait until no thread can still be using an old snapshot, then free the old snapshots
+		/// @param always false to skip it when the calling thread is inside a dispatch, where waiting could deadlock
+		void reclaim(bool always)
+		{
+			std::array<int, 2>& own = readDepth();
+			if (!always && (own[0] > 0 || own[1] > 0 || StreamWorker::current() != nullptr))
+			{
+				return;
+			}
+
+			std::lock_guard<std::mutex> syncing(syncLock);
+			std::vector<const StreamSnapshot*> old;
+			std::vector<StreamPool::Slot*> removed;
+			std::vector<std::shared_ptr<StreamWorker::Queue>> queues;
+			{
+				std::lock_guard<std::mutex> lock(writerLock);
+				old.swap(retired);
+				removed.swap(retiredSlots);
+				queues.swap(retiredQueues);
+			}
+			// readers that arrived before the flip are counted in the old epoch, two flips catch both epochs
+			for (int flip = 0; flip < 2; ++flip)
+			{
+				size_t previous = epoch.fetch_add(1) & 1;
+				while (readers[previous].count.load() > own[previous])
+				{
+					std::this_thread::yield();
+				}
+			}
+			for (auto s : old)
+			{
+				delete s;
+			}
+			// the streams are only destroyed once their workers have handed over what was queued for them
+			for (auto& queue : queues)
+			{
+				StreamWorker* worker = queue->worker;
+				worker->detach(queue.get());
+				// a worker left with nothing to serve ends its thread, the check is under writerLock so it can't be picked meanwhile
+				std::unique_ptr<StreamWorker> finished;
+				{
+					std::lock_guard<std::mutex> lock(writerLock);
+					for (auto& w : workers)
+					{
+						if (w.get() == worker && worker->load() == 0)
+						{
+							finished = std::move(w);
+						}
+					}
+					workers.erase(std::remove(workers.begin(), workers.end(), nullptr), workers.end());
+				}
+			}
+			for (auto slot : removed)
+			{
+				pool.destroy(slot);
+			}
+		}
+
+		/// @brief Tell every registered stream to write out what it is holding back
+		void flushStreams()
+		{
+			ReadGuard reading(*this);
+			for (auto s : reading.streams->streams)
+			{
+				s.second->deliverFlush();
+			}
+		}
+
+		/// @brief Flush the streams that no other thread is handling events on, without waiting for the others
+		void flushIdleStreams()
+		{
+			ReadGuard reading(*this);
+			for (auto s : reading.streams->streams)
+			{
+				s.second->tryDeliverFlush();
+			}
+		}
+
+		/// @brief Main function of the background writer thread
+		/// Takes events off the queue in batches and sends them to the streams, sleeping when there is nothing to do
+		void writerLoop()
+		{
+			writerId = std::this_thread::get_id();
+			std::vector<Event> batch(MAX_HARVEST);
+			std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+			std::vector<std::pair<ThreadBuffer*, size_t>> harvested;
+			std::vector<size_t> order;
+			std::vector<Event> merged;
+			while (true)
+			{
+#ifndef _WIN32
+				if (signalsInstalled.load(std::memory_order_relaxed))
+				{
+					crash::SignalStack::install(); // streams crash on this thread too
+				}
+#endif
+				size_t taken = 0;
+				size_t depth = ring->size();
+				while (taken < MAX_HARVEST && ring->pop(batch[taken]))
+				{
+					++taken;
+				}
+				if (config.perThreadBuffers)
+				{
+					taken = harvest(batch, taken, buffers, harvested);
+				}
+
+				if (taken > 0)
+				{
+					if (depth > stats.highWater.load(std::memory_order_relaxed))
+					{
+						stats.highWater.store(depth, std::memory_order_relaxed);
+					}
+					if (config.perThreadBuffers)
+					{
+						// each thread's events are in order, merge them so the streams see one timeline
+						order.resize(taken);
+						for (size_t i = 0; i < taken; ++i)
+						{
+							order[i] = i;
+						}
+						std::stable_sort(order.begin(), order.end(), [&batch](size_t a, size_t b)
+							{
+								return batch[a].timestamp < batch[b].timestamp;
+							});
+						if (merged.size() < taken)
+						{
+							merged.resize(taken);
+						}
+						for (size_t i = 0; i < taken; ++i)
+						{
+							std::swap(merged[i], batch[order[i]]);
+						}
+						dispatchBatch(merged.data(), taken);
+						for (auto& done : harvested)
+						{
+							done.first->delivered.store(done.second, std::memory_order_release);
+						}
+					}
+					else
+					{
+						dispatchBatch(batch.data(), taken);
+					}
+					reportStats(true);
+					continue;
+				}
+
+				reportStats(true);
+
+				std::unique_lock<std::mutex> lock(queueLock);
+				writing = false;
+				queueDrained.notify_all();
+				if (!running && activeProducers.load() == 0 && ring->empty() && buffersEmpty())
+				{
+					break; // stopped and fully drained
+				}
+
+				writerSleeping.store(true);
+				if (ring->empty() && buffersEmpty())
+				{
+					queueNotEmpty.wait_for(lock, std::chrono::milliseconds(10));
+				}
+				writerSleeping.store(false);
+				writing = true;
+			}
+			writerId = std::thread::id();
+		}
+
+		/// @brief Start the background writer on the current queue
+		void startWriter()
+		{
+			writing = true;
+			running = true;
+			writer = std::thread(&Log::writerLoop, this);
+		}
+
+		/// @brief Stop the background writer after it has sent all queued events
+		void stopWriter()
+		{
+			{
+				std::lock_guard<std::mutex> lock(queueLock);
+				running = false;
+				queueNotEmpty.notify_all();
+			}
+			if (writer.joinable())
+			{
+				writer.join();
+			}
+			writing = false;
+
+			// threads get a new buffer if the writer is started again
+			std::lock_guard<std::mutex> lock(threadBuffersLock);
+			threadBuffers.clear();
+			++threadBuffersVersion;
+			bufferGeneration.fetch_add(1, std::memory_order_release);
+		}
+
+		/// @brief Store the time for CACHED_CLOCK every interval until stopClock
+		void clockLoop(std::chrono::microseconds interval)
+		{
+			std::unique_lock<std::mutex> lock(clockWake);
+			while (!clockStop.wait_for(lock, interval, [this] { return !clockRunning; }))
+			{
+				EventClock::update();
+			}
+		}
+
+		/// @brief Start the thread that keeps the time for CACHED_CLOCK
+		void startClockThread()
+		{
+			clockRunning = true;
+			clockThread = std::thread(&Log::clockLoop, this, clockInterval);
+		}
+
+		/// @brief Stop the clock thread, going back to SYSTEM_CLOCK if it was keeping the time so it doesn't stand still
+		void stopClock()
+		{
+			if (EventClock::get() == CLOCK_SOURCE::CACHED_CLOCK)
+			{
+				EventClock::set(CLOCK_SOURCE::SYSTEM_CLOCK);
+			}
+			endClockThread();
+		}
+
+		/// @brief End the clock thread without changing the clock source
+		void endClockThread()
+		{
+			{
+				std::lock_guard<std::mutex> lock(clockWake);
+				clockRunning = false;
+				clockStop.notify_all();
+			}
+			if (clockThread.joinable())
+			{
+				clockThread.join();
+			}
+		}
+
+		/// @brief Ends the logger when the program ends
+		struct Teardown
+		{
+			~Teardown()
+			{
+				shutdown();
+			}
+		};
+
+		/// @brief The singleton instance, constant initialized so nothing runs before the first log call
+		inline static std::atomic<Log*> instance = nullptr;
+
+		/// @brief Makes sure the instance is only created once, even if several threads log at the same time, and isn't destroyed during a fork
+		inline static std::mutex lifecycle;
+
+		/// @brief Shuts the logger down at exit
+		inline static Teardown teardown;
+
+		/// @brief Whether the fork handlers have been registered, they stay registered for later instances, guarded by lifecycle
+		inline static bool forkHandlersAdded = false;
+
+		/// @brief Whether to pause the logger's threads around fork()
+		bool handleFork = true;
+
+		/// @brief Set by beforeFork when it stopped the threads, with whether the writer and clock thread were running
+		bool forkPaused = false;
+		bool forkAsync = false;
+		bool forkClock = false;
+
+		/// @brief Closed by beforeFork once no thread is reading the streams, threads that start reading wait until it opens
+		std::atomic<bool> forkGate = false;
+
+		/// @brief The registered streams, read without locking through a ReadGuard
+		std::atomic<const StreamSnapshot*> snapshot = nullptr;
+
+		/// @brief Snapshots that have been replaced but may still be in use
+		std::vector<const StreamSnapshot*> retired;
+
+		/// @brief Guards publishing snapshots and the retired list
+		std::mutex writerLock;
+
+		/// @brief Makes threads freeing old snapshots take turns
+		std::mutex syncLock;
+
+		/// @brief Number of times old snapshots have been waited for, its lowest bit picks the readers' counter
+		std::atomic<size_t> epoch = 0;
+
+		/// @brief Number of threads using a snapshot in each epoch, on separate cache lines
+		struct alignas(64) ReaderCount
+		{
+			std::atomic<int> count = 0;
+		};
+		std::array<ReaderCount, 2> readers;
+
+		/// @brief Every level that at least one stream listens to
+		std::atomic<int> listeningLevels = 0;
+
+		/// @brief Levels that at least one stream with a filter listens to, events of other levels skip the filters
+		std::atomic<int> filteredLevels = 0;
+
+		/// @brief Stream configuration version that the current snapshot was built from
+		std::atomic<unsigned> snapshotVersion = 0;
+
+		/// @brief Storage for the streams the logger owns
+		StreamPool pool;
+
+		/// @brief The registered streams that the logger owns, by name, guarded by writerLock
+		std::map<std::string, StreamPool::Slot*> owned;
+
+		/// @brief Owned streams that have been removed or replaced but may still be in use, guarded by writerLock
+		std::vector<StreamPool::Slot*> retiredSlots;
+
+		/// @brief The threads that hand events to the streams on workers, guarded by writerLock
+		std::vector<std::unique_ptr<StreamWorker>> workers;
+
+		/// @brief The queue of each stream on a worker, guarded by writerLock
+		std::map<const Stream*, std::shared_ptr<StreamWorker::Queue>> workerQueues;
+
+		/// @brief Queues that are no longer used but may still be added to, guarded by writerLock
+		std::vector<std::shared_ptr<StreamWorker::Queue>> retiredQueues;
+
+		/// @brief Most threads shared by the pooled streams, guarded by writerLock
+		size_t workerPoolSize = 2;
+
+		/// @brief Keeps the time for CACHED_CLOCK
+		std::thread clockThread;
+
+		/// @brief How often the clock thread stores the time, guarded by clockLock
+		std::chrono::microseconds clockInterval = std::chrono::milliseconds(1);
+
+		/// @brief Set while the clock thread should keep going, guarded by clockWake
+		bool clockRunning = false;
+
+		/// @brief Guards the clock thread's sleeping and stopping
+		std::mutex clockWake;
+
+		/// @brief Signalled to stop the clock thread
+		std::condition_variable clockStop;
+
+		/// @brief Serializes setClock
+		std::mutex clockLock;
+
+		/// @brief Shared copies of the events of a batch, only used by the background writer
+		std::vector<std::shared_ptr<const Event>> sharedBatch;
+
+		/// @brief Events waiting to be sent by the background writer
+		std::unique_ptr<RingBuffer<Event>> ring;
+
+		/// @brief Guards the writer's sleeping and waking
+		std::mutex queueLock;
+
+		/// @brief Signalled when an event is added to the queue while the writer is asleep
+		std::condition_variable queueNotEmpty;
+
+		/// @brief Signalled when the writer has sent everything in the queue
+		std::condition_variable queueDrained;
+
+		/// @brief The background writer thread
+		std::thread writer;
+
+		/// @brief ID of the background writer, used to avoid waiting on itself
+		std::atomic<std::thread::id> writerId;
+
+		/// @brief Settings for asynchronous mode
+		AsyncConfig config;
+
+		/// @brief Whether the background writer is accepting events
+		std::atomic<bool> running = false;
+
+		/// @brief Number of threads currently filling in a queue slot
+		std::atomic<int> activeProducers = 0;
+
+		/// @brief Whether the writer is waiting for a producer to wake it
+		std::atomic<bool> writerSleeping = false;
+
+		/// @brief Whether the background writer may still be sending events, guarded by queueLock
+		bool writing = false;
+
+		/// @brief Most events the writer takes from the shared queue or from one thread's buffer in each batch
+		static const size_t MAX_HARVEST = 256;
+
+		/// @brief The buffers of the threads that log while per-thread buffers are enabled
+		std::vector<std::shared_ptr<ThreadBuffer>> threadBuffers;
+
+		/// @brief Guards the list of thread buffers
+		std::mutex threadBuffersLock;
+
+		/// @brief Changes whenever the list of thread buffers changes
+		std::atomic<uint64_t> threadBuffersVersion = 0;
+
+		/// @brief The version of the list the writer last copied
+		uint64_t buffersVersionSeen = 0;
+
+		/// @brief Changes every time the writer stops, so threads know their buffer is no longer collected
+		std::atomic<uint64_t> bufferGeneration = 0;
+
+		/// @brief Counters behind QueueStats, the atomic ones are updated by producers
+		struct QueueCounters
+		{
+			/// @brief Set everything back to zero
+			void reset()
+			{
+				capacity = 0;
+				highWater = 0;
+				dropped = 0;
+				full = 0;
+				contention = 0;
+				enqueueNsTotal = 0;
+				enqueueNsMax = 0;
+				harvested = 0;
+				for (auto& bucket : enqueueNsHistogram)
+				{
+					bucket = 0;
+				}
+			}
+
+			size_t capacity = 0;
+			std::atomic<size_t> highWater = 0;
+			std::atomic<uint64_t> dropped = 0;
+			std::atomic<uint64_t> full = 0;
+			std::atomic<uint64_t> contention = 0;
+			std::atomic<uint64_t> enqueueNsTotal = 0;
+			std::atomic<uint64_t> enqueueNsMax = 0;
+			std::atomic<uint64_t> harvested = 0;
+			std::array<std::atomic<uint64_t>, 16> enqueueNsHistogram{};
+		} stats;
+
+		/// @brief Holds back events that are logged too often
+		RateLimiter limiter;
+
+		/// @brief Counters of the threads that have logged and are still running
+		std::vector<std::shared_ptr<ThreadCounters>> threadCounters;
+
+		/// @brief Counters of the threads that have exited
+		std::array<uint64_t, LEVEL_COUNT> exitedCreated{};
+		uint64_t exitedDispatched = 0;
+
+		/// @brief Guards the list of thread counters and the totals of exited threads
+		std::mutex countersLock;
+
+		/// @brief Events sent to the streams when each registered stream was added, guarded by writerLock
+		std::map<std::string, uint64_t> registered;
+
+		/// @brief Settings for the logger's own counters, guarded by statsLock
+		StatsConfig statsConfig;
+		std::mutex statsLock;
+
+		/// @brief Whether to time every call to a stream
+		std::atomic<bool> measureHandle = false;
+
+		/// @brief Whether to send a stats event every interval
+		std::atomic<bool> statsEnabled = false;
+
+		/// @brief Time between stats events, and when the next one is due, in steady clock nanoseconds
+		std::atomic<int64_t> statsInterval = 0;
+		std::atomic<int64_t> nextStats = 0;
+
+		/// @brief Levels written to the crash file and sent without queueing, 0 when crash handling is off
+		std::atomic<int> crashLevels = 0;
+
+		/// @brief The crash file, -1 if there is none
+		std::atomic<int> crashFile = -1;
+
+		/// @brief Whether crash lines are also written to stderr
+		std::atomic<bool> crashStderr = false;
+
+		/// @brief Set by the first crash handler to run, so a handler that leads to another crash doesn't write twice
+		std::atomic<bool> crashing = false;
+
+		/// @brief Whether the crash handlers are installed
+		std::atomic<bool> signalsInstalled = false;
+		bool terminateInstalled = false;
+
+		/// @brief The terminate handler that was installed before
+		std::terminate_handler previousTerminate = nullptr;
+
+		/// @brief Whether to display debug messages in release build
+		inline static std::atomic<bool> showDebug = false;
+	};
+
+
+	
+
+}
+
+// Logging macros that are removed completely when their level is below BOOM_MIN_LEVEL
+// Takes the same arguments as the matching boom::Log function, which are not evaluated if the level is removed
+#define BOOM_LOG(level, ...) do { if constexpr (::boom::isCompiledIn((level), BOOM_MIN_LEVEL)) { ::boom::Log::log((level), __VA_ARGS__); } } while (0)
+#define BOOM_DEBUG(...) BOOM_LOG(::boom::LEVELS::DBG, __VA_ARGS__)
+#define BOOM_INFO(...) BOOM_LOG(::boom::LEVELS::INFO, __VA_ARGS__)
+#define BOOM_WARNING(...) BOOM_LOG(::boom::LEVELS::WARNING, __VA_ARGS__)
+#define BOOM_ERROR(...) BOOM_LOG(::boom::LEVELS::ERR, __VA_ARGS__)
+#define BOOM_CRITICAL(...) BOOM_LOG(::boom::LEVELS::CRITICAL, __VA_ARGS__)
+
+// Logging macros that record where they are called from in a static boom::CallSite, registered the first time the line runs.
+// The source is the calling function and the code must be a string literal; events carry the call site's ID instead of the strings
+#define BOOM_LOG_AT(level, msg, code) do { if constexpr (::boom::isCompiledIn((level), BOOM_MIN_LEVEL)) { \
+	static const ::boom::CallSite boomCallSite((level), __FILE__, __LINE__, __func__, (code)); \
+	::boom::Log::log(boomCallSite, (msg)); } } while (0)
+#define BOOM_DEBUG_AT(msg, code) BOOM_LOG_AT(::boom::LEVELS::DBG, msg, code)
+#define BOOM_INFO_AT(msg, code) BOOM_LOG_AT(::boom::LEVELS::INFO, msg, code)
+#define BOOM_WARNING_AT(msg, code) BOOM_LOG_AT(::boom::LEVELS::WARNING, msg, code)
+#define BOOM_ERROR_AT(msg, code) BOOM_LOG_AT(::boom::LEVELS::ERR, msg, code)
+#define BOOM_CRITICAL_AT(msg, code) BOOM_LOG_AT(::boom::LEVELS::CRITICAL, msg, code)
+
+#endif // !BOOM_LOGGER_HPP
@@ -1,201 +1,3018 @@
-/*!
-UnitTest.cpp
-@author Alex Schlieck
-@version 0.1
-@date 2023-05-31
-
----------------------------------
-Unit tests for the miniLogger Library
-Built using catch2lib
-
-*/
-
-#define CATCH_CONFIG_MAIN
-
-#include <iostream>
-#include "catch.hpp"
-#include "BoomLog.hpp"
-
-
-
-using namespace boom;
-
-class TestStream : public Stream
-{
-public:
-	TestStream()
-	{}
-
-	std::string getMsg()
-	{
-		return e.msg;
-	}
-	
-	std::string getTime()
-	{
-		const std::string dateFormat("%Y/%m/%d/%H:%M:%S - ");
-
-		struct tm output;
-		std::stringstream result;
-
-		auto converted = std::chrono::system_clock::to_time_t(e.timestamp);
-		localtime_s(&output, &converted);
-		result << std::put_time(&output, dateFormat.c_str());
-		return result.str();
-	}
-
-	std::string getEventString()
-	{
-		return e.toString();
-	}
-
-	virtual void handle(Event& event)
-	{
-		e = event;
-	}
-
-private:
-	Event e;
-};
-
-TEST_CASE("Logger")
-{
-	SECTION("Event")
-	{
-		// create a known timestamp to compare to
-		std::tm target = {};
-		std::stringstream timestamp("Jan 1 2000 12:00:00");
-		timestamp >> std::get_time(&target, "%b %d %Y %H:%M:%S");
-		auto tp = std::chrono::system_clock::from_time_t(std::mktime(&target));
-		
-		Event e(LEVELS::WARNING, "Test Message", "", "", tp);
-		REQUIRE(e.toString() == " ! 2000/01/01/12:00:00 - Test Message");
-	}
-
-	SECTION("Stream")
-	{
-		TestStream* t = new TestStream;
-		t->setLevels(LEVELS::INFO | LEVELS::DBG);
-		Log::addStream("Test", t);
-		Log::log(LEVELS::INFO, "InfoEvent");
-		REQUIRE(t->getMsg() == "InfoEvent");
-		Log::log(LEVELS::DBG, "DebugEvent");
-		REQUIRE(t->getMsg() == "DebugEvent");
-		Log::log(LEVELS::ERR, "InvalidStream");
-		REQUIRE(t->getMsg() != "InvalidStream");
-
-		delete Log::removeStream("Test");
-	}
-
-	SECTION("Streams Management")
-	{
-		REQUIRE(Log::getStream("Target") == nullptr);
-		TestStream* t1 = new TestStream;
-		Log::addStream("Target", t1);
-		REQUIRE(Log::getStream("Target") == t1);
-		REQUIRE(Log::removeStream("Target") == t1);
-		REQUIRE(Log::getStream("Target") == nullptr);
-		delete t1;
-	}
-
-	SECTION("Logger Levels")
-	{
-		TestStream* t_dbg_info = new TestStream();
-		t_dbg_info->setLevels(LEVELS::DBG | LEVELS::INFO | LEVELS::ERR);
-
-		TestStream* t_warn_crit = new TestStream();
-		t_warn_crit->setLevels(LEVELS::WARNING | LEVELS::CRITICAL | LEVELS::ERR);
-
-		Log::addStream("dbg_info", t_dbg_info);
-		Log::addStream("warn_crit", t_warn_crit);
-
-		Log::debug("dbg_msg");
-		REQUIRE(t_dbg_info->getMsg() == "dbg_msg");
-		REQUIRE(t_warn_crit->getMsg() != "dbg_msg");
-
-		Log::info("info_msg");
-		REQUIRE(t_dbg_info->getMsg() == "info_msg");
-		REQUIRE(t_warn_crit->getMsg() != "info_msg");
-
-		Log::warning("warn_msg");
-		REQUIRE(t_dbg_info->getMsg() != "warn_msg");
-		REQUIRE(t_warn_crit->getMsg() == "warn_msg");
-
-		Log::critical("crit_msg");
-		REQUIRE(t_dbg_info->getMsg() != "crit_msg");
-		REQUIRE(t_warn_crit->getMsg() == "crit_msg");
-
-		Log::error("err_msg");
-		REQUIRE(t_dbg_info->getMsg() == "err_msg");
-		REQUIRE(t_warn_crit->getMsg() == "err_msg");
-
-		delete Log::removeStream("dbg_info");
-		delete Log::removeStream("warn_crit");
-	}
-
-	SECTION("Output Formatting")
-	{
-		TestStream t;
-		Log::addStream("Test", &t);
-
-		std::string expected;
-
-		Log::debug("dbg_msg");
-		expected = " # " + t.getTime() + "dbg_msg";
-		REQUIRE(t.getEventString() == expected);
-
-		Log::info("info_msg");
-		expected = "   " + t.getTime() + "info_msg";
-		REQUIRE(t.getEventString() == expected);
-
-		Log::warning("warning_msg");
-		expected = " ! " + t.getTime() + "warning_msg";
-		REQUIRE(t.getEventString() == expected);
-
-		Log::error("error_msg");
-		expected = "!! " + t.getTime() + "error_msg";
-		REQUIRE(t.getEventString() == expected);
-
-		Log::critical("critical_msg");
-		expected = "!!!" + t.getTime() + "critical_msg";
-		REQUIRE(t.getEventString() == expected);
-		Log::removeStream("Test");
-	}
-
-	SECTION("Optional Formatting")
-	{
-		TestStream * t = new TestStream;
-		Log::addStream("Test", t);
-
-		std::string expected;
-
-		Log::info("info_msg", "", "C0001");
-		expected = "   " + t->getTime() + "[C0001] info_msg";
-		REQUIRE(t->getEventString() == expected);
-
-		Log::info("info_msg", "UnitTest");
-		expected = "   " + t->getTime() + "info_msg (from UnitTest)";
-		REQUIRE(t->getEventString() == expected);
-
-		Log::info("info_msg", "UnitTest", "C0002");
-		expected = "   " + t->getTime() + "[C0002] info_msg (from UnitTest)";
-		REQUIRE(t->getEventString() == expected);
-
-		delete(Log::removeStream("Test"));
-	}
-
-	SECTION("Debug Messages")
-	{
-
-		TestStream* t = new TestStream;
-		Log::addStream("Test", t);
-
-		#define SHOW_DEBUG // simulate Debug build
-
-		Log::info("Info");
-		Log::debug("Debug");
-		REQUIRE(t->getMsg() == "Debug");
-
-		// Find a way to simulate and test the macro that would be generated in release build
-	}
-}
+/*!
+UnitTest.cpp
+@author Alex Schlieck
+@version 0.1
+@date 2023-05-31
+
+---------------------------------
+Unit tests for the miniLogger Library
+Built using catch2lib
+
+*/
+
+#define CATCH_CONFIG_MAIN
+
+#include <iostream>
+#include <cstdio>
+#include "catch.hpp"
+#include "BoomLog.hpp"
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
+
+
+
+using namespace boom;
+
+class TestStream : public Stream
+{
+public:
+	TestStream()
+	{}
+
+	std::string getMsg()
+	{
+		return e.msg;
+	}
+	
+	std::string getTime()
+	{
+		const std::string dateFormat("%Y/%m/%d/%H:%M:%S - ");
+
+		struct tm output;
+		std::stringstream result;
+
+		auto converted = std::chrono::system_clock::to_time_t(e.timestamp);
+		TimestampFormat::toLocalTime(converted, output);
+		result << std::put_time(&output, dateFormat.c_str());
+		return result.str();
+	}
+
+	std::string getEventString()
+	{
+		return e.toString();
+	}
+
+	virtual void handle(Event& event)
+	{
+		e = event;
+	}
+
+private:
+	Event e;
+};
+
+/// @brief Stream that holds the writer thread inside handle() until it is opened
+class GateStream : public Stream
+{
+public:
+	virtual void handle(Event& event)
+	{
+		entered = true;
+		while (!open)
+		{
+			std::this_thread::yield();
+		}
+		msgs.push_back(event.msg);
+	}
+
+	std::atomic<bool> entered = false;
+	std::atomic<bool> open = false;
+	std::vector<std::string> msgs;
+};
+
+/// @brief Stream that records the batches it receives
+class BatchStream : public Stream
+{
+public:
+	virtual void handle(Event& event)
+	{
+		batches.push_back({ event.msg });
+	}
+
+	virtual void handleBatch(EventSpan events)
+	{
+		std::vector<std::string> batch;
+		for (auto& event : events)
+		{
+			batch.push_back(event.msg);
+		}
+		batches.push_back(batch);
+	}
+
+	std::vector<std::vector<std::string>> batches;
+};
+
+/// @brief Stream that keeps count of how many of its kind are alive
+class TrackedStream : public Stream
+{
+public:
+	TrackedStream(int id = 0) : id(id)
+	{
+		++alive;
+	}
+
+	~TrackedStream()
+	{
+		--alive;
+	}
+
+	virtual void handle(Event& event)
+	{
+		msgs.push_back(event.msg);
+	}
+
+	int id;
+	std::vector<std::string> msgs;
+	inline static int alive = 0;
+};
+
+/// @brief Logs through a call site macro, so its events come from one place
+void connectToDatabase(int attempt)
+{
+	BOOM_ERROR_AT("connection failed, attempt " + std::to_string(attempt), "E0042");
+}
+
+/// @brief Logs from a second call site in the same function
+void connectToCache()
+{
+	BOOM_WARNING_AT("cache unavailable", "");
+	BOOM_INFO_AT("using the database instead", "I0001");
+}
+
+/// @brief Read a whole file into a string
+std::string readFile(const std::string& name)
+{
+	std::ifstream f(name, std::ios::binary);
+	std::stringstream contents;
+	contents << f.rdbuf();
+	return contents.str();
+}
+
+/// @brief Stream that counts the events it receives
+class CountingStream : public Stream
+{
+public:
+	virtual void handle(Event&)
+	{
+		++count;
+	}
+
+	size_t count = 0;
+};
+
+/// @brief Stream that logs an event of its own when it is destroyed
+class ClosingStream : public Stream
+{
+public:
+	~ClosingStream()
+	{
+		Log::warning("closing stream destroyed");
+	}
+
+	virtual void handle(Event&)
+	{}
+};
+
+TEST_CASE("Logger")
+{
+	SECTION("Event")
+	{
+		// create a known timestamp to compare to
+		std::tm target = {};
+		std::stringstream timestamp("Jan 1 2000 12:00:00");
+		timestamp >> std::get_time(&target, "%b %d %Y %H:%M:%S");
+		auto tp = std::chrono::system_clock::from_time_t(std::mktime(&target));
+		
+		Event e(LEVELS::WARNING, "Test Message", "", "", tp);
+		REQUIRE(e.toString() == " ! 2000/01/01/12:00:00 - Test Message");
+
+		// formatting into a buffer adds the same text to the end
+		std::string buffer = "start:";
+		e.formatTo(buffer);
+		REQUIRE(buffer == "start: ! 2000/01/01/12:00:00 - Test Message");
+
+		Event full(LEVELS::CRITICAL, "Full", "UnitTest", "C0003", tp);
+		buffer.clear();
+		full.formatTo(buffer);
+		REQUIRE(buffer == full.toString());
+		REQUIRE(buffer == "!!!2000/01/01/12:00:00 - [C0003] Full (from UnitTest)");
+	}
+
+	SECTION("Stream")
+	{
+		TestStream* t = new TestStream;
+		t->setLevels(LEVELS::INFO | LEVELS::DBG);
+		Log::addStream("Test", t);
+		Log::forceDebug(true); // debug events are only shown by default in _DEBUG builds
+		Log::log(LEVELS::INFO, "InfoEvent");
+		REQUIRE(t->getMsg() == "InfoEvent");
+		Log::log(LEVELS::DBG, "DebugEvent");
+		REQUIRE(t->getMsg() == "DebugEvent");
+		Log::log(LEVELS::ERR, "InvalidStream");
+		REQUIRE(t->getMsg() != "InvalidStream");
+
+		Log::forceDebug(false);
+		delete Log::removeStream("Test");
+	}
+
+	SECTION("Streams Management")
+	{
+		REQUIRE(Log::getStream("Target") == nullptr);
+		TestStream* t1 = new TestStream;
+		Log::addStream("Target", t1);
+		REQUIRE(Log::getStream("Target") == t1);
+		REQUIRE(Log::removeStream("Target") == t1);
+		REQUIRE(Log::getStream("Target") == nullptr);
+		delete t1;
+	}
+
+	SECTION("Logger Levels")
+	{
+		TestStream* t_dbg_info = new TestStream();
+		t_dbg_info->setLevels(LEVELS::DBG | LEVELS::INFO | LEVELS::ERR);
+
+		TestStream* t_warn_crit = new TestStream();
+		t_warn_crit->setLevels(LEVELS::WARNING | LEVELS::CRITICAL | LEVELS::ERR);
+
+		Log::addStream("dbg_info", t_dbg_info);
+		Log::addStream("warn_crit", t_warn_crit);
+		Log::forceDebug(true);
+
+		Log::debug("dbg_msg");
+		REQUIRE(t_dbg_info->getMsg() == "dbg_msg");
+		REQUIRE(t_warn_crit->getMsg() != "dbg_msg");
+
+		Log::info("info_msg");
+		REQUIRE(t_dbg_info->getMsg() == "info_msg");
+		REQUIRE(t_warn_crit->getMsg() != "info_msg");
+
+		Log::warning("warn_msg");
+		REQUIRE(t_dbg_info->getMsg() != "warn_msg");
+		REQUIRE(t_warn_crit->getMsg() == "warn_msg");
+
+		Log::critical("crit_msg");
+		REQUIRE(t_dbg_info->getMsg() != "crit_msg");
+		REQUIRE(t_warn_crit->getMsg() == "crit_msg");
+
+		Log::error("err_msg");
+		REQUIRE(t_dbg_info->getMsg() == "err_msg");
+		REQUIRE(t_warn_crit->getMsg() == "err_msg");
+
+		Log::forceDebug(false);
+		delete Log::removeStream("dbg_info");
+		delete Log::removeStream("warn_crit");
+	}
+
+	SECTION("Dispatch Table")
+	{
+		Stream* defaultText = Log::getStream("defaultTextFile");
+		Stream* defaultConsole = Log::getStream("defaultConsole");
+		defaultText->setLevels(LEVELS::ERR);
+		defaultConsole->setLevels(LEVELS::ERR);
+
+		TestStream* t = new TestStream;
+		t->setLevels(LEVELS::INFO);
+		Log::addStream("Test", t);
+		REQUIRE(Log::isListening(LEVELS::INFO));
+		REQUIRE(Log::isListening(LEVELS::ERR));
+		REQUIRE(!Log::isListening(LEVELS::WARNING));
+
+		Log::info("info_msg");
+		REQUIRE(t->getMsg() == "info_msg");
+
+		// changing the levels of a registered stream updates the table
+		t->setLevels(LEVELS::WARNING);
+		REQUIRE(!Log::isListening(LEVELS::INFO));
+		REQUIRE(Log::isListening(LEVELS::WARNING));
+		Log::info("ignored_msg");
+		REQUIRE(t->getMsg() == "info_msg");
+		Log::warning("warning_msg");
+		REQUIRE(t->getMsg() == "warning_msg");
+
+		delete Log::removeStream("Test");
+		REQUIRE(!Log::isListening(LEVELS::WARNING));
+
+		defaultText->setLevels(ALL_LEVELS);
+		defaultConsole->setLevels(ALL_LEVELS);
+	}
+
+	SECTION("Output Formatting")
+	{
+		auto t = Log::emplaceStream<TestStream>("Test");
+		Log::forceDebug(true);
+
+		std::string expected;
+
+		Log::debug("dbg_msg");
+		expected = " # " + t->getTime() + "dbg_msg";
+		REQUIRE(t->getEventString() == expected);
+
+		Log::info("info_msg");
+		expected = "   " + t->getTime() + "info_msg";
+		REQUIRE(t->getEventString() == expected);
+
+		Log::warning("warning_msg");
+		expected = " ! " + t->getTime() + "warning_msg";
+		REQUIRE(t->getEventString() == expected);
+
+		Log::error("error_msg");
+		expected = "!! " + t->getTime() + "error_msg";
+		REQUIRE(t->getEventString() == expected);
+
+		Log::critical("critical_msg");
+		expected = "!!!" + t->getTime() + "critical_msg";
+		REQUIRE(t->getEventString() == expected);
+		Log::forceDebug(false);
+		REQUIRE(Log::removeStream("Test") == nullptr); // owned by the logger, which destroys it
+		REQUIRE(!t);
+	}
+
+	SECTION("Optional Formatting")
+	{
+		TestStream * t = new TestStream;
+		Log::addStream("Test", t);
+
+		std::string expected;
+
+		Log::info("info_msg", "", "C0001");
+		expected = "   " + t->getTime() + "[C0001] info_msg";
+		REQUIRE(t->getEventString() == expected);
+
+		Log::info("info_msg", "UnitTest");
+		expected = "   " + t->getTime() + "info_msg (from UnitTest)";
+		REQUIRE(t->getEventString() == expected);
+
+		Log::info("info_msg", "UnitTest", "C0002");
+		expected = "   " + t->getTime() + "[C0002] info_msg (from UnitTest)";
+		REQUIRE(t->getEventString() == expected);
+
+		delete(Log::removeStream("Test"));
+	}
+
+	SECTION("Debug Messages")
+	{
+
+		TestStream* t = new TestStream;
+		Log::addStream("Test", t);
+
+		// debug messages can always be forced on
+		Log::forceDebug(true);
+		Log::info("Info");
+		Log::debug("Debug");
+		REQUIRE(t->getMsg() == "Debug");
+
+		Log::forceDebug(false);
+		Log::debug("Hidden");
+#ifdef SHOW_DEBUG
+		REQUIRE(t->getMsg() == "Hidden");
+#else
+		REQUIRE(t->getMsg() == "Debug");
+#endif
+
+		delete Log::removeStream("Test");
+	}
+
+	SECTION("Compile Time Levels")
+	{
+		static_assert(isCompiledIn(LEVELS::DBG, LEVELS::DBG), "");
+		static_assert(!isCompiledIn(LEVELS::INFO, LEVELS::WARNING), "");
+		static_assert(isCompiledIn(LEVELS::CRITICAL, LEVELS::WARNING), "");
+
+		TestStream* t = new TestStream;
+		Log::addStream("Test", t);
+
+		int evaluated = 0;
+		auto buildMsg = [&evaluated](const std::string& text) {
+			++evaluated;
+			return text;
+		};
+
+		BOOM_INFO(buildMsg("macro_info"), "UnitTest");
+		REQUIRE(t->getMsg() == "macro_info");
+		Log::log<LEVELS::WARNING>("template_warning");
+		REQUIRE(t->getMsg() == "template_warning");
+
+#undef BOOM_MIN_LEVEL
+#define BOOM_MIN_LEVEL 4 // simulate a build that only keeps warnings and above
+		evaluated = 0;
+		BOOM_DEBUG(buildMsg("removed_debug"));
+		BOOM_INFO(buildMsg("removed_info"));
+		REQUIRE(evaluated == 0);
+		REQUIRE(t->getMsg() == "template_warning");
+
+		BOOM_ERROR(buildMsg("kept_error"));
+		REQUIRE(evaluated == 1);
+		REQUIRE(t->getMsg() == "kept_error");
+#undef BOOM_MIN_LEVEL
+#define BOOM_MIN_LEVEL 1
+
+		delete Log::removeStream("Test");
+	}
+}
+
+TEST_CASE("Async")
+{
+	SECTION("Queued Delivery")
+	{
+		TestStream* t = new TestStream;
+		Log::addStream("Test", t);
+
+		Log::enableAsync();
+		REQUIRE(Log::isAsync());
+		Log::info("async_msg");
+		Log::flush();
+		REQUIRE(t->getMsg() == "async_msg");
+
+		Log::warning("drained_msg");
+		Log::disableAsync();
+		REQUIRE(!Log::isAsync());
+		REQUIRE(t->getMsg() == "drained_msg");
+
+		delete Log::removeStream("Test");
+	}
+
+	SECTION("Many Producers")
+	{
+		CountingStream* c = new CountingStream;
+		c->setLevels(LEVELS::DBG);
+		Log::addStream("Counter", c);
+		Log::forceDebug(true); // the stream only counts debug events
+
+		AsyncConfig config;
+		config.capacity = 64;
+		config.measureLatency = true;
+		Log::enableAsync(config);
+
+		const size_t producers = 8;
+		const size_t perProducer = 500;
+		std::vector<std::thread> threads;
+		for (size_t i = 0; i < producers; ++i)
+		{
+			threads.emplace_back([] {
+				for (size_t j = 0; j < perProducer; ++j)
+				{
+					Log::debug("threaded");
+				}
+			});
+		}
+		for (auto& t : threads)
+		{
+			t.join();
+		}
+		Log::flush();
+		REQUIRE(c->count == producers * perProducer);
+
+		QueueStats stats = Log::getQueueStats();
+		REQUIRE(stats.capacity == 64);
+		REQUIRE(stats.enqueued == producers * perProducer);
+		REQUIRE(stats.dropped == 0);
+		REQUIRE(stats.depth == 0);
+		REQUIRE(stats.highWater <= stats.capacity);
+		uint64_t timed = 0;
+		for (auto bucket : stats.enqueueNsHistogram)
+		{
+			timed += bucket;
+		}
+		REQUIRE(timed == producers * perProducer);
+
+		Log::disableAsync();
+		Log::forceDebug(false);
+		delete Log::removeStream("Counter");
+	}
+
+	SECTION("Drop Newest")
+	{
+		GateStream* g = new GateStream;
+		Log::addStream("Gate", g);
+
+		AsyncConfig config;
+		config.capacity = 2;
+		config.overflow = OVERFLOW_POLICY::DROP_NEWEST;
+		Log::enableAsync(config);
+
+		Log::info("first");
+		while (!g->entered)
+		{
+			std::this_thread::yield();
+		}
+		Log::info("second");
+		Log::info("third");
+		Log::info("fourth");
+		REQUIRE(Log::getDroppedCount() == 1);
+
+		g->open = true;
+		Log::flush();
+		REQUIRE(g->msgs == std::vector<std::string>{ "first", "second", "third" });
+
+		Log::disableAsync();
+		delete Log::removeStream("Gate");
+	}
+
+	SECTION("Drop Oldest")
+	{
+		GateStream* g = new GateStream;
+		Log::addStream("Gate", g);
+
+		AsyncConfig config;
+		config.capacity = 2;
+		config.overflow = OVERFLOW_POLICY::DROP_OLDEST;
+		Log::enableAsync(config);
+
+		Log::info("first");
+		while (!g->entered)
+		{
+			std::this_thread::yield();
+		}
+		Log::info("second");
+		Log::info("third");
+		Log::info("fourth");
+		REQUIRE(Log::getDroppedCount() == 1);
+
+		g->open = true;
+		Log::flush();
+		REQUIRE(g->msgs == std::vector<std::string>{ "first", "third", "fourth" });
+
+		Log::disableAsync();
+		delete Log::removeStream("Gate");
+	}
+
+	SECTION("Batch Delivery")
+	{
+		BatchStream* all = new BatchStream;
+		BatchStream* warnings = new BatchStream;
+		warnings->setLevels(LEVELS::WARNING);
+		GateStream* g = new GateStream;
+		Log::addStream("Batch", all);
+		Log::addStream("Batch Warnings", warnings);
+		Log::addStream("Gate", g);
+
+		Log::enableAsync();
+		Log::info("first");
+		while (!g->entered)
+		{
+			std::this_thread::yield();
+		}
+		// queued while the writer is held up, then delivered together
+		Log::info("a");
+		Log::warning("w1");
+		Log::warning("w2");
+		Log::info("b");
+		Log::warning("w3");
+		g->open = true;
+		Log::flush();
+
+		using Batches = std::vector<std::vector<std::string>>;
+		REQUIRE(all->batches == Batches{ { "first" }, { "a", "w1", "w2", "b", "w3" } });
+		REQUIRE(warnings->batches == Batches{ { "w1", "w2" }, { "w3" } });
+
+		// a synchronous logger still sends one event at a time
+		Log::disableAsync();
+		Log::info("sync");
+		REQUIRE(all->batches.back() == std::vector<std::string>{ "sync" });
+
+		delete Log::removeStream("Batch");
+		delete Log::removeStream("Batch Warnings");
+		delete Log::removeStream("Gate");
+	}
+
+	SECTION("Per Thread Buffers")
+	{
+		CountingStream* c = new CountingStream;
+		c->setLevels(LEVELS::DBG);
+		Log::addStream("Counter", c);
+		Log::forceDebug(true); // the stream only counts debug events
+
+		AsyncConfig config;
+		config.capacity = 64;
+		config.perThreadBuffers = true;
+		config.threadBufferCapacity = 16; // small enough that some events go to the shared queue
+		Log::enableAsync(config);
+
+		const size_t producers = 8;
+		const size_t perProducer = 500;
+		std::vector<std::thread> threads;
+		for (size_t i = 0; i < producers; ++i)
+		{
+			threads.emplace_back([] {
+				for (size_t j = 0; j < perProducer; ++j)
+				{
+					Log::debug("threaded");
+				}
+			});
+		}
+		for (auto& t : threads)
+		{
+			t.join();
+		}
+		Log::flush(); // the buffers of the exited threads are still drained
+		REQUIRE(c->count == producers * perProducer);
+		REQUIRE(Log::getQueueStats().enqueued == producers * perProducer);
+
+		size_t seen = 0;
+		std::thread([c, &seen] {
+			Log::debug("before blocking");
+			Log::flushThread();
+			seen = c->count;
+		}).join();
+		REQUIRE(seen == producers * perProducer + 1);
+
+		Log::disableAsync();
+		Log::forceDebug(false);
+		delete Log::removeStream("Counter");
+	}
+
+	SECTION("Merged By Timestamp")
+	{
+		GateStream* g = new GateStream;
+		Log::addStream("Gate", g);
+
+		AsyncConfig config;
+		config.perThreadBuffers = true;
+		Log::enableAsync(config);
+
+		Log::info("first");
+		while (!g->entered)
+		{
+			std::this_thread::yield();
+		}
+		// each message waits in its own thread's buffer until the gate opens
+		Log::info("main 1");
+		std::thread([] { Log::info("thread 1"); }).join();
+		Log::info("main 2");
+		std::thread([] { Log::info("thread 2"); }).join();
+
+		g->open = true;
+		Log::flush();
+		REQUIRE(g->msgs == std::vector<std::string>{ "first", "main 1", "thread 1", "main 2", "thread 2" });
+
+		Log::disableAsync();
+		delete Log::removeStream("Gate");
+	}
+
+	SECTION("Switching Modes While Logging")
+	{
+		CountingStream* c = new CountingStream;
+		c->setLevels(LEVELS::DBG);
+		Log::addStream("Counter", c);
+		Log::forceDebug(true);
+
+		const size_t producers = 4;
+		const size_t perProducer = 2000;
+		std::vector<std::thread> threads;
+		for (size_t i = 0; i < producers; ++i)
+		{
+			threads.emplace_back([] {
+				for (size_t j = 0; j < perProducer; ++j)
+				{
+					Log::debug("switching");
+				}
+			});
+		}
+		for (int i = 0; i < 20; ++i)
+		{
+			AsyncConfig config;
+			config.capacity = 16 << (i % 4);
+			config.perThreadBuffers = i % 2 == 1;
+			Log::enableAsync(config);
+			std::this_thread::yield();
+			if (i % 3 == 0)
+			{
+				Log::disableAsync();
+			}
+		}
+		for (auto& t : threads)
+		{
+			t.join();
+		}
+		Log::disableAsync();
+		REQUIRE(c->count == producers * perProducer); // none lost while the queue was replaced
+
+		Log::forceDebug(false);
+		delete Log::removeStream("Counter");
+	}
+}
+
+TEST_CASE("TextFileStream")
+{
+	std::remove("boom_test_a.txt");
+	std::remove("boom_test_b.txt");
+	Event info(LEVELS::INFO, "info_msg");
+	Event error(LEVELS::ERR, "error_msg");
+
+	SECTION("Buffered Writes")
+	{
+		TextFileStream tfs("boom_test_a.txt");
+		tfs.setFlushInterval(std::chrono::milliseconds(0));
+
+		tfs.handle(info);
+		REQUIRE(readFile("boom_test_a.txt") == "");
+		tfs.flush();
+		REQUIRE(readFile("boom_test_a.txt") == info.toString());
+
+		tfs.handle(info);
+		tfs.handle(error); // errors are written straight away
+		REQUIRE(readFile("boom_test_a.txt") == info.toString() + info.toString() + error.toString());
+	}
+
+	SECTION("Buffer Size")
+	{
+		TextFileStream tfs("boom_test_a.txt", 0);
+		tfs.handle(info);
+		REQUIRE(readFile("boom_test_a.txt") == info.toString());
+
+		tfs.setBufferSize(4096);
+		tfs.setFlushLevels(0);
+		tfs.handle(error);
+		REQUIRE(readFile("boom_test_a.txt") == info.toString());
+	}
+
+	SECTION("Change File")
+	{
+		TextFileStream tfs("boom_test_a.txt");
+		tfs.handle(info);
+		tfs.setFilename("boom_test_b.txt");
+		REQUIRE(readFile("boom_test_a.txt") == info.toString());
+
+		tfs.handle(info);
+		tfs.flush();
+		REQUIRE(readFile("boom_test_b.txt") == info.toString());
+	}
+
+	SECTION("Change File While Logging")
+	{
+		auto tfs = Log::emplaceStream<TextFileStream>("Switched", "boom_test_a.txt");
+		tfs->setLevels(LEVELS::DBG);
+		Log::forceDebug(true);
+		Log::enableAsync();
+		std::thread producer([] {
+			for (int i = 0; i < 2000; ++i)
+			{
+				Log::debug("switching files");
+			}
+		});
+		for (int i = 0; i < 20; ++i)
+		{
+			tfs->setFilename(i % 2 == 0 ? "boom_test_b.txt" : "boom_test_a.txt"); // the writer thread is handling events meanwhile
+		}
+		producer.join();
+		Log::flush();
+		std::string both = readFile("boom_test_a.txt") + readFile("boom_test_b.txt");
+		size_t lines = 0;
+		for (size_t at = both.find("switching files"); at != std::string::npos; at = both.find("switching files", at + 1))
+		{
+			++lines;
+		}
+		REQUIRE(lines == 2000);
+		Log::disableAsync();
+		Log::forceDebug(false);
+		Log::removeStream("Switched");
+	}
+
+	SECTION("Batches")
+	{
+		std::vector<Event> events = { info, info, error };
+		TextFileStream tfs("boom_test_a.txt");
+		tfs.handleBatch(EventSpan(events.data(), 2));
+		REQUIRE(readFile("boom_test_a.txt") == "");
+		tfs.handleBatch(EventSpan(events.data() + 2, 1)); // errors are written straight away
+		REQUIRE(readFile("boom_test_a.txt") == info.toString() + info.toString() + error.toString());
+	}
+
+	SECTION("Log Flush")
+	{
+		TextFileStream* tfs = new TextFileStream("boom_test_a.txt");
+		Log::addStream("File", tfs);
+		Log::info("info_msg");
+		Log::flush();
+		REQUIRE(readFile("boom_test_a.txt").find("info_msg") != std::string::npos);
+		delete Log::removeStream("File");
+	}
+
+	std::remove("boom_test_a.txt");
+	std::remove("boom_test_b.txt");
+}
+
+TEST_CASE("Event Storage")
+{
+	SECTION("Inline Text")
+	{
+		Event e(LEVELS::INFO, "short message", "UnitTest", "C0001");
+		REQUIRE(e.msg.isInline());
+		REQUIRE(e.source.isInline());
+		REQUIRE(e.code.isInline());
+		REQUIRE(e.getMsg() == "short message");
+		REQUIRE(e.getSource() == "UnitTest");
+		REQUIRE(e.getCode() == "C0001");
+		REQUIRE(e.getLevel() == LEVELS::INFO);
+	}
+
+	SECTION("Overflow")
+	{
+		std::string longMsg(500, 'x');
+		Event e(LEVELS::INFO, longMsg);
+		REQUIRE(!e.msg.isInline());
+		REQUIRE(e.getMsg() == longMsg);
+
+		// the heap block is reused for shorter text
+		const char* block = e.msg.data();
+		e.msg = "now short";
+		REQUIRE(e.msg.data() == block);
+		REQUIRE(e.msg == "now short");
+	}
+
+	SECTION("Copy And Move")
+	{
+		std::string longMsg(200, 'y');
+		Event a(LEVELS::WARNING, longMsg, "source");
+		Event b = a;
+		REQUIRE(b.getMsg() == longMsg);
+		REQUIRE(b.msg.data() != a.msg.data());
+
+		Event c = std::move(a);
+		REQUIRE(c.getMsg() == longMsg);
+		REQUIRE(c.getSource() == "source");
+
+		std::string copied = c.msg;
+		REQUIRE(copied == longMsg);
+	}
+}
+
+TEST_CASE("Timestamp Format")
+{
+	// create a known timestamp to compare to
+	std::tm target = {};
+	std::stringstream timestamp("Jan 1 2000 12:00:00");
+	timestamp >> std::get_time(&target, "%b %d %Y %H:%M:%S");
+	auto tp = std::chrono::system_clock::from_time_t(std::mktime(&target));
+
+	SECTION("Custom Format")
+	{
+		Log::setDateFormat("%d.%m.%y %H-%M-%S | ");
+		Event e(LEVELS::INFO, "Test Message", "", "", tp);
+		REQUIRE(e.toString() == "   01.01.00 12-00-00 | Test Message");
+	}
+
+	SECTION("Sub-second Digits")
+	{
+		Log::setDateFormat("%H:%M:%S %%", 3);
+		Event first(LEVELS::INFO, "first", "", "", tp + std::chrono::milliseconds(7));
+		Event second(LEVELS::INFO, "second", "", "", tp + std::chrono::milliseconds(456));
+		REQUIRE(first.toString() == "   12:00:00.007 %first");
+		REQUIRE(second.toString() == "   12:00:00.456 %second");
+
+		Log::setDateFormat("%S", 6);
+		Event micro(LEVELS::INFO, "", "", "", tp + std::chrono::microseconds(123456));
+		REQUIRE(micro.toString() == "   00.123456");
+	}
+
+	SECTION("Other Fields")
+	{
+		Log::setDateFormat("%b %Y ");
+		Event e(LEVELS::INFO, "Test Message", "", "", tp);
+		REQUIRE(e.toString() == "   Jan 2000 Test Message");
+	}
+
+	Log::setDateFormat(TimestampFormat::DEFAULT);
+	Event e(LEVELS::INFO, "Test Message", "", "", tp);
+	REQUIRE(e.toString() == "   2000/01/01/12:00:00 - Test Message");
+}
+
+TEST_CASE("BinaryFileStream")
+{
+	std::remove("boom_test.bin");
+	std::remove("boom_test_b.bin");
+
+	std::tm target = {};
+	std::stringstream timestamp("Jan 1 2000 12:00:00");
+	timestamp >> std::get_time(&target, "%b %d %Y %H:%M:%S");
+	auto tp = std::chrono::system_clock::from_time_t(std::mktime(&target));
+
+	std::vector<Event> events;
+	events.emplace_back(LEVELS::INFO, "info_msg", "", "", tp);
+	events.emplace_back(LEVELS::WARNING, "warning_msg", "UnitTest", "", tp + std::chrono::milliseconds(250));
+	events.emplace_back(LEVELS::ERR, "error_msg", "UnitTest", "C0001", tp + std::chrono::seconds(1));
+	events.emplace_back(LEVELS::CRITICAL, std::string(300, 'c'), "Other::source", "C0001", tp + std::chrono::seconds(2));
+	events[1].fields.add("retries", 3).add("ratio", 0.1).add("ok", true);
+	events[3].fields.add("user", "alice").add("id", UINT64_MAX).add("delta", -7).add("note", std::string(300, 'n'));
+
+	std::string expected;
+	for (auto& e : events)
+	{
+		expected += e.toString();
+	}
+
+	SECTION("Round Trip")
+	{
+		{
+			BinaryFileStream bfs("boom_test.bin");
+			for (auto& e : events)
+			{
+				bfs.handle(e);
+			}
+		}
+
+		BinaryLogReader reader("boom_test.bin");
+		REQUIRE(reader.isOpen());
+		Event e;
+		for (auto& original : events)
+		{
+			REQUIRE(reader.next(e));
+			REQUIRE(e.level == original.level);
+			REQUIRE(e.timestamp == original.timestamp);
+			REQUIRE(e.getMsg() == original.getMsg());
+			REQUIRE(e.getSource() == original.getSource());
+			REQUIRE(e.getCode() == original.getCode());
+			REQUIRE(e.fields.size() == original.fields.size());
+			REQUIRE(e.toString() == original.toString());
+		}
+		REQUIRE(!reader.next(e));
+		REQUIRE(!reader.failed());
+
+		REQUIRE(BinaryLogReader::toText("boom_test.bin") == expected);
+	}
+
+	SECTION("Interned Strings")
+	{
+		Event repeated(LEVELS::INFO, "m", "A::rather_long_function_name", "CODE0001", tp);
+		{
+			BinaryFileStream interned("boom_test.bin");
+			BinaryFileStream inlined("boom_test_b.bin", 64 * 1024, false);
+			for (int i = 0; i < 100; ++i)
+			{
+				interned.handle(repeated);
+				inlined.handle(repeated);
+			}
+		}
+		REQUIRE(readFile("boom_test.bin").size() < readFile("boom_test_b.bin").size());
+		REQUIRE(BinaryLogReader::toText("boom_test.bin") == BinaryLogReader::toText("boom_test_b.bin"));
+	}
+
+	SECTION("Sessions")
+	{
+		// each stream starts a new session, so appended files still decode
+		for (auto& e : events)
+		{
+			BinaryFileStream bfs("boom_test.bin");
+			bfs.handle(e);
+		}
+		REQUIRE(BinaryLogReader::toText("boom_test.bin") == expected);
+
+		BinaryFileStream bfs("boom_test_b.bin");
+		bfs.handle(events[2]);
+		bfs.setFilename("boom_test.bin");
+		bfs.handle(events[3]);
+		bfs.flush();
+		REQUIRE(BinaryLogReader::toText("boom_test.bin") == expected + events[3].toString());
+	}
+
+	SECTION("Damaged File")
+	{
+		std::ofstream bad("boom_test.bin", std::ios::binary);
+		bad << "not a log";
+		bad.close();
+
+		BinaryLogReader reader("boom_test.bin");
+		Event e;
+		REQUIRE(!reader.next(e));
+		REQUIRE(reader.failed());
+	}
+
+	std::remove("boom_test.bin");
+	std::remove("boom_test_b.bin");
+}
+
+TEST_CASE("MappedFileStream")
+{
+	std::vector<std::string> names = { "boom_test.map", "boom_test.map.1", "boom_test.map.2", "boom_test.map.3" };
+	for (auto& name : names)
+	{
+		std::remove(name.c_str());
+	}
+
+	Event info(LEVELS::INFO, "info_msg");
+	Event critical(LEVELS::CRITICAL, "critical_msg");
+
+	SECTION("Write And Close")
+	{
+		{
+			MappedFileStream mfs("boom_test.map", 4096);
+			mfs.handle(info);
+			mfs.handle(critical);
+			REQUIRE(readFile("boom_test.map").size() == 4096); // preallocated while open
+			REQUIRE(readFile("boom_test.map").find("critical_msg") != std::string::npos);
+		}
+		REQUIRE(readFile("boom_test.map") == info.toString() + critical.toString());
+
+		// a new stream continues after the existing data
+		{
+			MappedFileStream mfs("boom_test.map", 4096, std::chrono::milliseconds(0));
+			mfs.handle(info);
+		}
+		REQUIRE(readFile("boom_test.map") == info.toString() + critical.toString() + info.toString());
+	}
+
+	SECTION("Segments")
+	{
+		std::string line = info.toString();
+		std::string expected;
+		{
+			MappedFileStream mfs("boom_test.map", line.size() * 2);
+			for (int i = 0; i < 5; ++i)
+			{
+				mfs.handle(info);
+				expected += line;
+			}
+			REQUIRE(mfs.getFilename() == "boom_test.map.2");
+		}
+		REQUIRE(readFile("boom_test.map") == line + line);
+		REQUIRE(readFile("boom_test.map.1") == line + line);
+		REQUIRE(readFile("boom_test.map.2") == line);
+	}
+
+	for (auto& name : names)
+	{
+		std::remove(name.c_str());
+	}
+}
+
+TEST_CASE("ArchiveStream")
+{
+	auto start = std::chrono::system_clock::now();
+	auto at = [&](int seconds) { return start + std::chrono::seconds(seconds); };
+
+	SECTION("Queries")
+	{
+		ArchiveStream archive;
+		Event events[] = {
+			Event(LEVELS::INFO, "started", "main", "", at(0)),
+			Event(LEVELS::WARNING, "slow", "net", "E1", at(1)),
+			Event(LEVELS::ERR, "failed", "net", "E2", at(2)),
+			Event(LEVELS::INFO, "retry", "net", "E1", at(3)),
+			Event(LEVELS::CRITICAL, "stopped", "main", "E2", at(4)),
+		};
+		for (auto& event : events)
+		{
+			archive.handle(event);
+		}
+		REQUIRE(archive.size() == 5);
+
+		auto found = archive.findLevels(LEVELS::INFO | LEVELS::CRITICAL);
+		REQUIRE(found.size() == 3);
+		REQUIRE(found[0].msg == "started");
+		REQUIRE(found[1].msg == "retry");
+		REQUIRE(found[2].msg == "stopped");
+
+		found = archive.findCode("E1");
+		REQUIRE(found.size() == 2);
+		REQUIRE(found[1].source == "net");
+		REQUIRE(archive.findCode("E3").empty());
+
+		found = archive.findSource("main");
+		REQUIRE(found.size() == 2);
+		REQUIRE(found[1].code == "E2");
+
+		found = archive.findTime(at(1), at(3));
+		REQUIRE(found.size() == 2);
+		REQUIRE(found[0].msg == "slow");
+		REQUIRE(found[1].level == LEVELS::ERR);
+
+		auto copies = archive.getEvents();
+		REQUIRE(copies.size() == 5);
+		REQUIRE(copies[4].getMsg() == "stopped");
+		REQUIRE(copies[4].getTimestamp() == at(4));
+	}
+
+	SECTION("Fields")
+	{
+		ArchiveStream archive;
+		Event event(LEVELS::WARNING, "slow", "net", "E1", at(0));
+		event.fields.add("ms", 1500).add("host", "db1").add("ratio", 0.5).add("cached", false).add("bytes", (uint64_t)1 << 40);
+		archive.handle(event);
+		Event plain(LEVELS::INFO, "plain", "", "", at(1));
+		archive.handle(plain);
+
+		auto found = archive.findCode("E1");
+		REQUIRE(found.size() == 1);
+		Fields fields = found[0].getFields();
+		REQUIRE(fields.size() == 5);
+		REQUIRE(fields[1].key == "host");
+		REQUIRE(fields[1].text == "db1");
+		REQUIRE(fields[2].number == 0.5);
+		REQUIRE(fields[4].unsignedInteger == ((uint64_t)1 << 40));
+
+		auto copies = archive.getEvents();
+		REQUIRE(copies[0].toString() == event.toString());
+		REQUIRE(copies[1].fields.empty());
+
+		// fields that don't fit the arena are left out rather than cut short
+		ArchiveLimits limits;
+		limits.maxBytes = 16;
+		ArchiveStream small(limits);
+		small.handle(event);
+		REQUIRE(small.getEvents()[0].fields.empty());
+	}
+
+	SECTION("Copies While Storing")
+	{
+		ArchiveStream archive;
+		std::atomic<bool> done = false;
+		std::atomic<bool> ordered = true;
+		std::thread storing([&]
+			{
+				for (int i = 0; i < 2000; ++i)
+				{
+					Event event(LEVELS::INFO, "stored " + std::to_string(i), "", "", at(i));
+					archive.handle(event);
+				}
+				done = true;
+			});
+		std::vector<std::thread> readers;
+		for (int t = 0; t < 2; ++t)
+		{
+			readers.emplace_back([&]
+				{
+					while (!done)
+					{
+						auto copies = archive.getEvents(); // each caller gets its own copy
+						for (size_t i = 1; i < copies.size(); ++i)
+						{
+							if (copies[i].getTimestamp() <= copies[i - 1].getTimestamp())
+							{
+								ordered = false;
+							}
+						}
+					}
+				});
+		}
+		storing.join();
+		for (auto& reader : readers)
+		{
+			reader.join();
+		}
+		REQUIRE(ordered);
+		REQUIRE(archive.getEvents().size() == 2000);
+	}
+
+	SECTION("Out Of Order")
+	{
+		ArchiveStream archive;
+		Event late(LEVELS::INFO, "late", "", "", at(5));
+		Event early(LEVELS::INFO, "early", "", "", at(1));
+		archive.handle(late);
+		archive.handle(early);
+		auto found = archive.findTime(at(0), at(2));
+		REQUIRE(found.size() == 1);
+		REQUIRE(found[0].msg == "early");
+	}
+
+	SECTION("Retention")
+	{
+		ArchiveLimits limits;
+		limits.maxEvents = 3;
+		ArchiveStream byCount(limits);
+		for (int i = 0; i < 5; ++i)
+		{
+			Event event(LEVELS::INFO, std::to_string(i), "src", "code");
+			byCount.handle(event);
+		}
+		REQUIRE(byCount.size() == 3);
+		REQUIRE(byCount.getEvents()[0].getMsg() == "2");
+		REQUIRE(byCount.findSource("src").size() == 3);
+
+		limits = ArchiveLimits();
+		limits.maxBytes = 20;
+		ArchiveStream byBytes(limits);
+		Event msg(LEVELS::INFO, "0123456789", "", "", at(0)); // 10 bytes of text
+		Event big(LEVELS::INFO, "a message longer than the arena", "", "", at(0));
+		byBytes.handle(msg);
+		byBytes.handle(msg);
+		REQUIRE(byBytes.size() == 2);
+		byBytes.handle(msg);
+		REQUIRE(byBytes.size() == 2);
+		REQUIRE(byBytes.bytesUsed() <= 20);
+		byBytes.handle(big);
+		REQUIRE(byBytes.size() == 1);
+		REQUIRE(byBytes.findLevels(ALL_LEVELS)[0].msg == "a message longer tha");
+
+		limits = ArchiveLimits();
+		limits.maxAge = std::chrono::seconds(10);
+		ArchiveStream byAge(limits);
+		Event old(LEVELS::INFO, "old", "", "", start - std::chrono::seconds(60));
+		Event recent(LEVELS::INFO, "recent", "", "", start);
+		byAge.handle(old);
+		byAge.handle(recent);
+		REQUIRE(byAge.size() == 1);
+		REQUIRE(byAge.findLevels(ALL_LEVELS)[0].msg == "recent");
+
+		byAge.clear();
+		REQUIRE(byAge.size() == 0);
+		REQUIRE(byAge.getEvents().empty());
+	}
+}
+
+TEST_CASE("Rotation")
+{
+	std::vector<std::string> names = { "boom_rotate.txt", "boom_rotate.txt.1", "boom_rotate.txt.2", "boom_rotate.txt.3",
+		"boom_rotate.txt.1.gz", "boom_rotate.txt.2.gz" };
+	for (auto& name : names)
+	{
+		std::remove(name.c_str());
+	}
+
+	std::vector<Event> events;
+	for (int i = 0; i < 7; ++i)
+	{
+		events.push_back(Event(LEVELS::INFO, "event" + std::to_string(i)));
+	}
+	std::string line = events[0].toString();
+
+	SECTION("By Size")
+	{
+		{
+			TextFileStream tfs("boom_rotate.txt", 0);
+			RotationConfig rotation;
+			rotation.maxSize = line.size() * 2;
+			rotation.keep = 2;
+			rotation.compress = false;
+			tfs.setRotation(rotation);
+			for (auto& event : events)
+			{
+				tfs.handle(event);
+			}
+		}
+		REQUIRE(readFile("boom_rotate.txt") == events[6].toString());
+		REQUIRE(readFile("boom_rotate.txt.1") == events[4].toString() + events[5].toString());
+		REQUIRE(readFile("boom_rotate.txt.2") == events[2].toString() + events[3].toString());
+		REQUIRE(readFile("boom_rotate.txt.3").empty());
+	}
+
+	SECTION("By Time")
+	{
+		auto hour = std::chrono::time_point_cast<std::chrono::hours>(std::chrono::system_clock::now());
+		Event first(LEVELS::INFO, "first", "", "", hour + std::chrono::minutes(1));
+		Event second(LEVELS::INFO, "second", "", "", hour + std::chrono::minutes(59));
+		Event third(LEVELS::INFO, "third", "", "", hour + std::chrono::minutes(61));
+		{
+			TextFileStream tfs("boom_rotate.txt");
+			RotationConfig rotation;
+			rotation.interval = std::chrono::hours(1);
+			rotation.compress = false;
+			tfs.setRotation(rotation);
+			tfs.handle(first);
+			tfs.handle(second);
+			tfs.handle(third);
+		}
+		REQUIRE(readFile("boom_rotate.txt.1") == first.toString() + second.toString());
+		REQUIRE(readFile("boom_rotate.txt") == third.toString());
+	}
+
+	SECTION("Compressor")
+	{
+		TextFileStream tfs("boom_rotate.txt", 0);
+		RotationConfig rotation;
+		rotation.maxSize = 1;
+		rotation.compressor = [](const std::string& from, const std::string& to)
+		{
+			std::ofstream out(to, std::ios::binary);
+			out << "packed:" << readFile(from);
+			return true;
+		};
+		tfs.setRotation(rotation);
+		tfs.handle(events[0]);
+		tfs.handle(events[1]);
+		tfs.waitForRotation();
+		REQUIRE(readFile("boom_rotate.txt.1.gz") == "packed:" + events[0].toString());
+		REQUIRE(readFile("boom_rotate.txt.1").empty());
+	}
+
+#ifdef BOOM_USE_ZLIB
+	SECTION("Gzip")
+	{
+		TextFileStream tfs("boom_rotate.txt", 0);
+		RotationConfig rotation;
+		rotation.maxSize = 1;
+		tfs.setRotation(rotation);
+		tfs.handle(events[0]);
+		tfs.handle(events[1]);
+		tfs.waitForRotation();
+
+		gzFile in = gzopen("boom_rotate.txt.1.gz", "rb");
+		REQUIRE(in != nullptr);
+		char text[256] = {};
+		int size = gzread(in, text, sizeof(text));
+		gzclose(in);
+		REQUIRE(std::string(text, size > 0 ? size : 0) == events[0].toString());
+	}
+#endif
+
+	for (auto& name : names)
+	{
+		std::remove(name.c_str());
+	}
+}
+
+#ifndef _WIN32
+/// @brief Read everything waiting in a pipe
+std::string readPipe(int fd)
+{
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	std::string text;
+	char chunk[4096];
+	ssize_t size;
+	while ((size = read(fd, chunk, sizeof(chunk))) > 0)
+	{
+		text.append(chunk, size);
+	}
+	return text;
+}
+
+TEST_CASE("BufferedConsoleStream")
+{
+	int pipeEnds[2];
+	REQUIRE(pipe(pipeEnds) == 0);
+	Event info(LEVELS::INFO, "info_msg");
+	Event error(LEVELS::ERR, "err_msg");
+
+	SECTION("Batches")
+	{
+		BufferedConsoleStream bcs(pipeEnds[1], 1024);
+		bcs.handle(info);
+		bcs.handle(info);
+		REQUIRE(readPipe(pipeEnds[0]).empty()); // still buffered
+		bcs.handle(error);
+		REQUIRE(readPipe(pipeEnds[0]) == info.toString() + info.toString() + error.toString());
+		bcs.handle(info);
+		bcs.flush();
+		REQUIRE(readPipe(pipeEnds[0]) == info.toString());
+	}
+
+	SECTION("Colors")
+	{
+		BufferedConsoleStream bcs(pipeEnds[1]);
+		bcs.setColors(true);
+		bcs.handle(info);
+		bcs.handle(error);
+		REQUIRE(readPipe(pipeEnds[0]) == info.toString() + "\x1b[31m" + error.toString() + "\x1b[0m");
+	}
+
+	SECTION("Drop When Behind")
+	{
+		BufferedConsoleStream bcs(pipeEnds[1], 1024);
+		bcs.setFlushInterval(std::chrono::milliseconds(0));
+		for (int i = 0; i < 100000 && bcs.getDroppedCount() == 0; ++i)
+		{
+			bcs.handle(info); // nobody reads the pipe, so it fills up
+		}
+		REQUIRE(bcs.getDroppedCount() > 0);
+		bcs.handle(info);
+		REQUIRE(bcs.getDroppedCount() == 2);
+
+		std::string text = readPipe(pipeEnds[0]);
+		REQUIRE(text.substr(0, info.toString().size()) == info.toString());
+		bcs.handle(info);
+		bcs.flush();
+		text = readPipe(pipeEnds[0]);
+		REQUIRE(text.find("2 console events dropped") != std::string::npos);
+	}
+
+	close(pipeEnds[0]);
+	close(pipeEnds[1]);
+}
+#endif
+
+/// @brief Counts how many times it is written as text
+struct Expensive
+{
+	inline static int formatted = 0;
+};
+
+std::ostream& operator<<(std::ostream& out, const Expensive&)
+{
+	++Expensive::formatted;
+	return out << "expensive";
+}
+
+TEST_CASE("Deferred Formatting")
+{
+	TestStream* t = new TestStream;
+	Log::addStream("Test", t);
+
+	SECTION("Placeholders")
+	{
+		Log::infof("user {} took {}ms", 42, 1.5);
+		REQUIRE(t->getMsg() == "user 42 took 1.5ms");
+
+		std::string name = "bob";
+		Log::warningf("{} {} {} {}", name, std::string_view("view"), 'c', true);
+		REQUIRE(t->getMsg() == "bob view c true");
+
+		Log::errorf("{{literal}} {} {}", -7);
+		REQUIRE(t->getMsg() == "{literal} -7 {}");
+
+		Log::infof("no placeholders", 1, 2);
+		REQUIRE(t->getMsg() == "no placeholders");
+
+		Event event(LEVELS::INFO, "value {}");
+		event.args = std::make_shared<FormatArguments<int>>(5);
+		REQUIRE(event.toString().find("value 5") != std::string::npos);
+		event.resolve();
+		REQUIRE(event.getMsg() == "value 5");
+		REQUIRE(event.args == nullptr);
+	}
+
+	SECTION("Skipped When Not Listening")
+	{
+		auto defaultText = Log::getStream("defaultTextFile");
+		auto defaultConsole = Log::getStream("defaultConsole");
+		int textLevels = defaultText->getLevels();
+		int consoleLevels = defaultConsole->getLevels();
+		defaultText->setLevels(LEVELS::ERR);
+		defaultConsole->setLevels(LEVELS::ERR);
+		t->setLevels(LEVELS::ERR);
+
+		Expensive::formatted = 0;
+		Log::infof("{}", Expensive());
+		REQUIRE(Expensive::formatted == 0);
+		Log::errorf("{}", Expensive());
+		REQUIRE(Expensive::formatted == 1);
+		REQUIRE(t->getMsg() == "expensive");
+
+		defaultText->setLevels(textLevels);
+		defaultConsole->setLevels(consoleLevels);
+	}
+
+	SECTION("Formatted By The Writer")
+	{
+		Log::enableAsync();
+		{
+			std::string temporary = "gone";
+			Log::infof("copied {}", temporary);
+			temporary = "changed";
+		}
+		Log::flush();
+		REQUIRE(t->getMsg() == "copied gone");
+		Log::disableAsync();
+	}
+
+	delete Log::removeStream("Test");
+}
+
+TEST_CASE("Rate Limit")
+{
+	ArchiveStream* archive = new ArchiveStream;
+	Log::addStream("Archive", archive);
+
+	RateLimit limit;
+	limit.eventsPerSecond = 0.001;
+	limit.burst = 3;
+	limit.summaryInterval = std::chrono::hours(1); // only summarised by flush
+	Log::setRateLimit(limit);
+
+	for (int i = 0; i < 10; ++i)
+	{
+		Log::error("connection failed", "Db::connect", "E0042");
+	}
+	Log::error("other code", "Db::connect", "E0043");
+	for (int i = 0; i < 5; ++i)
+	{
+		Log::infof("value {}", i); // told apart by the format
+	}
+	REQUIRE(archive->findCode("E0042").size() == 3);
+	REQUIRE(archive->findCode("E0043").size() == 1);
+	REQUIRE(archive->findLevels(LEVELS::INFO).size() == 3);
+	REQUIRE(Log::getRateLimitedCount() == 9);
+
+	Log::flush();
+	auto summary = archive->findCode("E0042");
+	REQUIRE(summary.size() == 4);
+	REQUIRE(summary[3].msg == "connection failed (repeated 7 more times)");
+	REQUIRE(summary[3].source == "Db::connect");
+	REQUIRE(archive->findLevels(LEVELS::INFO).back().msg == "value {} (repeated 2 more times)");
+
+	// turned off again
+	Log::setRateLimit(RateLimit());
+	for (int i = 0; i < 10; ++i)
+	{
+		Log::error("connection failed", "Db::connect", "E0042");
+	}
+	REQUIRE(archive->findCode("E0042").size() == 14);
+	REQUIRE(Log::getStats().rateLimitOverflow == 0);
+	delete Log::removeStream("Archive");
+
+	// more kinds than the shards can track share a bucket per shard instead of going unlimited
+	auto limiter = std::make_unique<RateLimiter>();
+	RateLimit tight;
+	tight.eventsPerSecond = 0.001;
+	tight.burst = 1;
+	limiter->configure(tight);
+	const size_t tracked = RateLimiter::SHARDS * RateLimiter::MAX_BUCKETS;
+	const size_t kinds = tracked + 5000;
+	size_t allowed = 0;
+	for (size_t i = 0; i < kinds; ++i)
+	{
+		allowed += limiter->allow(LEVELS::INFO, "flood", "", "K" + std::to_string(i)) ? 1 : 0;
+	}
+	uint64_t overflowed = limiter->getOverflowCount();
+	REQUIRE(overflowed >= kinds - tracked);
+	REQUIRE(allowed <= kinds - overflowed + RateLimiter::SHARDS); // one token per overflow bucket
+	REQUIRE(limiter->getHeldCount() == kinds - allowed);
+	auto summaries = limiter->collect(true);
+	REQUIRE(!summaries.empty());
+	REQUIRE(summaries[0].msg.find("held back with events of other kinds") != std::string::npos);
+}
+
+TEST_CASE("SamplingStream")
+{
+	CountingStream counter;
+	SamplingStream sampler(&counter);
+	Event debug(LEVELS::DBG, "dbg_msg");
+	Event info(LEVELS::INFO, "info_msg");
+	Event error(LEVELS::ERR, "err_msg");
+
+	SECTION("One In N")
+	{
+		sampler.setSampleEvery(LEVELS::DBG, 4);
+		sampler.setSampleEvery(LEVELS::INFO, 0);
+		for (int i = 0; i < 20; ++i)
+		{
+			sampler.handle(debug);
+			sampler.handle(info);
+			sampler.handle(error); // not sampled
+		}
+		REQUIRE(counter.count == 5 + 20);
+		REQUIRE(sampler.getSampledCount(LEVELS::DBG) == 5);
+		REQUIRE(sampler.getDroppedCount(LEVELS::DBG) == 15);
+		REQUIRE(sampler.getDroppedCount(LEVELS::INFO) == 20);
+		REQUIRE(sampler.getSampledCount(LEVELS::ERR) == 20);
+	}
+
+	SECTION("Fraction")
+	{
+		sampler.setSampleRate(LEVELS::DBG, 0.25);
+		std::vector<Event> batch(10000, debug);
+		sampler.handleBatch(EventSpan(batch.data(), batch.size()));
+		REQUIRE(counter.count > 2000);
+		REQUIRE(counter.count < 3000);
+		REQUIRE(sampler.getSampledCount(LEVELS::DBG) + sampler.getDroppedCount(LEVELS::DBG) == 10000);
+
+		sampler.setSampleRate(LEVELS::DBG, 0);
+		sampler.handle(debug);
+		REQUIRE(sampler.getDroppedCount(LEVELS::DBG) == 10000 - counter.count + 1);
+	}
+
+	SECTION("Registered With The Logger")
+	{
+		CountingStream* target = new CountingStream;
+		target->setLevels(LEVELS::INFO);
+		SamplingStream* wrapper = new SamplingStream(target);
+		wrapper->setSampleEvery(LEVELS::INFO, 10);
+		Log::addStream("Sampled", wrapper);
+		for (int i = 0; i < 100; ++i)
+		{
+			Log::info("sampled");
+		}
+		Log::error("not listened to");
+		REQUIRE(target->count == 10);
+		delete Log::removeStream("Sampled");
+		delete target;
+	}
+
+	SECTION("Wrapped Stream Also Registered")
+	{
+		CountingStream* target = Log::emplaceStream<CountingStream>("Sampled Target").get();
+		target->setLevels(LEVELS::INFO);
+		SamplingStream* wrapper = new SamplingStream(target);
+		wrapper->setLevels(LEVELS::INFO | LEVELS::ERR);
+		wrapper->setSampleEvery(LEVELS::INFO, 2);
+		Log::addStream("Sampled", wrapper);
+		std::vector<std::thread> loggers;
+		for (int t = 0; t < 4; ++t)
+		{
+			loggers.emplace_back([]
+				{
+					for (int i = 0; i < 1000; ++i)
+					{
+						Log::info("sampled and direct");
+					}
+				});
+		}
+		for (auto& thread : loggers)
+		{
+			thread.join();
+		}
+		Log::error("the target doesn't listen to errors");
+		REQUIRE(target->count == 4000 + 2000); // both paths take the target's handle lock
+		REQUIRE(wrapper->getSampledCount(LEVELS::ERR) == 0);
+		delete Log::removeStream("Sampled");
+		Log::removeStream("Sampled Target");
+	}
+}
+
+TEST_CASE("Stream Registry")
+{
+	// keep the flood of events below off the console and out of the log file
+	auto defaultText = Log::getStream("defaultTextFile");
+	auto defaultConsole = Log::getStream("defaultConsole");
+	int textLevels = defaultText->getLevels();
+	int consoleLevels = defaultConsole->getLevels();
+	defaultText->setLevels(0);
+	defaultConsole->setLevels(0);
+
+	CountingStream* steady = new CountingStream;
+	steady->setLevels(LEVELS::INFO);
+	Log::addStream("Steady", steady);
+
+	SECTION("Add And Remove While Logging")
+	{
+		std::atomic<bool> stop = false;
+		std::vector<std::thread> loggers;
+		for (int i = 0; i < 4; ++i)
+		{
+			loggers.emplace_back([&stop] {
+				while (!stop)
+				{
+					Log::info("busy");
+				}
+			});
+		}
+
+		size_t delivered = 0;
+		for (int i = 0; i < 200; ++i)
+		{
+			CountingStream* temporary = new CountingStream;
+			Log::addStream("Temporary", temporary);
+			std::this_thread::yield();
+			Stream* removed = Log::removeStream("Temporary");
+			REQUIRE(removed == temporary);
+			delivered += temporary->count; // nothing else is using it once it is removed
+			delete removed;
+		}
+		stop = true;
+		for (auto& t : loggers)
+		{
+			t.join();
+		}
+		REQUIRE(Log::getStream("Temporary") == nullptr);
+		REQUIRE(steady->count > 0);
+	}
+
+	SECTION("Stream Logging From Handle")
+	{
+		// a stream that logs while handling an event doesn't deadlock the registry
+		class EchoStream : public Stream
+		{
+		public:
+			virtual void handle(Event& event)
+			{
+				if (event.getMsg() == "echo")
+				{
+					Log::info("echoed");
+					Log::addStream("Added From Handle", new CountingStream);
+				}
+			}
+		};
+		EchoStream* echo = new EchoStream;
+		Log::addStream("Echo", echo);
+		Log::info("echo");
+		REQUIRE(steady->count == 2);
+		delete Log::removeStream("Added From Handle");
+		delete Log::removeStream("Echo");
+	}
+
+	delete Log::removeStream("Steady");
+	defaultText->setLevels(textLevels);
+	defaultConsole->setLevels(consoleLevels);
+}
+
+#ifndef _WIN32
+/// @brief TCP or UDP socket on a free port of the loopback address, standing in for a log collector
+class Collector
+{
+public:
+	Collector(bool udp = false)
+	{
+		fd = socket(AF_INET, udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+		sockaddr_in address{};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		bind(fd, (sockaddr*)&address, sizeof(address));
+		socklen_t size = sizeof(address);
+		getsockname(fd, (sockaddr*)&address, &size);
+		port = ntohs(address.sin_port);
+		setTimeout(fd);
+	}
+
+	~Collector()
+	{
+		if (client >= 0)
+		{
+			close(client);
+		}
+		close(fd);
+	}
+
+	/// @brief Start taking connections, until then connecting is refused
+	void listen()
+	{
+		::listen(fd, 2);
+	}
+
+	/// @brief Wait for the next TCP frame, the length is taken off and compressed tells if the frame was marked compressed
+	std::string readFrame()
+	{
+		if (client < 0)
+		{
+			client = accept(fd, nullptr, nullptr);
+			setTimeout(client);
+		}
+		std::string length = readExactly(4);
+		if (length.size() != 4)
+		{
+			return "";
+		}
+		uint64_t size = binary::get(length.data(), 4);
+		compressed = (size & NetworkStream::COMPRESSED_FRAME) != 0;
+		return readExactly((size_t)(size & ~(uint64_t)NetworkStream::COMPRESSED_FRAME));
+	}
+
+	/// @brief Move on to the next TCP connection, the next readFrame takes it
+	void nextClient()
+	{
+		if (client >= 0)
+		{
+			close(client);
+			client = -1;
+		}
+	}
+
+	/// @brief Wait for the next datagram
+	std::string receive()
+	{
+		char datagram[65536];
+		ssize_t size = recv(fd, datagram, sizeof(datagram), 0);
+		return std::string(datagram, size > 0 ? size : 0);
+	}
+
+	uint16_t port = 0;
+	bool compressed = false;
+
+private:
+	static void setTimeout(int socket)
+	{
+		timeval wait = { 5, 0 };
+		setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+	}
+
+	std::string readExactly(size_t size)
+	{
+		std::string data(size, 0);
+		size_t got = 0;
+		while (got < size)
+		{
+			ssize_t done = recv(client, &data[got], size - got, 0);
+			if (done <= 0)
+			{
+				break;
+			}
+			got += done;
+		}
+		data.resize(got);
+		return data;
+	}
+
+	int fd = -1;
+	int client = -1;
+};
+
+TEST_CASE("NetworkStream")
+{
+	Event info(LEVELS::INFO, "info_msg");
+	Event error(LEVELS::ERR, "err_msg", "main", "E42");
+	NetworkConfig config;
+	config.linger = std::chrono::milliseconds(60000); // only flush() or a full batch sends
+	config.reconnectMin = std::chrono::milliseconds(10);
+	config.reconnectMax = std::chrono::milliseconds(10);
+
+	SECTION("TCP")
+	{
+		Collector collector;
+		collector.listen();
+		config.port = collector.port;
+		NetworkStream stream(config);
+		stream.handle(info);
+		stream.handle(error);
+		stream.flush();
+		REQUIRE(stream.isConnected());
+		REQUIRE(stream.getSentCount() == 2);
+		REQUIRE(collector.readFrame() == info.toString() + "\n" + error.toString() + "\n");
+
+		std::vector<Event> batch = { error, info };
+		stream.handleBatch(EventSpan(batch.data(), batch.size()));
+		stream.flush();
+		REQUIRE(collector.readFrame() == error.toString() + "\n" + info.toString() + "\n");
+	}
+
+	SECTION("Compressed")
+	{
+		Collector collector;
+		collector.listen();
+		config.port = collector.port;
+		config.compress = true;
+		config.compressor = [](std::string_view in, std::string& out)
+		{
+			if (in.find("err_msg") != std::string_view::npos)
+			{
+				return false;
+			}
+			out = "packed:" + std::to_string(in.size());
+			return true;
+		};
+		NetworkStream stream(config);
+		stream.handle(info);
+		stream.flush();
+		REQUIRE(collector.readFrame() == "packed:" + std::to_string(info.toString().size() + 1));
+		REQUIRE(collector.compressed);
+
+		// sent as it is when the compressor fails
+		stream.handle(error);
+		stream.flush();
+		REQUIRE(collector.readFrame() == error.toString() + "\n");
+		REQUIRE_FALSE(collector.compressed);
+		REQUIRE(stream.getSentCount() == 2);
+	}
+
+#ifdef BOOM_USE_ZLIB
+	SECTION("Zlib")
+	{
+		Collector collector;
+		collector.listen();
+		config.port = collector.port;
+		config.compress = true;
+		NetworkStream stream(config);
+		std::string expected;
+		for (int i = 0; i < 50; ++i)
+		{
+			stream.handle(info);
+			expected += info.toString() + "\n";
+		}
+		stream.flush();
+		std::string frame = collector.readFrame();
+		REQUIRE(collector.compressed);
+		std::string text(expected.size(), 0);
+		uLongf size = (uLongf)text.size();
+		REQUIRE(uncompress((Bytef*)&text[0], &size, (const Bytef*)frame.data(), (uLong)frame.size()) == Z_OK);
+		text.resize(size);
+		REQUIRE(text == expected);
+	}
+#endif
+
+	SECTION("Full Batches")
+	{
+		Collector collector;
+		collector.listen();
+		config.port = collector.port;
+		config.batchSize = 1;
+		NetworkStream stream(config);
+		stream.handle(info);
+		stream.handle(error);
+		REQUIRE(collector.readFrame() == info.toString() + "\n");
+		REQUIRE(collector.readFrame() == error.toString() + "\n");
+	}
+
+	SECTION("Binary")
+	{
+		Collector collector;
+		collector.listen();
+		config.port = collector.port;
+		config.binary = true;
+		NetworkStream stream(config);
+		for (int i = 0; i < 2; ++i)
+		{
+			stream.handle(error);
+			stream.handle(info);
+			stream.handle(error);
+			stream.flush();
+
+			// each frame is a binary log of its own
+			std::string frame = collector.readFrame();
+			std::ofstream("boom_network.bin", std::ios::binary) << frame;
+			BinaryLogReader reader("boom_network.bin");
+			Event read;
+			REQUIRE(reader.next(read));
+			REQUIRE(read.toString() == error.toString());
+			REQUIRE(reader.next(read));
+			REQUIRE(read.toString() == info.toString());
+			REQUIRE(reader.next(read));
+			REQUIRE(read.toString() == error.toString());
+			REQUIRE_FALSE(reader.next(read));
+			REQUIRE_FALSE(reader.failed());
+		}
+		std::remove("boom_network.bin");
+	}
+
+	SECTION("UDP Syslog")
+	{
+		Collector collector(true);
+		config.port = collector.port;
+		config.protocol = NETWORK_PROTOCOL::UDP_SYSLOG;
+		config.appName = "my app";
+		config.maxDatagram = 100;
+		NetworkStream stream(config);
+		Event warning(LEVELS::WARNING, "disk full", "main", "E42");
+		stream.handle(warning);
+		stream.handle(info);
+		Event longer(LEVELS::INFO, std::string(200, 'x'));
+		stream.handle(longer);
+		stream.flush();
+
+		std::string message = collector.receive();
+		REQUIRE(message.substr(0, 6) == "<12>1 ");
+		REQUIRE(message.find(" my_app " + std::to_string(getpid()) + " E42 - disk full (from main)") != std::string::npos);
+		REQUIRE(message[message.find('Z') - 7] == '.'); // UTC timestamp with microseconds
+		message = collector.receive();
+		REQUIRE(message.substr(0, 6) == "<14>1 ");
+		REQUIRE(message.find(" - - info_msg") != std::string::npos);
+		REQUIRE(collector.receive().size() == 100);
+		REQUIRE(stream.getSentCount() == 3);
+	}
+
+	SECTION("Spill")
+	{
+		Collector collector; // not listening yet, so connecting is refused
+		config.port = collector.port;
+		config.spillFile = "boom_network_spill.bin";
+		{
+			NetworkStream stream(config);
+			stream.handle(info);
+			stream.flush();
+			REQUIRE_FALSE(stream.isConnected());
+			REQUIRE(stream.getSpilledCount() == 1);
+			stream.handle(error);
+		}
+
+		// a later run picks up what was spilled, a damaged batch at the end is cut off
+		std::ofstream("boom_network_spill.bin", std::ios::binary | std::ios::app) << "damaged";
+		NetworkStream stream(config);
+		REQUIRE(stream.getSpilledCount() == 2);
+		stream.handle(info);
+		stream.flush();
+		REQUIRE(stream.getSpilledCount() == 3);
+
+		collector.listen();
+		REQUIRE(collector.readFrame() == info.toString() + "\n");
+		REQUIRE(collector.readFrame() == error.toString() + "\n");
+		REQUIRE(collector.readFrame() == info.toString() + "\n");
+		for (int wait = 0; wait < 500 && stream.getSpilledCount() > 0; ++wait)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		REQUIRE(stream.getSpilledCount() == 0);
+		REQUIRE(stream.getSentCount() == 3);
+		REQUIRE(readFile("boom_network_spill.bin").empty());
+	}
+
+	SECTION("Memory Limit")
+	{
+		Collector collector;
+		config.port = collector.port;
+		config.batchSize = 1;
+		config.memoryLimit = 200;
+		NetworkStream stream(config);
+		for (int i = 0; i < 20; ++i)
+		{
+			stream.handle(info);
+		}
+		stream.flush();
+		uint64_t dropped = stream.getDroppedCount();
+		REQUIRE(dropped > 0);
+
+		collector.listen();
+		for (uint64_t i = 0; i < 20 - dropped; ++i)
+		{
+			REQUIRE(collector.readFrame() == info.toString() + "\n");
+		}
+		stream.flush(); // the memory has been given back once the sending thread is done
+
+		// the first event with room tells the collector what was lost
+		stream.handle(error);
+		stream.flush();
+		REQUIRE(stream.getDroppedCount() == dropped);
+		REQUIRE(collector.readFrame().find(std::to_string(dropped) + " network events dropped") != std::string::npos);
+	}
+
+	SECTION("Fork")
+	{
+		Collector collector;
+		collector.listen();
+		config.port = collector.port;
+		NetworkStream* stream = Log::emplaceStream<NetworkStream>("Network", config).get();
+		stream->setLevels(LEVELS::INFO);
+		Log::info("before the fork");
+		Log::flush();
+		REQUIRE(collector.readFrame().find("before the fork\n") != std::string::npos);
+		Log::info("waiting at the fork"); // sent by the parent before it forks
+
+		pid_t child = fork();
+		if (child == 0)
+		{
+			// the child has its own sending thread and connection, and its exit joins that thread
+			uint64_t sent = stream->getSentCount();
+			Log::info("from the child");
+			Log::flush();
+			std::exit(stream->getSentCount() == sent + 1 ? 0 : 1);
+		}
+		int status = 0;
+		REQUIRE(waitpid(child, &status, 0) == child);
+		REQUIRE(WIFEXITED(status));
+		REQUIRE(WEXITSTATUS(status) == 0);
+		REQUIRE(collector.readFrame().find("waiting at the fork\n") != std::string::npos);
+
+		Log::info("from the parent");
+		Log::flush();
+		REQUIRE(collector.readFrame().find("from the parent\n") != std::string::npos);
+		collector.nextClient();
+		std::string frame = collector.readFrame();
+		REQUIRE(frame.find("from the child\n") != std::string::npos);
+		REQUIRE(frame.find("waiting at the fork") == std::string::npos);
+		Log::removeStream("Network");
+	}
+}
+#endif
+
+TEST_CASE("Stats")
+{
+	CountingStream* counted = new CountingStream;
+	counted->setLevels(LEVELS::ERR);
+	Log::addStream("Counted", counted);
+	LogStats before = Log::getStats();
+	REQUIRE(before.streams.count("Counted") == 1);
+	REQUIRE(before.streams["Counted"].delivered == 0);
+
+	SECTION("Counters")
+	{
+		for (int i = 0; i < 4; ++i)
+		{
+			Log::info("counted info");
+		}
+		Log::error("counted error");
+		Log::error("counted error");
+		std::thread other([]
+			{
+				for (int i = 0; i < 100; ++i)
+				{
+					Log::warning("from another thread");
+				}
+			});
+		other.join(); // its counters are kept after it exits
+
+		LogStats after = Log::getStats();
+		REQUIRE(after.created[levelIndex(LEVELS::INFO)] - before.created[levelIndex(LEVELS::INFO)] == 4);
+		REQUIRE(after.created[levelIndex(LEVELS::ERR)] - before.created[levelIndex(LEVELS::ERR)] == 2);
+		REQUIRE(after.created[levelIndex(LEVELS::WARNING)] - before.created[levelIndex(LEVELS::WARNING)] == 100);
+		REQUIRE(after.streams["Counted"].delivered == 2);
+		REQUIRE(after.streams["Counted"].filtered == 104);
+		REQUIRE(after.streams["Counted"].handleCalls == 0);
+		REQUIRE(Log::getStats().created[levelIndex(LEVELS::WARNING)] == after.created[levelIndex(LEVELS::WARNING)]);
+	}
+
+	SECTION("Bytes Written")
+	{
+		std::remove("stats.txt");
+		TextFileStream* file = new TextFileStream("stats.txt");
+		Log::addStream("StatsFile", file);
+		Log::info("written out");
+		Log::flush();
+		REQUIRE(Log::getStats().streams["StatsFile"].bytesWritten == readFile("stats.txt").size());
+		REQUIRE(Log::getStats().streams["StatsFile"].bytesWritten > 0);
+		delete Log::removeStream("StatsFile");
+		std::remove("stats.txt");
+	}
+
+	SECTION("Handle Times")
+	{
+		StatsConfig config;
+		config.measureHandle = true;
+		Log::setStatsConfig(config);
+		Log::error("timed");
+		Log::error("timed");
+		Log::error("timed");
+		StreamStats timed = Log::getStats().streams["Counted"];
+		REQUIRE(timed.handleCalls == 3);
+		REQUIRE(timed.handleNsMax <= timed.handleNsTotal);
+		uint64_t bucketed = 0;
+		for (auto bucket : timed.handleNsHistogram)
+		{
+			bucketed += bucket;
+		}
+		REQUIRE(bucketed == 3);
+	}
+
+	SECTION("Stats Events")
+	{
+		ArchiveStream* archive = new ArchiveStream;
+		Log::addStream("StatsOut", archive);
+		counted->setLevels(ALL_LEVELS);
+		StatsConfig config;
+		config.interval = std::chrono::milliseconds(1);
+		config.stream = "StatsOut";
+		Log::setStatsConfig(config);
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		Log::error("triggers a report");
+		auto reports = archive->findCode("stats");
+		REQUIRE(reports.size() == 1);
+		REQUIRE(reports[0].level == LEVELS::INFO);
+		REQUIRE(reports[0].msg.find("Counted delivered 1 filtered 0") != std::string::npos);
+		REQUIRE(counted->count == 1); // the report only goes to the chosen stream
+		REQUIRE(Log::getStats().streams["StatsOut"].delivered == 1);
+
+		Log::enableAsync();
+		std::this_thread::sleep_for(std::chrono::milliseconds(50)); // sent by the writer while idle
+		Log::disableAsync();
+		REQUIRE(archive->findCode("stats").size() > 1);
+		REQUIRE(counted->count == 1);
+		delete Log::removeStream("StatsOut");
+	}
+
+	Log::setStatsConfig(StatsConfig());
+	delete Log::removeStream("Counted");
+}
+
+TEST_CASE("Stream Ownership")
+{
+	REQUIRE(TrackedStream::alive == 0);
+
+	SECTION("Emplaced")
+	{
+		StreamHandle<TrackedStream> handle = Log::emplaceStream<TrackedStream>("Owned", 7);
+		REQUIRE(handle);
+		REQUIRE(handle->id == 7);
+		REQUIRE(Log::getStream("Owned") == handle.get());
+		Log::info("to the owned stream");
+		REQUIRE(handle->msgs.back() == "to the owned stream");
+
+		REQUIRE(Log::removeStream("Owned") == nullptr);
+		REQUIRE(TrackedStream::alive == 0);
+		REQUIRE(handle.get() == nullptr);
+		REQUIRE(Log::removeStream("Owned") == nullptr);
+	}
+
+	SECTION("Unique Pointer")
+	{
+		StreamHandle<Stream> handle = Log::addStream("Owned", std::make_unique<TrackedStream>());
+		REQUIRE(TrackedStream::alive == 1);
+		REQUIRE(handle.get() == Log::getStream("Owned"));
+		REQUIRE(!Log::addStream("Empty", std::unique_ptr<Stream>()));
+		REQUIRE(Log::getStream("Empty") == nullptr);
+		REQUIRE(Log::removeStream("Owned") == nullptr);
+		REQUIRE(TrackedStream::alive == 0);
+		REQUIRE(!handle);
+	}
+
+	SECTION("Replaced")
+	{
+		auto first = Log::emplaceStream<TrackedStream>("Owned", 1);
+		auto second = Log::emplaceStream<TrackedStream>("Owned", 2);
+		REQUIRE(TrackedStream::alive == 1); // the first one is destroyed once nothing can be using it
+		REQUIRE(!first);
+		REQUIRE(second->id == 2);
+
+		// a stream the caller owns replaces it too, and isn't destroyed by the logger
+		TrackedStream* raw = new TrackedStream(3);
+		Log::addStream("Owned", raw);
+		REQUIRE(!second);
+		REQUIRE(TrackedStream::alive == 1);
+		REQUIRE(Log::removeStream("Owned") == raw);
+		delete raw;
+	}
+
+	SECTION("Pool")
+	{
+		// blocks are reused, so the streams end up next to each other
+		std::vector<StreamHandle<TrackedStream>> handles;
+		for (int i = 0; i < 4; ++i)
+		{
+			handles.push_back(Log::emplaceStream<TrackedStream>("Pooled" + std::to_string(i), i));
+		}
+		REQUIRE(TrackedStream::alive == 4);
+		std::vector<TrackedStream*> addresses;
+		for (auto& handle : handles)
+		{
+			addresses.push_back(handle.get());
+		}
+		REQUIRE(std::abs((char*)addresses[1] - (char*)addresses[0]) < 4096);
+		REQUIRE(Log::removeStream("Pooled2") == nullptr);
+		REQUIRE(!handles[2]);
+		REQUIRE(handles[3]->id == 3);
+		auto reused = Log::emplaceStream<TrackedStream>("Pooled4", 4);
+		REQUIRE(reused.get() == addresses[2]);
+		REQUIRE(!handles[2]); // the old handle doesn't see the new stream
+
+		Log::info("to every pooled stream");
+		REQUIRE(reused->msgs.size() == 1);
+		for (int i : { 0, 1, 3, 4 })
+		{
+			Log::removeStream("Pooled" + std::to_string(i));
+		}
+		REQUIRE(TrackedStream::alive == 0);
+	}
+}
+
+TEST_CASE("Call Sites")
+{
+	ArchiveStream* archive = Log::emplaceStream<ArchiveStream>("Sites").get();
+
+	SECTION("Descriptors")
+	{
+		connectToDatabase(1);
+		connectToDatabase(2);
+		connectToCache();
+		auto errors = archive->findCode("E0042");
+		REQUIRE(errors.size() == 2);
+		REQUIRE(errors[1].msg == "connection failed, attempt 2");
+		REQUIRE(errors[1].source == "connectToDatabase");
+		REQUIRE(archive->findSource("connectToCache").size() == 2);
+
+		REQUIRE(errors[0].toEvent().site == 0); // the archive keeps the strings
+	}
+
+	SECTION("Events Carry The ID")
+	{
+		TestStream* last = Log::emplaceStream<TestStream>("Last").get();
+		connectToDatabase(3);
+		REQUIRE(last->getMsg() == "connection failed, attempt 3");
+		REQUIRE(last->getEventString().find("[E0042] connection failed, attempt 3 (from connectToDatabase)") != std::string::npos);
+		Log::removeStream("Last");
+	}
+
+	SECTION("Lookup")
+	{
+		Event captured;
+		class Capture : public Stream
+		{
+		public:
+			Capture(Event& out) : out(out) {}
+			virtual void handle(Event& event) { out = event; }
+			Event& out;
+		};
+		Log::emplaceStream<Capture>("Capture", captured);
+		connectToDatabase(4);
+		uint32_t id = captured.site;
+		REQUIRE(id != 0);
+		REQUIRE(captured.source.empty()); // nothing copied into the event
+		REQUIRE(captured.code.empty());
+		REQUIRE(captured.getCode() == "E0042");
+		const CallSite* site = captured.getCallSite();
+		REQUIRE(site != nullptr);
+		REQUIRE(site->getLevel() == LEVELS::ERR);
+		REQUIRE(std::string(site->getFile()).find("UnitTest.cpp") != std::string::npos);
+		REQUIRE(site->getLine() > 0);
+		REQUIRE(std::string(site->getFunction()) == "connectToDatabase");
+
+		connectToDatabase(5);
+		REQUIRE(captured.site == id); // registered once
+		connectToCache();
+		REQUIRE(captured.site != id);
+		REQUIRE(CallSite::count() >= 3);
+		REQUIRE(CallSite::find(0) == nullptr);
+		Log::removeStream("Capture");
+	}
+
+	SECTION("Rate Limit")
+	{
+		RateLimit limit;
+		limit.eventsPerSecond = 0.001;
+		limit.burst = 2;
+		limit.summaryInterval = std::chrono::hours(1);
+		Log::setRateLimit(limit);
+		for (int i = 0; i < 6; ++i)
+		{
+			connectToDatabase(i); // a different message each time, but the same call site
+		}
+		REQUIRE(archive->findCode("E0042").size() == 2);
+		Log::flush();
+		auto summary = archive->findCode("E0042");
+		REQUIRE(summary.size() == 3);
+		REQUIRE(summary[2].msg.find("(repeated 4 more times)") != std::string::npos);
+		REQUIRE(summary[2].source == "connectToDatabase");
+		Log::setRateLimit(RateLimit());
+	}
+
+	SECTION("Binary")
+	{
+		std::remove("boom_sites.bin");
+		Log::emplaceStream<BinaryFileStream>("SitesBinary", "boom_sites.bin");
+		connectToDatabase(1);
+		connectToDatabase(2);
+		connectToCache();
+		Log::removeStream("SitesBinary"); // closes the file
+		std::string expected;
+		for (auto& archived : archive->findLevels(ALL_LEVELS))
+		{
+			expected += archived.toEvent().toString();
+		}
+		REQUIRE(BinaryLogReader::toText("boom_sites.bin") == expected);
+		std::remove("boom_sites.bin");
+	}
+
+	Log::removeStream("Sites");
+}
+
+TEST_CASE("Fields")
+{
+	SECTION("Storage")
+	{
+		Fields fields;
+		REQUIRE(fields.empty());
+		std::string longText(200, 'x');
+		fields.add("user", "bob").add("attempts", 3).add("bytes", (uint64_t)UINT64_MAX)
+			.add("ratio", 0.5).add("cached", true).add("path", longText);
+		REQUIRE(fields.size() == 6);
+		REQUIRE(fields[0].key == "user");
+		REQUIRE(fields[0].type == FIELD_STRING);
+		REQUIRE(fields[0].text == "bob");
+		REQUIRE(fields[1].type == FIELD_INT);
+		REQUIRE(fields[1].integer == 3);
+		REQUIRE(fields[2].type == FIELD_UINT);
+		REQUIRE(fields[2].unsignedInteger == UINT64_MAX);
+		REQUIRE(fields[3].type == FIELD_DOUBLE);
+		REQUIRE(fields[3].number == 0.5);
+		REQUIRE(fields[4].type == FIELD_BOOL);
+		REQUIRE(fields[4].flag);
+		REQUIRE(fields[5].text == longText);
+
+		Fields copy = fields;
+		fields.clear();
+		REQUIRE(fields.empty());
+		REQUIRE(copy.size() == 6);
+		REQUIRE(copy[0].text == "bob");
+		REQUIRE(copy[5].text == longText);
+
+		for (int i = 0; i < 10; ++i)
+		{
+			fields.add("n", i);
+		}
+		size_t limit = Fields::MAX_FIELDS;
+		REQUIRE(fields.size() == limit); // the rest are ignored
+		REQUIRE(fields[7].integer == 7);
+	}
+
+	SECTION("Text")
+	{
+		Event e{ LEVELS::INFO, "request done", "Http" };
+		e.fields.add("status", 200).add("path", "/index.html").add("ok", true);
+		std::string text = e.toString();
+		REQUIRE(text.find("request done status=200 path=\"/index.html\" ok=true (from Http)") != std::string::npos);
+
+		Event plain{ LEVELS::INFO, "request done", "Http" };
+		REQUIRE(plain.toString().find("request done (from Http)") != std::string::npos);
+	}
+
+	SECTION("Logged")
+	{
+		TestStream* t = Log::emplaceStream<TestStream>("FieldsTest").get();
+		Log::info("request done", Fields().add("status", 404), "Http");
+		REQUIRE(t->getEventString().find("request done status=404 (from Http)") != std::string::npos);
+
+		Log::enableAsync();
+		Log::warning("slow request", Fields().add("ms", 1500).add("path", "/search"));
+		Log::flush();
+		REQUIRE(t->getEventString().find("slow request ms=1500 path=\"/search\"") != std::string::npos);
+		Log::info("no fields");
+		Log::flush();
+		REQUIRE(t->getEventString().find("no fields") != std::string::npos);
+		REQUIRE(t->getEventString().find("=") == std::string::npos); // the queue slot doesn't keep old fields
+		Log::disableAsync();
+		Log::removeStream("FieldsTest");
+	}
+
+	SECTION("JSON Lines")
+	{
+		std::remove("boom_fields.jsonl");
+		{
+			JsonLinesStream stream("boom_fields.jsonl");
+			auto time = std::chrono::system_clock::from_time_t(946728000) + std::chrono::microseconds(250);
+			Event e{ LEVELS::ERR, "say \"hi\"\\\n\x01", "Http", "E1", time };
+			e.fields.add("user", "a\tb").add("count", -2).add("ratio", 0.25).add("bad", std::nan("")).add("ok", false);
+			stream.handle(e);
+			Event plain{ LEVELS::DBG, "plain", "", "", time + std::chrono::seconds(1) };
+			stream.handle(plain);
+			stream.flush();
+		}
+		std::string text = readFile("boom_fields.jsonl");
+		REQUIRE(text ==
+			"{\"ts\":\"2000-01-01T12:00:00.000250Z\",\"level\":\"error\",\"msg\":\"say \\\"hi\\\"\\\\\\n\\u0001\","
+			"\"source\":\"Http\",\"code\":\"E1\","
+			"\"fields\":{\"user\":\"a\\tb\",\"count\":-2,\"ratio\":0.25,\"bad\":null,\"ok\":false}}\n"
+			"{\"ts\":\"2000-01-01T12:00:01.000250Z\",\"level\":\"debug\",\"msg\":\"plain\"}\n");
+		std::remove("boom_fields.jsonl");
+	}
+}
+
+/// @brief Stream that waits in handle() while it is closed, to stand in for a slow stream
+class GatedStream : public Stream
+{
+public:
+	virtual void handle(Event& event)
+	{
+		std::unique_lock<std::mutex> lock(gate);
+		if (!open)
+		{
+			held = true;
+			heldUp.notify_all();
+			opened.wait(lock, [this] { return open; });
+			held = false;
+		}
+		messages.push_back(std::string(event.msg.data(), event.msg.size()));
+		last = &event;
+		thread = std::this_thread::get_id();
+	}
+
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(gate);
+		open = false;
+	}
+
+	void release()
+	{
+		{
+			std::lock_guard<std::mutex> lock(gate);
+			open = true;
+		}
+		opened.notify_all();
+	}
+
+	/// @brief Wait until a thread is stuck in handle() behind the closed gate
+	void waitUntilHeld()
+	{
+		std::unique_lock<std::mutex> lock(gate);
+		heldUp.wait(lock, [this] { return held; });
+	}
+
+	std::mutex gate;
+	std::condition_variable opened;
+	std::condition_variable heldUp;
+	bool open = true;
+	bool held = false;
+	std::vector<std::string> messages;
+	const Event* last = nullptr;
+	std::thread::id thread;
+};
+
+TEST_CASE("Stream Workers")
+{
+	WorkerConfig dedicated;
+	dedicated.mode = WORKER_MODE::DEDICATED;
+
+	SECTION("Slow Streams Don't Hold Up Others")
+	{
+		GatedStream* slow = Log::emplaceStream<GatedStream>("Slow").get();
+		CountingStream* fast = Log::emplaceStream<CountingStream>("Fast").get();
+		slow->setWorker(dedicated);
+		slow->close();
+		for (int i = 0; i < 10; ++i)
+		{
+			Log::info("event " + std::to_string(i));
+		}
+		REQUIRE(fast->count == 10); // handed over while the slow stream is stuck
+		slow->release();
+		Log::flush();
+		REQUIRE(slow->messages.size() == 10);
+		REQUIRE(slow->messages[9] == "event 9");
+		REQUIRE(slow->thread != std::this_thread::get_id());
+		REQUIRE(Log::getStats().streams["Slow"].delivered == 10);
+		Log::removeStream("Slow");
+		Log::removeStream("Fast");
+	}
+
+	SECTION("Shared Events")
+	{
+		WorkerConfig pooled;
+		pooled.mode = WORKER_MODE::POOLED;
+		GatedStream* first = Log::emplaceStream<GatedStream>("First").get();
+		GatedStream* second = Log::emplaceStream<GatedStream>("Second").get();
+		first->setWorker(pooled);
+		second->setWorker(pooled);
+		Log::enableAsync();
+		Log::warning("shared");
+		Log::flush();
+		REQUIRE(first->messages == std::vector<std::string>{ "shared" });
+		REQUIRE(second->messages == std::vector<std::string>{ "shared" });
+		REQUIRE(first->last == second->last); // one copy of the event for both streams
+		Log::disableAsync();
+		Log::removeStream("First");
+		Log::removeStream("Second");
+	}
+
+	SECTION("Overflow")
+	{
+		GatedStream* gated = Log::emplaceStream<GatedStream>("Gated").get();
+		WorkerConfig small = dedicated;
+		small.capacity = 4;
+		small.overflow = OVERFLOW_POLICY::DROP_NEWEST;
+		gated->setWorker(small);
+		gated->close();
+		Log::info("event 0");
+		gated->waitUntilHeld(); // the worker holds event 0, the queue is empty
+		for (int i = 1; i < 10; ++i)
+		{
+			Log::info("event " + std::to_string(i));
+		}
+		LogStats stats = Log::getStats();
+		REQUIRE(stats.streams["Gated"].dropped == 5);
+		REQUIRE(stats.streams["Gated"].queued == 4);
+		gated->release();
+		Log::flush();
+		REQUIRE(gated->messages == std::vector<std::string>{ "event 0", "event 1", "event 2", "event 3", "event 4" });
+
+		small.overflow = OVERFLOW_POLICY::DROP_OLDEST;
+		gated->setWorker(small);
+		gated->messages.clear();
+		gated->close();
+		Log::info("event 0");
+		gated->waitUntilHeld();
+		for (int i = 1; i < 10; ++i)
+		{
+			Log::info("event " + std::to_string(i));
+		}
+		REQUIRE(Log::getStats().streams["Gated"].dropped == 5);
+		gated->release();
+		Log::flush();
+		REQUIRE(gated->messages == std::vector<std::string>{ "event 0", "event 6", "event 7", "event 8", "event 9" }); // the newest events are kept
+		Log::removeStream("Gated");
+	}
+
+	SECTION("Removing Waits For The Queue")
+	{
+		GatedStream* gated = new GatedStream;
+		Log::addStream("Removed", gated);
+		gated->setWorker(dedicated);
+		gated->close();
+		Log::info("one");
+		Log::info("two");
+		std::thread opener([gated]
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(20));
+				gated->release();
+			});
+		REQUIRE(Log::removeStream("Removed") == gated);
+		opener.join();
+		REQUIRE(gated->messages.size() == 2); // safe to delete now
+		delete gated;
+	}
+}
+
+TEST_CASE("Filters")
+{
+	FilterRule quietNetwork;
+	quietNetwork.source = "Net::";
+	quietNetwork.levels = LEVELS::DBG | LEVELS::INFO;
+	FilterRule keepOne;
+	keepOne.allow = true;
+	keepOne.codes = { "E1" };
+	FilterRule dropCodes;
+	dropCodes.codes = { "E2", "E3" };
+
+	SECTION("Rules")
+	{
+		EventFilter filter({ quietNetwork, keepOne, dropCodes });
+		REQUIRE(!filter.allows(LEVELS::INFO, "Net::Socket", ""));
+		REQUIRE(filter.allows(LEVELS::WARNING, "Net::Socket", ""));
+		REQUIRE(filter.allows(LEVELS::INFO, "Net", "")); // shorter than the prefix
+		REQUIRE(filter.allows(LEVELS::INFO, "Disk", ""));
+		REQUIRE(!filter.allows(LEVELS::INFO, "Net::Socket", "E1")); // the first rule that matches decides
+		REQUIRE(filter.allows(LEVELS::ERR, "Disk", "E1"));
+		REQUIRE(!filter.allows(LEVELS::ERR, "Disk", "E3"));
+		REQUIRE(filter.allows(LEVELS::ERR, "Disk", "E4"));
+
+		Event event(LEVELS::DBG, "reconnecting", "Net::Socket");
+		REQUIRE(!filter.allows(event));
+	}
+
+	SECTION("Streams")
+	{
+		GatedStream* filtered = Log::emplaceStream<GatedStream>("Filtered").get();
+		GatedStream* everything = Log::emplaceStream<GatedStream>("Everything").get();
+		filtered->setFilter({ quietNetwork, dropCodes });
+		Log::info("connected", "Net::Socket");
+		Log::warning("timed out", "Net::Socket");
+		Log::error("disk full", "Disk", "E2");
+		Log::info("loaded", "Disk");
+		REQUIRE(filtered->messages == std::vector<std::string>{ "timed out", "loaded" });
+		REQUIRE(everything->messages.size() == 4);
+
+		filtered->setFilter({}); // takes the filter off again
+		Log::info("connected", "Net::Socket");
+		REQUIRE(filtered->messages.back() == "connected");
+		Log::removeStream("Filtered");
+		Log::removeStream("Everything");
+	}
+
+	SECTION("Call Sites")
+	{
+		FilterRule noDatabase;
+		noDatabase.codes = { "E0042" };
+		GatedStream* filtered = Log::emplaceStream<GatedStream>("Filtered").get();
+		filtered->setFilter({ noDatabase });
+		connectToDatabase(1);
+		connectToCache();
+		connectToDatabase(2); // answered from the call site
+		REQUIRE(filtered->messages == std::vector<std::string>{ "cache unavailable", "using the database instead" });
+		Log::removeStream("Filtered");
+	}
+
+	SECTION("Batches And Workers")
+	{
+		GatedStream* direct = Log::emplaceStream<GatedStream>("Direct").get();
+		GatedStream* worker = Log::emplaceStream<GatedStream>("Worker").get();
+		WorkerConfig dedicated;
+		dedicated.mode = WORKER_MODE::DEDICATED;
+		worker->setWorker(dedicated);
+		direct->setFilter({ quietNetwork });
+		worker->setFilter({ dropCodes });
+		Log::enableAsync();
+		Log::info("connected", "Net::Socket");
+		Log::error("disk full", "Disk", "E2");
+		Log::info("loaded", "Disk");
+		Log::flush();
+		REQUIRE(direct->messages == std::vector<std::string>{ "disk full", "loaded" });
+		REQUIRE(worker->messages == std::vector<std::string>{ "connected", "loaded" });
+		Log::disableAsync();
+		Log::removeStream("Direct");
+		Log::removeStream("Worker");
+	}
+
+	SECTION("Config File")
+	{
+		GatedStream* filtered = Log::emplaceStream<GatedStream>("Filtered").get();
+		{
+			std::ofstream rules("boom_filters.txt");
+			rules << "# quiet the network layer\n"
+				<< "Filtered deny levels=debug,info source=Net::\n"
+				<< "\n"
+				<< "Filtered allow code=E1\n"
+				<< "Filtered deny levels=all code=E2,E3\n"
+				<< "NotRegistered deny\n";
+		}
+		REQUIRE(Log::loadFilters("boom_filters.txt"));
+		Log::info("connected", "Net::Socket");
+		Log::error("kept", "Net::Socket", "E1");
+		Log::error("dropped", "Disk", "E3");
+		REQUIRE(filtered->messages == std::vector<std::string>{ "kept" });
+
+		{
+			std::ofstream rules("boom_filters.txt");
+			rules << "Filtered deny levels=sometimes\n";
+		}
+		REQUIRE(!Log::loadFilters("boom_filters.txt"));
+		REQUIRE(!Log::loadFilters("boom_missing_filters.txt"));
+		Log::info("still quiet", "Net::Socket"); // the old rules are kept
+		REQUIRE(filtered->messages.size() == 1);
+		std::remove("boom_filters.txt");
+		Log::removeStream("Filtered");
+	}
+}
+
+TEST_CASE("Clock Sources")
+{
+	using namespace std::chrono;
+	auto close = [](EventClock::time_point a, EventClock::time_point b)
+	{
+		return a - b < milliseconds(100) && b - a < milliseconds(100);
+	};
+	REQUIRE(Log::getClock() == CLOCK_SOURCE::SYSTEM_CLOCK);
+
+	SECTION("Every Source Gives Wall Time")
+	{
+		for (auto source : { CLOCK_SOURCE::COARSE_CLOCK, CLOCK_SOURCE::CACHED_CLOCK, CLOCK_SOURCE::STEADY_CLOCK, CLOCK_SOURCE::SYSTEM_CLOCK })
+		{
+			Log::setClock(source);
+			REQUIRE(Log::getClock() == source);
+			REQUIRE(close(EventClock::now(), system_clock::now()));
+			Event event(LEVELS::INFO, "stamped");
+			REQUIRE(close(event.timestamp, system_clock::now()));
+		}
+		REQUIRE(close(EventClock::coarse(), system_clock::now()));
+	}
+
+	SECTION("Cached Time Moves On")
+	{
+		Log::setClock(CLOCK_SOURCE::CACHED_CLOCK, milliseconds(1));
+		auto first = EventClock::now();
+		std::this_thread::sleep_for(milliseconds(30));
+		REQUIRE(EventClock::now() > first);
+
+		// changing the interval restarts the thread
+		Log::setClock(CLOCK_SOURCE::CACHED_CLOCK, milliseconds(2));
+		first = EventClock::now();
+		std::this_thread::sleep_for(milliseconds(30));
+		REQUIRE(EventClock::now() > first);
+		Log::setClock(CLOCK_SOURCE::SYSTEM_CLOCK);
+	}
+
+	SECTION("Queued Events")
+	{
+		Log::setClock(CLOCK_SOURCE::STEADY_CLOCK);
+		Log::enableAsync();
+		auto t = new TestStream;
+		Log::addStream("Clock", t);
+		Log::info("queued with the steady clock");
+		Log::flush();
+		REQUIRE(t->getMsg() == "queued with the steady clock");
+		REQUIRE(!t->getTime().empty());
+		Log::disableAsync();
+		delete Log::removeStream("Clock");
+		Log::setClock(CLOCK_SOURCE::SYSTEM_CLOCK);
+	}
+	REQUIRE(Log::getClock() == CLOCK_SOURCE::SYSTEM_CLOCK);
+}
+
+#ifndef _WIN32
+/// @brief Cleared to stop overflowStack, never is
+volatile bool keepRecursing = true;
+
+/// @brief Recurse until the stack runs out
+int overflowStack(int depth)
+{
+	volatile char frame[1024];
+	frame[0] = (char)depth;
+	if (!keepRecursing)
+	{
+		return 0;
+	}
+	return overflowStack(depth + 1) + frame[0];
+}
+#endif
+
+TEST_CASE("Crash Handling")
+{
+	std::remove("boom_crash.log");
+	CrashConfig config;
+	config.file = "boom_crash.log";
+	config.handleSignals = false;
+	config.handleTerminate = false;
+
+	SECTION("Write Through")
+	{
+		REQUIRE(Log::enableCrashHandling(config));
+		Log::error("not urgent");
+		Log::critical("disk on fire", "Controller", "C9");
+		std::string written = readFile("boom_crash.log"); // on disk already, nothing was flushed
+		REQUIRE(written.find("not urgent") == std::string::npos);
+		REQUIRE(written.substr(0, 3) == "!!!");
+		REQUIRE(written[7] == '-');
+		REQUIRE(written[13] == 'T');
+		REQUIRE(written.substr(26, 2) == "Z ");
+		REQUIRE(written.substr(28) == "[C9] disk on fire (from Controller)\n");
+
+		Log::disableCrashHandling();
+		Log::critical("not written after disabling");
+		REQUIRE(readFile("boom_crash.log") == written);
+
+		config.file = "no_such_directory/boom_crash.log";
+		REQUIRE(!Log::enableCrashHandling(config));
+	}
+
+	SECTION("Bypasses The Queue")
+	{
+		ArchiveStream* archive = Log::emplaceStream<ArchiveStream>("Crash").get();
+		config.levels = LEVELS::ERR | LEVELS::CRITICAL;
+		REQUIRE(Log::enableCrashHandling(config));
+		Log::enableAsync();
+		for (int i = 0; i < 100; ++i)
+		{
+			Log::info("queued " + std::to_string(i));
+		}
+		Log::error("urgent");
+		auto all = archive->findLevels(ALL_LEVELS); // everything queued before it has been sent too
+		REQUIRE(all.size() == 101);
+		REQUIRE(all[99].msg == "queued 99");
+		REQUIRE(all[100].msg == "urgent");
+		Log::disableAsync();
+		Log::disableCrashHandling();
+		Log::removeStream("Crash");
+		REQUIRE(readFile("boom_crash.log").find("urgent") != std::string::npos);
+	}
+
+#ifndef _WIN32
+	SECTION("Signal")
+	{
+		pid_t child = fork();
+		if (child == 0)
+		{
+			config.handleSignals = true;
+			Log::enableCrashHandling(config);
+			GateStream* gate = new GateStream; // holds the writer so the next events stay queued
+			Log::addStream("Gate", gate);
+			Log::enableAsync();
+			Log::info("first");
+			while (!gate->entered)
+			{
+				std::this_thread::yield();
+			}
+			for (int i = 0; i < 3; ++i)
+			{
+				Log::warning("stuck " + std::to_string(i));
+			}
+			std::raise(SIGSEGV);
+			_exit(0);
+		}
+		int status = 0;
+		REQUIRE(waitpid(child, &status, 0) == child);
+		REQUIRE(!(WIFEXITED(status) && WEXITSTATUS(status) == 0));
+		std::string written = readFile("boom_crash.log");
+		REQUIRE(written.find("fatal signal SIGSEGV") != std::string::npos);
+		REQUIRE(written.find("stuck 0") != std::string::npos);
+		REQUIRE(written.find("stuck 0") < written.find("stuck 2"));
+	}
+
+#if !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__) // the sanitizers catch the overflow themselves
+	SECTION("Stack Overflow On Another Thread")
+	{
+		pid_t child = fork();
+		if (child == 0)
+		{
+			config.handleSignals = true;
+			Log::enableCrashHandling(config);
+			std::thread([] {
+				Log::info("about to overflow"); // logging sets up the thread's signal stack
+				overflowStack(0);
+			}).join();
+			_exit(0);
+		}
+		int status = 0;
+		REQUIRE(waitpid(child, &status, 0) == child);
+		REQUIRE(WIFSIGNALED(status));
+		REQUIRE(readFile("boom_crash.log").find("fatal signal SIGSEGV") != std::string::npos);
+	}
+#endif
+
+	SECTION("Terminate")
+	{
+		std::remove("boom_crash_text.log");
+		pid_t child = fork();
+		if (child == 0)
+		{
+			config.handleTerminate = true;
+			Log::enableCrashHandling(config);
+			Log::emplaceStream<TextFileStream>("Buffered", "boom_crash_text.log");
+			Log::info("still in the buffer");
+			GateStream* gate = new GateStream; // holds the writer, terminating mustn't wait for it
+			Log::addStream("Gate", gate);
+			Log::enableAsync();
+			Log::info("first");
+			while (!gate->entered)
+			{
+				std::this_thread::yield();
+			}
+			Log::warning("queued at terminate");
+			try
+			{
+				throw std::runtime_error("out of widgets");
+			}
+			catch (...)
+			{
+				std::terminate();
+			}
+			_exit(0);
+		}
+		int status = 0;
+		REQUIRE(waitpid(child, &status, 0) == child);
+		REQUIRE(WIFSIGNALED(status));
+		REQUIRE(WTERMSIG(status) == SIGABRT);
+		REQUIRE(readFile("boom_crash.log").find("std::terminate called out of widgets") != std::string::npos);
+		REQUIRE(readFile("boom_crash.log").find("queued at terminate") != std::string::npos);
+		REQUIRE(readFile("boom_crash_text.log").find("still in the buffer") != std::string::npos);
+		std::remove("boom_crash_text.log");
+	}
+#endif
+	std::remove("boom_crash.log");
+}
+
+#ifndef _WIN32
+/// @brief Stream that starts a thread logging to the other streams while the logger is stopping for fork()
+class ForkProbeStream : public Stream
+{
+public:
+	ForkProbeStream(CountingStream* counted) : counted(counted)
+	{}
+
+	virtual void handle(Event&)
+	{}
+
+	virtual void beforeFork()
+	{
+		logger = std::thread([] { Log::info("logged during the fork"); });
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		countedDuringFork = counted->count;
+	}
+
+	CountingStream* counted;
+	std::thread logger;
+	size_t countedDuringFork = 0;
+};
+#endif
+
+TEST_CASE("Lifecycle")
+{
+	SECTION("Init And Shutdown")
+	{
+		Log::getStream("defaultConsole"); // any use starts the logger
+		REQUIRE(!Log::init());
+		Log::shutdown();
+
+		LogConfig quiet;
+		quiet.defaultStreams = false;
+		quiet.async = true;
+		quiet.clock = CLOCK_SOURCE::CACHED_CLOCK;
+		REQUIRE(Log::init(quiet));
+		REQUIRE(!Log::init(quiet));
+		REQUIRE(Log::getStream("defaultConsole") == nullptr);
+		REQUIRE(Log::isAsync());
+		REQUIRE(Log::getClock() == CLOCK_SOURCE::CACHED_CLOCK);
+		TestStream* t = new TestStream;
+		Log::addStream("Lifecycle", t);
+		Log::emplaceStream<ClosingStream>("Closing A");
+		Log::emplaceStream<ClosingStream>("Closing B");
+		Log::info("queued before shutdown");
+		Log::shutdown();
+		REQUIRE(t->getMsg() == "queued before shutdown"); // the streams are gone by the time the owned ones close
+		REQUIRE(Log::getClock() == CLOCK_SOURCE::SYSTEM_CLOCK);
+		delete t;
+
+		// logging again starts the logger with the defaults
+		REQUIRE(!Log::isAsync());
+		REQUIRE(Log::getStream("defaultConsole") != nullptr);
+		REQUIRE(Log::getStream("Lifecycle") == nullptr);
+	}
+
+#ifndef _WIN32
+	SECTION("Fork")
+	{
+		std::remove("boom_fork.log");
+		Log::emplaceStream<TextFileStream>("Forked", "boom_fork.log");
+		GatedStream* pooled = Log::emplaceStream<GatedStream>("Pooled").get();
+		WorkerConfig worker;
+		worker.mode = WORKER_MODE::POOLED;
+		pooled->setWorker(worker);
+		Log::enableAsync();
+		Log::info("before the fork"); // still buffered in the text file stream
+
+		pid_t child = fork();
+		if (child == 0)
+		{
+			Log::info("from the child");
+			Log::flush();
+			bool handed = Log::isAsync() && pooled->messages.size() == 2 && pooled->messages[1] == "from the child";
+			_exit(handed ? 0 : 1);
+		}
+		int status = 0;
+		REQUIRE(waitpid(child, &status, 0) == child);
+		REQUIRE(WIFEXITED(status));
+		REQUIRE(WEXITSTATUS(status) == 0);
+
+		Log::info("from the parent");
+		Log::flush();
+		REQUIRE(pooled->messages == std::vector<std::string>{ "before the fork", "from the parent" });
+		std::string written = readFile("boom_fork.log");
+		size_t first = written.find("before the fork");
+		REQUIRE(first != std::string::npos);
+		REQUIRE(written.find("before the fork", first + 1) == std::string::npos); // written once, before the fork
+		REQUIRE(written.find("from the child") != std::string::npos);
+		REQUIRE(written.find("from the parent") != std::string::npos);
+
+		Log::disableAsync();
+		Log::removeStream("Pooled");
+		Log::removeStream("Forked");
+		std::remove("boom_fork.log");
+	}
+
+	SECTION("Logging During A Fork")
+	{
+		CountingStream* counted = Log::emplaceStream<CountingStream>("Counted").get();
+		counted->setLevels(LEVELS::INFO);
+		ForkProbeStream* probe = Log::emplaceStream<ForkProbeStream>("Probe", counted).get();
+		probe->setLevels(0);
+		Log::warning("not counted"); // takes in the new levels before the fork
+
+		pid_t child = fork();
+		if (child == 0)
+		{
+			// the logging thread never got into a stream, so none of them is left locked in the child
+			Log::info("from the child");
+			_exit(counted->count == 1 ? 0 : 1);
+		}
+		probe->logger.join();
+		int status = 0;
+		REQUIRE(waitpid(child, &status, 0) == child);
+		REQUIRE(WIFEXITED(status));
+		REQUIRE(WEXITSTATUS(status) == 0);
+		REQUIRE(probe->countedDuringFork == 0);
+		REQUIRE(counted->count == 1);
+
+		Log::removeStream("Probe");
+		Log::removeStream("Counted");
+	}
+#endif
+}